@@ -0,0 +1,331 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include "gst-clip.h"
+#include "gst-index.h"
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define FOURCC(a, b, c, d) ((guint32)(a) << 24 | (guint32)(b) << 16 | (guint32)(c) << 8 | (guint32)(d))
+#define CLIP_COPY_BLOCK (4 * 1024 * 1024)
+
+// 源文件读取和区间复制。Linux上用copy_file_range在内核里复制，
+// 其他平台用GIO按大块读写
+typedef struct ClipCopy
+{
+#ifdef __linux__
+    int in_fd, out_fd;
+    gboolean use_copy_range;
+#else
+    GFileInputStream *in;
+    GFileOutputStream *out;
+#endif
+    guint8 *buffer;
+    guint64 src_size;
+    guint64 copied;
+} ClipCopy;
+
+gboolean clip_open(ClipCopy *self, const char *src_path, const char *dst_path);
+void clip_close(ClipCopy *self);
+gboolean clip_read_at(ClipCopy *self, guint64 offset, guint8 *data, gsize size);
+gboolean clip_copy(ClipCopy *self, guint64 offset, guint64 length);
+gboolean clip_export_range(const char *src_path, gint64 t0, gint64 t1, const char *dst_path,
+                           gboolean copy_range, guint64 *copied);
+gboolean clip_duration(const char *src_path, guint64 *duration);
+
+gboolean clip_open(ClipCopy *self, const char *src_path, const char *dst_path)
+{
+    memset(self, 0, sizeof(ClipCopy));
+    self->buffer = g_malloc(CLIP_COPY_BLOCK);
+
+#ifdef __linux__
+    self->out_fd = -1;
+    self->in_fd = open(src_path, O_RDONLY);
+    if (self->in_fd < 0)
+    {
+        g_printerr("Could not open %s\n", src_path);
+        return FALSE;
+    }
+    self->src_size = lseek(self->in_fd, 0, SEEK_END);
+    posix_fadvise(self->in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    self->out_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (self->out_fd < 0)
+    {
+        g_printerr("Could not create %s\n", dst_path);
+        return FALSE;
+    }
+    self->use_copy_range = TRUE;
+#else
+    GFile *src = g_file_new_for_path(src_path);
+    GFile *dst = g_file_new_for_path(dst_path);
+    GFileInfo *info = g_file_query_info(src, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (info)
+    {
+        self->src_size = g_file_info_get_size(info);
+        g_object_unref(info);
+    }
+    self->in = g_file_read(src, NULL, NULL);
+    self->out = g_file_replace(dst, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL);
+    g_object_unref(src);
+    g_object_unref(dst);
+
+    if (!self->in || !self->out)
+    {
+        g_printerr("Could not open %s or create %s\n", src_path, dst_path);
+        return FALSE;
+    }
+#endif
+
+    return TRUE;
+}
+
+void clip_close(ClipCopy *self)
+{
+#ifdef __linux__
+    if (self->in_fd >= 0)
+        close(self->in_fd);
+    if (self->out_fd >= 0)
+        close(self->out_fd);
+#else
+    if (self->in)
+        g_object_unref(self->in);
+    if (self->out)
+    {
+        g_output_stream_close(G_OUTPUT_STREAM(self->out), NULL, NULL);
+        g_object_unref(self->out);
+    }
+#endif
+    g_free(self->buffer);
+    self->buffer = NULL;
+}
+
+gboolean clip_read_at(ClipCopy *self, guint64 offset, guint8 *data, gsize size)
+{
+#ifdef __linux__
+    return pread(self->in_fd, data, size, offset) == (ssize_t)size;
+#else
+    gsize n = 0;
+    return g_seekable_seek(G_SEEKABLE(self->in), offset, G_SEEK_SET, NULL, NULL) &&
+           g_input_stream_read_all(G_INPUT_STREAM(self->in), data, size, &n, NULL, NULL) && n == size;
+#endif
+}
+
+gboolean clip_copy(ClipCopy *self, guint64 offset, guint64 length)
+{
+#ifdef __linux__
+    loff_t in_offset = offset;
+
+    while (length > 0 && self->use_copy_range)
+    {
+        ssize_t n = copy_file_range(self->in_fd, &in_offset, self->out_fd, NULL, MIN(length, (guint64)G_MAXINT32), 0);
+        if (n > 0)
+        {
+            length -= n;
+            self->copied += n;
+            continue;
+        }
+        if (n == 0)
+            return FALSE;
+        if (errno == EINTR)
+            continue;
+        // 跨文件系统或内核不支持时退回普通读写
+        self->use_copy_range = FALSE;
+    }
+
+    offset = in_offset;
+    while (length > 0)
+    {
+        ssize_t n = pread(self->in_fd, self->buffer, MIN(length, (guint64)CLIP_COPY_BLOCK), offset);
+        if (n <= 0)
+            return FALSE;
+        for (ssize_t written = 0; written < n;)
+        {
+            ssize_t w = write(self->out_fd, self->buffer + written, n - written);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return FALSE;
+            written += w;
+        }
+        offset += n;
+        length -= n;
+        self->copied += n;
+    }
+    return TRUE;
+#else
+    if (!g_seekable_seek(G_SEEKABLE(self->in), offset, G_SEEK_SET, NULL, NULL))
+        return FALSE;
+
+    while (length > 0)
+    {
+        gsize n = 0;
+        if (!g_input_stream_read_all(G_INPUT_STREAM(self->in), self->buffer, MIN(length, (guint64)CLIP_COPY_BLOCK), &n, NULL, NULL) ||
+            n == 0)
+            return FALSE;
+        if (!g_output_stream_write_all(G_OUTPUT_STREAM(self->out), self->buffer, n, NULL, NULL, NULL))
+            return FALSE;
+        length -= n;
+        self->copied += n;
+    }
+    return TRUE;
+#endif
+}
+
+// copy_range为FALSE时强制使用普通读写，性能测试用来对比
+gboolean clip_export_range(const char *src_path, gint64 t0, gint64 t1, const char *dst_path,
+                           gboolean copy_range, guint64 *copied)
+{
+    // 优先使用录制时生成的索引，没有时只扫描box头建立索引
+    GstKeyIndex index;
+    index_init(&index);
+    gchar *index_path = index_sidecar_path(src_path);
+    gboolean have_index = index_load(&index, index_path) || index_scan_file(&index, src_path);
+    g_free(index_path);
+
+    if (!have_index || index.init_size == 0 || index.entries->len == 0)
+    {
+        g_printerr("%s has no keyframe index, is it a fragmented recording?\n", src_path);
+        index_destroy(&index);
+        return FALSE;
+    }
+
+    KeyIndexEntry first, last;
+    if (!index_lookup(&index, t0, &first))
+        first = g_array_index(index.entries, KeyIndexEntry, 0);
+    guint64 end_offset = G_MAXUINT64;
+    if (index_lookup_after(&index, t1, &last))
+        end_offset = last.offset;
+    guint64 init_size = index.init_size;
+    index_destroy(&index);
+
+    ClipCopy copy;
+    if (!clip_open(&copy, src_path, dst_path))
+    {
+        clip_close(&copy);
+        return FALSE;
+    }
+#ifdef __linux__
+    copy.use_copy_range = copy_range;
+#endif
+
+    gboolean ok = clip_copy(&copy, 0, init_size);
+
+    // 逐个复制moof/mdat，遇到mfra、末尾不完整的分片或区间终点时停止
+    guint64 offset = first.offset;
+    while (ok && offset < end_offset && offset + 8 <= copy.src_size)
+    {
+        guint8 header[16];
+        if (!clip_read_at(&copy, offset, header, 8))
+            break;
+
+        guint64 box_size = GST_READ_UINT32_BE(header);
+        guint32 type = GST_READ_UINT32_BE(header + 4);
+        if (box_size == 1)
+        {
+            if (!clip_read_at(&copy, offset + 8, header + 8, 8))
+                break;
+            box_size = GST_READ_UINT64_BE(header + 8);
+        }
+        else if (box_size == 0)
+        {
+            box_size = copy.src_size - offset;
+        }
+
+        if (type != FOURCC('m', 'o', 'o', 'f') && type != FOURCC('m', 'd', 'a', 't'))
+            break;
+        if (box_size < 8 || offset + box_size > copy.src_size)
+            break;
+
+        ok = clip_copy(&copy, offset, box_size);
+        offset += box_size;
+    }
+
+    *copied = copy.copied;
+    clip_close(&copy);
+
+    if (!ok)
+        g_printerr("Failed to export clip from %s to %s\n", src_path, dst_path);
+    return ok;
+}
+
+gboolean clip_export(const char *src_path, gint64 t0, gint64 t1, const char *dst_path)
+{
+    if (!src_path || !dst_path || t0 < 0 || t1 < t0)
+    {
+        g_printerr("Invalid arguments to clip_export\n");
+        return FALSE;
+    }
+
+    gint64 start_time = g_get_monotonic_time();
+    guint64 copied = 0;
+    if (!clip_export_range(src_path, t0, t1, dst_path, TRUE, &copied))
+        return FALSE;
+
+    gint64 elapsed = MAX(g_get_monotonic_time() - start_time, 1);
+    g_print("Exported clip %s (%" G_GUINT64_FORMAT " bytes) in %" G_GINT64_FORMAT " ms, %.1f MB/s\n",
+            dst_path, copied, elapsed / 1000, copied / (gdouble)elapsed);
+    return TRUE;
+}
+
+// 最后一个关键帧的时间，作为录像时长的近似
+gboolean clip_duration(const char *src_path, guint64 *duration)
+{
+    GstKeyIndex index;
+    index_init(&index);
+    gchar *index_path = index_sidecar_path(src_path);
+    KeyIndexEntry last;
+    gboolean ok = (index_load(&index, index_path) || index_scan_file(&index, src_path)) &&
+                  index_lookup(&index, G_MAXUINT64 - 1, &last);
+    g_free(index_path);
+    index_destroy(&index);
+
+    if (ok)
+        *duration = last.pts;
+    return ok;
+}
+
+// 性能测试：从一个已有的分片录像（几GB以上才能看出差别）导出开头1%、10%、50%和整个文件，
+// 分别用copy_file_range和普通读写，输出耗时和吞吐。第一轮读取可能不在页缓存里，
+// 冷缓存的数字需要先手动清空缓存再运行
+void clip_bench(const char *src_path, const char *dst_dir)
+{
+    if (!src_path)
+        return;
+
+    guint64 duration = 0;
+    if (!clip_duration(src_path, &duration) || duration == 0)
+    {
+        g_printerr("%s has no keyframe index, is it a fragmented recording?\n", src_path);
+        return;
+    }
+
+    gchar *dst_path = g_build_filename(dst_dir ? dst_dir : g_get_tmp_dir(), "clip_bench.mp4", NULL);
+    static const gint percents[] = {1, 10, 50, 100};
+
+    g_print("clip: %s, %.1f s\n", src_path, duration / (gdouble)GST_SECOND);
+    for (guint i = 0; i < G_N_ELEMENTS(percents); i++)
+    {
+        gint64 t1 = duration / 100 * percents[i];
+        gdouble mbps[2] = {0, 0};
+        guint64 copied = 0;
+        for (gint pass = 0; pass < 2; pass++)
+        {
+            gint64 start_time = g_get_monotonic_time();
+            if (!clip_export_range(src_path, 0, t1, dst_path, pass == 0, &copied))
+                break;
+            gint64 elapsed = MAX(g_get_monotonic_time() - start_time, 1);
+            mbps[pass] = copied / (gdouble)elapsed;
+        }
+
+        g_print("  %3d%% (%8.1f MB): copy_file_range %8.1f MB/s, read/write %8.1f MB/s\n",
+                percents[i], copied / 1e6, mbps[0], mbps[1]);
+    }
+
+    g_unlink(dst_path);
+    g_free(dst_path);
+}
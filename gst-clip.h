@@ -0,0 +1,14 @@
+#ifndef __GST_CLIP_H__
+#define __GST_CLIP_H__
+
+#include <gst/gst.h>
+
+// 从GstRecorder生成的分片MP4中导出[t0, t1]的片段，不解码不重新编码：
+// 复制初始化段(ftyp+moov)，再按关键帧索引复制覆盖该区间的moof+mdat分片。
+// 起点对齐到t0之前最近的关键帧，终点延伸到t1之后的第一个关键帧分片。
+gboolean clip_export(const char *src_path, gint64 t0, gint64 t1, const char *dst_path);
+
+// 性能测试：导出不同长度的片段，对比内核复制和普通读写，dst_dir为NULL时写到临时目录
+void clip_bench(const char *src_path, const char *dst_dir);
+
+#endif
@@ -0,0 +1,916 @@
+#include "gst-config.h"
+#include "gst-log.h"
+#include <string.h>
+#include <stdio.h>
+
+#define CONFIG_STREAM_PREFIX "stream:"
+#define CONFIG_DEFAULT_RTSP_PORT 8554
+#define CONFIG_DEFAULT_HLS_PORT 8080
+#define CONFIG_DEFAULT_RECORD_DELAY 1000  // 毫秒
+
+// 参与比较的键，任何一个变化都会重建对应的分支
+static const char *const config_player_keys[] = {"player", "queue", NULL};
+static const char *const config_record_keys[] = {"record", "record-mode", "record-proxy", "encoder", "queue", NULL};
+static const char *const config_rtsp_keys[] = {"rtsp", "rtsp-audio", "encoder", "queue", NULL};
+static const char *const config_hls_keys[] = {"hls", "hls-audio", "encoder", "queue", NULL};
+static const char *const config_hls_server_keys[] = {"port", "target-duration", "part-duration", "window",
+                                                     "max-bytes", NULL};
+
+void config_apply(GstConfig *self);
+void config_apply_rtsp_server(GstConfig *self);
+void config_apply_hls_server(GstConfig *self);
+void config_apply_log(GstConfig *self);
+void config_apply_sync(GstConfig *self);
+gboolean config_stream_start(GstConfig *self, ConfigStream *stream, const char *group);
+void config_stream_stop(GstConfig *self, ConfigStream *stream);
+void config_stream_update(GstConfig *self, ConfigStream *stream, const char *group, gboolean create);
+void config_stream_free(ConfigStream *stream);
+gboolean config_add_player(GstConfig *self, ConfigStream *stream, const char *group);
+void config_remove_player(ConfigStream *stream);
+gboolean config_add_recorder(GstConfig *self, ConfigStream *stream, const char *group, const char *filename);
+void config_remove_recorder(ConfigStream *stream);
+gboolean config_add_rtsp(GstConfig *self, ConfigStream *stream, const char *group, const char *path);
+void config_remove_rtsp(GstConfig *self, ConfigStream *stream);
+gboolean config_add_hls(GstConfig *self, ConfigStream *stream, const char *group, const char *path);
+void config_remove_hls(GstConfig *self, ConfigStream *stream);
+gchar *config_signature(GKeyFile *keyfile, const char *group, const char *const *keys);
+void config_apply_profile(GKeyFile *keyfile, const char *group, const char *key, GstElement *element);
+void config_apply_properties(GKeyFile *keyfile, const char *group, GstElement *element);
+void config_on_rtsp_configure(RtspStream *rtsp, GstConfig *self);
+void config_on_hls_configure(HlsStream *hls, GstConfig *self);
+void config_on_stream_started(GstMedia *media, gboolean success, ConfigStream *stream);
+
+gboolean config_init(GstConfig *self)
+{
+    if (!self)
+    {
+        g_printerr("Config instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstConfig));
+    self->streams = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)config_stream_free);
+    self->record_start = GST_CLOCK_TIME_NONE;
+
+    return TRUE;
+}
+
+void config_destroy(GstConfig *self)
+{
+    if (!self)
+        return;
+
+    if (self->streams)
+    {
+        GHashTableIter iter;
+        ConfigStream *stream;
+        g_hash_table_iter_init(&iter, self->streams);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+            config_stream_stop(self, stream);
+        g_hash_table_destroy(self->streams);
+        self->streams = NULL;
+    }
+
+    if (self->rtsp)
+    {
+        rtsp_server_destroy(self->rtsp);
+        g_free(self->rtsp);
+        self->rtsp = NULL;
+    }
+
+    if (self->hls)
+    {
+        hls_server_destroy(self->hls);
+        g_clear_pointer(&self->hls, g_free);
+    }
+    g_clear_pointer(&self->hls_sig, g_free);
+
+    if (self->sync)
+    {
+        sync_destroy(self->sync);
+        g_clear_pointer(&self->sync, g_free);
+    }
+
+    if (self->keyfile)
+    {
+        g_key_file_free(self->keyfile);
+        self->keyfile = NULL;
+    }
+
+    if (self->log_file)
+    {
+        log_stop();
+        g_clear_pointer(&self->log_file, g_free);
+    }
+
+    g_free(self->path);
+    self->path = NULL;
+}
+
+// 第一次加载，之后可以用config_reload重新读取同一个文件
+gboolean config_load(GstConfig *self, const char *path)
+{
+    if (!self || !path)
+    {
+        g_printerr("Invalid arguments to config_load\n");
+        return FALSE;
+    }
+
+    g_free(self->path);
+    self->path = g_strdup(path);
+    return config_reload(self);
+}
+
+// 重新读取配置文件并应用差异。文件有错误时保留当前配置，不做任何修改
+gboolean config_reload(GstConfig *self)
+{
+    if (!self || !self->path)
+    {
+        g_printerr("Config not loaded\n");
+        return FALSE;
+    }
+
+    GError *err = NULL;
+    GKeyFile *keyfile = g_key_file_new();
+    if (!g_key_file_load_from_file(keyfile, self->path, G_KEY_FILE_NONE, &err))
+    {
+        g_printerr("Could not load config %s: %s\n", self->path, err->message);
+        g_clear_error(&err);
+        g_key_file_free(keyfile);
+        return FALSE;
+    }
+
+    if (self->keyfile)
+        g_key_file_free(self->keyfile);
+    self->keyfile = keyfile;
+
+    g_print("Applying config %s\n", self->path);
+    config_apply(self);
+    return TRUE;
+}
+
+ConfigStream *config_get_stream(GstConfig *self, const char *name)
+{
+    if (!self || !name)
+        return NULL;
+
+    return g_hash_table_lookup(self->streams, name);
+}
+
+void config_apply(GstConfig *self)
+{
+    GKeyFile *keyfile = self->keyfile;
+
+    config_apply_log(self);
+    config_apply_sync(self);
+    config_apply_rtsp_server(self);
+    config_apply_hls_server(self);
+
+    // 删除配置里已经没有的流，以及uri变化需要整条重建的流
+    GHashTableIter iter;
+    ConfigStream *stream;
+    g_hash_table_iter_init(&iter, self->streams);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+    {
+        gchar *group = g_strconcat(CONFIG_STREAM_PREFIX, stream->name, NULL);
+        gchar *uri = g_key_file_get_string(keyfile, group, "uri", NULL);
+        if (g_strcmp0(uri, stream->uri) != 0)
+        {
+            g_print("Stream %s %s\n", stream->name, uri ? "changed source, restarting" : "removed");
+            config_stream_stop(self, stream);
+            g_hash_table_iter_remove(&iter);
+        }
+        g_free(uri);
+        g_free(group);
+    }
+
+    // 分两遍处理分支：先拆掉所有有变化的分支，再创建，挂载点在流之间移动时不会冲突
+    gchar **groups = g_key_file_get_groups(keyfile, NULL);
+    for (gint pass = 0; pass < 2; pass++)
+    {
+        for (gchar **group = groups; *group; group++)
+        {
+            if (!g_str_has_prefix(*group, CONFIG_STREAM_PREFIX))
+                continue;
+
+            const char *name = *group + strlen(CONFIG_STREAM_PREFIX);
+            stream = g_hash_table_lookup(self->streams, name);
+            if (stream)
+            {
+                config_stream_update(self, stream, *group, pass == 1);
+                continue;
+            }
+            if (pass == 0)
+                continue;
+
+            gchar *uri = g_key_file_get_string(keyfile, *group, "uri", NULL);
+            if (!uri)
+            {
+                g_printerr("Stream %s has no uri, ignored\n", name);
+                continue;
+            }
+
+            stream = g_new0(ConfigStream, 1);
+            stream->name = g_strdup(name);
+            stream->uri = uri;
+            g_hash_table_insert(self->streams, stream->name, stream);
+            if (!config_stream_start(self, stream, *group))
+            {
+                g_printerr("Failed to start stream %s\n", name);
+                config_stream_stop(self, stream);
+                g_hash_table_remove(self->streams, name);
+            }
+        }
+    }
+    g_strfreev(groups);
+
+    // 对齐时刻只在这一次加载里共用
+    self->record_start = GST_CLOCK_TIME_NONE;
+}
+
+// 端口变化时整个服务器重建，所有挂载点在之后创建分支时重新发布
+void config_apply_rtsp_server(GstConfig *self)
+{
+    guint port = 0;
+    if (g_key_file_has_group(self->keyfile, "rtsp"))
+    {
+        port = g_key_file_get_integer(self->keyfile, "rtsp", "port", NULL);
+        if (port == 0)
+            port = CONFIG_DEFAULT_RTSP_PORT;
+    }
+
+    if (port == self->rtsp_port)
+        return;
+
+    if (self->rtsp)
+    {
+        rtsp_server_destroy(self->rtsp);
+        g_free(self->rtsp);
+        self->rtsp = NULL;
+
+        GHashTableIter iter;
+        ConfigStream *stream;
+        g_hash_table_iter_init(&iter, self->streams);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+        {
+            g_clear_pointer(&stream->rtsp_path, g_free);
+            g_clear_pointer(&stream->rtsp_sig, g_free);
+        }
+    }
+
+    self->rtsp_port = 0;
+    if (!port)
+        return;
+
+    self->rtsp = g_new0(GstRtspServer, 1);
+    if (!rtsp_server_init(self->rtsp, port))
+    {
+        g_free(self->rtsp);
+        self->rtsp = NULL;
+        return;
+    }
+
+    rtsp_set_configure_func(self->rtsp, (RtspConfigureFunc)config_on_rtsp_configure, self);
+    if (!rtsp_start(self->rtsp))
+    {
+        rtsp_server_destroy(self->rtsp);
+        g_free(self->rtsp);
+        self->rtsp = NULL;
+        return;
+    }
+    self->rtsp_port = port;
+}
+
+// [hls]组的任何键变化时整个服务器重建，和RTSP一样挂载点在之后创建分支时重新发布
+void config_apply_hls_server(GstConfig *self)
+{
+    GKeyFile *keyfile = self->keyfile;
+    gchar *sig = g_key_file_has_group(keyfile, "hls") ? config_signature(keyfile, "hls", config_hls_server_keys)
+                                                      : NULL;
+    if (g_strcmp0(sig, self->hls_sig) == 0)
+    {
+        g_free(sig);
+        return;
+    }
+
+    if (self->hls)
+    {
+        hls_server_destroy(self->hls);
+        g_clear_pointer(&self->hls, g_free);
+
+        GHashTableIter iter;
+        ConfigStream *stream;
+        g_hash_table_iter_init(&iter, self->streams);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+        {
+            g_clear_pointer(&stream->hls_path, g_free);
+            g_clear_pointer(&stream->hls_sig, g_free);
+        }
+    }
+
+    g_free(self->hls_sig);
+    self->hls_sig = sig;
+    if (!sig)
+        return;
+
+    guint port = g_key_file_get_integer(keyfile, "hls", "port", NULL);
+    self->hls = g_new0(GstHlsServer, 1);
+    hls_server_init(self->hls, port ? port : CONFIG_DEFAULT_HLS_PORT);
+    hls_set_segmenting(self->hls, g_key_file_get_uint64(keyfile, "hls", "target-duration", NULL) * GST_MSECOND,
+                       g_key_file_get_uint64(keyfile, "hls", "part-duration", NULL) * GST_MSECOND,
+                       g_key_file_get_integer(keyfile, "hls", "window", NULL),
+                       g_key_file_get_uint64(keyfile, "hls", "max-bytes", NULL));
+    hls_set_configure_func(self->hls, (HlsConfigureFunc)config_on_hls_configure, self);
+    if (!hls_start(self->hls))
+    {
+        hls_server_destroy(self->hls);
+        g_clear_pointer(&self->hls, g_free);
+    }
+}
+
+// [sync]组存在时之后启动的流加入共享时钟。删除该组只释放协调器和网络时钟，已经在播放的流继续使用原来的时钟，
+// 重新加入需要重启流
+void config_apply_sync(GstConfig *self)
+{
+    GKeyFile *keyfile = self->keyfile;
+    if (!g_key_file_has_group(keyfile, "sync"))
+    {
+        if (self->sync)
+        {
+            sync_destroy(self->sync);
+            g_clear_pointer(&self->sync, g_free);
+        }
+        return;
+    }
+
+    if (!self->sync)
+    {
+        self->sync = g_new0(GstSync, 1);
+        sync_init(self->sync);
+    }
+
+    gint64 delay = g_key_file_has_key(keyfile, "sync", "record-delay", NULL)
+                       ? g_key_file_get_int64(keyfile, "sync", "record-delay", NULL)
+                       : CONFIG_DEFAULT_RECORD_DELAY;
+    self->record_delay = MAX(delay, 0) * GST_MSECOND;
+
+    if (!g_key_file_has_key(keyfile, "sync", "net-clock-port", NULL))
+    {
+        sync_stop_net_clock(self->sync);
+        return;
+    }
+
+    guint port = g_key_file_get_integer(keyfile, "sync", "net-clock-port", NULL);
+    if (!self->sync->provider || (port && port != self->sync->net_port))
+        sync_start_net_clock(self->sync, port);
+}
+
+// 没有level时保持当前级别，控制接口修改的级别不会被重新加载覆盖；file变化时重启日志线程
+void config_apply_log(GstConfig *self)
+{
+    gchar *name = g_key_file_get_string(self->keyfile, "log", "level", NULL);
+    LogLevel level;
+    if (name && log_parse_level(name, &level))
+        log_set_level(level);
+    else if (name)
+        g_printerr("Unknown log level %s\n", name);
+    g_free(name);
+
+    // 没有配置时也启动日志线程，输出到stderr
+    gchar *file = g_key_file_get_string(self->keyfile, "log", "file", NULL);
+    if (!file)
+        file = g_strdup("-");
+    if (g_strcmp0(file, self->log_file) == 0)
+    {
+        g_free(file);
+        return;
+    }
+
+    if (self->log_file)
+    {
+        log_stop();
+        g_clear_pointer(&self->log_file, g_free);
+    }
+
+    if (log_start(file))
+        self->log_file = file;
+    else
+        g_free(file);
+}
+
+gboolean config_stream_start(GstConfig *self, ConfigStream *stream, const char *group)
+{
+    stream->media = g_new0(GstMedia, 1);
+    if (!media_init(stream->media))
+    {
+        g_clear_pointer(&stream->media, g_free);
+        return FALSE;
+    }
+    media_set_name(stream->media, stream->name);
+
+    if (!media_set_uri(stream->media, stream->uri))
+        return FALSE;
+
+    // 在录像分支计算开始时刻之前加入，管道第一次启动就使用共享的base time
+    if (self->sync && !sync_add_media(self->sync, stream->media))
+        g_printerr("Stream %s: could not use shared clock\n", stream->name);
+
+    // 分支都在管道启动之前加入，随管道一起切换状态
+    config_stream_update(self, stream, group, TRUE);
+
+    g_print("Starting stream %s from %s\n", stream->name, stream->uri);
+    return media_play_async(stream->media, (MediaStateCallback)config_on_stream_started, stream);
+}
+
+void config_stream_stop(GstConfig *self, ConfigStream *stream)
+{
+    config_remove_hls(self, stream);
+    config_remove_rtsp(self, stream);
+    config_remove_recorder(stream);
+    config_remove_player(stream);
+
+    if (stream->media)
+    {
+        sync_remove_media(self->sync, stream->media);
+        media_stop(stream->media);
+        media_destroy(stream->media);
+        g_clear_pointer(&stream->media, g_free);
+    }
+}
+
+void config_stream_free(ConfigStream *stream)
+{
+    g_free(stream->name);
+    g_free(stream->uri);
+    g_free(stream->player_sig);
+    g_free(stream->record_sig);
+    g_free(stream->rtsp_sig);
+    g_free(stream->hls_sig);
+    g_free(stream);
+}
+
+// create为FALSE时只拆掉配置有变化的分支，为TRUE时创建需要但还不存在的分支。
+// 创建失败的分支不记录摘要，下次加载时重试
+void config_stream_update(GstConfig *self, ConfigStream *stream, const char *group, gboolean create)
+{
+    GKeyFile *keyfile = self->keyfile;
+
+    if (create)
+        media_set_memory_budget(stream->media, g_key_file_get_uint64(keyfile, group, "memory-budget", NULL),
+                                g_key_file_get_uint64(keyfile, group, "branch-budget", NULL));
+
+    gchar *player_sig = g_key_file_get_boolean(keyfile, group, "player", NULL)
+                            ? config_signature(keyfile, group, config_player_keys)
+                            : NULL;
+    if (g_strcmp0(player_sig, stream->player_sig) != 0)
+    {
+        if (!create)
+        {
+            config_remove_player(stream);
+            g_clear_pointer(&stream->player_sig, g_free);
+        }
+        else if (player_sig && config_add_player(self, stream, group))
+        {
+            stream->player_sig = player_sig;
+            player_sig = NULL;
+        }
+    }
+    g_free(player_sig);
+
+    gchar *record = g_key_file_get_string(keyfile, group, "record", NULL);
+    gchar *record_sig = record && *record ? config_signature(keyfile, group, config_record_keys) : NULL;
+    if (g_strcmp0(record_sig, stream->record_sig) != 0)
+    {
+        if (!create)
+        {
+            config_remove_recorder(stream);
+            g_clear_pointer(&stream->record_sig, g_free);
+        }
+        else if (record_sig && config_add_recorder(self, stream, group, record))
+        {
+            stream->record_sig = record_sig;
+            record_sig = NULL;
+        }
+    }
+    g_free(record_sig);
+    g_free(record);
+
+    gchar *rtsp = g_key_file_get_string(keyfile, group, "rtsp", NULL);
+    gchar *rtsp_sig = rtsp && *rtsp ? config_signature(keyfile, group, config_rtsp_keys) : NULL;
+    if (g_strcmp0(rtsp_sig, stream->rtsp_sig) != 0)
+    {
+        if (!create)
+        {
+            config_remove_rtsp(self, stream);
+            g_clear_pointer(&stream->rtsp_sig, g_free);
+        }
+        else if (rtsp_sig && config_add_rtsp(self, stream, group, rtsp))
+        {
+            stream->rtsp_sig = rtsp_sig;
+            rtsp_sig = NULL;
+        }
+    }
+    g_free(rtsp_sig);
+    g_free(rtsp);
+
+    gchar *hls = g_key_file_get_string(keyfile, group, "hls", NULL);
+    gchar *hls_sig = hls && *hls ? config_signature(keyfile, group, config_hls_keys) : NULL;
+    if (g_strcmp0(hls_sig, stream->hls_sig) != 0)
+    {
+        if (!create)
+        {
+            config_remove_hls(self, stream);
+            g_clear_pointer(&stream->hls_sig, g_free);
+        }
+        else if (hls_sig && config_add_hls(self, stream, group, hls))
+        {
+            stream->hls_sig = hls_sig;
+            hls_sig = NULL;
+        }
+    }
+    g_free(hls_sig);
+    g_free(hls);
+}
+
+gboolean config_add_player(GstConfig *self, ConfigStream *stream, const char *group)
+{
+    GstPlayer *player = g_new0(GstPlayer, 1);
+    if (!player_init(player))
+    {
+        g_free(player);
+        return FALSE;
+    }
+
+    config_apply_profile(self->keyfile, group, "queue", player->v_queue);
+    config_apply_profile(self->keyfile, group, "queue", player->a_queue);
+
+    stream->player = player;
+    if (!player_link(player, stream->media))
+    {
+        g_printerr("Failed to link player to stream %s\n", stream->name);
+        config_remove_player(stream);
+        return FALSE;
+    }
+
+    // 流已经在运行时直接启动分支
+    gst_element_sync_state_with_parent(GST_ELEMENT(player->bin));
+    g_print("Stream %s: player added\n", stream->name);
+    return TRUE;
+}
+
+void config_remove_player(ConfigStream *stream)
+{
+    if (!stream->player)
+        return;
+
+    if (stream->player->media)
+        player_unlink(stream->player);
+    player_destroy(stream->player);
+    g_clear_pointer(&stream->player, g_free);
+    g_print("Stream %s: player removed\n", stream->name);
+}
+
+// group提供录像的模式、代理、编码器和队列配置，文件名单独指定
+gboolean config_add_recorder(GstConfig *self, ConfigStream *stream, const char *group, const char *filename)
+{
+    GKeyFile *keyfile = self->keyfile;
+    GstRecorder *recorder = g_new0(GstRecorder, 1);
+    if (!recorder_init(recorder))
+    {
+        g_free(recorder);
+        return FALSE;
+    }
+    stream->recorder = recorder;
+
+    gchar *mode = g_key_file_get_string(keyfile, group, "record-mode", NULL);
+    if (g_strcmp0(mode, "faststart") == 0)
+        recorder_set_mode(recorder, RECORDER_MODE_FASTSTART);
+    else if (mode && g_strcmp0(mode, "fragmented") != 0)
+        g_printerr("Stream %s: unknown record-mode %s, using fragmented\n", stream->name, mode);
+    g_free(mode);
+
+    gchar *proxy = g_key_file_get_string(keyfile, group, "record-proxy", NULL);
+    gint width = 0, height = 0, fps = 0;
+    if (proxy && sscanf(proxy, "%dx%d@%d", &width, &height, &fps) < 2)
+        g_printerr("Stream %s: invalid record-proxy %s, expected WIDTHxHEIGHT[@FPS]\n", stream->name, proxy);
+    else if (proxy)
+        recorder_set_proxy(recorder, width, height, fps);
+    g_free(proxy);
+
+    config_apply_profile(keyfile, group, "encoder", recorder->v_encoder);
+    config_apply_profile(keyfile, group, "queue", recorder->v_queue);
+    config_apply_profile(keyfile, group, "queue", recorder->a_queue);
+
+    // 共享时钟的流在同一次加载里开始的录像对齐到同一时刻，record-delay给新启动的流留出连接的时间
+    GstClockTime start = GST_CLOCK_TIME_NONE;
+    if (self->sync && g_list_find(self->sync->media, stream->media))
+    {
+        if (!GST_CLOCK_TIME_IS_VALID(self->record_start))
+            self->record_start = sync_get_running_time(self->sync) + self->record_delay;
+        start = self->record_start;
+    }
+
+    gboolean result = recorder_link(recorder, stream->media) && recorder_start_at(recorder, filename, start);
+    if (!result)
+    {
+        g_printerr("Failed to start recording stream %s to %s\n", stream->name, filename);
+        config_remove_recorder(stream);
+    }
+    else
+    {
+        g_print("Stream %s: recording to %s\n", stream->name, filename);
+    }
+
+    return result;
+}
+
+// 停止录制会等待muxer写完最后一个分片
+void config_remove_recorder(ConfigStream *stream)
+{
+    if (!stream->recorder)
+        return;
+
+    if (stream->recorder->media)
+        recorder_unlink(stream->recorder);
+    recorder_destroy(stream->recorder);
+    g_clear_pointer(&stream->recorder, g_free);
+    g_print("Stream %s: recorder removed\n", stream->name);
+}
+
+gboolean config_add_rtsp(GstConfig *self, ConfigStream *stream, const char *group, const char *path)
+{
+    if (!self->rtsp)
+    {
+        g_printerr("Stream %s: rtsp mount requested but no [rtsp] server configured\n", stream->name);
+        return FALSE;
+    }
+
+    GError *err = NULL;
+    gboolean audio = g_key_file_get_boolean(self->keyfile, group, "rtsp-audio", &err);
+    if (err)
+    {
+        // 没有设置时和rtsp_link一样带音频
+        audio = TRUE;
+        g_clear_error(&err);
+    }
+
+    if (!rtsp_add_mount(self->rtsp, stream->media, path, audio))
+        return FALSE;
+
+    stream->rtsp_path = g_strdup(path);
+    return TRUE;
+}
+
+void config_remove_rtsp(GstConfig *self, ConfigStream *stream)
+{
+    if (!stream->rtsp_path)
+        return;
+
+    if (self->rtsp)
+        rtsp_remove_mount(self->rtsp, stream->rtsp_path);
+    g_clear_pointer(&stream->rtsp_path, g_free);
+}
+
+gboolean config_add_hls(GstConfig *self, ConfigStream *stream, const char *group, const char *path)
+{
+    if (!self->hls)
+    {
+        g_printerr("Stream %s: hls mount requested but no [hls] server configured\n", stream->name);
+        return FALSE;
+    }
+
+    GError *err = NULL;
+    gboolean audio = g_key_file_get_boolean(self->keyfile, group, "hls-audio", &err);
+    if (err)
+    {
+        audio = TRUE;
+        g_clear_error(&err);
+    }
+
+    if (!hls_add_mount(self->hls, stream->media, path, audio))
+        return FALSE;
+
+    stream->hls_path = g_strdup(path);
+    return TRUE;
+}
+
+void config_remove_hls(GstConfig *self, ConfigStream *stream)
+{
+    if (!stream->hls_path)
+        return;
+
+    if (self->hls)
+        hls_remove_mount(self->hls, stream->hls_path);
+    g_clear_pointer(&stream->hls_path, g_free);
+}
+
+// 运行时按名字挂上一个分支（控制接口使用），player不需要参数，recorder是文件名，rtsp和hls是挂载路径。
+// 编码器和队列仍然按流的配置设置。已经存在的同类分支先拆掉；下次重新加载配置时以配置文件为准
+gboolean config_attach_branch(GstConfig *self, ConfigStream *stream, const char *branch, const char *arg)
+{
+    if (!self || !stream || !stream->media || !branch)
+    {
+        g_printerr("Invalid arguments to config_attach_branch\n");
+        return FALSE;
+    }
+
+    gchar *group = g_strconcat(CONFIG_STREAM_PREFIX, stream->name, NULL);
+    gchar **sig = NULL;
+    gboolean result = FALSE;
+
+    if (strcmp(branch, "player") == 0)
+    {
+        config_remove_player(stream);
+        result = config_add_player(self, stream, group);
+        sig = &stream->player_sig;
+    }
+    else if (strcmp(branch, "recorder") == 0 && arg)
+    {
+        config_remove_recorder(stream);
+        result = config_add_recorder(self, stream, group, arg);
+        self->record_start = GST_CLOCK_TIME_NONE;
+        sig = &stream->record_sig;
+    }
+    else if (strcmp(branch, "rtsp") == 0 && arg)
+    {
+        config_remove_rtsp(self, stream);
+        result = config_add_rtsp(self, stream, group, arg);
+        sig = &stream->rtsp_sig;
+    }
+    else if (strcmp(branch, "hls") == 0 && arg)
+    {
+        config_remove_hls(self, stream);
+        result = config_add_hls(self, stream, group, arg);
+        sig = &stream->hls_sig;
+    }
+    else
+    {
+        g_printerr("Unknown branch %s or missing argument\n", branch);
+    }
+
+    // 摘要标记为运行时修改，和任何配置都不相同
+    if (sig)
+    {
+        g_free(*sig);
+        *sig = result ? g_strdup("attached at runtime\n") : NULL;
+    }
+
+    g_free(group);
+    return result;
+}
+
+gboolean config_detach_branch(GstConfig *self, ConfigStream *stream, const char *branch)
+{
+    if (!self || !stream || !branch)
+    {
+        g_printerr("Invalid arguments to config_detach_branch\n");
+        return FALSE;
+    }
+
+    if (strcmp(branch, "player") == 0)
+    {
+        config_remove_player(stream);
+        g_clear_pointer(&stream->player_sig, g_free);
+    }
+    else if (strcmp(branch, "recorder") == 0)
+    {
+        config_remove_recorder(stream);
+        g_clear_pointer(&stream->record_sig, g_free);
+    }
+    else if (strcmp(branch, "rtsp") == 0)
+    {
+        config_remove_rtsp(self, stream);
+        g_clear_pointer(&stream->rtsp_sig, g_free);
+    }
+    else if (strcmp(branch, "hls") == 0)
+    {
+        config_remove_hls(self, stream);
+        g_clear_pointer(&stream->hls_sig, g_free);
+    }
+    else
+    {
+        g_printerr("Unknown branch %s\n", branch);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// 挂载点的分支连接到媒体之前，按所属流的配置设置编码器和队列
+void config_on_rtsp_configure(RtspStream *rtsp, GstConfig *self)
+{
+    GHashTableIter iter;
+    ConfigStream *stream;
+    g_hash_table_iter_init(&iter, self->streams);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+    {
+        if (stream->media != rtsp->media)
+            continue;
+
+        gchar *group = g_strconcat(CONFIG_STREAM_PREFIX, stream->name, NULL);
+        config_apply_profile(self->keyfile, group, "encoder", rtsp->v_encoder);
+        config_apply_profile(self->keyfile, group, "queue", rtsp->v_queue);
+        config_apply_profile(self->keyfile, group, "queue", rtsp->a_queue);
+        g_free(group);
+        return;
+    }
+}
+
+void config_on_hls_configure(HlsStream *hls, GstConfig *self)
+{
+    GHashTableIter iter;
+    ConfigStream *stream;
+    g_hash_table_iter_init(&iter, self->streams);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+    {
+        if (stream->media != hls->media)
+            continue;
+
+        gchar *group = g_strconcat(CONFIG_STREAM_PREFIX, stream->name, NULL);
+        config_apply_profile(self->keyfile, group, "encoder", hls->v_encoder);
+        config_apply_profile(self->keyfile, group, "queue", hls->v_queue);
+        config_apply_profile(self->keyfile, group, "queue", hls->a_queue);
+        g_free(group);
+        return;
+    }
+}
+
+void config_on_stream_started(GstMedia *media, gboolean success, ConfigStream *stream)
+{
+    if (!success)
+    {
+        g_printerr("Stream %s failed to start\n", stream->name);
+        return;
+    }
+
+    MediaTimings timings;
+    media_get_timings(media, &timings);
+    g_print("Stream %s playing after %.1f ms\n", stream->name, timings.playing / 1000.0);
+}
+
+// 分支配置的摘要：所有相关键的值，加上引用的encoder/queue组的内容
+gchar *config_signature(GKeyFile *keyfile, const char *group, const char *const *keys)
+{
+    GString *sig = g_string_new(NULL);
+    for (const char *const *key = keys; *key; key++)
+    {
+        gchar *value = g_key_file_get_value(keyfile, group, *key, NULL);
+        g_string_append_printf(sig, "%s=%s\n", *key, value ? value : "");
+
+        if (value && (strcmp(*key, "encoder") == 0 || strcmp(*key, "queue") == 0))
+        {
+            gchar *ref = g_strdup_printf("%s:%s", *key, value);
+            gchar **ref_keys = g_key_file_get_keys(keyfile, ref, NULL, NULL);
+            for (gchar **ref_key = ref_keys; ref_key && *ref_key; ref_key++)
+            {
+                gchar *ref_value = g_key_file_get_value(keyfile, ref, *ref_key, NULL);
+                g_string_append_printf(sig, "  %s=%s\n", *ref_key, ref_value);
+                g_free(ref_value);
+            }
+            g_strfreev(ref_keys);
+            g_free(ref);
+        }
+        g_free(value);
+    }
+    return g_string_free(sig, FALSE);
+}
+
+// 流的group里key引用的配置组(例如encoder=hd对应[encoder:hd])，设置到element上
+void config_apply_profile(GKeyFile *keyfile, const char *group, const char *key, GstElement *element)
+{
+    if (!element)
+        return;
+
+    gchar *name = g_key_file_get_string(keyfile, group, key, NULL);
+    if (!name)
+        return;
+
+    gchar *ref = g_strdup_printf("%s:%s", key, name);
+    if (g_key_file_has_group(keyfile, ref))
+        config_apply_properties(keyfile, ref, element);
+    else
+        g_printerr("Config group [%s] referenced by [%s] not found\n", ref, group);
+
+    g_free(ref);
+    g_free(name);
+}
+
+// 组里的每个键都是element的属性名，值按gst-launch的语法解析（枚举可以用名字）
+void config_apply_properties(GKeyFile *keyfile, const char *group, GstElement *element)
+{
+    gchar **keys = g_key_file_get_keys(keyfile, group, NULL, NULL);
+    for (gchar **key = keys; key && *key; key++)
+    {
+        if (!g_object_class_find_property(G_OBJECT_GET_CLASS(element), *key))
+        {
+            g_printerr("Element %s has no property %s (config group [%s])\n",
+                       GST_ELEMENT_NAME(element), *key, group);
+            continue;
+        }
+
+        gchar *value = g_key_file_get_string(keyfile, group, *key, NULL);
+        gst_util_set_object_arg(G_OBJECT(element), *key, value);
+        g_free(value);
+    }
+    g_strfreev(keys);
+}
@@ -0,0 +1,113 @@
+#ifndef __GST_CONFIG_H__
+#define __GST_CONFIG_H__
+
+#include <gst/gst.h>
+#include "gst-media.h"
+#include "gst-player.h"
+#include "gst-recorder.h"
+#include "gst-rtsp-server.h"
+#include "gst-hls.h"
+#include "gst-sync.h"
+
+// 声明式配置：用GKeyFile描述所有流和它们的分支，重新加载时只修改有变化的部分。
+//
+//   # 没有[rtsp]组时不启动RTSP服务器
+//   [rtsp]
+//   port=8554
+//
+//   # 没有[hls]组时不启动HLS服务器；时长单位毫秒，max-bytes是每个挂载点的缓存上限，只监听127.0.0.1
+//   [hls]
+//   port=8080
+//   target-duration=2000
+//   part-duration=200
+//   window=6
+//   max-bytes=33554432
+//
+//   # 日志级别为error/warning/info/debug；file为文件路径、"-"(stderr，默认)或journal
+//   [log]
+//   level=info
+//   file=/var/log/gst-player.log
+//
+//   # 所有流共用一个时钟和base time（只对之后启动的流生效）。同一次加载里开始的录像从同一时刻开始，
+//   # record-delay（毫秒，默认1000）是该时刻相对于加载时刻的延迟；设置net-clock-port时在127.0.0.1上
+//   # 发布网络时钟，0表示由系统分配端口
+//   [sync]
+//   record-delay=1000
+//   net-clock-port=8555
+//
+//   # 编码器配置，键值直接设置为x264enc的属性
+//   [encoder:hd]
+//   bitrate=2048
+//   speed-preset=veryfast
+//   key-int-max=60
+//
+//   # 队列策略，键值直接设置为各分支入口queue的属性
+//   [queue:realtime]
+//   leaky=downstream
+//   max-size-time=500000000
+//
+//   [stream:cam1]
+//   uri=rtsp://10.0.0.1/main
+//   player=false
+//   # 不设置record时不录像；record-mode为fragmented或faststart；record-proxy为代理录像的宽x高@帧率
+//   record=/data/cam1.mp4
+//   record-mode=fragmented
+//   record-proxy=640x360@10
+//   rtsp=/cam1
+//   rtsp-audio=true
+//   # 播放列表为http://127.0.0.1:8080/cam1/index.m3u8
+//   hls=/cam1
+//   hls-audio=true
+//   # 录像、RTSP和HLS使用的编码器配置，所有分支使用的队列策略
+//   encoder=hd
+//   queue=realtime
+//   # 内存预算（字节）：整条流和每个分支，超出后分支的队列开始丢弃旧数据；不设置时不限制
+//   memory-budget=268435456
+//   branch-budget=67108864
+//
+// 重新加载时按流的名字比较：uri变化时整条流重建，否则只重建配置有变化的分支，
+// 引用的encoder/queue组内容变化也算分支变化。没有变化的流和分支不会中断。
+// 内存预算不需要重建，重新加载时直接生效。
+
+typedef struct ConfigStream
+{
+    gchar *name;
+    gchar *uri;
+
+    GstMedia *media;
+    GstPlayer *player;
+    GstRecorder *recorder;
+    gchar *rtsp_path;        // 当前挂载的路径，NULL表示没有发布
+    gchar *hls_path;
+
+    // 各分支当前生效的配置摘要，和新配置的摘要不同时重建该分支
+    gchar *player_sig, *record_sig, *rtsp_sig, *hls_sig;
+
+} ConfigStream;
+
+typedef struct GstConfig
+{
+    gchar *path;
+    GKeyFile *keyfile;       // 当前生效的配置
+    GHashTable *streams;     // 流名 -> ConfigStream
+
+    GstRtspServer *rtsp;
+    guint rtsp_port;
+    GstHlsServer *hls;
+    gchar *hls_sig;          // [hls]组的摘要，变化时重建服务器
+    gchar *log_file;         // 当前日志输出，NULL表示没有启动日志线程
+    GstSync *sync;           // 有[sync]组时的时钟协调器
+    GstClockTime record_delay;
+    GstClockTime record_start;  // 当前这次加载里录像对齐的时刻，NONE表示还没有录像开始
+
+} GstConfig;
+
+gboolean config_init(GstConfig *self);
+void config_destroy(GstConfig *self);
+gboolean config_load(GstConfig *self, const char *path);
+gboolean config_reload(GstConfig *self);
+ConfigStream *config_get_stream(GstConfig *self, const char *name);
+gboolean config_attach_branch(GstConfig *self, ConfigStream *stream, const char *branch, const char *arg);
+gboolean config_detach_branch(GstConfig *self, ConfigStream *stream, const char *branch);
+
+#endif
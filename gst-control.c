@@ -0,0 +1,695 @@
+#include "gst-control.h"
+#include "gst-log.h"
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// 一个客户端连接：读一行、执行、写回复，写完之后再读下一行
+typedef struct ControlClient
+{
+    GstControl *control;     // 控制接口停止后为NULL，等待中的异步操作结束时释放连接
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GOutputStream *output;
+    GCancellable *cancellable;
+    gchar *response;
+} ControlClient;
+
+typedef gchar *(*ControlHandler)(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+
+typedef struct ControlCommand
+{
+    const char *name;
+    gint min_args;           // 包括命令名
+    gboolean stream;         // 第二个参数是流名
+    ControlHandler handler;
+} ControlCommand;
+
+gboolean control_on_incoming(GSocketService *service, GSocketConnection *connection,
+                             GObject *source_object, GstControl *self);
+void control_client_read(ControlClient *client);
+void control_on_line(GObject *source, GAsyncResult *result, ControlClient *client);
+void control_on_written(GObject *source, GAsyncResult *result, ControlClient *client);
+void control_client_free(ControlClient *client);
+void control_client_reply(ControlClient *client, gchar *response);
+void control_on_record_stopped(GstRecorder *recorder, gboolean success, ControlClient *client);
+
+gchar *control_cmd_ping(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_list(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_play(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_pause(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_stop(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_seek(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_record_start(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_record_stop(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_attach(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_detach(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_stats(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_tracks(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_select(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_memory(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_log_level(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+gchar *control_cmd_clock(GstControl *self, ConfigStream *stream, gint argc, gchar **argv);
+
+static const ControlCommand control_commands[] = {
+    {"ping", 1, FALSE, control_cmd_ping},
+    {"list", 1, FALSE, control_cmd_list},
+    {"play", 2, TRUE, control_cmd_play},
+    {"pause", 2, TRUE, control_cmd_pause},
+    {"stop", 2, TRUE, control_cmd_stop},
+    {"seek", 3, TRUE, control_cmd_seek},
+    {"record-start", 2, TRUE, control_cmd_record_start},
+    {"record-stop", 2, TRUE, control_cmd_record_stop},
+    {"attach", 3, TRUE, control_cmd_attach},
+    {"detach", 3, TRUE, control_cmd_detach},
+    {"stats", 2, TRUE, control_cmd_stats},
+    {"tracks", 2, TRUE, control_cmd_tracks},
+    {"select", 4, TRUE, control_cmd_select},
+    {"memory", 2, TRUE, control_cmd_memory},
+    {"log-level", 1, FALSE, control_cmd_log_level},
+    {"clock", 1, FALSE, control_cmd_clock},
+};
+
+#define CONTROL_OK g_strdup("OK")
+#define CONTROL_FAIL(what) g_strdup("ERR " what " failed")
+
+gboolean control_init(GstControl *self, GstConfig *config)
+{
+    if (!self || !config)
+    {
+        g_printerr("Invalid arguments to control_init\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstControl));
+    self->config = config;
+
+    return TRUE;
+}
+
+void control_destroy(GstControl *self)
+{
+    if (!self)
+        return;
+
+    control_stop(self);
+    self->config = NULL;
+}
+
+// 在socket_path上监听，已经存在的旧套接字文件会被删除
+gboolean control_start(GstControl *self, const char *socket_path)
+{
+    if (!self || !socket_path)
+    {
+        g_printerr("Invalid arguments to control_start\n");
+        return FALSE;
+    }
+
+    if (self->service)
+    {
+        g_printerr("Control server already started on %s\n", self->socket_path);
+        return FALSE;
+    }
+
+    g_unlink(socket_path);
+
+    GError *err = NULL;
+    GSocketAddress *address = g_unix_socket_address_new(socket_path);
+    self->service = g_socket_service_new();
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(self->service), address,
+                                       G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                       NULL, NULL, &err))
+    {
+        g_printerr("Could not listen on %s: %s\n", socket_path, err->message);
+        g_clear_error(&err);
+        g_object_unref(address);
+        g_clear_object(&self->service);
+        return FALSE;
+    }
+    g_object_unref(address);
+
+    self->socket_path = g_strdup(socket_path);
+    g_signal_connect(self->service, "incoming", G_CALLBACK(control_on_incoming), self);
+    g_socket_service_start(self->service);
+
+    g_print("Control server listening on %s\n", socket_path);
+    return TRUE;
+}
+
+void control_stop(GstControl *self)
+{
+    if (!self || !self->service)
+        return;
+
+    g_socket_service_stop(self->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+    g_clear_object(&self->service);
+
+    // 客户端的异步读写被取消后在回调里释放
+    for (GList *l = self->clients; l; l = l->next)
+    {
+        ControlClient *client = l->data;
+        client->control = NULL;
+        g_cancellable_cancel(client->cancellable);
+    }
+    g_list_free(self->clients);
+    self->clients = NULL;
+
+    g_unlink(self->socket_path);
+    g_free(self->socket_path);
+    self->socket_path = NULL;
+
+    g_print("Control server stopped\n");
+}
+
+gboolean control_on_incoming(GSocketService *service, GSocketConnection *connection,
+                             GObject *source_object, GstControl *self)
+{
+    ControlClient *client = g_new0(ControlClient, 1);
+    client->control = self;
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    client->output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    client->cancellable = g_cancellable_new();
+    g_data_input_stream_set_newline_type(client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+    self->clients = g_list_prepend(self->clients, client);
+    control_client_read(client);
+    return TRUE;
+}
+
+void control_client_read(ControlClient *client)
+{
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, client->cancellable,
+                                        (GAsyncReadyCallback)control_on_line, client);
+}
+
+void control_on_line(GObject *source, GAsyncResult *result, ControlClient *client)
+{
+    GError *err = NULL;
+    gchar *line = g_data_input_stream_read_line_finish(client->input, result, NULL, &err);
+
+    // 连接关闭、读错误或者控制接口已经停止
+    if (!line || !client->control)
+    {
+        if (err && !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr("Control client read failed: %s\n", err->message);
+        g_clear_error(&err);
+        g_free(line);
+        control_client_free(client);
+        return;
+    }
+
+    GstControl *control = client->control;
+    control->current = client;
+    gchar *response = control_execute(control, line);
+    control->current = NULL;
+    g_free(line);
+
+    // 异步完成的命令在完成时回复，之前不读下一行
+    if (response)
+        control_client_reply(client, response);
+}
+
+// 发送一行回复，写完之后读下一条命令。接管response
+void control_client_reply(ControlClient *client, gchar *response)
+{
+    client->response = g_strconcat(response, "\n", NULL);
+    g_free(response);
+    g_output_stream_write_all_async(client->output, client->response, strlen(client->response),
+                                    G_PRIORITY_DEFAULT, client->cancellable,
+                                    (GAsyncReadyCallback)control_on_written, client);
+}
+
+void control_on_written(GObject *source, GAsyncResult *result, ControlClient *client)
+{
+    GError *err = NULL;
+    gboolean ok = g_output_stream_write_all_finish(client->output, result, NULL, &err);
+    g_clear_pointer(&client->response, g_free);
+
+    if (!ok || !client->control)
+    {
+        if (err && !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr("Control client write failed: %s\n", err->message);
+        g_clear_error(&err);
+        control_client_free(client);
+        return;
+    }
+
+    control_client_read(client);
+}
+
+void control_client_free(ControlClient *client)
+{
+    if (client->control)
+        client->control->clients = g_list_remove(client->control->clients, client);
+
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_object_unref(client->cancellable);
+    g_free(client->response);
+    g_free(client);
+}
+
+// 执行一条命令，返回不带换行的回复。也可以不经过套接字直接调用
+gchar *control_execute(GstControl *self, const char *line)
+{
+    gint argc = 0;
+    gchar **argv = NULL;
+    GError *err = NULL;
+    gchar *response = NULL;
+
+    if (!g_shell_parse_argv(line, &argc, &argv, &err))
+    {
+        response = g_strdup_printf("ERR %s", err->message);
+        g_clear_error(&err);
+        self->errors++;
+        return response;
+    }
+
+    const ControlCommand *command = NULL;
+    for (guint i = 0; i < G_N_ELEMENTS(control_commands); i++)
+    {
+        if (strcmp(control_commands[i].name, argv[0]) == 0)
+        {
+            command = &control_commands[i];
+            break;
+        }
+    }
+
+    ConfigStream *stream = NULL;
+    if (!command)
+        response = g_strdup_printf("ERR unknown command %s", argv[0]);
+    else if (argc < command->min_args)
+        response = g_strdup_printf("ERR %s needs %d arguments", command->name, command->min_args - 1);
+    else if (command->stream && !(stream = config_get_stream(self->config, argv[1])))
+        response = g_strdup_printf("ERR unknown stream %s", argv[1]);
+    else
+        response = command->handler(self, stream, argc, argv);
+
+    self->commands++;
+    if (response && g_str_has_prefix(response, "ERR"))
+        self->errors++;
+
+    g_strfreev(argv);
+    return response;
+}
+
+gchar *control_cmd_ping(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    return g_strdup("OK pong");
+}
+
+gchar *control_cmd_list(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    GString *response = g_string_new("OK");
+    GHashTableIter iter;
+    g_hash_table_iter_init(&iter, self->config->streams);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&stream))
+        g_string_append_printf(response, " %s", stream->name);
+    return g_string_free(response, FALSE);
+}
+
+gchar *control_cmd_play(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    return media_play(stream->media) ? CONTROL_OK : CONTROL_FAIL("play");
+}
+
+gchar *control_cmd_pause(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    return media_pause(stream->media) ? CONTROL_OK : CONTROL_FAIL("pause");
+}
+
+gchar *control_cmd_stop(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    return media_stop(stream->media) ? CONTROL_OK : CONTROL_FAIL("stop");
+}
+
+// seek STREAM MS [RATE] [MODE]
+gchar *control_cmd_seek(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    static const char *const modes[] = {"default", "keyframe", "accurate", "segment", "instant"};
+
+    gchar *end = NULL;
+    gint64 position = g_ascii_strtoll(argv[2], &end, 10);
+    if (*end || position < 0)
+        return g_strdup_printf("ERR invalid position %s", argv[2]);
+
+    gdouble rate = stream->media->rate;
+    if (argc > 3)
+    {
+        rate = g_ascii_strtod(argv[3], &end);
+        if (*end || rate == 0.0)
+            return g_strdup_printf("ERR invalid rate %s", argv[3]);
+    }
+
+    MediaSeekMode mode = MEDIA_SEEK_KEYFRAME;
+    if (argc > 4)
+    {
+        guint i;
+        for (i = 0; i < G_N_ELEMENTS(modes) && strcmp(modes[i], argv[4]) != 0; i++)
+            ;
+        if (i == G_N_ELEMENTS(modes))
+            return g_strdup_printf("ERR invalid seek mode %s", argv[4]);
+        mode = (MediaSeekMode)i;
+    }
+
+    return media_seek_full(stream->media, position * GST_MSECOND, rate, mode) ? CONTROL_OK : CONTROL_FAIL("seek");
+}
+
+gchar *control_cmd_record_start(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    if (!stream->recorder)
+        return g_strdup("ERR no recorder attached");
+
+    const char *filename = argc > 2 ? argv[2] : stream->recorder->filename;
+    if (!filename)
+        return g_strdup("ERR no filename");
+
+    return recorder_start(stream->recorder, filename) ? CONTROL_OK : CONTROL_FAIL("record-start");
+}
+
+// 等待EOS最多要几秒，从连接收到的命令异步停止，文件关闭后再回复
+gchar *control_cmd_record_stop(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    if (!stream->recorder)
+        return g_strdup("ERR no recorder attached");
+
+    if (stream->recorder->state == RECORDER_STATE_STOPPING)
+        return g_strdup("ERR record-stop already in progress");
+
+    if (!self->current || stream->recorder->state != RECORDER_STATE_RECORDING)
+        return recorder_stop(stream->recorder) ? CONTROL_OK : CONTROL_FAIL("record-stop");
+
+    if (!recorder_stop_async(stream->recorder, (RecorderStopCallback)control_on_record_stopped, self->current))
+        return CONTROL_FAIL("record-stop");
+    return NULL;
+}
+
+// 控制接口已经停止时写入会被取消，连接在写完成的回调里释放
+void control_on_record_stopped(GstRecorder *recorder, gboolean success, ControlClient *client)
+{
+    if (!success && client->control)
+        client->control->errors++;
+    control_client_reply(client, success ? CONTROL_OK : CONTROL_FAIL("record-stop"));
+}
+
+// attach STREAM player | recorder FILE | rtsp PATH | hls PATH
+gchar *control_cmd_attach(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    return config_attach_branch(self->config, stream, argv[2], argc > 3 ? argv[3] : NULL)
+               ? CONTROL_OK
+               : CONTROL_FAIL("attach");
+}
+
+gchar *control_cmd_detach(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    return config_detach_branch(self->config, stream, argv[2]) ? CONTROL_OK : CONTROL_FAIL("detach");
+}
+
+// 一行key=value，时间都是毫秒
+gchar *control_cmd_stats(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    static const char *const states[] = {"stopped", "playing", "paused"};
+    GstMedia *media = stream->media;
+
+    GString *response = g_string_new("OK");
+    g_string_append_printf(response, " state=%s position=%" G_GINT64_FORMAT " rate=%.2f",
+                           states[media->state], media_get_position(media) / GST_MSECOND, media->rate);
+
+    MediaTimings timings;
+    media_get_timings(media, &timings);
+    if (timings.request)
+        g_string_append_printf(response, " startup=%.1f first-frame=%.1f",
+                               timings.playing / 1000.0, timings.first_frame / 1000.0);
+    if (media->last_seek_latency)
+        g_string_append_printf(response, " seek-latency=%.1f", media->last_seek_latency / 1000.0);
+
+    g_string_append_printf(response, " player=%d", stream->player != NULL);
+    if (stream->player)
+    {
+        PlayerQosStats qos;
+        player_get_qos_stats(stream->player, &qos);
+        g_string_append_printf(response, " qos-level=%d dropped=%" G_GUINT64_FORMAT,
+                               qos.level, qos.dropped);
+    }
+
+    g_string_append_printf(response, " recording=%d",
+                           stream->recorder && stream->recorder->state == RECORDER_STATE_RECORDING);
+    if (stream->recorder)
+    {
+        WriterStats writer;
+        recorder_get_writer_stats(stream->recorder, &writer);
+        g_string_append_printf(response, " written=%" G_GUINT64_FORMAT " queued=%" G_GUINT64_FORMAT
+                                         " max-write-latency=%.1f stalled=%.1f",
+                               writer.bytes_written, writer.queued_bytes, writer.max_write_latency / 1000.0,
+                               writer.total_stall_time / 1000.0);
+    }
+
+    if (stream->rtsp_path)
+        g_string_append_printf(response, " rtsp=%s", stream->rtsp_path);
+
+    HlsStats hls;
+    if (stream->hls_path && hls_get_stats(self->config->hls, stream->hls_path, &hls))
+        g_string_append_printf(response, " hls=%s hls-segments=%" G_GUINT64_FORMAT " hls-part-latency=%.1f"
+                                         " hls-cache=%" G_GUINT64_FORMAT,
+                               stream->hls_path, hls.segments, hls.part_latency / 1000.0, hls.bytes);
+
+    MediaMemoryUsage memory;
+    media_get_memory_usage(media, NULL, &memory);
+    g_string_append_printf(response, " memory=%" G_GUINT64_FORMAT " memory-peak=%" G_GUINT64_FORMAT,
+                           memory.current, memory.peak);
+
+    return g_string_free(response, FALSE);
+}
+
+// OK video=2 audio=3 selected-video=ID selected-audio=ID
+gchar *control_cmd_tracks(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    GstMedia *media = stream->media;
+    return g_strdup_printf("OK video=%u audio=%u selected-video=%s selected-audio=%s",
+                           media_get_track_count(media, GST_STREAM_TYPE_VIDEO),
+                           media_get_track_count(media, GST_STREAM_TYPE_AUDIO),
+                           media->selected_video ? media->selected_video : "none",
+                           media->selected_audio ? media->selected_audio : "none");
+}
+
+// select STREAM video|audio INDEX | language CODE，INDEX为-1时不解码该类型
+gchar *control_cmd_select(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    if (strcmp(argv[2], "language") == 0)
+        return media_select_audio_language(stream->media, argv[3]) ? CONTROL_OK : CONTROL_FAIL("select");
+
+    gchar *end = NULL;
+    gint64 index = g_ascii_strtoll(argv[3], &end, 10);
+    if (*end || index < -1 || index > G_MAXINT)
+        return g_strdup_printf("ERR invalid track %s", argv[3]);
+
+    if (strcmp(argv[2], "video") == 0)
+        return media_select_video_track(stream->media, (gint)index) ? CONTROL_OK : CONTROL_FAIL("select");
+    if (strcmp(argv[2], "audio") == 0)
+        return media_select_audio_track(stream->media, (gint)index) ? CONTROL_OK : CONTROL_FAIL("select");
+    return g_strdup_printf("ERR invalid track type %s", argv[2]);
+}
+
+// OK total=当前/峰值/预算 分支名=当前/峰值/预算[/limited] ...，单位字节，预算0表示不限制
+gchar *control_cmd_memory(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    MediaMemoryUsage usage;
+    media_get_memory_usage(stream->media, NULL, &usage);
+
+    GString *response = g_string_new("OK");
+    g_string_append_printf(response, " total=%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "%s",
+                           usage.current, usage.peak, usage.budget, usage.limited ? "/limited" : "");
+
+    gchar **branches = media_get_memory_branches(stream->media);
+    for (gchar **name = branches; *name; name++)
+    {
+        if (!media_get_memory_usage(stream->media, *name, &usage))
+            continue;
+        g_string_append_printf(response, " %s=%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "%s",
+                               *name, usage.current, usage.peak, usage.budget, usage.limited ? "/limited" : "");
+    }
+    g_strfreev(branches);
+
+    return g_string_free(response, FALSE);
+}
+
+gchar *control_cmd_log_level(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    LogLevel level;
+    if (argc > 1)
+    {
+        if (!log_parse_level(argv[1], &level))
+            return g_strdup_printf("ERR unknown log level %s", argv[1]);
+        log_set_level(level);
+    }
+
+    LogStats stats;
+    log_get_stats(&stats);
+    return g_strdup_printf("OK level=%s written=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT " threads=%u",
+                           log_level_name(g_atomic_int_get(&log_level)), stats.written, stats.dropped, stats.threads);
+}
+
+// 其他进程跟随网络时钟时需要同样的base time
+gchar *control_cmd_clock(GstControl *self, ConfigStream *stream, gint argc, gchar **argv)
+{
+    GstSync *sync = self->config->sync;
+    if (!sync)
+        return g_strdup("OK shared=0");
+
+    GString *response = g_string_new("OK shared=1");
+    if (GST_CLOCK_TIME_IS_VALID(sync->base_time))
+        g_string_append_printf(response, " base-time=%" G_GUINT64_FORMAT " running-time=%" G_GUINT64_FORMAT,
+                               sync->base_time, sync_get_running_time(sync));
+    g_string_append_printf(response, " streams=%u net-port=%u", g_list_length(sync->media), sync->net_port);
+    return g_string_free(response, FALSE);
+}
+
+// 性能测试：在本进程里启动控制接口和若干客户端线程，客户端每次发一条命令、等到回复再发下一条，
+// 统计往返延迟和总吞吐。流只创建管道不启动，命令在stats和ping之间轮换
+
+#define CONTROL_BENCH_CLIENTS 4
+
+typedef struct ControlBench
+{
+    const char *socket_path;
+    gint streams, commands;
+    gint64 *latency;         // 每条命令的往返时间，微秒
+    gint failed;
+    GMainLoop *loop;
+    gint running;
+} ControlBench;
+
+typedef struct ControlBenchClient
+{
+    ControlBench *bench;
+    gint index;
+} ControlBenchClient;
+
+static int control_bench_compare(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static gboolean control_bench_quit(gpointer data)
+{
+    g_main_loop_quit((GMainLoop *)data);
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer control_bench_client(gpointer data)
+{
+    ControlBenchClient *client = data;
+    ControlBench *bench = client->bench;
+    GError *err = NULL;
+
+    GSocketClient *socket_client = g_socket_client_new();
+    GSocketAddress *address = g_unix_socket_address_new(bench->socket_path);
+    GSocketConnection *connection = g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, &err);
+    g_object_unref(address);
+    g_object_unref(socket_client);
+
+    if (!connection)
+    {
+        g_printerr("Bench client could not connect: %s\n", err->message);
+        g_clear_error(&err);
+        g_atomic_int_inc(&bench->failed);
+    }
+    else
+    {
+        GDataInputStream *input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+        GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+        for (gint i = client->index; i < bench->commands; i += CONTROL_BENCH_CLIENTS)
+        {
+            gchar *line = i % 2 ? g_strdup("ping\n") : g_strdup_printf("stats bench%d\n", (i / 2) % bench->streams);
+            gint64 start = g_get_monotonic_time();
+            gchar *response = NULL;
+            if (g_output_stream_write_all(output, line, strlen(line), NULL, NULL, NULL))
+                response = g_data_input_stream_read_line(input, NULL, NULL, NULL);
+            bench->latency[i] = g_get_monotonic_time() - start;
+
+            if (!response || !g_str_has_prefix(response, "OK"))
+                g_atomic_int_inc(&bench->failed);
+            g_free(response);
+            g_free(line);
+        }
+
+        g_object_unref(input);
+        g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+        g_object_unref(connection);
+    }
+
+    if (g_atomic_int_dec_and_test(&bench->running))
+        g_idle_add(control_bench_quit, bench->loop);
+    return NULL;
+}
+
+void control_bench(gint streams, gint commands)
+{
+    if (streams <= 0 || commands <= 0)
+        return;
+
+    GstConfig config;
+    config_init(&config);
+    for (gint i = 0; i < streams; i++)
+    {
+        ConfigStream *stream = g_new0(ConfigStream, 1);
+        stream->name = g_strdup_printf("bench%d", i);
+        stream->media = g_new0(GstMedia, 1);
+        media_init(stream->media);
+        g_hash_table_insert(config.streams, stream->name, stream);
+    }
+
+    gchar *name = g_strdup_printf("gst-control-bench-%08x.sock", g_random_int());
+    gchar *socket_path = g_build_filename(g_get_tmp_dir(), name, NULL);
+    g_free(name);
+
+    GstControl control;
+    control_init(&control, &config);
+    if (!control_start(&control, socket_path))
+    {
+        g_free(socket_path);
+        config_destroy(&config);
+        return;
+    }
+
+    ControlBench bench = {0};
+    bench.socket_path = socket_path;
+    bench.streams = streams;
+    bench.commands = commands;
+    bench.latency = g_new0(gint64, commands);
+    bench.loop = g_main_loop_new(NULL, FALSE);
+    bench.running = CONTROL_BENCH_CLIENTS;
+
+    ControlBenchClient clients[CONTROL_BENCH_CLIENTS];
+    GThread *threads[CONTROL_BENCH_CLIENTS];
+    gint64 start = g_get_monotonic_time();
+    for (gint i = 0; i < CONTROL_BENCH_CLIENTS; i++)
+    {
+        clients[i].bench = &bench;
+        clients[i].index = i;
+        threads[i] = g_thread_new("control-bench", control_bench_client, &clients[i]);
+    }
+
+    g_main_loop_run(bench.loop);
+    gint64 elapsed = g_get_monotonic_time() - start;
+    for (gint i = 0; i < CONTROL_BENCH_CLIENTS; i++)
+        g_thread_join(threads[i]);
+
+    qsort(bench.latency, commands, sizeof(gint64), control_bench_compare);
+    g_print("control: %d streams, %d commands from %d clients in %.1f ms, %.0f commands/s, "
+            "round trip p50 %" G_GINT64_FORMAT " us p99 %" G_GINT64_FORMAT " us max %" G_GINT64_FORMAT " us, %d failed\n",
+            streams, commands, CONTROL_BENCH_CLIENTS, elapsed / 1000.0, commands * 1e6 / MAX(elapsed, 1),
+            bench.latency[commands / 2], bench.latency[commands * 99 / 100], bench.latency[commands - 1],
+            bench.failed);
+
+    g_free(bench.latency);
+    g_main_loop_unref(bench.loop);
+    control_destroy(&control);
+    config_destroy(&config);
+    g_free(socket_path);
+}
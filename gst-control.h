@@ -0,0 +1,49 @@
+#ifndef __GST_CONTROL_H__
+#define __GST_CONTROL_H__
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+#include "gst-config.h"
+
+// 本地控制接口：Unix域套接字上的行协议，每行一条命令，按顺序每条命令回复一行。
+// 参数按shell规则拆分，文件名可以加引号。回复以OK或ERR开头：
+//
+//   ping                                  -> OK pong
+//   list                                  -> OK cam1 cam2 ...
+//   play|pause|stop STREAM
+//   seek STREAM MS [RATE] [default|keyframe|accurate|segment|instant]
+//   record-start STREAM [FILE]            ; 省略FILE时使用上一次的文件名
+//   record-stop STREAM                    ; 等录像文件写完关闭后才回复，期间不阻塞其他命令
+//   attach STREAM player | recorder FILE | rtsp PATH | hls PATH
+//   detach STREAM player|recorder|rtsp|hls
+//   stats STREAM                          -> OK state=playing position=12000 ...
+//   tracks STREAM                         -> OK video=1 audio=2 selected-video=... selected-audio=...
+//   select STREAM video|audio INDEX | language CODE
+//   memory STREAM                         -> OK total=当前/峰值/预算 recorder_bin=... ，单位字节
+//   log-level [error|warning|info|debug]  -> OK level=info written=... dropped=... ，立即对所有线程生效
+//   clock                                 -> OK shared=1 base-time=NS running-time=NS streams=2 net-port=8555
+//
+// 命令在创建控制接口的线程的主循环中执行，和管道的总线消息处理在同一个上下文，不需要加锁。
+
+typedef struct GstControl
+{
+    GstConfig *config;
+    GSocketService *service;
+    gchar *socket_path;
+    GList *clients;          // ControlClient
+    struct ControlClient *current;  // 正在执行的命令来自的连接，直接调用control_execute时为NULL
+
+    guint64 commands;        // 已执行的命令数
+    guint64 errors;
+
+} GstControl;
+
+gboolean control_init(GstControl *self, GstConfig *config);
+void control_destroy(GstControl *self);
+gboolean control_start(GstControl *self, const char *socket_path);
+void control_stop(GstControl *self);
+// 返回NULL表示命令在完成后再通过连接回复，只有从连接收到的命令会这样
+gchar *control_execute(GstControl *self, const char *line);
+void control_bench(gint streams, gint commands);
+
+#endif
@@ -0,0 +1,800 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#elif !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "gst-export.h"
+#include <gst/app/gstappsink.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef G_OS_UNIX
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#define EXPORT_PAGE 4096
+#define EXPORT_ROUND_UP(x) (((x) + EXPORT_PAGE - 1) & ~((gsize)EXPORT_PAGE - 1))
+#define EXPORT_MESSAGE_SIZE 4096
+
+G_STATIC_ASSERT(sizeof(ExportSlot) == 32);
+
+#ifdef G_OS_UNIX
+
+typedef struct ExportClient
+{
+    GSocketConnection *connection;
+    int fd;
+} ExportClient;
+
+GstFlowReturn export_on_new_sample(GstAppSink *sink, GstShmExport *self);
+gboolean export_on_incoming(GSocketService *service, GSocketConnection *connection,
+                            GObject *source_object, GstShmExport *self);
+gboolean export_ring_create(GstShmExport *self, ExportRing *ring, gsize size);
+void export_ring_destroy(ExportRing *ring);
+void export_ring_write(GstShmExport *self, ExportRing *ring, GstBuffer *buffer);
+gboolean export_announce(GstShmExport *self, ExportClient *client, ExportRing *ring);
+void export_broadcast(GstShmExport *self, const char *line, int fd, gboolean droppable);
+gint export_send(int socket, const char *line, int fd);
+void export_client_free(ExportClient *client);
+
+gboolean export_init(GstShmExport *self, const char *socket_path, const char *video_format, guint slot_count)
+{
+    if (!self || !socket_path)
+    {
+        g_printerr("Invalid arguments to export_init\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstShmExport));
+    g_mutex_init(&self->lock);
+    self->slot_count = slot_count ? slot_count : EXPORT_DEFAULT_SLOTS;
+    self->video.kind = 'v';
+    self->video.fd = -1;
+    self->audio.kind = 'a';
+    self->audio.fd = -1;
+
+    self->bin = GST_BIN(gst_bin_new("export_bin"));
+    self->v_queue = gst_element_factory_make("queue", "export_v_queue");
+    self->v_convert = gst_element_factory_make("videoconvert", "export_v_convert");
+    self->v_filter = gst_element_factory_make("capsfilter", "export_v_filter");
+    self->v_sink = gst_element_factory_make("appsink", "export_v_sink");
+    self->a_queue = gst_element_factory_make("queue", "export_a_queue");
+    self->a_sink = gst_element_factory_make("appsink", "export_a_sink");
+
+    if (!self->bin || !self->v_queue || !self->v_convert || !self->v_filter || !self->v_sink ||
+        !self->a_queue || !self->a_sink)
+    {
+        g_printerr("Could not create export elements.\n");
+        export_destroy(self);
+        return FALSE;
+    }
+
+    gst_bin_add_many(GST_BIN(self->bin),
+                     self->v_queue, self->v_convert, self->v_filter, self->v_sink,
+                     self->a_queue, self->a_sink,
+                     NULL);
+
+    if (!gst_element_link_many(self->v_queue, self->v_convert, self->v_filter, self->v_sink, NULL) ||
+        !gst_element_link_many(self->a_queue, self->a_sink, NULL))
+    {
+        g_printerr("Elements could not be linked.\n");
+        export_destroy(self);
+        return FALSE;
+    }
+
+    // 写共享内存从不等待读者，这里再保证写入本身慢时也不会反压tee
+    g_object_set(self->v_queue, "leaky", 2, "max-size-buffers", 2, "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+    g_object_set(self->a_queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                 "max-size-time", (guint64)(200 * GST_MSECOND), NULL);
+
+    // 统一转换成读者约定的格式，读者按caps和默认行跨度解释帧数据
+    if (video_format)
+    {
+        GstCaps *caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, video_format, NULL);
+        g_object_set(self->v_filter, "caps", caps, NULL);
+        gst_caps_unref(caps);
+    }
+
+    GstAppSinkCallbacks callbacks = {0};
+    callbacks.new_sample = (GstFlowReturn(*)(GstAppSink *, gpointer))export_on_new_sample;
+    g_object_set(self->v_sink, "async", FALSE, "max-buffers", 1, "drop", TRUE, NULL);
+    g_object_set(self->a_sink, "async", FALSE, "max-buffers", 8, "drop", TRUE, NULL);
+    gst_app_sink_set_callbacks(GST_APP_SINK(self->v_sink), &callbacks, self, NULL);
+    gst_app_sink_set_callbacks(GST_APP_SINK(self->a_sink), &callbacks, self, NULL);
+
+    GstPad *v_pad = gst_element_get_static_pad(self->v_queue, "sink");
+    GstPad *a_pad = gst_element_get_static_pad(self->a_queue, "sink");
+    GstPad *v_ghost_pad = gst_ghost_pad_new("v_sink", v_pad);  // 统一使用v_sink和a_sink
+    GstPad *a_ghost_pad = gst_ghost_pad_new("a_sink", a_pad);
+    gst_element_add_pad(GST_ELEMENT(self->bin), v_ghost_pad);
+    gst_element_add_pad(GST_ELEMENT(self->bin), a_ghost_pad);
+    gst_pad_set_active(v_ghost_pad, TRUE);
+    gst_pad_set_active(a_ghost_pad, TRUE);
+    gst_object_unref(v_pad);
+    gst_object_unref(a_pad);
+
+    // 控制套接字
+    GError *err = NULL;
+    g_unlink(socket_path);
+    GSocketAddress *address = g_unix_socket_address_new(socket_path);
+    self->service = g_socket_service_new();
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(self->service), address,
+                                       G_SOCKET_TYPE_SEQPACKET, G_SOCKET_PROTOCOL_DEFAULT,
+                                       NULL, NULL, &err))
+    {
+        g_printerr("Could not listen on %s: %s\n", socket_path, err->message);
+        g_clear_error(&err);
+        g_object_unref(address);
+        export_destroy(self);
+        return FALSE;
+    }
+    g_object_unref(address);
+
+    self->socket_path = g_strdup(socket_path);
+    g_signal_connect(self->service, "incoming", G_CALLBACK(export_on_incoming), self);
+    g_socket_service_start(self->service);
+
+    g_print("Exporting frames on %s\n", socket_path);
+    return TRUE;
+}
+
+void export_destroy(GstShmExport *self)
+{
+    if (!self)
+        return;
+
+    if (self->media)
+        export_unlink(self);
+
+    if (self->service)
+    {
+        g_socket_service_stop(self->service);
+        g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+        g_clear_object(&self->service);
+    }
+
+    if (self->socket_path)
+    {
+        g_unlink(self->socket_path);
+        g_free(self->socket_path);
+        self->socket_path = NULL;
+    }
+
+    if (self->bin)
+    {
+        gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
+        gst_object_unref(GST_ELEMENT(self->bin));
+        self->bin = NULL;
+    }
+
+    g_list_free_full(self->clients, (GDestroyNotify)export_client_free);
+    self->clients = NULL;
+    export_ring_destroy(&self->video);
+    export_ring_destroy(&self->audio);
+
+    g_mutex_clear(&self->lock);
+}
+
+gboolean export_link(GstShmExport *self, GstMedia *media)
+{
+    if (!self || !self->bin || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to export_link\n");
+        return FALSE;
+    }
+
+    if (!media_add_video_branch(media, GST_ELEMENT(self->bin)) ||
+        !media_add_audio_branch(media, GST_ELEMENT(self->bin)))
+    {
+        g_printerr("Failed to link export branch to media\n");
+        self->media = media;
+        export_unlink(self);
+        return FALSE;
+    }
+
+    self->media = media;
+    return TRUE;
+}
+
+gboolean export_unlink(GstShmExport *self)
+{
+    if (!self || !self->media)
+    {
+        g_printerr("Export not linked to media\n");
+        return FALSE;
+    }
+
+    media_remove_video_branch(self->media, GST_ELEMENT(self->bin));
+    media_remove_audio_branch(self->media, GST_ELEMENT(self->bin));
+
+    // 断开在tee的空闲探针里完成，之后才能停止：还连着时设为NULL会让tee收到FLUSHING而停止整个媒体。
+    // 超时仍然停止，appsink的回调会访问self，bin不能在export_destroy之后继续运行
+    media_wait_branch_unlinked(self->media, GST_ELEMENT(self->bin));
+
+    // 管道持有bin唯一的引用，移除前先加一个，bin仍由export_destroy释放
+    if (GST_OBJECT_PARENT(self->bin))
+    {
+        gst_object_ref(self->bin);
+        gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(self->media->pipeline), GST_ELEMENT(self->bin));
+    }
+
+    self->media = NULL;
+    return TRUE;
+}
+
+// 新的读者：先发送当前的格式和共享内存环，之后才开始收到frame通知
+gboolean export_on_incoming(GSocketService *service, GSocketConnection *connection,
+                            GObject *source_object, GstShmExport *self)
+{
+    GSocket *socket = g_socket_connection_get_socket(connection);
+
+    ExportClient *client = g_new0(ExportClient, 1);
+    client->connection = g_object_ref(connection);
+    client->fd = g_socket_get_fd(socket);
+
+    g_mutex_lock(&self->lock);
+    if (export_announce(self, client, &self->video) && export_announce(self, client, &self->audio))
+    {
+        self->clients = g_list_prepend(self->clients, client);
+        client = NULL;
+    }
+    g_mutex_unlock(&self->lock);
+
+    if (client)
+    {
+        g_printerr("Could not send ring to export client\n");
+        export_client_free(client);
+    }
+    return TRUE;
+}
+
+gboolean export_announce(GstShmExport *self, ExportClient *client, ExportRing *ring)
+{
+    gchar line[EXPORT_MESSAGE_SIZE];
+
+    if (ring->caps)
+    {
+        gchar *caps = gst_caps_to_string(ring->caps);
+        g_snprintf(line, sizeof(line), "caps %c %s", ring->kind, caps);
+        g_free(caps);
+        if (export_send(client->fd, line, -1) <= 0)
+            return FALSE;
+    }
+
+    if (ring->header)
+    {
+        g_snprintf(line, sizeof(line), "ring %c %u %u", ring->kind, ring->header->slot_count, ring->header->slot_size);
+        if (export_send(client->fd, line, ring->fd) <= 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+// 流线程：把一帧写进共享内存环并通知所有读者
+GstFlowReturn export_on_new_sample(GstAppSink *sink, GstShmExport *self)
+{
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample)
+        return GST_FLOW_OK;
+
+    ExportRing *ring = GST_ELEMENT(sink) == self->v_sink ? &self->video : &self->audio;
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    gchar line[EXPORT_MESSAGE_SIZE];
+
+    g_mutex_lock(&self->lock);
+
+    if (caps && (!ring->caps || !gst_caps_is_equal(caps, ring->caps)))
+    {
+        gst_caps_replace(&ring->caps, caps);
+        gchar *str = gst_caps_to_string(caps);
+        g_snprintf(line, sizeof(line), "caps %c %s", ring->kind, str);
+        g_free(str);
+        export_broadcast(self, line, -1, FALSE);
+    }
+
+    if (buffer)
+    {
+        gsize size = gst_buffer_get_size(buffer);
+        // 放不下时换一个更大的环；音频buffer大小会变化，留出余量
+        if (!ring->header || size > ring->header->slot_size)
+        {
+            gsize slot_size = ring->kind == 'a' ? MAX(size * 2, ring->header ? ring->header->slot_size * 2 : 0) : size;
+            if (export_ring_create(self, ring, slot_size))
+            {
+                g_snprintf(line, sizeof(line), "ring %c %u %u", ring->kind, ring->header->slot_count, ring->header->slot_size);
+                export_broadcast(self, line, ring->fd, FALSE);
+            }
+        }
+
+        if (ring->header && size <= ring->header->slot_size)
+            export_ring_write(self, ring, buffer);
+    }
+
+    g_mutex_unlock(&self->lock);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void export_ring_write(GstShmExport *self, ExportRing *ring, GstBuffer *buffer)
+{
+    ExportRingHeader *header = ring->header;
+
+    // 序号从1开始，0表示slot正在写入
+    if (++ring->seq == 0 || ring->seq > G_MAXINT)
+        ring->seq = 1;
+    guint32 index = ring->seq % header->slot_count;
+    ExportSlot *slot = &header->slots[index];
+
+    g_atomic_int_set(&slot->seq, 0);
+    gsize size = gst_buffer_extract(buffer, 0, ring->map + header->data_offset + (gsize)index * header->slot_size,
+                                    header->slot_size);
+    slot->size = size;
+    slot->flags = GST_BUFFER_FLAGS(buffer);
+    slot->pts = GST_BUFFER_PTS(buffer);
+    slot->duration = GST_BUFFER_DURATION(buffer);
+    g_atomic_int_set(&slot->seq, ring->seq);
+    g_atomic_int_set(&header->write_seq, ring->seq);
+
+    ring->frames++;
+    ring->bytes += size;
+
+    gchar line[128];
+    g_snprintf(line, sizeof(line), "frame %c %u %u %" G_GINT64_FORMAT " %u", ring->kind, ring->seq, index,
+               GST_BUFFER_PTS_IS_VALID(buffer) ? (gint64)GST_BUFFER_PTS(buffer) : (gint64)-1, (guint)size);
+    export_broadcast(self, line, -1, TRUE);
+}
+
+// 创建新的共享内存环。旧的映射立即释放，读者自己的映射不受影响，收到ring消息后切换
+gboolean export_ring_create(GstShmExport *self, ExportRing *ring, gsize slot_size)
+{
+    slot_size = EXPORT_ROUND_UP(slot_size);
+    gsize data_offset = EXPORT_ROUND_UP(sizeof(ExportRingHeader) + self->slot_count * sizeof(ExportSlot));
+    gsize map_size = data_offset + self->slot_count * slot_size;
+
+    int fd = -1;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd = memfd_create("gst-export", MFD_CLOEXEC);
+#else
+    gchar *name = g_strdup_printf("/gst-export-%08x", g_random_int());
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        shm_unlink(name);
+    g_free(name);
+#endif
+    if (fd < 0 || ftruncate(fd, map_size) != 0)
+    {
+        g_printerr("Could not create shared memory: %s\n", g_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return FALSE;
+    }
+
+    guint8 *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        g_printerr("Could not map shared memory: %s\n", g_strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    export_ring_destroy(ring);
+    ring->fd = fd;
+    ring->map = map;
+    ring->map_size = map_size;
+    ring->header = (ExportRingHeader *)map;
+    ring->header->magic = EXPORT_RING_MAGIC;
+    ring->header->version = EXPORT_RING_VERSION;
+    ring->header->slot_count = self->slot_count;
+    ring->header->slot_size = slot_size;
+    ring->header->data_offset = data_offset;
+
+    g_print("Export %s ring: %u slots of %" G_GSIZE_FORMAT " bytes\n",
+            ring->kind == 'v' ? "video" : "audio", self->slot_count, slot_size);
+    return TRUE;
+}
+
+void export_ring_destroy(ExportRing *ring)
+{
+    if (ring->map)
+    {
+        munmap(ring->map, ring->map_size);
+        ring->map = NULL;
+        ring->header = NULL;
+    }
+
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+// 发送给所有读者，droppable的消息在读者来不及读时丢弃，其他消息发不出去时断开该读者
+void export_broadcast(GstShmExport *self, const char *line, int fd, gboolean droppable)
+{
+    GList *l = self->clients;
+    while (l)
+    {
+        GList *next = l->next;
+        ExportClient *client = l->data;
+        gint ret = export_send(client->fd, line, fd);
+        if (ret == 0 && droppable)
+        {
+            self->notify_dropped++;
+        }
+        else if (ret <= 0)
+        {
+            self->clients = g_list_delete_link(self->clients, l);
+            export_client_free(client);
+            self->disconnects++;
+        }
+        l = next;
+    }
+}
+
+// 返回1表示已发送，0表示套接字缓冲区已满，-1表示连接已断开
+gint export_send(int socket, const char *line, int fd)
+{
+    struct iovec iov = {(void *)line, strlen(line)};
+    struct msghdr msg = {0};
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+    if (sendmsg(socket, &msg, flags) >= 0)
+        return 1;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+}
+
+void export_client_free(ExportClient *client)
+{
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->connection);
+    g_free(client);
+}
+
+// 读者一侧的一个共享内存环
+typedef struct ExportView
+{
+    guint8 *map;
+    gsize map_size;
+    ExportRingHeader *header;
+    guint32 last_seq;
+} ExportView;
+
+static void export_view_map(ExportView *view, int fd)
+{
+    struct stat st;
+    if (view->map)
+        munmap(view->map, view->map_size);
+    view->map = NULL;
+    view->header = NULL;
+
+    if (fstat(fd, &st) == 0)
+    {
+        guint8 *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED && ((ExportRingHeader *)map)->magic == EXPORT_RING_MAGIC)
+        {
+            view->map = map;
+            view->map_size = st.st_size;
+            view->header = (ExportRingHeader *)map;
+        }
+        else if (map != MAP_FAILED)
+        {
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+// 读取一帧：直接在共享内存上计算校验，处理完再确认没有被覆盖
+static void export_view_frame(ExportView *view, guint32 seq, guint32 index, guint32 size, ExportConsumerStats *stats)
+{
+    if (!view->header || index >= view->header->slot_count)
+        return;
+
+    if (view->last_seq && seq > view->last_seq + 1)
+        stats->missed += seq - view->last_seq - 1;
+    view->last_seq = seq;
+
+    ExportSlot *slot = &view->header->slots[index];
+    if ((guint32)g_atomic_int_get(&slot->seq) != seq)
+    {
+        stats->overwritten++;
+        return;
+    }
+
+    const guint8 *data = view->map + view->header->data_offset + (gsize)index * view->header->slot_size;
+    guint64 checksum = 0;
+    for (guint32 i = 0; i < size; i += 64)
+        checksum += data[i];
+
+    if ((guint32)g_atomic_int_get(&slot->seq) != seq)
+    {
+        stats->overwritten++;
+        return;
+    }
+
+    stats->frames++;
+    stats->bytes += size;
+    stats->checksum += checksum;
+}
+
+gboolean export_consume(const char *socket_path, gdouble seconds, ExportConsumerStats *stats)
+{
+    if (!socket_path || !stats)
+        return FALSE;
+
+    memset(stats, 0, sizeof(ExportConsumerStats));
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        g_printerr("Could not connect to %s: %s\n", socket_path, g_strerror(errno));
+        if (sock >= 0)
+            close(sock);
+        return FALSE;
+    }
+
+    ExportView video = {0}, audio = {0};
+    gint64 deadline = g_get_monotonic_time() + (gint64)(seconds * G_TIME_SPAN_SECOND);
+    gchar line[EXPORT_MESSAGE_SIZE];
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    for (;;)
+    {
+        gint64 remaining = deadline - g_get_monotonic_time();
+        if (remaining <= 0)
+            break;
+
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, (int)(remaining / 1000) + 1) <= 0)
+            continue;
+
+        struct iovec iov = {line, sizeof(line) - 1};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        ssize_t len = recvmsg(sock, &msg, 0);
+        if (len <= 0)
+            break;
+        line[len] = '\0';
+
+        int fd = -1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+        char kind = 0;
+        guint32 seq, index, size;
+        gint64 pts;
+        if (sscanf(line, "frame %c %u %u %" G_GINT64_FORMAT " %u", &kind, &seq, &index, &pts, &size) == 5)
+        {
+            export_view_frame(kind == 'v' ? &video : &audio, seq, index, size, stats);
+        }
+        else if (g_str_has_prefix(line, "ring ") && fd >= 0)
+        {
+            export_view_map(line[5] == 'v' ? &video : &audio, fd);
+            fd = -1;
+        }
+
+        if (fd >= 0)
+            close(fd);
+    }
+
+    close(sock);
+    if (video.map)
+        munmap(video.map, video.map_size);
+    if (audio.map)
+        munmap(audio.map, audio.map_size);
+    return TRUE;
+}
+
+// 性能测试：N个读者共享一路解码，对比每个读者各自解码(N条独立管道)。两种方式都按时钟实时播放，
+// 比较相同时长内的进程CPU时间和读者拿到的帧数
+
+typedef struct ExportBenchConsumer
+{
+    const char *socket_path;
+    gdouble seconds;
+    ExportConsumerStats stats;
+} ExportBenchConsumer;
+
+static gpointer export_bench_consumer(gpointer data)
+{
+    ExportBenchConsumer *consumer = data;
+    export_consume(consumer->socket_path, consumer->seconds, &consumer->stats);
+    return NULL;
+}
+
+static GstPadProbeReturn export_bench_count(GstPad *pad, GstPadProbeInfo *info, gpointer data)
+{
+    g_atomic_int_inc((gint *)data);
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean export_bench_quit(gpointer data)
+{
+    g_main_loop_quit((GMainLoop *)data);
+    return G_SOURCE_REMOVE;
+}
+
+void export_bench(const char *uri, gint consumers, gint seconds)
+{
+    if (!uri || consumers <= 0 || seconds <= 0)
+        return;
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+    // 基线：每个读者一条独立的解码管道
+    GstElement **pipelines = g_new0(GstElement *, consumers);
+    gint frames = 0;
+    for (gint i = 0; i < consumers; i++)
+    {
+        gchar *desc = g_strdup_printf("uridecodebin uri=\"%s\" caps=video/x-raw expose-all-streams=false ! "
+                                      "videoconvert ! video/x-raw,format=I420 ! fakesink name=sink sync=true",
+                                      uri);
+        pipelines[i] = gst_parse_launch(desc, NULL);
+        g_free(desc);
+        if (!pipelines[i])
+            continue;
+
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(pipelines[i]), "sink");
+        GstPad *pad = gst_element_get_static_pad(sink, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, export_bench_count, &frames, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(sink);
+        gst_element_set_state(pipelines[i], GST_STATE_PLAYING);
+    }
+
+    clock_t cpu = clock();
+    g_timeout_add_seconds(seconds, export_bench_quit, loop);
+    g_main_loop_run(loop);
+    gdouble baseline_cpu = (gdouble)(clock() - cpu) / CLOCKS_PER_SEC;
+    gint baseline_frames = g_atomic_int_get(&frames);
+
+    for (gint i = 0; i < consumers; i++)
+    {
+        if (!pipelines[i])
+            continue;
+        gst_element_set_state(pipelines[i], GST_STATE_NULL);
+        gst_object_unref(pipelines[i]);
+    }
+    g_free(pipelines);
+
+    // 共享内存：一路解码，读者通过控制套接字和共享内存读取
+    gchar *name = g_strdup_printf("gst-export-bench-%08x.sock", g_random_int());
+    gchar *socket_path = g_build_filename(g_get_tmp_dir(), name, NULL);
+    g_free(name);
+
+    GstMedia media;
+    GstShmExport shm_export;
+    if (!media_init(&media) || !media_set_uri(&media, uri) ||
+        !export_init(&shm_export, socket_path, "I420", EXPORT_DEFAULT_SLOTS))
+    {
+        g_printerr("Could not set up export benchmark\n");
+        media_destroy(&media);
+        g_free(socket_path);
+        g_main_loop_unref(loop);
+        return;
+    }
+    export_link(&shm_export, &media);
+    media_play(&media);
+
+    ExportBenchConsumer *readers = g_new0(ExportBenchConsumer, consumers);
+    GThread **threads = g_new0(GThread *, consumers);
+    cpu = clock();
+    for (gint i = 0; i < consumers; i++)
+    {
+        readers[i].socket_path = socket_path;
+        readers[i].seconds = seconds;
+        threads[i] = g_thread_new("export-bench", export_bench_consumer, &readers[i]);
+    }
+
+    g_timeout_add_seconds(seconds, export_bench_quit, loop);
+    g_main_loop_run(loop);
+    for (gint i = 0; i < consumers; i++)
+        g_thread_join(threads[i]);
+    gdouble export_cpu = (gdouble)(clock() - cpu) / CLOCKS_PER_SEC;
+
+    ExportConsumerStats total = {0};
+    for (gint i = 0; i < consumers; i++)
+    {
+        total.frames += readers[i].stats.frames;
+        total.bytes += readers[i].stats.bytes;
+        total.missed += readers[i].stats.missed;
+        total.overwritten += readers[i].stats.overwritten;
+    }
+
+    g_print("export: %d consumers for %d s\n", consumers, seconds);
+    g_print("  decode per consumer: %d frames, cpu %.2f s (%.0f%% of one core)\n",
+            baseline_frames, baseline_cpu, baseline_cpu * 100 / seconds);
+    g_print("  shared memory:       %" G_GUINT64_FORMAT " frames (%.1f MB/s), %" G_GUINT64_FORMAT " missed, %"
+            G_GUINT64_FORMAT " overwritten, %" G_GUINT64_FORMAT " notifications dropped, cpu %.2f s (%.0f%% of one core)\n",
+            total.frames, total.bytes / 1e6 / seconds, total.missed, total.overwritten,
+            shm_export.notify_dropped, export_cpu, export_cpu * 100 / seconds);
+
+    g_free(threads);
+    g_free(readers);
+    media_stop(&media);
+    export_destroy(&shm_export);
+    media_destroy(&media);
+    g_free(socket_path);
+    g_main_loop_unref(loop);
+}
+
+#else
+
+gboolean export_init(GstShmExport *self, const char *socket_path, const char *video_format, guint slot_count)
+{
+    g_printerr("Shared memory export is not supported on this platform\n");
+    return FALSE;
+}
+
+void export_destroy(GstShmExport *self)
+{
+}
+
+gboolean export_link(GstShmExport *self, GstMedia *media)
+{
+    return FALSE;
+}
+
+gboolean export_unlink(GstShmExport *self)
+{
+    return FALSE;
+}
+
+gboolean export_consume(const char *socket_path, gdouble seconds, ExportConsumerStats *stats)
+{
+    g_printerr("Shared memory export is not supported on this platform\n");
+    return FALSE;
+}
+
+void export_bench(const char *uri, gint consumers, gint seconds)
+{
+    g_printerr("Shared memory export is not supported on this platform\n");
+}
+
+#endif
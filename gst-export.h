@@ -0,0 +1,99 @@
+#ifndef __GST_EXPORT_H__
+#define __GST_EXPORT_H__
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+#include "gst-media.h"
+
+// 共享内存导出分支：解码后的音视频帧写入共享内存环(memfd)，分析进程映射后直接读取，
+// 不需要各自重新打开摄像头和解码。仅支持Unix。
+//
+// 控制套接字是Unix SOCK_SEQPACKET，服务端发出的每条消息是一行文本，kind为v或a：
+//   caps KIND <caps字符串>                    格式变化，之后的帧按该格式解释（视频为默认的行跨度）
+//   ring KIND <slot数> <slot大小>              新的共享内存环，消息通过SCM_RIGHTS附带memfd
+//   frame KIND <seq> <slot> <pts> <size>      一帧写完，pts为纳秒，-1表示无效
+//
+// 共享内存开头是ExportRingHeader和slot_count个ExportSlot，slot i的数据在data_offset + i * slot_size。
+// 写入方从不等待读者：写一个slot之前把它的seq清零，写完再设置为帧序号。读者处理完一帧后再读一次seq，
+// 变化了说明处理期间已经被覆盖，结果要丢弃。读者来不及读控制套接字时frame通知被丢弃，
+// 可以从seq的间隔得知丢了多少帧；caps和ring消息发不出去时断开该读者。
+
+#define EXPORT_RING_MAGIC 0x4d485347  // "GSHM"
+#define EXPORT_RING_VERSION 1
+#define EXPORT_DEFAULT_SLOTS 8
+
+typedef struct ExportSlot
+{
+    volatile gint seq;       // 0表示正在写入
+    guint32 size;
+    guint32 flags;           // GstBufferFlags
+    guint32 reserved;
+    guint64 pts, duration;   // 纳秒，G_MAXUINT64表示无效
+} ExportSlot;
+
+typedef struct ExportRingHeader
+{
+    guint32 magic;
+    guint32 version;
+    guint32 slot_count;
+    guint32 slot_size;
+    guint32 data_offset;
+    volatile gint write_seq; // 最近写完的帧序号
+    guint32 reserved[2];
+    ExportSlot slots[];
+} ExportRingHeader;
+
+typedef struct ExportRing
+{
+    char kind;               // 'v' 或 'a'
+    GstCaps *caps;
+    int fd;                  // memfd，新的读者连接时发给它
+    guint8 *map;
+    gsize map_size;
+    ExportRingHeader *header;
+    guint32 seq;
+
+    guint64 frames;
+    guint64 bytes;
+} ExportRing;
+
+typedef struct GstShmExport
+{
+    GstBin *bin;
+    GstElement *v_queue, *v_convert, *v_filter, *v_sink;
+    GstElement *a_queue, *a_sink;
+    GstMedia *media;
+
+    guint slot_count;
+    gchar *socket_path;
+    GSocketService *service;
+
+    // 流线程写入、主循环接受连接，都在lock下访问读者列表和共享内存环
+    GMutex lock;
+    GList *clients;          // ExportClient
+    ExportRing video, audio;
+
+    guint64 notify_dropped;  // 读者来不及读而丢弃的frame通知
+    guint64 disconnects;
+
+} GstShmExport;
+
+// 读者统计
+typedef struct ExportConsumerStats
+{
+    guint64 frames, bytes;
+    guint64 missed;          // 没有收到通知的帧（seq间隔）
+    guint64 overwritten;     // 收到通知时已经被覆盖，或者处理期间被覆盖
+    guint64 checksum;        // 读取数据时计算的校验，保证数据确实被访问过
+} ExportConsumerStats;
+
+gboolean export_init(GstShmExport *self, const char *socket_path, const char *video_format, guint slot_count);
+void export_destroy(GstShmExport *self);
+gboolean export_link(GstShmExport *self, GstMedia *media);
+gboolean export_unlink(GstShmExport *self);
+
+// 参考读者：连接到socket_path，读取seconds秒
+gboolean export_consume(const char *socket_path, gdouble seconds, ExportConsumerStats *stats);
+void export_bench(const char *uri, gint consumers, gint seconds);
+
+#endif
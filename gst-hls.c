@@ -0,0 +1,1254 @@
+#include "gst-hls.h"
+#include "gst-log.h"
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <string.h>
+#include <time.h>
+
+// 播放列表里列出部分片段的片段数（包括正在生成的），更早的片段只列完整片段
+#define HLS_PART_SEGMENTS 3
+
+typedef struct HlsPart
+{
+    GBytes *data;
+    GstClockTime duration;
+    gboolean independent;    // 以关键帧开始，可以从这里开始播放
+} HlsPart;
+
+typedef struct HlsSegment
+{
+    guint64 sequence;
+    GPtrArray *parts;        // HlsPart，完整片段就是所有部分片段依次拼接
+    GstClockTime duration;
+    gboolean complete;
+    gsize size;
+} HlsSegment;
+
+// 一个HTTP连接：读请求行和请求头、回复，支持keep-alive。等待部分片段生成时挂在挂载点的waiters上
+typedef struct HlsClient
+{
+    GstHlsServer *server;    // 服务器停止后为NULL，等待中的异步操作结束时释放连接
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GOutputStream *output;
+    GCancellable *cancellable;
+
+    gchar *target;           // 请求行里的路径，包括查询参数
+    gboolean keep_alive;
+    GQueue output_queue;     // 待写出的GBytes，回复头和各个部分片段
+    GBytes *current;         // 正在写出的数据
+
+    HlsStream *stream;       // 正在等待的挂载点
+    guint timeout_id;
+    gint64 blocked_since;
+} HlsClient;
+
+GstFlowReturn hls_on_new_sample(GstAppSink *sink, HlsStream *stream);
+GstPadProbeReturn hls_on_sink_event(GstPad *pad, GstPadProbeInfo *info, HlsStream *stream);
+void hls_stream_push(HlsStream *stream, GstBuffer *buffer, GstClockTime capture);
+void hls_stream_finish_part(HlsStream *stream, GstClockTime end);
+void hls_stream_finish_segment(HlsStream *stream, GstClockTime end);
+void hls_stream_evict(HlsStream *stream);
+HlsSegment *hls_stream_segment(HlsStream *stream, guint64 msn);
+gboolean hls_stream_ready(HlsStream *stream, guint64 msn, gint64 part);
+GBytes *hls_stream_playlist(HlsStream *stream);
+gboolean hls_on_wake(HlsStream *stream);
+void hls_stream_free(HlsStream *stream);
+guint64 hls_stream_memory(HlsStream *stream);
+void hls_segment_free(HlsSegment *segment);
+void hls_part_free(HlsPart *part);
+gboolean hls_on_incoming(GSocketService *service, GSocketConnection *connection,
+                         GObject *source_object, GstHlsServer *self);
+void hls_client_read(HlsClient *client);
+void hls_on_line(GObject *source, GAsyncResult *result, HlsClient *client);
+void hls_client_dispatch(HlsClient *client);
+void hls_client_respond(HlsClient *client, const char *status, const char *type, const char *cache, GList *bodies);
+gboolean hls_on_wait_timeout(HlsClient *client);
+void hls_client_write_next(HlsClient *client);
+void hls_on_written(GObject *source, GAsyncResult *result, HlsClient *client);
+void hls_client_free(HlsClient *client);
+
+// 有的发行版只带其中一部分AAC编码器
+static GstElement *hls_make_aac_encoder(void)
+{
+    static const char *const names[] = {"fdkaacenc", "avenc_aac", "voaacenc"};
+    for (guint i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+        GstElement *encoder = gst_element_factory_make(names[i], "hls_a_encoder");
+        if (encoder)
+            return encoder;
+    }
+    return NULL;
+}
+
+// 创建HLS流的bin，用于连接到media的tee：编码、复用成TS，appsink取出后切分。
+// 每个HLS挂载点有自己的x264enc，不和同一路媒体上的RTSP挂载点共用：HLS按片段时长向编码器请求关键帧，
+// 共用时这些请求会打乱RTSP的GOP；两个模块也各自独立增删，没有可以共享的已编码tee。
+// 代价是同一路媒体同时开HLS和RTSP时编码两次，每路多一个ultrafast编码器的CPU，
+// hls_bench输出的cpu一项包含这部分
+gboolean create_hls_stream_bin(HlsStream *stream)
+{
+    gchar *name = g_strdup_printf("hls%s", stream->path);
+    g_strdelimit(name, "/", '_');
+    stream->bin = gst_bin_new(name);
+    g_free(name);
+
+    stream->v_queue = gst_element_factory_make("queue", "hls_v_queue");
+    stream->v_convert = gst_element_factory_make("videoconvert", "hls_v_convert");
+    stream->v_encoder = gst_element_factory_make("x264enc", "hls_v_encoder");
+    stream->v_parse = gst_element_factory_make("h264parse", "hls_v_parse");
+    stream->mux = gst_element_factory_make("mpegtsmux", "hls_mux");
+    stream->sink = gst_element_factory_make("appsink", "hls_sink");
+
+    if (!stream->bin || !stream->v_queue || !stream->v_convert || !stream->v_encoder ||
+        !stream->v_parse || !stream->mux || !stream->sink)
+    {
+        g_printerr("Could not create HLS stream basic elements\n");
+        return FALSE;
+    }
+
+    gst_bin_add_many(GST_BIN(stream->bin),
+                     stream->v_queue, stream->v_convert, stream->v_encoder, stream->v_parse,
+                     stream->mux, stream->sink, NULL);
+
+    if (!gst_element_link_many(stream->v_queue, stream->v_convert, stream->v_encoder,
+                               stream->v_parse, stream->mux, stream->sink, NULL))
+    {
+        g_printerr("HLS video elements could not be linked.\n");
+        return FALSE;
+    }
+
+    // 编码跟不上时丢旧帧，不能反压tee影响播放和录像。关键帧由切分逻辑按片段时长请求，
+    // key-int-max只是上限
+    g_object_set(stream->v_queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                 "max-size-time", (guint64)GST_SECOND, NULL);
+    g_object_set(stream->v_encoder, "speed-preset", 1, "tune", 0x00000004, "bitrate", 2048,
+                 "key-int-max", 250, NULL);
+    g_object_set(stream->v_parse, "config-interval", -1, NULL);
+    // 每个buffer是7个TS包，部分片段按buffer切分
+    g_object_set(stream->mux, "alignment", 7, NULL);
+
+    GstPad *v_pad = gst_element_get_static_pad(stream->v_queue, "sink");
+    GstPad *v_ghost_pad = gst_ghost_pad_new("v_sink", v_pad);  // 统一使用v_sink和a_sink
+    gst_element_add_pad(stream->bin, v_ghost_pad);
+    gst_pad_set_active(v_ghost_pad, TRUE);
+    gst_object_unref(v_pad);
+
+    if (stream->audio)
+    {
+        stream->a_queue = gst_element_factory_make("queue", "hls_a_queue");
+        stream->a_convert = gst_element_factory_make("audioconvert", "hls_a_convert");
+        stream->a_resample = gst_element_factory_make("audioresample", "hls_a_resample");
+        stream->a_encoder = hls_make_aac_encoder();
+        stream->a_parse = gst_element_factory_make("aacparse", "hls_a_parse");
+
+        if (!stream->a_queue || !stream->a_convert || !stream->a_resample || !stream->a_encoder || !stream->a_parse)
+        {
+            g_printerr("Could not create HLS audio elements\n");
+            return FALSE;
+        }
+
+        gst_bin_add_many(GST_BIN(stream->bin),
+                         stream->a_queue, stream->a_convert, stream->a_resample, stream->a_encoder, stream->a_parse,
+                         NULL);
+
+        if (!gst_element_link_many(stream->a_queue, stream->a_convert, stream->a_resample,
+                                   stream->a_encoder, stream->a_parse, stream->mux, NULL))
+        {
+            g_printerr("HLS audio elements could not be linked.\n");
+            return FALSE;
+        }
+
+        g_object_set(stream->a_queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                     "max-size-time", (guint64)GST_SECOND, NULL);
+
+        GstPad *a_pad = gst_element_get_static_pad(stream->a_queue, "sink");
+        GstPad *a_ghost_pad = gst_ghost_pad_new("a_sink", a_pad);
+        gst_element_add_pad(stream->bin, a_ghost_pad);
+        gst_pad_set_active(a_ghost_pad, TRUE);
+        gst_object_unref(a_pad);
+    }
+
+    // appsink不参与同步和预卷；TS数据不能丢，取出后立即放进缓存
+    GstAppSinkCallbacks callbacks = {0};
+    callbacks.new_sample = (GstFlowReturn(*)(GstAppSink *, gpointer))hls_on_new_sample;
+    g_object_set(stream->sink, "sync", FALSE, "async", FALSE, NULL);
+    gst_app_sink_set_callbacks(GST_APP_SINK(stream->sink), &callbacks, stream, NULL);
+
+    GstPad *sink_pad = gst_element_get_static_pad(stream->sink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      (GstPadProbeCallback)hls_on_sink_event, stream, NULL);
+    gst_object_unref(sink_pad);
+
+    return TRUE;
+}
+
+gboolean hls_server_init(GstHlsServer *self, guint port)
+{
+    if (!self)
+    {
+        g_printerr("HLS server instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstHlsServer));
+
+    self->port = port;
+    self->target_duration = HLS_DEFAULT_TARGET_DURATION;
+    self->part_duration = HLS_DEFAULT_PART_DURATION;
+    self->window = HLS_DEFAULT_WINDOW;
+    self->max_bytes = HLS_DEFAULT_MAX_BYTES;
+
+    return TRUE;
+}
+
+void hls_server_destroy(GstHlsServer *self)
+{
+    if (!self)
+        return;
+
+    hls_stop(self);
+
+    while (self->streams)
+        hls_remove_mount(self, ((HlsStream *)self->streams->data)->path);
+}
+
+void hls_set_segmenting(GstHlsServer *self, GstClockTime target_duration, GstClockTime part_duration,
+                        guint window, guint64 max_bytes)
+{
+    if (!self)
+        return;
+
+    // 部分片段不能比片段长
+    self->target_duration = target_duration ? target_duration : HLS_DEFAULT_TARGET_DURATION;
+    self->part_duration = part_duration ? MIN(part_duration, self->target_duration) : HLS_DEFAULT_PART_DURATION;
+    self->window = window ? window : HLS_DEFAULT_WINDOW;
+    self->max_bytes = max_bytes ? max_bytes : HLS_DEFAULT_MAX_BYTES;
+}
+
+void hls_set_configure_func(GstHlsServer *self, HlsConfigureFunc func, gpointer user_data)
+{
+    if (!self)
+        return;
+
+    self->configure_func = func;
+    self->configure_data = user_data;
+}
+
+HlsStream *hls_find_mount(GstHlsServer *self, const char *path)
+{
+    for (GList *l = self ? self->streams : NULL; l; l = l->next)
+    {
+        HlsStream *stream = l->data;
+        if (g_strcmp0(stream->path, path) == 0)
+            return stream;
+    }
+    return NULL;
+}
+
+// 在path上发布媒体，播放列表是path/index.m3u8。媒体可以已经在播放，分支会同步到管道的状态
+gboolean hls_add_mount(GstHlsServer *self, GstMedia *media, const char *path, gboolean audio)
+{
+    if (!self || !media || !media->pipeline || !path || path[0] != '/' || g_str_has_suffix(path, "/"))
+    {
+        g_printerr("Invalid arguments to hls_add_mount\n");
+        return FALSE;
+    }
+
+    if (hls_find_mount(self, path))
+    {
+        g_printerr("HLS mount %s already exists\n", path);
+        return FALSE;
+    }
+
+    HlsStream *stream = g_new0(HlsStream, 1);
+    stream->server = self;
+    stream->path = g_strdup(path);
+    stream->media = media;
+    stream->audio = audio;
+    stream->pending = g_byte_array_new();
+    stream->part_start = GST_CLOCK_TIME_NONE;
+    stream->segment_start = GST_CLOCK_TIME_NONE;
+    stream->segment_capture = GST_CLOCK_TIME_NONE;
+    stream->part_capture = GST_CLOCK_TIME_NONE;
+    g_queue_init(&stream->segments);
+    g_mutex_init(&stream->lock);
+
+    if (!create_hls_stream_bin(stream))
+    {
+        g_printerr("Could not create HLS stream bin\n");
+        hls_stream_free(stream);
+        return FALSE;
+    }
+
+    // 分支还是NULL状态，编码器的所有属性都可以修改
+    if (self->configure_func)
+        self->configure_func(stream, self->configure_data);
+
+    if (!media_add_video_branch(media, stream->bin) ||
+        (audio && !media_add_audio_branch(media, stream->bin)))
+    {
+        g_printerr("Failed to link HLS stream bin to media\n");
+        hls_stream_free(stream);
+        return FALSE;
+    }
+
+    media_add_memory_source(media, stream->bin, (MediaMemoryFunc)hls_stream_memory, stream);
+    self->streams = g_list_append(self->streams, stream);
+
+    LOG_INFO(media->name, GST_ELEMENT_NAME(stream->bin), "HLS mount %s added", path);
+    return TRUE;
+}
+
+gboolean hls_remove_mount(GstHlsServer *self, const char *path)
+{
+    HlsStream *stream = hls_find_mount(self, path);
+    if (!stream)
+    {
+        g_printerr("HLS mount %s not found\n", path ? path : "(null)");
+        return FALSE;
+    }
+
+    self->streams = g_list_remove(self->streams, stream);
+
+    LOG_INFO(stream->media->name, GST_ELEMENT_NAME(stream->bin), "HLS mount %s removed", stream->path);
+    hls_stream_free(stream);
+    return TRUE;
+}
+
+gboolean hls_get_stats(GstHlsServer *self, const char *path, HlsStats *stats)
+{
+    HlsStream *stream = hls_find_mount(self, path);
+    if (!stream || !stats)
+        return FALSE;
+
+    g_mutex_lock(&stream->lock);
+    *stats = stream->stats;
+    stats->part_latency = stats->parts ? stream->latency_sum / (gint64)stats->parts : 0;
+    stats->wake_latency = stream->woken ? stream->wake_sum / (gint64)stream->woken : 0;
+    g_mutex_unlock(&stream->lock);
+    return TRUE;
+}
+
+// 缓存的片段和正在生成的部分片段，计入该挂载点分支的内存占用
+guint64 hls_stream_memory(HlsStream *stream)
+{
+    g_mutex_lock(&stream->lock);
+    guint64 bytes = stream->stats.bytes + stream->pending->len;
+    g_mutex_unlock(&stream->lock);
+    return bytes;
+}
+
+// 从媒体断开分支，等待中的请求回复404。正在发送的数据由请求自己持有引用
+void hls_stream_free(HlsStream *stream)
+{
+    if (stream->bin)
+    {
+        if (GST_OBJECT_PARENT(stream->bin))
+        {
+            media_remove_memory_source(stream->media, (MediaMemoryFunc)hls_stream_memory, stream);
+            media_remove_video_branch(stream->media, stream->bin);
+            if (stream->audio)
+                media_remove_audio_branch(stream->media, stream->bin);
+
+            gst_object_ref(stream->bin);
+            gst_element_set_state(stream->bin, GST_STATE_NULL);
+            gst_bin_remove(GST_BIN(stream->media->pipeline), stream->bin);
+        }
+        else
+        {
+            gst_object_ref_sink(stream->bin);
+        }
+        gst_object_unref(stream->bin);
+    }
+
+    // 分支已经停止，流线程不会再访问缓存
+    if (stream->wake_id)
+        g_source_remove(stream->wake_id);
+    GList *waiters = stream->waiters;
+    stream->waiters = NULL;
+    for (GList *l = waiters; l; l = l->next)
+    {
+        HlsClient *client = l->data;
+        client->stream = NULL;
+        hls_client_respond(client, "404 Not Found", "text/plain", "no-cache", NULL);
+    }
+    g_list_free(waiters);
+
+    g_queue_clear_full(&stream->segments, (GDestroyNotify)hls_segment_free);
+    g_byte_array_unref(stream->pending);
+    g_mutex_clear(&stream->lock);
+    g_free(stream->path);
+    g_free(stream);
+}
+
+void hls_segment_free(HlsSegment *segment)
+{
+    g_ptr_array_unref(segment->parts);
+    g_free(segment);
+}
+
+void hls_part_free(HlsPart *part)
+{
+    g_bytes_unref(part->data);
+    g_free(part);
+}
+
+// mpegtsmux在强制关键帧之前把事件转发下来，并且重发PAT/PMT，从下一个buffer开始新片段
+GstPadProbeReturn hls_on_sink_event(GstPad *pad, GstPadProbeInfo *info, HlsStream *stream)
+{
+    if (gst_video_event_is_force_key_unit(GST_PAD_PROBE_INFO_EVENT(info)))
+    {
+        g_mutex_lock(&stream->lock);
+        stream->cut = TRUE;
+        g_mutex_unlock(&stream->lock);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// appsink流线程：TS数据放进缓存。片段一开始就向编码器请求在目标时长前一个部分片段处插入关键帧，
+// 编码器按运行时间插入，不受编码延迟影响
+GstFlowReturn hls_on_new_sample(GstAppSink *sink, HlsStream *stream)
+{
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample)
+        return GST_FLOW_OK;
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstClockTime capture = GST_CLOCK_TIME_NONE;
+    if (buffer && GST_BUFFER_PTS_IS_VALID(buffer))
+        capture = gst_segment_to_running_time(gst_sample_get_segment(sample), GST_FORMAT_TIME,
+                                              GST_BUFFER_PTS(buffer));
+
+    GstClockTime key_time = GST_CLOCK_TIME_NONE;
+    g_mutex_lock(&stream->lock);
+    if (buffer)
+        hls_stream_push(stream, buffer, capture);
+    if (!stream->key_requested && GST_CLOCK_TIME_IS_VALID(stream->segment_capture))
+    {
+        GstHlsServer *server = stream->server;
+        GstClockTime ahead = server->target_duration > server->part_duration ? server->part_duration : 0;
+        stream->key_requested = TRUE;
+        key_time = stream->segment_capture + server->target_duration - ahead;
+    }
+    g_mutex_unlock(&stream->lock);
+
+    // 请求经mpegtsmux到达编码器，all-headers让mpegtsmux在关键帧之前重发PAT/PMT
+    if (GST_CLOCK_TIME_IS_VALID(key_time))
+    {
+        GstPad *pad = gst_element_get_static_pad(stream->sink, "sink");
+        gst_pad_push_event(pad, gst_video_event_new_upstream_force_key_unit(key_time, TRUE, 0));
+        gst_object_unref(pad);
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// 按时间戳切分：收到强制关键帧事件后结束当前片段，部分片段达到目标时长后结束当前部分片段。
+// 关键帧没有按时到达（编码器丢帧或者不支持按时间插入）时在目标时长处直接切分，片段从不超过目标时长，
+// 这样的片段以非关键帧开始，第一个部分片段不标INDEPENDENT。调用时持有lock
+void hls_stream_push(HlsStream *stream, GstBuffer *buffer, GstClockTime capture)
+{
+    GstClockTime time = GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) : GST_BUFFER_DTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(time))
+        time = stream->part_start;
+
+    gboolean overdue = GST_CLOCK_TIME_IS_VALID(time) && GST_CLOCK_TIME_IS_VALID(stream->segment_start) &&
+                       time >= stream->segment_start + stream->server->target_duration;
+    if (stream->cut || overdue || g_queue_is_empty(&stream->segments))
+    {
+        hls_stream_finish_part(stream, time);
+        hls_stream_finish_segment(stream, time);
+
+        HlsSegment *segment = g_new0(HlsSegment, 1);
+        segment->sequence = stream->sequence++;
+        segment->parts = g_ptr_array_new_with_free_func((GDestroyNotify)hls_part_free);
+        g_queue_push_tail(&stream->segments, segment);
+
+        stream->segment_start = time;
+        stream->segment_capture = capture;
+        stream->cut = FALSE;
+        stream->key_requested = FALSE;
+    }
+    else if (stream->pending->len > 0 && GST_CLOCK_TIME_IS_VALID(time) &&
+             GST_CLOCK_TIME_IS_VALID(stream->part_start) &&
+             time >= stream->part_start + stream->server->part_duration)
+    {
+        hls_stream_finish_part(stream, time);
+    }
+
+    if (stream->pending->len == 0)
+    {
+        stream->part_start = time;
+        stream->part_capture = capture;
+        stream->independent = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+
+    GstMapInfo map;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        g_byte_array_append(stream->pending, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+}
+
+// 正在生成的部分片段可以下载了，唤醒等待它的请求。调用时持有lock
+void hls_stream_finish_part(HlsStream *stream, GstClockTime end)
+{
+    HlsSegment *segment = g_queue_peek_tail(&stream->segments);
+    if (!segment || stream->pending->len == 0)
+        return;
+
+    HlsPart *part = g_new0(HlsPart, 1);
+    part->data = g_byte_array_free_to_bytes(stream->pending);
+    part->duration = GST_CLOCK_TIME_IS_VALID(end) && GST_CLOCK_TIME_IS_VALID(stream->part_start) &&
+                             end > stream->part_start
+                         ? end - stream->part_start
+                         : 0;
+    part->independent = stream->independent;
+    stream->pending = g_byte_array_new();
+
+    gsize size = g_bytes_get_size(part->data);
+    g_ptr_array_add(segment->parts, part);
+    segment->size += size;
+    stream->stats.parts++;
+    stream->stats.bytes += size;
+    stream->stats.peak_bytes = MAX(stream->stats.peak_bytes, stream->stats.bytes);
+
+    // 第一个样本的运行时间到现在，包括编码、复用和凑够部分片段时长的时间
+    GstClock *clock = gst_element_get_clock(stream->sink);
+    if (clock && GST_CLOCK_TIME_IS_VALID(stream->part_capture))
+    {
+        GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(stream->sink);
+        gint64 latency = now > stream->part_capture ? (gint64)((now - stream->part_capture) / GST_USECOND) : 0;
+        stream->latency_sum += latency;
+        stream->stats.max_part_latency = MAX(stream->stats.max_part_latency, latency);
+    }
+    if (clock)
+        gst_object_unref(clock);
+
+    stream->published = g_get_monotonic_time();
+    if (stream->waiters && !stream->wake_id)
+        stream->wake_id = g_idle_add((GSourceFunc)hls_on_wake, stream);
+}
+
+// 调用时持有lock
+void hls_stream_finish_segment(HlsStream *stream, GstClockTime end)
+{
+    HlsSegment *segment = g_queue_peek_tail(&stream->segments);
+    if (!segment)
+        return;
+
+    segment->complete = TRUE;
+    segment->duration = GST_CLOCK_TIME_IS_VALID(end) && GST_CLOCK_TIME_IS_VALID(stream->segment_start) &&
+                                end > stream->segment_start
+                            ? end - stream->segment_start
+                            : 0;
+    stream->stats.segments++;
+    hls_stream_evict(stream);
+}
+
+// 完整片段超过窗口，或者缓存超过上限时淘汰最旧的片段，正在生成的片段总是保留。调用时持有lock
+void hls_stream_evict(HlsStream *stream)
+{
+    GstHlsServer *server = stream->server;
+    while (stream->segments.length > 1)
+    {
+        HlsSegment *last = g_queue_peek_tail(&stream->segments);
+        guint complete = stream->segments.length - (last->complete ? 0 : 1);
+        if (complete <= server->window && stream->stats.bytes <= server->max_bytes)
+            break;
+
+        HlsSegment *segment = g_queue_pop_head(&stream->segments);
+        stream->stats.bytes -= segment->size;
+        stream->stats.evicted++;
+        hls_segment_free(segment);
+    }
+}
+
+// 序号为msn的片段，已经淘汰或者还没有开始时返回NULL。调用时持有lock
+HlsSegment *hls_stream_segment(HlsStream *stream, guint64 msn)
+{
+    HlsSegment *first = g_queue_peek_head(&stream->segments);
+    if (!first || msn < first->sequence || msn - first->sequence >= stream->segments.length)
+        return NULL;
+    return g_queue_peek_nth(&stream->segments, (guint)(msn - first->sequence));
+}
+
+// LL-HLS阻塞重载：片段msn的第part个部分片段（part为-1时是整个片段）已经生成。调用时持有lock
+gboolean hls_stream_ready(HlsStream *stream, guint64 msn, gint64 part)
+{
+    HlsSegment *first = g_queue_peek_head(&stream->segments);
+    if (first && msn < first->sequence)
+        return TRUE;
+
+    HlsSegment *segment = hls_stream_segment(stream, msn);
+    if (!segment)
+        return FALSE;
+    return segment->complete || (part >= 0 && part < (gint64)segment->parts->len);
+}
+
+// 生成播放列表，调用时持有lock
+GBytes *hls_stream_playlist(HlsStream *stream)
+{
+    GstHlsServer *server = stream->server;
+    gdouble part_target = (gdouble)server->part_duration / GST_SECOND;
+
+    // TARGETDURATION在整个直播期间不能变，取配置的目标时长向上取整；片段切分保证不超过它
+    GString *playlist = g_string_new("#EXTM3U\n#EXT-X-VERSION:6\n");
+    g_string_append_printf(playlist, "#EXT-X-TARGETDURATION:%u\n",
+                           (guint)((server->target_duration + GST_SECOND - 1) / GST_SECOND));
+    g_string_append_printf(playlist, "#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_target);
+    g_string_append_printf(playlist, "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n",
+                           part_target * 3);
+
+    HlsSegment *first = g_queue_peek_head(&stream->segments);
+    g_string_append_printf(playlist, "#EXT-X-MEDIA-SEQUENCE:%" G_GUINT64_FORMAT "\n", first ? first->sequence : 0);
+
+    guint index = 0;
+    for (GList *l = stream->segments.head; l; l = l->next, index++)
+    {
+        HlsSegment *segment = l->data;
+        if (index + HLS_PART_SEGMENTS >= stream->segments.length)
+        {
+            for (guint i = 0; i < segment->parts->len; i++)
+            {
+                HlsPart *part = g_ptr_array_index(segment->parts, i);
+                g_string_append_printf(playlist, "#EXT-X-PART:DURATION=%.3f,URI=\"part%" G_GUINT64_FORMAT ".%u.ts\"%s\n",
+                                       (gdouble)part->duration / GST_SECOND, segment->sequence, i,
+                                       part->independent ? ",INDEPENDENT=YES" : "");
+            }
+        }
+        if (segment->complete)
+            g_string_append_printf(playlist, "#EXTINF:%.3f,\nseg%" G_GUINT64_FORMAT ".ts\n",
+                                   (gdouble)segment->duration / GST_SECOND, segment->sequence);
+    }
+
+    // 下一个部分片段，客户端提前请求，生成后立即收到
+    HlsSegment *last = g_queue_peek_tail(&stream->segments);
+    if (last && !last->complete)
+        g_string_append_printf(playlist, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%" G_GUINT64_FORMAT ".%u.ts\"\n",
+                               last->sequence, last->parts->len);
+
+    gsize size = playlist->len;
+    return g_bytes_new_take(g_string_free(playlist, FALSE), size);
+}
+
+// 主循环：新的部分片段生成后重新处理所有等待中的请求，还没有满足的继续等待
+gboolean hls_on_wake(HlsStream *stream)
+{
+    g_mutex_lock(&stream->lock);
+    GList *waiters = stream->waiters;
+    stream->waiters = NULL;
+    stream->wake_id = 0;
+    g_mutex_unlock(&stream->lock);
+
+    for (GList *l = waiters; l; l = l->next)
+    {
+        HlsClient *client = l->data;
+        client->stream = NULL;
+        hls_client_dispatch(client);
+    }
+    g_list_free(waiters);
+    return G_SOURCE_REMOVE;
+}
+
+// 只监听回环地址，port为0时由系统分配，之后可以从self->port读取
+gboolean hls_start(GstHlsServer *self)
+{
+    if (!self)
+    {
+        g_printerr("HLS server instance is NULL\n");
+        return FALSE;
+    }
+
+    if (self->service)
+        return TRUE;
+
+    GError *err = NULL;
+    GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(loopback, self->port);
+    GSocketAddress *effective = NULL;
+    g_object_unref(loopback);
+
+    self->service = g_socket_service_new();
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(self->service), address,
+                                       G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP,
+                                       NULL, &effective, &err))
+    {
+        g_printerr("Could not listen on HLS port %u: %s\n", self->port, err->message);
+        g_clear_error(&err);
+        g_object_unref(address);
+        g_clear_object(&self->service);
+        return FALSE;
+    }
+    g_object_unref(address);
+    self->port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(effective));
+    g_object_unref(effective);
+
+    g_signal_connect(self->service, "incoming", G_CALLBACK(hls_on_incoming), self);
+    g_socket_service_start(self->service);
+
+    g_print("HLS server started on port %u\n", self->port);
+    for (GList *l = self->streams; l; l = l->next)
+        g_print("Play using: http://127.0.0.1:%u%s/index.m3u8\n",
+                self->port, ((HlsStream *)l->data)->path);
+
+    return TRUE;
+}
+
+gboolean hls_stop(GstHlsServer *self)
+{
+    if (!self)
+    {
+        g_printerr("HLS server instance is NULL\n");
+        return FALSE;
+    }
+
+    if (!self->service)
+        return TRUE;
+
+    g_socket_service_stop(self->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+    g_clear_object(&self->service);
+
+    // 等待中的请求没有进行中的异步操作，直接释放；其他的取消后在回调里释放
+    GList *clients = self->clients;
+    self->clients = NULL;
+    for (GList *l = clients; l; l = l->next)
+    {
+        HlsClient *client = l->data;
+        client->server = NULL;
+        if (client->stream)
+            hls_client_free(client);
+        else
+            g_cancellable_cancel(client->cancellable);
+    }
+    g_list_free(clients);
+
+    g_print("HLS server stopped\n");
+    return TRUE;
+}
+
+gboolean hls_on_incoming(GSocketService *service, GSocketConnection *connection,
+                         GObject *source_object, GstHlsServer *self)
+{
+    HlsClient *client = g_new0(HlsClient, 1);
+    client->server = self;
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    client->output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    client->cancellable = g_cancellable_new();
+    g_data_input_stream_set_newline_type(client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+    g_queue_init(&client->output_queue);
+
+    self->clients = g_list_prepend(self->clients, client);
+    hls_client_read(client);
+    return TRUE;
+}
+
+void hls_client_read(HlsClient *client)
+{
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, client->cancellable,
+                                        (GAsyncReadyCallback)hls_on_line, client);
+}
+
+// 第一行是请求行，之后是请求头，空行表示请求结束。只支持GET，请求头只看Connection
+void hls_on_line(GObject *source, GAsyncResult *result, HlsClient *client)
+{
+    gchar *line = g_data_input_stream_read_line_finish(client->input, result, NULL, NULL);
+    if (!line || !client->server)
+    {
+        g_free(line);
+        hls_client_free(client);
+        return;
+    }
+
+    if (!client->target)
+    {
+        // keep-alive连接上两个请求之间可能有空行
+        if (*line)
+        {
+            gchar **fields = g_strsplit(line, " ", 3);
+            gboolean valid = g_strv_length(fields) == 3 && strcmp(fields[0], "GET") == 0 && fields[1][0] == '/';
+            client->target = g_strdup(valid ? fields[1] : "");
+            client->keep_alive = valid && strcmp(fields[2], "HTTP/1.0") != 0;
+            g_strfreev(fields);
+        }
+    }
+    else if (*line)
+    {
+        if (g_ascii_strncasecmp(line, "Connection:", 11) == 0)
+        {
+            const char *value = g_strstrip(line + 11);
+            if (g_ascii_strcasecmp(value, "close") == 0)
+                client->keep_alive = FALSE;
+            else if (g_ascii_strcasecmp(value, "keep-alive") == 0)
+                client->keep_alive = TRUE;
+        }
+    }
+    else
+    {
+        g_free(line);
+        hls_client_dispatch(client);
+        return;
+    }
+
+    g_free(line);
+    hls_client_read(client);
+}
+
+// segN.ts或partN.M.ts，part为-1表示完整片段
+static gboolean hls_parse_resource(const char *name, guint64 *msn, gint64 *part)
+{
+    gchar *end;
+    if (g_str_has_prefix(name, "seg"))
+    {
+        *msn = g_ascii_strtoull(name + 3, &end, 10);
+        *part = -1;
+        return end != name + 3 && strcmp(end, ".ts") == 0;
+    }
+    if (g_str_has_prefix(name, "part"))
+    {
+        *msn = g_ascii_strtoull(name + 4, &end, 10);
+        if (end == name + 4 || *end != '.')
+            return FALSE;
+        const char *index = end + 1;
+        *part = g_ascii_strtoll(index, &end, 10);
+        return end != index && *part >= 0 && strcmp(end, ".ts") == 0;
+    }
+    return FALSE;
+}
+
+// 处理一个完整的请求。请求的部分片段还没有生成时挂到挂载点上，生成后由hls_on_wake重新处理
+void hls_client_dispatch(HlsClient *client)
+{
+    GstHlsServer *server = client->server;
+    gchar *target = g_strdup(client->target);
+    gchar *query = strchr(target, '?');
+    if (query)
+        *query++ = '\0';
+
+    gchar *resource = strrchr(target, '/');
+    HlsStream *stream = NULL;
+    if (resource && resource != target)
+    {
+        *resource++ = '\0';
+        stream = hls_find_mount(server, target);
+    }
+    if (!stream)
+    {
+        client->keep_alive = client->keep_alive && client->target[0];
+        hls_client_respond(client, client->target[0] ? "404 Not Found" : "400 Bad Request",
+                           "text/plain", "no-cache", NULL);
+        g_free(target);
+        return;
+    }
+
+    guint64 msn = 0;
+    gint64 part = -1;
+    gboolean blocking = FALSE;
+    gchar **params = query ? g_strsplit(query, "&", -1) : NULL;
+    for (gchar **param = params; param && *param; param++)
+    {
+        if (g_str_has_prefix(*param, "_HLS_msn="))
+        {
+            msn = g_ascii_strtoull(*param + 9, NULL, 10);
+            blocking = TRUE;
+        }
+        else if (g_str_has_prefix(*param, "_HLS_part="))
+        {
+            part = g_ascii_strtoll(*param + 10, NULL, 10);
+        }
+    }
+    g_strfreev(params);
+
+    const char *status = "404 Not Found";
+    const char *type = "video/mp2t";
+    const char *cache = "max-age=60";
+    GList *bodies = NULL;
+    gboolean wait = FALSE;
+
+    g_mutex_lock(&stream->lock);
+    if (!client->timeout_id)
+        stream->stats.requests++;
+
+    if (strcmp(resource, "index.m3u8") == 0)
+    {
+        type = "application/vnd.apple.mpegurl";
+        cache = "no-cache";
+        if (!blocking || hls_stream_ready(stream, msn, part))
+        {
+            status = "200 OK";
+            bodies = g_list_append(NULL, hls_stream_playlist(stream));
+        }
+        else if (msn <= stream->sequence)
+            wait = TRUE;
+        else
+            status = "400 Bad Request";   // 比下一个片段更远，规范要求直接拒绝
+    }
+    else if (hls_parse_resource(resource, &msn, &part))
+    {
+        HlsSegment *segment = hls_stream_segment(stream, msn);
+        if (segment && part < 0 && segment->complete)
+        {
+            for (guint i = 0; i < segment->parts->len; i++)
+                bodies = g_list_append(bodies, g_bytes_ref(((HlsPart *)g_ptr_array_index(segment->parts, i))->data));
+            status = "200 OK";
+        }
+        else if (segment && part >= 0 && part < (gint64)segment->parts->len)
+        {
+            bodies = g_list_append(NULL, g_bytes_ref(((HlsPart *)g_ptr_array_index(segment->parts, part))->data));
+            status = "200 OK";
+        }
+        else if (part >= 0 && msn <= stream->sequence && !(segment && segment->complete))
+        {
+            wait = TRUE;
+        }
+    }
+
+    if (wait)
+    {
+        stream->waiters = g_list_append(stream->waiters, client);
+        client->stream = stream;
+        if (!client->timeout_id)
+        {
+            // 规范要求等待不超过目标时长的三倍
+            stream->stats.blocked++;
+            client->blocked_since = g_get_monotonic_time();
+            client->timeout_id = g_timeout_add((guint)(3 * server->target_duration / GST_MSECOND),
+                                               (GSourceFunc)hls_on_wait_timeout, client);
+        }
+    }
+    else if (client->timeout_id && bodies)
+    {
+        stream->wake_sum += g_get_monotonic_time() - MAX(stream->published, client->blocked_since);
+        stream->woken++;
+    }
+    g_mutex_unlock(&stream->lock);
+    g_free(target);
+
+    if (!wait)
+        hls_client_respond(client, status, type, cache, bodies);
+}
+
+gboolean hls_on_wait_timeout(HlsClient *client)
+{
+    client->timeout_id = 0;
+    HlsStream *stream = client->stream;
+    if (stream)
+    {
+        g_mutex_lock(&stream->lock);
+        stream->waiters = g_list_remove(stream->waiters, client);
+        g_mutex_unlock(&stream->lock);
+        client->stream = NULL;
+    }
+
+    hls_client_respond(client, "503 Service Unavailable", "text/plain", "no-cache", NULL);
+    return G_SOURCE_REMOVE;
+}
+
+// 回复头和bodies(GBytes，取得所有权)依次写出，写完之后读下一个请求
+void hls_client_respond(HlsClient *client, const char *status, const char *type, const char *cache, GList *bodies)
+{
+    if (client->timeout_id)
+    {
+        g_source_remove(client->timeout_id);
+        client->timeout_id = 0;
+    }
+    g_clear_pointer(&client->target, g_free);
+
+    gsize length = 0;
+    for (GList *l = bodies; l; l = l->next)
+        length += g_bytes_get_size(l->data);
+
+    gchar *header = g_strdup_printf("HTTP/1.1 %s\r\n"
+                                    "Content-Type: %s\r\n"
+                                    "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                                    "Cache-Control: %s\r\n"
+                                    "Access-Control-Allow-Origin: *\r\n"
+                                    "Connection: %s\r\n\r\n",
+                                    status, type, length, cache, client->keep_alive ? "keep-alive" : "close");
+    g_queue_push_tail(&client->output_queue, g_bytes_new_take(header, strlen(header)));
+    for (GList *l = bodies; l; l = l->next)
+        g_queue_push_tail(&client->output_queue, l->data);
+    g_list_free(bodies);
+
+    hls_client_write_next(client);
+}
+
+void hls_client_write_next(HlsClient *client)
+{
+    g_clear_pointer(&client->current, g_bytes_unref);
+    client->current = g_queue_pop_head(&client->output_queue);
+    if (!client->current)
+    {
+        if (!client->keep_alive || !client->server)
+            hls_client_free(client);
+        else
+            hls_client_read(client);
+        return;
+    }
+
+    gsize size;
+    gconstpointer data = g_bytes_get_data(client->current, &size);
+    g_output_stream_write_all_async(client->output, data, size, G_PRIORITY_DEFAULT, client->cancellable,
+                                    (GAsyncReadyCallback)hls_on_written, client);
+}
+
+void hls_on_written(GObject *source, GAsyncResult *result, HlsClient *client)
+{
+    // 播放器随时可能断开，写失败不算错误
+    if (!g_output_stream_write_all_finish(client->output, result, NULL, NULL) || !client->server)
+    {
+        hls_client_free(client);
+        return;
+    }
+
+    hls_client_write_next(client);
+}
+
+void hls_client_free(HlsClient *client)
+{
+    if (client->server)
+        client->server->clients = g_list_remove(client->server->clients, client);
+
+    if (client->stream)
+    {
+        g_mutex_lock(&client->stream->lock);
+        client->stream->waiters = g_list_remove(client->stream->waiters, client);
+        g_mutex_unlock(&client->stream->lock);
+    }
+    if (client->timeout_id)
+        g_source_remove(client->timeout_id);
+
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_object_unref(client->cancellable);
+    g_queue_clear_full(&client->output_queue, (GDestroyNotify)g_bytes_unref);
+    if (client->current)
+        g_bytes_unref(client->current);
+    g_free(client->target);
+    g_free(client);
+}
+
+// 性能测试：发布uri，客户端线程按LL-HLS的方式跟随直播边缘：阻塞请求包含下一个部分片段的播放列表，
+// 收到后下载该部分片段。统计播放列表等待时间、部分片段延迟和缓存占用
+
+typedef struct HlsBenchClient
+{
+    guint port;
+    const char *path;
+    gint running;
+    GMainLoop *loop;
+
+    guint64 reloads, parts, bytes, errors;
+    gint64 wait_sum;         // 阻塞请求的等待时间，微秒
+    gint64 fetch_sum;        // 下载部分片段的时间，微秒
+} HlsBenchClient;
+
+static gboolean hls_bench_quit(gpointer data)
+{
+    g_main_loop_quit((GMainLoop *)data);
+    return G_SOURCE_REMOVE;
+}
+
+// 发一个GET请求并读完回复，状态不是200时返回NULL
+static GBytes *hls_bench_get(GSocketConnection *connection, GDataInputStream *input, const char *target)
+{
+    gchar *request = g_strdup_printf("GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", target);
+    gboolean sent = g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(connection)),
+                                              request, strlen(request), NULL, NULL, NULL);
+    g_free(request);
+    if (!sent)
+        return NULL;
+
+    gboolean ok = FALSE;
+    gsize length = 0;
+    gchar *line = g_data_input_stream_read_line(input, NULL, NULL, NULL);
+    if (line)
+        ok = g_str_has_prefix(line, "HTTP/1.1 200");
+    while (line && *line)
+    {
+        if (g_ascii_strncasecmp(line, "Content-Length:", 15) == 0)
+            length = g_ascii_strtoull(line + 15, NULL, 10);
+        g_free(line);
+        line = g_data_input_stream_read_line(input, NULL, NULL, NULL);
+    }
+    if (!line)
+        return NULL;
+    g_free(line);
+
+    gchar *body = g_malloc(length + 1);
+    gsize received = 0;
+    if (!g_input_stream_read_all(G_INPUT_STREAM(input), body, length, &received, NULL, NULL) ||
+        received != length || !ok)
+    {
+        g_free(body);
+        return NULL;
+    }
+    body[length] = '\0';
+    return g_bytes_new_take(body, length);
+}
+
+// 播放列表里的预加载提示，即下一个部分片段
+static gboolean hls_bench_hint(GBytes *playlist, guint64 *msn, gint64 *part)
+{
+    const char *prefix = "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"";
+    const char *hint = strstr(g_bytes_get_data(playlist, NULL), prefix);
+    if (!hint)
+        return FALSE;
+
+    hint += strlen(prefix);
+    const char *quote = strchr(hint, '"');
+    if (!quote)
+        return FALSE;
+    gchar *name = g_strndup(hint, quote - hint);
+    gboolean ok = hls_parse_resource(name, msn, part);
+    g_free(name);
+    return ok;
+}
+
+static gpointer hls_bench_client(gpointer data)
+{
+    HlsBenchClient *bench = data;
+    GSocketClient *socket_client = g_socket_client_new();
+    GSocketConnection *connection = NULL;
+    GDataInputStream *input = NULL;
+    guint64 msn = 0;
+    gint64 part = -1;
+
+    while (g_atomic_int_get(&bench->running))
+    {
+        if (!connection)
+        {
+            connection = g_socket_client_connect_to_host(socket_client, "127.0.0.1", bench->port, NULL, NULL);
+            if (!connection)
+            {
+                g_usleep(100000);
+                continue;
+            }
+            input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+            g_data_input_stream_set_newline_type(input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+        }
+
+        // 还不知道直播边缘时先取一次普通的播放列表
+        gchar *target = part < 0
+                            ? g_strdup_printf("%s/index.m3u8", bench->path)
+                            : g_strdup_printf("%s/index.m3u8?_HLS_msn=%" G_GUINT64_FORMAT "&_HLS_part=%" G_GINT64_FORMAT,
+                                              bench->path, msn, part);
+        gint64 start = g_get_monotonic_time();
+        GBytes *playlist = hls_bench_get(connection, input, target);
+        g_free(target);
+
+        if (playlist && part >= 0)
+        {
+            bench->reloads++;
+            bench->wait_sum += g_get_monotonic_time() - start;
+
+            gchar *name = g_strdup_printf("%s/part%" G_GUINT64_FORMAT ".%" G_GINT64_FORMAT ".ts", bench->path, msn, part);
+            start = g_get_monotonic_time();
+            GBytes *media = hls_bench_get(connection, input, name);
+            g_free(name);
+            if (media)
+            {
+                bench->parts++;
+                bench->bytes += g_bytes_get_size(media);
+                bench->fetch_sum += g_get_monotonic_time() - start;
+                g_bytes_unref(media);
+            }
+        }
+
+        if (!playlist || !hls_bench_hint(playlist, &msn, &part))
+        {
+            // 服务器刚启动还没有数据，或者请求失败：重新连接，从头开始
+            if (!playlist)
+                bench->errors++;
+            g_clear_object(&input);
+            g_clear_object(&connection);
+            part = -1;
+            g_usleep(100000);
+        }
+        if (playlist)
+            g_bytes_unref(playlist);
+    }
+
+    g_clear_object(&input);
+    g_clear_object(&connection);
+    g_object_unref(socket_client);
+    g_idle_add(hls_bench_quit, bench->loop);
+    return NULL;
+}
+
+void hls_bench(const char *uri, gint seconds)
+{
+    if (!uri || seconds <= 0)
+        return;
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+    GstMedia media;
+    GstHlsServer server;
+    hls_server_init(&server, 0);
+    if (!media_init(&media) || !media_set_uri(&media, uri))
+    {
+        g_printerr("Could not set up HLS benchmark\n");
+        media_destroy(&media);
+        g_main_loop_unref(loop);
+        return;
+    }
+    media_set_name(&media, "bench");
+    if (!hls_add_mount(&server, &media, "/bench", TRUE) || !hls_start(&server))
+    {
+        g_printerr("Could not set up HLS benchmark\n");
+        hls_server_destroy(&server);
+        media_destroy(&media);
+        g_main_loop_unref(loop);
+        return;
+    }
+    media_play(&media);
+
+    HlsBenchClient client = {0};
+    client.port = server.port;
+    client.path = "/bench";
+    client.running = 1;
+    client.loop = loop;
+    GThread *thread = g_thread_new("hls-bench", hls_bench_client, &client);
+
+    clock_t cpu = clock();
+    g_timeout_add_seconds(seconds, hls_bench_quit, loop);
+    g_main_loop_run(loop);
+    gdouble used = (gdouble)(clock() - cpu) / CLOCKS_PER_SEC;
+
+    HlsStats stats;
+    hls_get_stats(&server, "/bench", &stats);
+    MediaMemoryUsage usage = {0};
+    media_get_memory_usage(&media, "hls_bench", &usage);
+
+    // 客户端可能正在等待下一个部分片段，主循环继续处理请求，直到客户端线程退出
+    g_atomic_int_set(&client.running, 0);
+    g_main_loop_run(loop);
+    g_thread_join(thread);
+
+    g_print("hls: %d s, part target %.0f ms, segment target %.0f ms\n", seconds,
+            (gdouble)server.part_duration / GST_MSECOND, (gdouble)server.target_duration / GST_MSECOND);
+    g_print("  client:  %" G_GUINT64_FORMAT " blocking reloads, avg wait %.1f ms, %" G_GUINT64_FORMAT
+            " parts fetched in %.2f ms avg (%.1f KB/s), %" G_GUINT64_FORMAT " errors\n",
+            client.reloads, client.reloads ? client.wait_sum / 1000.0 / client.reloads : 0.0,
+            client.parts, client.parts ? client.fetch_sum / 1000.0 / client.parts : 0.0,
+            client.bytes / 1024.0 / seconds, client.errors);
+    g_print("  server:  %" G_GUINT64_FORMAT " segments, %" G_GUINT64_FORMAT " parts, %" G_GUINT64_FORMAT
+            " evicted, %" G_GUINT64_FORMAT " requests (%" G_GUINT64_FORMAT " blocked)\n",
+            stats.segments, stats.parts, stats.evicted, stats.requests, stats.blocked);
+    g_print("  latency: part %.1f ms avg / %.1f ms max from capture, reply %.0f us after the part is ready\n",
+            stats.part_latency / 1000.0, stats.max_part_latency / 1000.0, (gdouble)stats.wake_latency);
+    g_print("  memory:  cache %.1f KB (peak %.1f KB), branch %.1f KB (peak %.1f KB), cpu %.2f s\n",
+            stats.bytes / 1024.0, stats.peak_bytes / 1024.0, usage.current / 1024.0, usage.peak / 1024.0, used);
+
+    media_stop(&media);
+    hls_server_destroy(&server);
+    media_destroy(&media);
+    g_main_loop_unref(loop);
+}
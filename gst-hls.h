@@ -0,0 +1,113 @@
+#ifndef __GST_HLS_H__
+#define __GST_HLS_H__
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+#include "gst-media.h"
+
+// HLS输出：每个挂载点在媒体管道里编码一次，mpegtsmux复用成TS，所有HTTP客户端共用。
+// 片段按时间请求关键帧切分，不超过目标时长，片段内再按时间切成部分片段(LL-HLS)，最近的若干片段只保存在内存里，
+// 由内置的HTTP服务器在回环地址上提供，不写磁盘：
+//
+//   GET /PATH/index.m3u8[?_HLS_msn=N&_HLS_part=M]   播放列表，带_HLS_msn时等到该部分片段生成再回复
+//   GET /PATH/segN.ts                               完整片段
+//   GET /PATH/partN.M.ts                            片段N的第M个部分片段，还没有生成时等待（预加载提示）
+//
+// 片段和部分片段都是引用计数的GBytes，正在发送的数据不会因为片段被淘汰而释放。
+// 分片切在mpegtsmux收到的强制关键帧事件上，mpegtsmux在关键帧之前重发PAT/PMT，每个片段都可以独立解码。
+
+#define HLS_DEFAULT_TARGET_DURATION (2 * GST_SECOND)
+#define HLS_DEFAULT_PART_DURATION (200 * GST_MSECOND)
+#define HLS_DEFAULT_WINDOW 6
+#define HLS_DEFAULT_MAX_BYTES (32 * 1024 * 1024)
+
+struct GstHlsServer;
+struct HlsStream;
+
+// 挂载点的分支创建后、连接到媒体之前调用，可以修改编码器和队列的参数
+typedef void (*HlsConfigureFunc)(struct HlsStream *stream, gpointer user_data);
+
+typedef struct HlsStats
+{
+    guint64 segments;          // 已经生成的片段
+    guint64 parts;             // 已经生成的部分片段
+    guint64 evicted;           // 超出窗口或者内存上限被淘汰的片段
+    guint64 bytes, peak_bytes; // 缓存的字节数
+    guint64 requests;          // HTTP请求数
+    guint64 blocked;           // 等待部分片段生成的请求数
+    gint64 part_latency;       // 部分片段第一个样本采集到可以下载的时间，微秒，平均
+    gint64 max_part_latency;
+    gint64 wake_latency;       // 部分片段生成到等待中的请求得到回复的时间，微秒，平均
+} HlsStats;
+
+// 一个挂载点：分支里编码并复用成TS，appsink流线程切分后放进缓存，HTTP服务器在主循环里读取
+typedef struct HlsStream
+{
+    struct GstHlsServer *server;
+    gchar *path;
+    GstMedia *media;
+    gboolean audio;
+
+    GstElement *bin;
+    GstElement *v_queue, *v_convert, *v_encoder, *v_parse;
+    GstElement *a_queue, *a_convert, *a_resample, *a_encoder, *a_parse;
+    GstElement *mux, *sink;
+
+    // 缓存，appsink流线程写入，主循环读取
+    GMutex lock;
+    GQueue segments;           // HlsSegment，最后一个是正在生成的片段
+    guint64 sequence;          // 下一个片段的序号
+    GByteArray *pending;       // 正在生成的部分片段
+    GstClockTime part_start;   // 正在生成的部分片段的第一个时间戳
+    GstClockTime segment_start;
+    GstClockTime segment_capture; // 正在生成的片段第一个样本的运行时间，关键帧请求按它计算
+    GstClockTime part_capture; // 正在生成的部分片段第一个样本的运行时间
+    gboolean independent;      // 正在生成的部分片段以关键帧开始
+    gboolean cut;              // 收到强制关键帧事件，下一个buffer开始新片段
+    gboolean key_requested;
+    guint wake_id;             // 唤醒等待中的请求的主循环源
+    GList *waiters;            // 等待部分片段生成的HlsClient
+
+    HlsStats stats;
+    gint64 latency_sum, wake_sum;
+    guint64 woken;
+    gint64 published;          // 最近一个部分片段生成的时间，g_get_monotonic_time
+
+} HlsStream;
+
+typedef struct GstHlsServer
+{
+    GSocketService *service;
+    guint port;
+    GList *streams;            // HlsStream
+    GList *clients;            // HlsClient
+
+    GstClockTime target_duration; // 片段时长的上限，播放列表的TARGETDURATION是它向上取整的秒数
+    GstClockTime part_duration;
+    guint window;              // 播放列表里的完整片段数
+    guint64 max_bytes;         // 每个挂载点最多缓存的字节数
+
+    HlsConfigureFunc configure_func;
+    gpointer configure_data;
+
+} GstHlsServer;
+
+gboolean hls_server_init(GstHlsServer *self, guint port);
+void hls_server_destroy(GstHlsServer *self);
+// 修改片段时长等参数，在添加挂载点之前调用
+void hls_set_segmenting(GstHlsServer *self, GstClockTime target_duration, GstClockTime part_duration,
+                        guint window, guint64 max_bytes);
+gboolean hls_add_mount(GstHlsServer *self, GstMedia *media, const char *path, gboolean audio);
+gboolean hls_remove_mount(GstHlsServer *self, const char *path);
+HlsStream *hls_find_mount(GstHlsServer *self, const char *path);
+void hls_set_configure_func(GstHlsServer *self, HlsConfigureFunc func, gpointer user_data);
+gboolean hls_get_stats(GstHlsServer *self, const char *path, HlsStats *stats);
+
+// 只监听127.0.0.1
+gboolean hls_start(GstHlsServer *self);
+gboolean hls_stop(GstHlsServer *self);
+
+// 性能测试：发布uri，本进程里的客户端按LL-HLS阻塞请求跟随直播边缘，统计延迟和内存
+void hls_bench(const char *uri, gint seconds);
+
+#endif
@@ -0,0 +1,651 @@
+#include "gst-index.h"
+#include <gio/gio.h>
+#include <string.h>
+
+#define INDEX_MAGIC "GKIX"
+#define INDEX_VERSION 1
+#define INDEX_INIT_RECORD G_MAXUINT64
+#define INDEX_FLUSH_RECORDS 32                        // 攒够这么多条记录再刷盘
+#define INDEX_FLUSH_INTERVAL (1 * G_TIME_SPAN_SECOND) // 或者距离上次刷盘超过这么久
+
+#define FOURCC(a, b, c, d) ((guint32)(a) << 24 | (guint32)(b) << 16 | (guint32)(c) << 8 | (guint32)(d))
+#define SAMPLE_FLAG_NON_SYNC 0x00010000
+
+void index_parse_moov(GstKeyIndex *self, const guint8 *data, gsize size);
+void index_parse_moof(GstKeyIndex *self, const guint8 *data, gsize size, guint64 moof_offset);
+void index_append(GstKeyIndex *self, guint64 pts, guint64 offset);
+
+gboolean index_init(GstKeyIndex *self)
+{
+    if (!self)
+    {
+        g_printerr("Index instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstKeyIndex));
+    self->entries = g_array_new(FALSE, FALSE, sizeof(KeyIndexEntry));
+    g_mutex_init(&self->lock);
+
+    return TRUE;
+}
+
+void index_destroy(GstKeyIndex *self)
+{
+    if (!self)
+        return;
+
+    index_writer_close(self);
+
+    if (self->entries)
+    {
+        g_array_free(self->entries, TRUE);
+        self->entries = NULL;
+    }
+
+    g_mutex_clear(&self->lock);
+}
+
+gchar *index_sidecar_path(const char *filename)
+{
+    return g_strdup_printf("%s.idx", filename);
+}
+
+gboolean index_writer_open(GstKeyIndex *self, const char *path)
+{
+    if (!self || !path)
+    {
+        g_printerr("Invalid arguments to index_writer_open\n");
+        return FALSE;
+    }
+
+    index_writer_close(self);
+
+    g_mutex_lock(&self->lock);
+
+    self->file = fopen(path, "wb");
+    if (!self->file)
+    {
+        g_printerr("Could not open index file %s\n", path);
+        g_mutex_unlock(&self->lock);
+        return FALSE;
+    }
+
+    guint8 header[8];
+    memcpy(header, INDEX_MAGIC, 4);
+    GST_WRITE_UINT32_LE(header + 4, INDEX_VERSION);
+    fwrite(header, 1, sizeof(header), self->file);
+    fflush(self->file);
+
+    g_array_set_size(self->entries, 0);
+    self->init_size = 0;
+    self->offset = 0;
+    self->header_len = 0;
+    self->box_remaining = 0;
+    self->video_track_id = 0;
+    self->video_timescale = 0;
+    self->video_default_duration = 0;
+    self->video_default_flags = 0;
+    self->unflushed = 0;
+    self->last_flush = g_get_monotonic_time();
+
+    g_mutex_unlock(&self->lock);
+    return TRUE;
+}
+
+void index_writer_close(GstKeyIndex *self)
+{
+    if (!self)
+        return;
+
+    g_mutex_lock(&self->lock);
+
+    if (self->file)
+    {
+        fclose(self->file);
+        self->file = NULL;
+    }
+
+    if (self->box_data)
+    {
+        g_byte_array_unref(self->box_data);
+        self->box_data = NULL;
+    }
+
+    g_mutex_unlock(&self->lock);
+}
+
+// 追加一条记录，每个分片只有一次16字节的写入。在流线程里调用，不是每条都刷盘：
+// 初始化段立即刷，之后攒够INDEX_FLUSH_RECORDS条或超过INDEX_FLUSH_INTERVAL再刷，关闭时fclose刷出剩下的
+void index_append(GstKeyIndex *self, guint64 pts, guint64 offset)
+{
+    if (self->file)
+    {
+        guint8 record[16];
+        GST_WRITE_UINT64_LE(record, pts);
+        GST_WRITE_UINT64_LE(record + 8, offset);
+        fwrite(record, 1, sizeof(record), self->file);
+
+        gint64 now = g_get_monotonic_time();
+        if (pts == INDEX_INIT_RECORD || ++self->unflushed >= INDEX_FLUSH_RECORDS ||
+            now - self->last_flush >= INDEX_FLUSH_INTERVAL)
+        {
+            fflush(self->file);
+            self->unflushed = 0;
+            self->last_flush = now;
+        }
+    }
+
+    if (pts == INDEX_INIT_RECORD)
+    {
+        self->init_size = offset;
+        return;
+    }
+
+    KeyIndexEntry entry = {pts, offset};
+    g_array_append_val(self->entries, entry);
+}
+
+// 解析muxer输出的字节流，只收集moov和moof，mdat等直接跳过
+void index_writer_feed(GstKeyIndex *self, const guint8 *data, gsize size)
+{
+    if (!self)
+        return;
+
+    g_mutex_lock(&self->lock);
+
+    if (!self->file)
+    {
+        g_mutex_unlock(&self->lock);
+        return;
+    }
+
+    while (size > 0)
+    {
+        if (self->box_remaining == 0)
+        {
+            // 读取box头，size==1时还有8字节的largesize
+            guint need = 8;
+            if (self->header_len >= 8 && GST_READ_UINT32_BE(self->header) == 1)
+                need = 16;
+
+            guint n = MIN(need - self->header_len, size);
+            memcpy(self->header + self->header_len, data, n);
+            self->header_len += n;
+            data += n;
+            size -= n;
+            self->offset += n;
+
+            if (self->header_len < 8)
+                continue;
+            if (GST_READ_UINT32_BE(self->header) == 1 && self->header_len < 16)
+                continue;
+
+            guint64 box_size = GST_READ_UINT32_BE(self->header);
+            if (box_size == 1)
+                box_size = GST_READ_UINT64_BE(self->header + 8);
+            else if (box_size == 0)
+                box_size = G_MAXUINT64; // 一直延续到文件末尾
+
+            self->box_type = GST_READ_UINT32_BE(self->header + 4);
+            self->box_start = self->offset - self->header_len;
+
+            if (box_size < self->header_len)
+            {
+                g_printerr("Corrupt box in muxer output, index disabled\n");
+                fclose(self->file);
+                self->file = NULL;
+                break;
+            }
+
+            self->box_remaining = box_size == G_MAXUINT64 ? G_MAXUINT64 : box_size - self->header_len;
+
+            if (self->box_type == FOURCC('m', 'o', 'o', 'v') || self->box_type == FOURCC('m', 'o', 'o', 'f'))
+            {
+                self->box_data = g_byte_array_sized_new(box_size);
+                g_byte_array_append(self->box_data, self->header, self->header_len);
+            }
+            self->header_len = 0;
+
+            if (self->box_remaining > 0)
+                continue;
+        }
+        else
+        {
+            gsize n = (gsize)MIN(self->box_remaining, (guint64)size);
+            if (self->box_data)
+                g_byte_array_append(self->box_data, data, n);
+            data += n;
+            size -= n;
+            self->offset += n;
+            if (self->box_remaining != G_MAXUINT64)
+                self->box_remaining -= n;
+
+            if (self->box_remaining > 0)
+                continue;
+        }
+
+        // box已完整
+        if (self->box_data)
+        {
+            if (self->box_type == FOURCC('m', 'o', 'o', 'v'))
+                index_parse_moov(self, self->box_data->data, self->box_data->len);
+            else
+                index_parse_moof(self, self->box_data->data, self->box_data->len, self->box_start);
+
+            g_byte_array_unref(self->box_data);
+            self->box_data = NULL;
+        }
+    }
+
+    g_mutex_unlock(&self->lock);
+}
+
+// 在data中查找下一个box，返回它的类型和负载
+static gboolean index_next_box(const guint8 **data, gsize *size, guint32 *type,
+                               const guint8 **payload, gsize *payload_size)
+{
+    if (*size < 8)
+        return FALSE;
+
+    guint64 box_size = GST_READ_UINT32_BE(*data);
+    gsize header = 8;
+    if (box_size == 1)
+    {
+        if (*size < 16)
+            return FALSE;
+        box_size = GST_READ_UINT64_BE(*data + 8);
+        header = 16;
+    }
+    else if (box_size == 0)
+    {
+        box_size = *size;
+    }
+
+    if (box_size < header || box_size > *size)
+        return FALSE;
+
+    *type = GST_READ_UINT32_BE(*data + 4);
+    *payload = *data + header;
+    *payload_size = box_size - header;
+    *data += box_size;
+    *size -= box_size;
+    return TRUE;
+}
+
+static gboolean index_find_box(const guint8 *data, gsize size, guint32 wanted,
+                               const guint8 **payload, gsize *payload_size)
+{
+    guint32 type;
+    while (index_next_box(&data, &size, &type, payload, payload_size))
+    {
+        if (type == wanted)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// 从moov中找到视频轨道的ID、时间刻度和trex默认值
+void index_parse_moov(GstKeyIndex *self, const guint8 *data, gsize size)
+{
+    const guint8 *moov, *box, *payload;
+    gsize moov_size, box_size, payload_size;
+    guint32 type;
+
+    if (!index_find_box(data, size, FOURCC('m', 'o', 'o', 'v'), &moov, &moov_size))
+        return;
+
+    box = moov;
+    box_size = moov_size;
+    while (index_next_box(&box, &box_size, &type, &payload, &payload_size))
+    {
+        if (type != FOURCC('t', 'r', 'a', 'k'))
+            continue;
+
+        const guint8 *tkhd, *mdia, *mdhd, *hdlr;
+        gsize tkhd_size, mdia_size, mdhd_size, hdlr_size;
+
+        if (!index_find_box(payload, payload_size, FOURCC('t', 'k', 'h', 'd'), &tkhd, &tkhd_size) ||
+            !index_find_box(payload, payload_size, FOURCC('m', 'd', 'i', 'a'), &mdia, &mdia_size) ||
+            !index_find_box(mdia, mdia_size, FOURCC('m', 'd', 'h', 'd'), &mdhd, &mdhd_size) ||
+            !index_find_box(mdia, mdia_size, FOURCC('h', 'd', 'l', 'r'), &hdlr, &hdlr_size))
+            continue;
+
+        if (hdlr_size < 12 || GST_READ_UINT32_BE(hdlr + 8) != FOURCC('v', 'i', 'd', 'e'))
+            continue;
+
+        gsize id_pos = tkhd[0] == 1 ? 20 : 12;
+        gsize ts_pos = mdhd[0] == 1 ? 20 : 12;
+        if (tkhd_size < id_pos + 4 || mdhd_size < ts_pos + 4)
+            continue;
+
+        self->video_track_id = GST_READ_UINT32_BE(tkhd + id_pos);
+        self->video_timescale = GST_READ_UINT32_BE(mdhd + ts_pos);
+        break;
+    }
+
+    const guint8 *mvex, *trex;
+    gsize mvex_size, trex_size;
+    if (!index_find_box(moov, moov_size, FOURCC('m', 'v', 'e', 'x'), &mvex, &mvex_size))
+        return;
+
+    box = mvex;
+    box_size = mvex_size;
+    while (index_next_box(&box, &box_size, &type, &trex, &trex_size))
+    {
+        if (type == FOURCC('t', 'r', 'e', 'x') && trex_size >= 24 &&
+            GST_READ_UINT32_BE(trex + 4) == self->video_track_id)
+        {
+            self->video_default_duration = GST_READ_UINT32_BE(trex + 12);
+            self->video_default_flags = GST_READ_UINT32_BE(trex + 20);
+        }
+    }
+}
+
+// 在moof的视频traf中找到第一个同步样本，记录它的时间和moof偏移
+void index_parse_moof(GstKeyIndex *self, const guint8 *data, gsize size, guint64 moof_offset)
+{
+    const guint8 *moof, *traf;
+    gsize moof_size, traf_size;
+    guint32 type;
+
+    if (self->init_size == 0)
+        index_append(self, INDEX_INIT_RECORD, moof_offset);
+
+    if (self->video_timescale == 0)
+        return;
+
+    if (!index_find_box(data, size, FOURCC('m', 'o', 'o', 'f'), &moof, &moof_size))
+        return;
+
+    while (index_next_box(&moof, &moof_size, &type, &traf, &traf_size))
+    {
+        if (type != FOURCC('t', 'r', 'a', 'f'))
+            continue;
+
+        const guint8 *tfhd, *tfdt, *trun;
+        gsize tfhd_size, tfdt_size, trun_size;
+
+        if (!index_find_box(traf, traf_size, FOURCC('t', 'f', 'h', 'd'), &tfhd, &tfhd_size) || tfhd_size < 8 ||
+            GST_READ_UINT32_BE(tfhd + 4) != self->video_track_id)
+            continue;
+
+        // tfhd中的可选默认值
+        guint32 tfhd_flags = GST_READ_UINT32_BE(tfhd) & 0xffffff;
+        guint32 default_duration = self->video_default_duration;
+        guint32 default_flags = self->video_default_flags;
+        gsize pos = 8;
+        if (tfhd_flags & 0x01)
+            pos += 8;
+        if (tfhd_flags & 0x02)
+            pos += 4;
+        if (tfhd_flags & 0x08)
+        {
+            if (tfhd_size >= pos + 4)
+                default_duration = GST_READ_UINT32_BE(tfhd + pos);
+            pos += 4;
+        }
+        if (tfhd_flags & 0x10)
+            pos += 4;
+        if ((tfhd_flags & 0x20) && tfhd_size >= pos + 4)
+            default_flags = GST_READ_UINT32_BE(tfhd + pos);
+
+        guint64 decode_time = 0;
+        if (index_find_box(traf, traf_size, FOURCC('t', 'f', 'd', 't'), &tfdt, &tfdt_size))
+        {
+            if (tfdt[0] == 1 && tfdt_size >= 12)
+                decode_time = GST_READ_UINT64_BE(tfdt + 4);
+            else if (tfdt_size >= 8)
+                decode_time = GST_READ_UINT32_BE(tfdt + 4);
+        }
+
+        if (!index_find_box(traf, traf_size, FOURCC('t', 'r', 'u', 'n'), &trun, &trun_size) || trun_size < 8)
+            continue;
+
+        guint32 trun_flags = GST_READ_UINT32_BE(trun) & 0xffffff;
+        guint32 sample_count = GST_READ_UINT32_BE(trun + 4);
+        guint32 first_flags = default_flags;
+        gboolean has_first_flags = FALSE;
+        pos = 8;
+        if (trun_flags & 0x01)
+            pos += 4;
+        if (trun_flags & 0x04)
+        {
+            if (trun_size < pos + 4)
+                continue;
+            first_flags = GST_READ_UINT32_BE(trun + pos);
+            has_first_flags = TRUE;
+            pos += 4;
+        }
+
+        for (guint32 i = 0; i < sample_count; i++)
+        {
+            guint32 duration = default_duration;
+            guint32 flags = (i == 0 && has_first_flags) ? first_flags : default_flags;
+            gint32 cts = 0;
+
+            if (trun_flags & 0x100)
+            {
+                if (trun_size < pos + 4)
+                    break;
+                duration = GST_READ_UINT32_BE(trun + pos);
+                pos += 4;
+            }
+            if (trun_flags & 0x200)
+                pos += 4;
+            if (trun_flags & 0x400)
+            {
+                if (trun_size < pos + 4)
+                    break;
+                if (!(i == 0 && has_first_flags))
+                    flags = GST_READ_UINT32_BE(trun + pos);
+                pos += 4;
+            }
+            if (trun_flags & 0x800)
+            {
+                if (trun_size < pos + 4)
+                    break;
+                cts = (gint32)GST_READ_UINT32_BE(trun + pos);
+                pos += 4;
+            }
+
+            if (!(flags & SAMPLE_FLAG_NON_SYNC))
+            {
+                gint64 pts = (gint64)decode_time + cts;
+                if (pts < 0)
+                    pts = 0;
+                index_append(self, gst_util_uint64_scale(pts, GST_SECOND, self->video_timescale), moof_offset);
+                return;
+            }
+
+            decode_time += duration;
+        }
+    }
+}
+
+gboolean index_load(GstKeyIndex *self, const char *path)
+{
+    if (!self || !path)
+    {
+        g_printerr("Invalid arguments to index_load\n");
+        return FALSE;
+    }
+
+    gchar *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(path, &contents, &length, NULL))
+        return FALSE;
+
+    if (length < 8 || memcmp(contents, INDEX_MAGIC, 4) != 0 ||
+        GST_READ_UINT32_LE(contents + 4) != INDEX_VERSION)
+    {
+        g_printerr("Invalid index file %s\n", path);
+        g_free(contents);
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->lock);
+
+    g_array_set_size(self->entries, 0);
+    self->init_size = 0;
+
+    // 末尾不完整的记录（写入时崩溃）直接忽略
+    for (gsize pos = 8; pos + 16 <= length; pos += 16)
+    {
+        KeyIndexEntry entry;
+        entry.pts = GST_READ_UINT64_LE(contents + pos);
+        entry.offset = GST_READ_UINT64_LE(contents + pos + 8);
+
+        if (entry.pts == INDEX_INIT_RECORD)
+            self->init_size = entry.offset;
+        else
+            g_array_append_val(self->entries, entry);
+    }
+
+    g_mutex_unlock(&self->lock);
+
+    g_free(contents);
+    return TRUE;
+}
+
+// 没有sidecar时从文件本身建立索引：只读取moov和moof，mdat直接跳过，
+// 读取量只有box头和分片头
+gboolean index_scan_file(GstKeyIndex *self, const char *path)
+{
+    if (!self || !path)
+    {
+        g_printerr("Invalid arguments to index_scan_file\n");
+        return FALSE;
+    }
+
+    GFile *file = g_file_new_for_path(path);
+    GFileInputStream *stream = g_file_read(file, NULL, NULL);
+    g_object_unref(file);
+    if (!stream)
+    {
+        g_printerr("Could not open %s for indexing\n", path);
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->lock);
+    g_array_set_size(self->entries, 0);
+    self->init_size = 0;
+    self->video_track_id = 0;
+    self->video_timescale = 0;
+
+    guint64 offset = 0;
+    guint8 header[16];
+    gsize n;
+
+    while (g_input_stream_read_all(G_INPUT_STREAM(stream), header, 8, &n, NULL, NULL) && n == 8)
+    {
+        guint64 box_size = GST_READ_UINT32_BE(header);
+        guint32 type = GST_READ_UINT32_BE(header + 4);
+        gsize header_len = 8;
+
+        if (box_size == 1)
+        {
+            if (!g_input_stream_read_all(G_INPUT_STREAM(stream), header + 8, 8, &n, NULL, NULL) || n != 8)
+                break;
+            box_size = GST_READ_UINT64_BE(header + 8);
+            header_len = 16;
+        }
+
+        if (box_size == 0 || box_size < header_len)
+            break;
+
+        if (type == FOURCC('m', 'o', 'o', 'v') || type == FOURCC('m', 'o', 'o', 'f'))
+        {
+            guint8 *box = g_malloc(box_size);
+            memcpy(box, header, header_len);
+            if (!g_input_stream_read_all(G_INPUT_STREAM(stream), box + header_len, box_size - header_len, &n, NULL, NULL) ||
+                n != box_size - header_len)
+            {
+                g_free(box);
+                break;
+            }
+
+            if (type == FOURCC('m', 'o', 'o', 'v'))
+                index_parse_moov(self, box, box_size);
+            else
+                index_parse_moof(self, box, box_size, offset);
+            g_free(box);
+        }
+        else if (!g_seekable_seek(G_SEEKABLE(stream), offset + box_size, G_SEEK_SET, NULL, NULL))
+        {
+            break;
+        }
+
+        offset += box_size;
+    }
+
+    gboolean found = self->entries->len > 0;
+    g_mutex_unlock(&self->lock);
+    g_object_unref(stream);
+
+    return found;
+}
+
+guint index_count(GstKeyIndex *self)
+{
+    if (!self || !self->entries)
+        return 0;
+
+    g_mutex_lock(&self->lock);
+    guint count = self->entries->len;
+    g_mutex_unlock(&self->lock);
+    return count;
+}
+
+// 查找pts之前（含）最近的关键帧
+gboolean index_lookup(GstKeyIndex *self, guint64 pts, KeyIndexEntry *entry)
+{
+    if (!self || !self->entries)
+        return FALSE;
+
+    // 录制时流线程会同时追加记录，长度也要在锁内读取
+    g_mutex_lock(&self->lock);
+
+    guint lo = 0, hi = self->entries->len;
+    while (lo < hi)
+    {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(self->entries, KeyIndexEntry, mid).pts <= pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    gboolean found = lo > 0;
+    if (found && entry)
+        *entry = g_array_index(self->entries, KeyIndexEntry, lo - 1);
+
+    g_mutex_unlock(&self->lock);
+    return found;
+}
+
+// 查找pts之后（不含）的第一个关键帧
+gboolean index_lookup_after(GstKeyIndex *self, guint64 pts, KeyIndexEntry *entry)
+{
+    if (!self || !self->entries)
+        return FALSE;
+
+    g_mutex_lock(&self->lock);
+
+    guint lo = 0, hi = self->entries->len;
+    while (lo < hi)
+    {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(self->entries, KeyIndexEntry, mid).pts <= pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    gboolean found = lo < self->entries->len;
+    if (found && entry)
+        *entry = g_array_index(self->entries, KeyIndexEntry, lo);
+
+    g_mutex_unlock(&self->lock);
+    return found;
+}
@@ -0,0 +1,61 @@
+#ifndef __GST_INDEX_H__
+#define __GST_INDEX_H__
+
+#include <gst/gst.h>
+#include <stdio.h>
+
+// 关键帧索引：记录分片MP4中每个分片(moof)的首个关键帧时间和它在文件中的字节偏移，
+// 录制时写到 <文件名>.idx，播放和剪辑时直接查表，不用扫描整个文件。
+//
+// sidecar格式：8字节文件头 "GKIX" + 版本号(u32 LE)，之后是16字节定长记录
+// { u64 pts(ns), u64 offset }，小端。pts为G_MAXUINT64的记录表示初始化段(ftyp+moov)的大小。
+// 记录只追加，分批刷盘，崩溃时最多丢失最后一秒左右的记录，末尾不完整的记录在加载时忽略。
+
+typedef struct KeyIndexEntry
+{
+    guint64 pts;    // 关键帧时间(ns)
+    guint64 offset; // 包含该关键帧的moof在文件中的偏移
+} KeyIndexEntry;
+
+typedef struct GstKeyIndex
+{
+    GArray *entries;  // KeyIndexEntry，按pts递增
+    guint64 init_size;
+
+    // 写入状态（录制时由流线程调用，需要加锁）
+    GMutex lock;
+    FILE *file;
+    guint64 offset;             // 已经经过解析器的字节数
+    guint8 header[16];
+    guint header_len;
+    guint64 box_remaining;
+    guint64 box_start;
+    guint32 box_type;
+    GByteArray *box_data;       // 正在收集的moov/moof
+    guint32 video_track_id;
+    guint32 video_timescale;
+    guint32 video_default_duration;
+    guint32 video_default_flags;
+    guint unflushed;            // 写入后还没有fflush的记录数
+    gint64 last_flush;          // 上次fflush的单调时间(us)
+
+} GstKeyIndex;
+
+gboolean index_init(GstKeyIndex *self);
+void index_destroy(GstKeyIndex *self);
+gchar *index_sidecar_path(const char *filename);
+
+// 录制端
+gboolean index_writer_open(GstKeyIndex *self, const char *path);
+void index_writer_feed(GstKeyIndex *self, const guint8 *data, gsize size);
+void index_writer_close(GstKeyIndex *self);
+
+// 读取端
+gboolean index_load(GstKeyIndex *self, const char *path);
+gboolean index_scan_file(GstKeyIndex *self, const char *path);
+
+guint index_count(GstKeyIndex *self);
+gboolean index_lookup(GstKeyIndex *self, guint64 pts, KeyIndexEntry *entry);
+gboolean index_lookup_after(GstKeyIndex *self, guint64 pts, KeyIndexEntry *entry);
+
+#endif
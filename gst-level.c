@@ -0,0 +1,542 @@
+#include "gst-level.h"
+#include <gst/audio/audio.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEVEL_X86 1
+#include <immintrin.h>
+#endif
+
+// 单精度累加的块大小，每块结束后合并到双精度，避免长buffer的精度损失
+#define LEVEL_CHUNK 4096
+#define LEVEL_SILENCE -120.0
+
+// 累加data中samples个交错采样的平方和与峰值（已归一化到[-1,1]）
+typedef void (*LevelF32Func)(const gfloat *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak);
+typedef void (*LevelS16Func)(const gint16 *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak);
+
+typedef struct LevelKernel
+{
+    const char *name;
+    LevelF32Func f32;
+    LevelS16Func s16;
+    gint lanes;  // 向量宽度，只有声道数能整除它时才能用，这样每个通道固定对应一个声道
+    gboolean available;
+} LevelKernel;
+
+GstPadProbeReturn level_on_sink_data(GstPad *pad, GstPadProbeInfo *info, GstAudioLevel *self);
+void level_set_caps(GstAudioLevel *self, GstCaps *caps);
+void level_process(GstAudioLevel *self, const guint8 *data, gsize size);
+void level_update_vad(GstAudioLevel *self, gdouble energy, GstClockTime duration);
+void level_report(GstAudioLevel *self);
+LevelKernel *level_get_kernel(gint channels);
+
+static inline gdouble level_to_db(gdouble value)
+{
+    return value > 0 ? MAX(10.0 * log10(value), LEVEL_SILENCE) : LEVEL_SILENCE;
+}
+
+void level_f32_c(const gfloat *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    for (gsize i = 0; i < samples; i++)
+    {
+        gint c = i % channels;
+        gdouble v = data[i];
+        sumsq[c] += v * v;
+        peak[c] = MAX(peak[c], fabs(v));
+    }
+}
+
+void level_s16_c(const gint16 *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    for (gsize i = 0; i < samples; i++)
+    {
+        gint c = i % channels;
+        gdouble v = data[i] / 32768.0;
+        sumsq[c] += v * v;
+        peak[c] = MAX(peak[c], fabs(v));
+    }
+}
+
+#ifdef LEVEL_X86
+// 把各向量通道的结果合并到对应的声道，lane j对应声道 j % channels
+static void level_fold(const gfloat *acc, const gfloat *pk, gint lanes, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    for (gint j = 0; j < lanes; j++)
+    {
+        sumsq[j % channels] += acc[j];
+        peak[j % channels] = MAX(peak[j % channels], pk[j]);
+    }
+}
+
+__attribute__((target("sse2")))
+void level_f32_sse2(const gfloat *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    gsize i = 0;
+    while (i + 4 <= samples)
+    {
+        gsize end = MIN(samples, i + LEVEL_CHUNK) & ~(gsize)3;
+        __m128 acc = _mm_setzero_ps(), pk = _mm_setzero_ps();
+        for (; i < end; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(data + i);
+            acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+            pk = _mm_max_ps(pk, _mm_and_ps(v, abs_mask));
+        }
+        gfloat a[4], p[4];
+        _mm_storeu_ps(a, acc);
+        _mm_storeu_ps(p, pk);
+        level_fold(a, p, 4, channels, sumsq, peak);
+    }
+    // 剩余不足一个向量的采样，i是4的倍数，声道对应关系不变
+    for (; i < samples; i++)
+    {
+        gdouble v = data[i];
+        sumsq[i % channels] += v * v;
+        peak[i % channels] = MAX(peak[i % channels], fabs(v));
+    }
+}
+
+__attribute__((target("sse2")))
+void level_s16_sse2(const gint16 *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    gsize i = 0;
+    while (i + 8 <= samples)
+    {
+        gsize end = MIN(samples, i + LEVEL_CHUNK) & ~(gsize)7;
+        __m128 acc = _mm_setzero_ps(), pk = _mm_setzero_ps();
+        for (; i < end; i += 8)
+        {
+            // 符号扩展到32位再转成浮点
+            __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), scale);
+            __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), scale);
+            acc = _mm_add_ps(acc, _mm_add_ps(_mm_mul_ps(lo, lo), _mm_mul_ps(hi, hi)));
+            pk = _mm_max_ps(pk, _mm_max_ps(_mm_and_ps(lo, abs_mask), _mm_and_ps(hi, abs_mask)));
+        }
+        gfloat a[4], p[4];
+        _mm_storeu_ps(a, acc);
+        _mm_storeu_ps(p, pk);
+        level_fold(a, p, 4, channels, sumsq, peak);
+    }
+    for (; i < samples; i++)
+    {
+        gdouble v = data[i] / 32768.0;
+        sumsq[i % channels] += v * v;
+        peak[i % channels] = MAX(peak[i % channels], fabs(v));
+    }
+}
+
+__attribute__((target("avx2")))
+void level_f32_avx2(const gfloat *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    gsize i = 0;
+    while (i + 8 <= samples)
+    {
+        gsize end = MIN(samples, i + LEVEL_CHUNK) & ~(gsize)7;
+        __m256 acc = _mm256_setzero_ps(), pk = _mm256_setzero_ps();
+        for (; i < end; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(data + i);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(v, v));
+            pk = _mm256_max_ps(pk, _mm256_and_ps(v, abs_mask));
+        }
+        gfloat a[8], p[8];
+        _mm256_storeu_ps(a, acc);
+        _mm256_storeu_ps(p, pk);
+        level_fold(a, p, 8, channels, sumsq, peak);
+    }
+    for (; i < samples; i++)
+    {
+        gdouble v = data[i];
+        sumsq[i % channels] += v * v;
+        peak[i % channels] = MAX(peak[i % channels], fabs(v));
+    }
+}
+
+__attribute__((target("avx2")))
+void level_s16_avx2(const gint16 *data, gsize samples, gint channels, gdouble *sumsq, gdouble *peak)
+{
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    gsize i = 0;
+    while (i + 16 <= samples)
+    {
+        gsize end = MIN(samples, i + LEVEL_CHUNK) & ~(gsize)15;
+        __m256 acc = _mm256_setzero_ps(), pk = _mm256_setzero_ps();
+        for (; i < end; i += 16)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(x))), scale);
+            __m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1))), scale);
+            acc = _mm256_add_ps(acc, _mm256_add_ps(_mm256_mul_ps(lo, lo), _mm256_mul_ps(hi, hi)));
+            pk = _mm256_max_ps(pk, _mm256_max_ps(_mm256_and_ps(lo, abs_mask), _mm256_and_ps(hi, abs_mask)));
+        }
+        gfloat a[8], p[8];
+        _mm256_storeu_ps(a, acc);
+        _mm256_storeu_ps(p, pk);
+        level_fold(a, p, 8, channels, sumsq, peak);
+    }
+    for (; i < samples; i++)
+    {
+        gdouble v = data[i] / 32768.0;
+        sumsq[i % channels] += v * v;
+        peak[i % channels] = MAX(peak[i % channels], fabs(v));
+    }
+}
+#endif
+
+// 按运行时CPU特性选择，顺序从快到慢
+static LevelKernel level_kernels[] = {
+#ifdef LEVEL_X86
+    {"avx2", level_f32_avx2, level_s16_avx2, 8, FALSE},
+    {"sse2", level_f32_sse2, level_s16_sse2, 4, FALSE},
+#endif
+    {"scalar", level_f32_c, level_s16_c, 1, TRUE},
+};
+
+static gpointer level_detect_kernels(gpointer data)
+{
+#ifdef LEVEL_X86
+    __builtin_cpu_init();
+    level_kernels[0].available = __builtin_cpu_supports("avx2");
+    level_kernels[1].available = __builtin_cpu_supports("sse2");
+#endif
+    return NULL;
+}
+
+// 5.1之类声道数不能整除向量宽度的布局退回到标量实现
+LevelKernel *level_get_kernel(gint channels)
+{
+    static GOnce once = G_ONCE_INIT;
+    g_once(&once, level_detect_kernels, NULL);
+
+    for (guint i = 0; i < G_N_ELEMENTS(level_kernels); i++)
+    {
+        if (level_kernels[i].available && level_kernels[i].lanes % channels == 0)
+            return &level_kernels[i];
+    }
+    return &level_kernels[G_N_ELEMENTS(level_kernels) - 1];
+}
+
+gboolean level_init(GstAudioLevel *self)
+{
+    if (!self)
+    {
+        g_printerr("Audio level instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstAudioLevel));
+    g_mutex_init(&self->lock);
+
+    self->interval = 100 * GST_MSECOND;
+    self->vad_threshold = 9.0;
+    self->vad_min_level = -55.0;
+    self->hangover = 300 * GST_MSECOND;
+    self->noise_floor = LEVEL_SILENCE;
+
+    // 创建元素
+    self->bin = GST_BIN(gst_bin_new("level_bin"));
+    self->a_queue = gst_element_factory_make("queue", "level_a_queue");
+    self->a_convert = gst_element_factory_make("audioconvert", "level_a_convert");
+    self->a_filter = gst_element_factory_make("capsfilter", "level_a_filter");
+    self->a_sink = gst_element_factory_make("fakesink", "level_a_sink");
+
+    if (!self->bin || !self->a_queue || !self->a_convert || !self->a_filter || !self->a_sink)
+    {
+        g_printerr("Could not create audio level elements.\n");
+        level_destroy(self);
+        return FALSE;
+    }
+
+    // bin会被加入媒体管道，这里持有自己的引用，销毁时再释放
+    gst_object_ref_sink(self->bin);
+
+    gst_bin_add_many(self->bin, self->a_queue, self->a_convert, self->a_filter, self->a_sink, NULL);
+
+    // 分析跟不上时丢弃，不能反压tee
+    g_object_set(self->a_queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                 "max-size-time", (guint64)(200 * GST_MSECOND), NULL);
+
+    // 源本身是S16或F32时audioconvert直接透传
+    GstCaps *caps = gst_caps_from_string("audio/x-raw, format=(string){ " GST_AUDIO_NE(S16) ", " GST_AUDIO_NE(F32) " }, "
+                                         "layout=(string)interleaved");
+    g_object_set(self->a_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(self->a_sink, "sync", FALSE, "async", FALSE, NULL);
+
+    if (!gst_element_link_many(self->a_queue, self->a_convert, self->a_filter, self->a_sink, NULL))
+    {
+        g_printerr("Audio level elements could not be linked.\n");
+        level_destroy(self);
+        return FALSE;
+    }
+
+    GstPad *sink_pad = gst_element_get_static_pad(self->a_sink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      (GstPadProbeCallback)level_on_sink_data, self, NULL);
+    gst_object_unref(sink_pad);
+
+    // 创建ghost pad
+    GstPad *a_pad = gst_element_get_static_pad(self->a_queue, "sink");
+    GstPad *a_ghost_pad = gst_ghost_pad_new("a_sink", a_pad);
+    gst_element_add_pad(GST_ELEMENT(self->bin), a_ghost_pad);
+    gst_pad_set_active(a_ghost_pad, TRUE);
+    gst_object_unref(a_pad);
+
+    return TRUE;
+}
+
+void level_destroy(GstAudioLevel *self)
+{
+    if (!self)
+        return;
+
+    if (self->bin)
+    {
+        gst_object_unref(self->bin);
+        self->bin = NULL;
+    }
+
+    g_mutex_clear(&self->lock);
+}
+
+gboolean level_link(GstAudioLevel *self, GstMedia *media)
+{
+    if (!self || !self->bin || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to level_link\n");
+        return FALSE;
+    }
+
+    return media_add_audio_branch(media, GST_ELEMENT(self->bin));
+}
+
+void level_get_stats(GstAudioLevel *self, AudioLevelStats *stats)
+{
+    if (!self || !stats)
+        return;
+
+    g_mutex_lock(&self->lock);
+    *stats = self->stats;
+    g_mutex_unlock(&self->lock);
+}
+
+GstPadProbeReturn level_on_sink_data(GstPad *pad, GstPadProbeInfo *info, GstAudioLevel *self)
+{
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            GstCaps *caps = NULL;
+            gst_event_parse_caps(event, &caps);
+            level_set_caps(self, caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (self->channels > 0 && gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        level_process(self, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void level_set_caps(GstAudioLevel *self, GstCaps *caps)
+{
+    GstAudioInfo info;
+    if (!caps || !gst_audio_info_from_caps(&info, caps))
+    {
+        self->channels = 0;
+        return;
+    }
+
+    self->channels = GST_AUDIO_INFO_CHANNELS(&info);
+    self->rate = GST_AUDIO_INFO_RATE(&info);
+    self->is_float = GST_AUDIO_INFO_FORMAT(&info) == GST_AUDIO_FORMAT_F32;
+    self->frames = 0;
+    memset(self->sumsq, 0, sizeof(self->sumsq));
+    memset(self->peak, 0, sizeof(self->peak));
+}
+
+// 在fakesink的流线程中运行
+void level_process(GstAudioLevel *self, const guint8 *data, gsize size)
+{
+    gint channels = self->channels;
+    gint bps = self->is_float ? sizeof(gfloat) : sizeof(gint16);
+    gsize frames = size / (bps * channels);
+    if (frames == 0 || self->rate <= 0)
+        return;
+
+    // 超过LEVEL_MAX_CHANNELS的声道只计入能量，不单独上报
+    gdouble sumsq[64] = {0}, peak[64] = {0};
+    if (channels > (gint)G_N_ELEMENTS(sumsq))
+        return;
+
+    LevelKernel *kernel = level_get_kernel(channels);
+    if (self->is_float)
+        kernel->f32((const gfloat *)data, frames * channels, channels, sumsq, peak);
+    else
+        kernel->s16((const gint16 *)data, frames * channels, channels, sumsq, peak);
+
+    gdouble energy = 0;
+    for (gint c = 0; c < channels; c++)
+    {
+        energy += sumsq[c];
+        if (c < LEVEL_MAX_CHANNELS)
+        {
+            self->sumsq[c] += sumsq[c];
+            self->peak[c] = MAX(self->peak[c], peak[c]);
+        }
+    }
+    self->frames += frames;
+
+    GstClockTime duration = gst_util_uint64_scale(frames, GST_SECOND, self->rate);
+    self->position += duration;
+    level_update_vad(self, level_to_db(energy / (frames * channels)), duration);
+
+    if (self->position >= self->next_report)
+    {
+        level_report(self);
+        self->next_report = self->position + self->interval;
+    }
+}
+
+// 能量VAD：噪声底遇到更安静的buffer时快速下降，有声音时按每秒0.5dB缓慢上升，
+// 这样持续的背景噪声最终会被当成噪声底，而短时的说话不会
+void level_update_vad(GstAudioLevel *self, gdouble energy, GstClockTime duration)
+{
+    if (self->noise_floor <= LEVEL_SILENCE)
+        self->noise_floor = energy;
+    else if (energy < self->noise_floor)
+        self->noise_floor += (energy - self->noise_floor) * 0.5;
+    else
+        self->noise_floor += MIN(energy - self->noise_floor, 0.5 * duration / GST_SECOND);
+
+    gboolean loud = energy >= self->vad_min_level && energy >= self->noise_floor + self->vad_threshold;
+    gboolean changed = FALSE;
+
+    if (loud)
+    {
+        self->last_voice = self->position;
+        changed = !self->voice;
+        self->voice = TRUE;
+    }
+    else if (self->voice && self->position - self->last_voice >= self->hangover)
+    {
+        changed = TRUE;
+        self->voice = FALSE;
+    }
+
+    g_mutex_lock(&self->lock);
+    self->stats.energy = energy;
+    self->stats.noise_floor = self->noise_floor;
+    self->stats.voice = self->voice;
+    g_mutex_unlock(&self->lock);
+
+    if (changed)
+    {
+        GstStructure *s = gst_structure_new("vad",
+                                            "active", G_TYPE_BOOLEAN, self->voice,
+                                            "energy", G_TYPE_DOUBLE, energy,
+                                            "noise-floor", G_TYPE_DOUBLE, self->noise_floor,
+                                            NULL);
+        gst_element_post_message(GST_ELEMENT(self->bin), gst_message_new_element(GST_OBJECT(self->bin), s));
+    }
+}
+
+void level_report(GstAudioLevel *self)
+{
+    if (self->frames == 0)
+        return;
+
+    gint channels = MIN(self->channels, LEVEL_MAX_CHANNELS);
+    GValue rms_array = G_VALUE_INIT, peak_array = G_VALUE_INIT;
+    g_value_init(&rms_array, GST_TYPE_ARRAY);
+    g_value_init(&peak_array, GST_TYPE_ARRAY);
+
+    g_mutex_lock(&self->lock);
+    self->stats.channels = channels;
+    for (gint c = 0; c < channels; c++)
+    {
+        self->stats.rms[c] = level_to_db(self->sumsq[c] / self->frames);
+        self->stats.peak[c] = level_to_db(self->peak[c] * self->peak[c]);
+
+        GValue v = G_VALUE_INIT;
+        g_value_init(&v, G_TYPE_DOUBLE);
+        g_value_set_double(&v, self->stats.rms[c]);
+        gst_value_array_append_value(&rms_array, &v);
+        g_value_set_double(&v, self->stats.peak[c]);
+        gst_value_array_append_value(&peak_array, &v);
+        g_value_unset(&v);
+    }
+    g_mutex_unlock(&self->lock);
+
+    GstStructure *s = gst_structure_new("audio-level",
+                                        "position", G_TYPE_UINT64, (guint64)self->position,
+                                        "voice", G_TYPE_BOOLEAN, self->voice,
+                                        NULL);
+    gst_structure_take_value(s, "rms", &rms_array);
+    gst_structure_take_value(s, "peak", &peak_array);
+    gst_element_post_message(GST_ELEMENT(self->bin), gst_message_new_element(GST_OBJECT(self->bin), s));
+
+    self->frames = 0;
+    memset(self->sumsq, 0, sizeof(self->sumsq));
+    memset(self->peak, 0, sizeof(self->peak));
+}
+
+// 电平内核性能测试：main.out --bench-level，输出处理一路音频占用单核的比例
+void level_bench(gint channels, gint rate, gint seconds)
+{
+    gsize samples = (gsize)rate * channels * seconds;
+    gfloat *f32 = g_new(gfloat, samples);
+    gint16 *s16 = g_new(gint16, samples);
+    GRand *rand = g_rand_new_with_seed(1);
+
+    for (gsize i = 0; i < samples; i++)
+    {
+        f32[i] = g_rand_double_range(rand, -1.0, 1.0);
+        s16[i] = (gint16)(f32[i] * 32767);
+    }
+
+    level_get_kernel(channels);
+
+    for (guint k = 0; k < G_N_ELEMENTS(level_kernels); k++)
+    {
+        LevelKernel *kernel = &level_kernels[k];
+        if (!kernel->available || kernel->lanes % channels != 0)
+        {
+            g_print("%dch %-6s not supported\n", channels, kernel->name);
+            continue;
+        }
+
+        gdouble sumsq[LEVEL_MAX_CHANNELS] = {0}, peak[LEVEL_MAX_CHANNELS] = {0};
+        gint64 start = g_get_monotonic_time();
+        kernel->f32(f32, samples, channels, sumsq, peak);
+        gint64 f32_time = MAX(g_get_monotonic_time() - start, 1);
+
+        start = g_get_monotonic_time();
+        kernel->s16(s16, samples, channels, sumsq, peak);
+        gint64 s16_time = MAX(g_get_monotonic_time() - start, 1);
+
+        g_print("%dch %dHz %-6s F32 %.4f%% S16 %.4f%% of a core (rms[0] %.2f dB)\n", channels, rate, kernel->name,
+                100.0 * f32_time / (seconds * G_USEC_PER_SEC),
+                100.0 * s16_time / (seconds * G_USEC_PER_SEC),
+                level_to_db(sumsq[0] / (2.0 * rate * seconds)));
+    }
+
+    g_rand_free(rand);
+    g_free(f32);
+    g_free(s16);
+}
@@ -0,0 +1,58 @@
+#ifndef __GST_LEVEL_H__
+#define __GST_LEVEL_H__
+
+#include <gst/gst.h>
+#include "gst-media.h"
+
+// 音频电平和声音活动检测分支：挂在a_tee上，按interval统计每个声道的RMS/峰值，
+// 并根据自适应噪声底做能量VAD。结果可以通过level_get_stats读取，
+// 同时以element消息发到总线上："audio-level"（每个interval）和"vad"（状态变化时）
+
+#define LEVEL_MAX_CHANNELS 8
+
+typedef struct AudioLevelStats
+{
+    gint channels;
+    gdouble rms[LEVEL_MAX_CHANNELS];   // dB，满幅为0
+    gdouble peak[LEVEL_MAX_CHANNELS];  // dB
+    gdouble energy;                    // 最近一个buffer所有声道的平均能量，dB
+    gdouble noise_floor;               // dB
+    gboolean voice;
+} AudioLevelStats;
+
+typedef struct GstAudioLevel
+{
+    GstBin *bin;
+    GstElement *a_queue, *a_convert, *a_filter, *a_sink;
+
+    // 参数
+    GstClockTime interval;      // 电平消息间隔
+    gdouble vad_threshold;      // 能量高出噪声底多少dB认为有声音
+    gdouble vad_min_level;      // 低于该电平一律认为是静音，dB
+    GstClockTime hangover;      // 声音消失后保持活动状态的时间
+
+    // 分析状态（流线程）
+    gint channels, rate;
+    gboolean is_float;
+    gdouble sumsq[LEVEL_MAX_CHANNELS];
+    gdouble peak[LEVEL_MAX_CHANNELS];
+    guint64 frames;             // 当前interval内累计的帧数
+    GstClockTime position;      // 按采样数累计的时间
+    GstClockTime next_report;
+    gdouble noise_floor;
+    gboolean voice;
+    GstClockTime last_voice;
+
+    GMutex lock;
+    AudioLevelStats stats;
+
+} GstAudioLevel;
+
+gboolean level_init(GstAudioLevel *self);
+void level_destroy(GstAudioLevel *self);
+gboolean level_link(GstAudioLevel *self, GstMedia *media);
+void level_get_stats(GstAudioLevel *self, AudioLevelStats *stats);
+
+void level_bench(gint channels, gint rate, gint seconds);
+
+#endif
@@ -0,0 +1,451 @@
+#include "gst-log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+G_STATIC_ASSERT(sizeof(LogRecord) == 256);
+G_STATIC_ASSERT((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0);
+
+// 单生产者单消费者的环：只有所属线程写head，只有日志线程写tail
+typedef struct LogRing
+{
+    LogRecord records[LOG_RING_SIZE];
+    volatile gint head;
+    volatile gint tail;
+    volatile gint dropped;    // 还没有报告的丢弃数
+    gboolean orphaned;        // 线程已经退出，写完剩下的记录后释放，lock保护
+    guint32 thread;
+} LogRing;
+
+typedef struct GstLog
+{
+    GThread *thread;
+    GMutex lock;              // 保护rings和输出，写日志的线程只在第一次写入和退出时获取
+    GCond cond;
+    GList *rings;             // LogRing
+    gboolean running;
+    guint32 next_thread;
+
+    FILE *file;
+    gboolean journal;
+
+    guint64 written, dropped;
+
+    // 同一秒内的记录复用格式化好的时间
+    gint64 cached_second;
+    gchar cached_time[32];
+} GstLog;
+
+void log_ring_release(LogRing *ring);
+LogRing *log_ring_get(void);
+gpointer log_thread_func(gpointer data);
+void log_drain(void);
+void log_output(const LogRecord *record);
+void log_mark_truncated(char *text, gsize size);
+
+volatile gint log_level = LOG_LEVEL_INFO;
+static volatile gint log_active;
+static GstLog log_state;
+static GPrivate log_ring_key = G_PRIVATE_INIT((GDestroyNotify)log_ring_release);
+
+static const char *const log_level_names[] = {"error", "warning", "info", "debug"};
+
+gboolean log_start(const char *target)
+{
+    if (!target)
+    {
+        g_printerr("Invalid arguments to log_start\n");
+        return FALSE;
+    }
+
+    g_mutex_lock(&log_state.lock);
+    if (log_state.running)
+    {
+        g_mutex_unlock(&log_state.lock);
+        g_printerr("Logging already started\n");
+        return FALSE;
+    }
+
+    log_state.file = NULL;
+    log_state.journal = FALSE;
+    if (strcmp(target, "journal") == 0)
+    {
+#ifdef G_OS_UNIX
+        log_state.journal = TRUE;
+#else
+        g_mutex_unlock(&log_state.lock);
+        g_printerr("The journal is not available on this platform\n");
+        return FALSE;
+#endif
+    }
+    else if (strcmp(target, "-") == 0)
+    {
+        log_state.file = stderr;
+    }
+    else if (!(log_state.file = fopen(target, "a")))
+    {
+        g_mutex_unlock(&log_state.lock);
+        g_printerr("Could not open log file %s\n", target);
+        return FALSE;
+    }
+
+    log_state.cached_second = -1;
+    log_state.written = 0;
+    log_state.dropped = 0;
+    log_state.running = TRUE;
+    log_state.thread = g_thread_new("log", log_thread_func, NULL);
+    g_mutex_unlock(&log_state.lock);
+
+    g_atomic_int_set(&log_active, 1);
+    return TRUE;
+}
+
+// 停止后台线程并写出剩下的记录，之后的日志恢复同步输出
+void log_stop(void)
+{
+    g_atomic_int_set(&log_active, 0);
+
+    g_mutex_lock(&log_state.lock);
+    if (!log_state.running)
+    {
+        g_mutex_unlock(&log_state.lock);
+        return;
+    }
+    log_state.running = FALSE;
+    g_cond_signal(&log_state.cond);
+    g_mutex_unlock(&log_state.lock);
+
+    g_thread_join(log_state.thread);
+    log_state.thread = NULL;
+
+    if (log_state.file && log_state.file != stderr)
+        fclose(log_state.file);
+    log_state.file = NULL;
+}
+
+void log_set_level(LogLevel level)
+{
+    g_atomic_int_set(&log_level, CLAMP((gint)level, LOG_LEVEL_ERROR, LOG_LEVEL_DEBUG));
+}
+
+gboolean log_parse_level(const char *name, LogLevel *level)
+{
+    for (guint i = 0; name && i < G_N_ELEMENTS(log_level_names); i++)
+    {
+        if (g_ascii_strcasecmp(name, log_level_names[i]) == 0)
+        {
+            *level = (LogLevel)i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+const char *log_level_name(LogLevel level)
+{
+    return level <= LOG_LEVEL_DEBUG ? log_level_names[level] : "unknown";
+}
+
+void log_write(LogLevel level, const char *stream, const char *branch, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    // 没有启动日志线程时直接输出
+    if (!g_atomic_int_get(&log_active))
+    {
+        gchar *message = g_strdup_vprintf(format, args);
+        if (level <= LOG_LEVEL_WARNING)
+            g_printerr("%s%s%s%s\n", stream ? "[" : "", stream ? stream : "", stream ? "] " : "", message);
+        else
+            g_print("%s%s%s%s\n", stream ? "[" : "", stream ? stream : "", stream ? "] " : "", message);
+        g_free(message);
+        va_end(args);
+        return;
+    }
+
+    LogRing *ring = log_ring_get();
+    guint head = (guint)ring->head;
+    if (head - (guint)g_atomic_int_get(&ring->tail) >= LOG_RING_SIZE)
+    {
+        g_atomic_int_inc(&ring->dropped);
+        va_end(args);
+        return;
+    }
+
+    LogRecord *record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    record->time = g_get_real_time();
+    record->thread = ring->thread;
+    record->level = (guint8)level;
+    if (g_strlcpy(record->stream, stream ? stream : "", sizeof(record->stream)) >= sizeof(record->stream))
+        log_mark_truncated(record->stream, sizeof(record->stream));
+    if (g_strlcpy(record->branch, branch ? branch : "", sizeof(record->branch)) >= sizeof(record->branch))
+        log_mark_truncated(record->branch, sizeof(record->branch));
+    if (g_vsnprintf(record->message, sizeof(record->message), format, args) >= (gint)sizeof(record->message))
+        log_mark_truncated(record->message, sizeof(record->message));
+    va_end(args);
+
+    // 记录写完之后才让日志线程看到
+    g_atomic_int_set(&ring->head, (gint)(head + 1));
+}
+
+// 截断的字段以"…"结尾，不在UTF-8字符中间截断
+void log_mark_truncated(char *text, gsize size)
+{
+    static const char ellipsis[] = "\xe2\x80\xa6";
+    gsize end = size - sizeof(ellipsis);
+    while (end > 0 && ((guchar)text[end] & 0xC0) == 0x80)
+        end--;
+    memcpy(text + end, ellipsis, sizeof(ellipsis));
+}
+
+LogRing *log_ring_get(void)
+{
+    LogRing *ring = g_private_get(&log_ring_key);
+    if (ring)
+        return ring;
+
+    ring = g_new0(LogRing, 1);
+    g_mutex_lock(&log_state.lock);
+    ring->thread = ++log_state.next_thread;
+    log_state.rings = g_list_prepend(log_state.rings, ring);
+    g_mutex_unlock(&log_state.lock);
+
+    g_private_set(&log_ring_key, ring);
+    return ring;
+}
+
+// 线程退出时调用
+void log_ring_release(LogRing *ring)
+{
+    g_mutex_lock(&log_state.lock);
+    if (log_state.running)
+    {
+        ring->orphaned = TRUE;
+        ring = NULL;
+    }
+    else
+    {
+        log_state.rings = g_list_remove(log_state.rings, ring);
+    }
+    g_mutex_unlock(&log_state.lock);
+
+    g_free(ring);
+}
+
+gpointer log_thread_func(gpointer data)
+{
+    g_mutex_lock(&log_state.lock);
+    while (log_state.running)
+    {
+        log_drain();
+        gint64 deadline = g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND;
+        g_cond_wait_until(&log_state.cond, &log_state.lock, deadline);
+    }
+    log_drain();
+    g_mutex_unlock(&log_state.lock);
+    return NULL;
+}
+
+// 在lock下调用：写出所有环里的记录
+void log_drain(void)
+{
+    for (GList *l = log_state.rings; l;)
+    {
+        LogRing *ring = l->data;
+        GList *next = l->next;
+
+        guint tail = (guint)ring->tail;
+        guint head = (guint)g_atomic_int_get(&ring->head);
+        for (; tail != head; tail++)
+            log_output(&ring->records[tail & (LOG_RING_SIZE - 1)]);
+        g_atomic_int_set(&ring->tail, (gint)tail);
+
+        gint dropped = g_atomic_int_get(&ring->dropped);
+        if (dropped)
+        {
+            g_atomic_int_add(&ring->dropped, -dropped);
+            log_state.dropped += dropped;
+
+            LogRecord record = {0};
+            record.time = g_get_real_time();
+            record.thread = ring->thread;
+            record.level = LOG_LEVEL_WARNING;
+            g_snprintf(record.message, sizeof(record.message), "%d records dropped", dropped);
+            log_output(&record);
+        }
+
+        if (ring->orphaned && tail == (guint)g_atomic_int_get(&ring->head))
+        {
+            log_state.rings = g_list_delete_link(log_state.rings, l);
+            g_free(ring);
+        }
+        l = next;
+    }
+
+    if (log_state.file)
+        fflush(log_state.file);
+}
+
+void log_output(const LogRecord *record)
+{
+    const char *stream = record->stream[0] ? record->stream : "-";
+    const char *branch = record->branch[0] ? record->branch : "-";
+    log_state.written++;
+
+#ifdef G_OS_UNIX
+    if (log_state.journal)
+    {
+        static const char *const priorities[] = {"3", "4", "6", "7"};
+        gchar thread[16];
+        g_snprintf(thread, sizeof(thread), "%u", record->thread);
+        const GLogField fields[] = {
+            {"MESSAGE", record->message, -1},
+            {"PRIORITY", priorities[MIN(record->level, LOG_LEVEL_DEBUG)], -1},
+            {"SYSLOG_IDENTIFIER", g_get_prgname() ? g_get_prgname() : "gst-player", -1},
+            {"GST_STREAM", stream, -1},
+            {"GST_BRANCH", branch, -1},
+            {"GST_THREAD", thread, -1},
+        };
+        g_log_writer_journald(G_LOG_LEVEL_MESSAGE, fields, G_N_ELEMENTS(fields), NULL);
+        return;
+    }
+#endif
+
+    gint64 second = record->time / G_USEC_PER_SEC;
+    if (second != log_state.cached_second)
+    {
+        GDateTime *time = g_date_time_new_from_unix_local(second);
+        gchar *text = time ? g_date_time_format(time, "%Y-%m-%d %H:%M:%S") : NULL;
+        g_strlcpy(log_state.cached_time, text ? text : "-", sizeof(log_state.cached_time));
+        g_free(text);
+        if (time)
+            g_date_time_unref(time);
+        log_state.cached_second = second;
+    }
+
+    fprintf(log_state.file, "%s.%06d %s thread=%u stream=%s branch=%s msg=%s\n",
+            log_state.cached_time, (int)(record->time % G_USEC_PER_SEC), log_level_name(record->level),
+            record->thread, stream, branch, record->message);
+}
+
+void log_get_stats(LogStats *stats)
+{
+    if (!stats)
+        return;
+
+    g_mutex_lock(&log_state.lock);
+    stats->written = log_state.written;
+    stats->dropped = log_state.dropped;
+    stats->threads = 0;
+    for (GList *l = log_state.rings; l; l = l->next)
+    {
+        LogRing *ring = l->data;
+        stats->dropped += g_atomic_int_get(&ring->dropped);
+        stats->threads += !ring->orphaned;
+    }
+    g_mutex_unlock(&log_state.lock);
+}
+
+// 性能测试：每个线程连续写events条记录，测量写入一条的耗时。每批写半个环后等日志线程写完，
+// 等待时间不计入，只测没有丢弃时的写入开销；再测被级别过滤掉的调用和同步fprintf+fflush作为对比
+
+#ifdef G_OS_WIN32
+#define LOG_NULL_DEVICE "NUL"
+#else
+#define LOG_NULL_DEVICE "/dev/null"
+#endif
+
+typedef struct LogBench
+{
+    gint events;
+    LogLevel level;           // 写入使用的级别
+    gboolean sync;            // 同步输出到file
+    FILE *file;
+    gint64 elapsed;           // 纳秒
+} LogBench;
+
+static gpointer log_bench_thread(gpointer data)
+{
+    LogBench *bench = data;
+    const gint batch = LOG_RING_SIZE / 2;
+
+    for (gint done = 0; done < bench->events; done += batch)
+    {
+        gint count = MIN(batch, bench->events - done);
+        gint64 start = g_get_monotonic_time();
+        for (gint i = 0; i < count; i++)
+        {
+            if (bench->sync)
+            {
+                fprintf(bench->file, "stream=bench branch=bench_bin msg=event %d value %d\n", done + i, i * 3);
+                fflush(bench->file);
+            }
+            else
+            {
+                LOG_AT(bench->level, "bench", "bench_bin", "event %d value %d", done + i, i * 3);
+            }
+        }
+        bench->elapsed += (g_get_monotonic_time() - start) * 1000;
+        g_usleep(20 * 1000);
+    }
+    return NULL;
+}
+
+static gdouble log_bench_run(gint threads, gint events, LogLevel level, gboolean sync, FILE *file)
+{
+    LogBench *benches = g_new0(LogBench, threads);
+    GThread **handles = g_new0(GThread *, threads);
+    for (gint i = 0; i < threads; i++)
+    {
+        benches[i].events = events;
+        benches[i].level = level;
+        benches[i].sync = sync;
+        benches[i].file = file;
+        handles[i] = g_thread_new("log-bench", log_bench_thread, &benches[i]);
+    }
+
+    gint64 elapsed = 0;
+    for (gint i = 0; i < threads; i++)
+    {
+        g_thread_join(handles[i]);
+        elapsed += benches[i].elapsed;
+    }
+
+    g_free(handles);
+    g_free(benches);
+    return (gdouble)elapsed / ((gint64)threads * events);
+}
+
+void log_bench(gint threads, gint events)
+{
+    if (threads <= 0 || events <= 0)
+        return;
+
+    FILE *null = fopen(LOG_NULL_DEVICE, "w");
+    if (!null || !log_start(LOG_NULL_DEVICE))
+    {
+        g_printerr("Could not open %s for the log benchmark\n", LOG_NULL_DEVICE);
+        if (null)
+            fclose(null);
+        return;
+    }
+
+    LogLevel saved = (LogLevel)g_atomic_int_get(&log_level);
+    log_set_level(LOG_LEVEL_INFO);
+    gdouble written = log_bench_run(threads, events, LOG_LEVEL_INFO, FALSE, NULL);
+    gdouble filtered = log_bench_run(threads, events, LOG_LEVEL_DEBUG, FALSE, NULL);
+    gdouble sync = log_bench_run(threads, events, LOG_LEVEL_INFO, TRUE, null);
+    log_set_level(saved);
+
+    LogStats stats;
+    log_stop();
+    log_get_stats(&stats);
+    fclose(null);
+
+    g_print("log: %d threads x %d events\n", threads, events);
+    g_print("  ring write:         %.0f ns/event (%" G_GUINT64_FORMAT " written, %" G_GUINT64_FORMAT " dropped)\n",
+            written, stats.written, stats.dropped);
+    g_print("  filtered by level:  %.1f ns/event\n", filtered);
+    g_print("  fprintf + fflush:   %.0f ns/event\n", sync);
+}
@@ -0,0 +1,68 @@
+#ifndef __GST_LOG_H__
+#define __GST_LOG_H__
+
+#include <glib.h>
+
+// 结构化事件日志：每个线程第一次写日志时分配一个自己的环形缓冲区，写入只格式化到环里的一条
+// 定长记录，不加锁、不做I/O；后台线程把所有线程的记录写到文件或systemd journal。
+// 环满时新记录被丢弃并计数，流线程永远不会因为日志阻塞。
+//
+// 没有调用log_start时退回到同步输出（g_print/g_printerr），工具和性能测试不需要启动日志线程。
+// 记录按线程分别写出，不同线程之间的先后以时间戳为准。
+
+typedef enum
+{
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+#define LOG_RING_SIZE 1024     // 每个线程的记录数（共256KB），必须是2的幂
+#define LOG_ID_SIZE 32
+#define LOG_MESSAGE_SIZE 180
+
+// 一条记录256字节，超长的流名、分支名和消息截断后以"…"结尾
+typedef struct LogRecord
+{
+    gint64 time;               // g_get_real_time，微秒
+    guint32 thread;            // 线程序号，按第一次写日志的顺序分配
+    guint8 level;
+    char stream[LOG_ID_SIZE - 1];
+    char branch[LOG_ID_SIZE];  // 分支bin的名字
+    char message[LOG_MESSAGE_SIZE];
+} LogRecord;
+
+typedef struct LogStats
+{
+    guint64 written;           // 已经写出的记录
+    guint64 dropped;           // 环满时丢弃的记录
+    guint threads;             // 当前有环的线程数
+} LogStats;
+
+// 当前级别，高于它的记录在调用处就被过滤掉，不会格式化
+extern volatile gint log_level;
+
+#define LOG_AT(level, stream, branch, ...)                              \
+    do                                                                  \
+    {                                                                   \
+        if ((gint)(level) <= g_atomic_int_get(&log_level))              \
+            log_write((level), (stream), (branch), __VA_ARGS__);        \
+    } while (0)
+
+#define LOG_ERROR(stream, branch, ...) LOG_AT(LOG_LEVEL_ERROR, stream, branch, __VA_ARGS__)
+#define LOG_WARNING(stream, branch, ...) LOG_AT(LOG_LEVEL_WARNING, stream, branch, __VA_ARGS__)
+#define LOG_INFO(stream, branch, ...) LOG_AT(LOG_LEVEL_INFO, stream, branch, __VA_ARGS__)
+#define LOG_DEBUG(stream, branch, ...) LOG_AT(LOG_LEVEL_DEBUG, stream, branch, __VA_ARGS__)
+
+// target：文件路径（追加写入），"-"表示stderr，"journal"表示systemd journal（仅Unix）
+gboolean log_start(const char *target);
+void log_stop(void);
+void log_set_level(LogLevel level);
+gboolean log_parse_level(const char *name, LogLevel *level);
+const char *log_level_name(LogLevel level);
+void log_write(LogLevel level, const char *stream, const char *branch, const char *format, ...) G_GNUC_PRINTF(4, 5);
+void log_get_stats(LogStats *stats);
+void log_bench(gint threads, gint events);
+
+#endif
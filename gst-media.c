@@ -1,9 +1,94 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include "gst-media.h"
+#include "gst-log.h"
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
 #include <string.h>
+#include <time.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
 
 void media_on_src_pad_added(GstElement *src, GstPad *new_pad, GstMedia *self);
 void media_on_src_pad_removed(GstElement *src, GstPad *new_pad, GstMedia *self);
 gboolean media_on_bus_message(GstBus *bus, GstMessage *msg, GstMedia *self);
+GstSeekFlags media_seek_flags(MediaSeekMode mode, gdouble rate);
+void media_load_index(GstMedia *self, const char *uri);
+gchar **media_on_timeline_format_location(GstElement *splitmux, GstMedia *self);
+void media_on_timeline_pad_added(GstElement *splitmux, GstPad *new_pad, GstElement *bin);
+void media_on_timeline_decoded_pad(GstElement *decodebin, GstPad *new_pad, GstElement *bin);
+void media_on_src_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, GstMedia *self);
+void media_on_buffering(GstMedia *self, GstMessage *msg);
+void media_cache_check_complete(GstMedia *self);
+GstPadProbeReturn media_on_branch_pad_idle(GstPad *tee_src_pad, GstPadProbeInfo *info, GstPad *branch_sink_pad);
+gboolean media_remove_branch(GstElement *branch, const char *pad_name);
+gboolean media_snapshot_add_branch(GstMedia *self);
+void media_snapshot_run(gpointer job, gpointer unused);
+void media_finish_state_request(GstMedia *self, gboolean success);
+gboolean media_on_state_idle(GstMedia *self);
+void media_on_pipeline_state(GstMedia *self, GstState new_state, GstState pending_state);
+void media_reset_timings(GstMedia *self);
+GstPadProbeReturn media_on_first_frame(GstPad *pad, GstPadProbeInfo *info, GstMedia *self);
+GstElement *media_make_uri_source(void);
+gboolean media_src_selects_streams(GstMedia *self);
+GstBusSyncReply media_on_bus_sync(GstBus *bus, GstMessage *msg, GstMedia *self);
+void media_on_stream_collection(GstMedia *self, GstMessage *msg);
+void media_on_streams_selected(GstMedia *self, GstMessage *msg);
+gboolean media_apply_stream_selection(GstMedia *self);
+
+#define MEDIA_SNAPSHOT_TIMEOUT (2 * GST_SECOND)
+#define MEDIA_MEMORY_INTERVAL 100  // 毫秒
+#define MEDIA_UNLINK_TIMEOUT (1 * G_TIME_SPAN_SECOND)
+#define MEDIA_FIRST_FRAME_PROBE "media-first-frame-probe"  // v_tee的pad上还没有触发的第一帧探针id
+
+// 超出预算时被限制的queue和它原来的设置，释放限制时恢复
+typedef struct MediaMemoryLimit
+{
+    GstElement *queue;
+    gint leaky;
+    guint max_bytes, max_buffers;
+    guint64 max_time;
+} MediaMemoryLimit;
+
+typedef struct MediaMemoryBranch
+{
+    MediaMemoryUsage usage;
+    GstElement *element;  // 分支本身，只在汇总时使用，不持有引用
+    guint64 limit;        // 限制生效时分支的上限，降到一半以下时解除
+    GList *limits;        // MediaMemoryLimit
+    gboolean seen;
+} MediaMemoryBranch;
+
+typedef struct MediaMemorySource
+{
+    GstElement *branch;
+    MediaMemoryFunc func;
+    gpointer user_data;
+} MediaMemorySource;
+
+gboolean media_on_memory_poll(GstMedia *self);
+guint64 media_memory_update_branch(GstMedia *self, GstElement *element);
+void media_memory_limit(GstMedia *self, const char *name, MediaMemoryBranch *branch, guint64 limit);
+void media_memory_release(GstMedia *self, const char *name, MediaMemoryBranch *branch);
+void media_memory_branch_free(MediaMemoryBranch *branch);
+
+typedef struct MediaSnapshotJob
+{
+    GstMedia *media;
+    MediaSnapshotFormat format;
+    gint width, height;
+    GArray *waiters;  // MediaSnapshotWaiter
+} MediaSnapshotJob;
+
+typedef struct MediaSnapshotWaiter
+{
+    MediaSnapshotCallback callback;
+    gpointer user_data;
+} MediaSnapshotWaiter;
 
 gboolean media_init(GstMedia *self)
 {
@@ -14,10 +99,19 @@ gboolean media_init(GstMedia *self)
     }
 
     memset(self, 0, sizeof(GstMedia));
+    g_mutex_init(&self->snapshot_lock);
+    g_cond_init(&self->snapshot_cond);
+    g_mutex_init(&self->timing_lock);
+    g_mutex_init(&self->stream_lock);
+    self->branch_timings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    self->state_target = GST_STATE_VOID_PENDING;
+    self->memory_branches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                  (GDestroyNotify)media_memory_branch_free);
+    self->branch_budgets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
     /* 创建元素 */
     self->pipeline = gst_pipeline_new("media-pipeline");
-    self->src = gst_element_factory_make("uridecodebin", "source");
+    self->src = media_make_uri_source();
     self->v_tee = gst_element_factory_make("tee", "videotee");
     self->a_tee = gst_element_factory_make("tee", "audiotee");
 
@@ -34,10 +128,12 @@ gboolean media_init(GstMedia *self)
     // 动态连接元素
     g_signal_connect(self->src, "pad-added", G_CALLBACK(media_on_src_pad_added), self);
     g_signal_connect(self->src, "pad-removed", G_CALLBACK(media_on_src_pad_removed), self);
+    g_signal_connect(self->src, "deep-element-added", G_CALLBACK(media_on_src_element_added), self);
 
     // 监听pipeline的总线
     self->bus = gst_element_get_bus(self->pipeline);
     if (self->bus) {
+        gst_bus_set_sync_handler(self->bus, (GstBusSyncHandler)media_on_bus_sync, self, NULL);
         gst_bus_add_watch(self->bus, (GstBusFunc)media_on_bus_message, self);
     } else {
         g_printerr("Could not get bus from pipeline\n");
@@ -45,22 +141,61 @@ gboolean media_init(GstMedia *self)
 
     self->state = MEDIA_STATE_STOPPED;
     self->current_uri = NULL;
+    self->rate = 1.0;
+    self->buffer_size = -1;
+    self->buffer_duration = -1;
+    self->video_track = 0;
+    self->audio_track = 0;
+
+    self->memory_poll_id = g_timeout_add(MEDIA_MEMORY_INTERVAL, (GSourceFunc)media_on_memory_poll, self);
 
     return TRUE;
 }
 
+// 优先使用uridecodebin3：它发布流集合并且只解码选中的轨道，uridecodebin会解码暴露出来的每一个轨道。
+// 没有uridecodebin3的旧版本退回到uridecodebin，此时轨道选择不起作用
+GstElement *media_make_uri_source(void)
+{
+    GstElement *src = gst_element_factory_make("uridecodebin3", "source");
+    if (!src)
+        src = gst_element_factory_make("uridecodebin", "source");
+    return src;
+}
+
 void media_destroy(GstMedia *self)
 {
     if (!self)
         return;
 
+    if (self->memory_poll_id)
+    {
+        g_source_remove(self->memory_poll_id);
+        self->memory_poll_id = 0;
+    }
+
     if (self->pipeline)
     {
         gst_element_set_state(self->pipeline, GST_STATE_NULL);
     }
 
+    // 管道停止后appsink不会再阻塞，等待已经提交的截图任务结束
+    g_mutex_lock(&self->snapshot_lock);
+    while (self->snapshot_running)
+        g_cond_wait(&self->snapshot_cond, &self->snapshot_lock);
+    g_mutex_unlock(&self->snapshot_lock);
+
+    if (self->snapshot_last)
+    {
+        gst_sample_unref(self->snapshot_last);
+        self->snapshot_last = NULL;
+    }
+    self->snapshot_sink = NULL;
+
     if (self->bus)
     {
+        // 停止管道时产生的消息还在总线上，不移除监听的话会在self释放后分发
+        gst_bus_set_sync_handler(self->bus, NULL, NULL, NULL);
+        gst_bus_remove_watch(self->bus);
         gst_object_unref(self->bus);
         self->bus = NULL;
     }
@@ -76,6 +211,62 @@ void media_destroy(GstMedia *self)
         g_free(self->current_uri);
         self->current_uri = NULL;
     }
+
+    g_strfreev(self->timeline);
+    self->timeline = NULL;
+    g_free(self->name);
+    self->name = NULL;
+
+    g_free(self->cache_dir);
+    self->cache_dir = NULL;
+    g_free(self->cache_path);
+    self->cache_path = NULL;
+    gst_clear_object(&self->download_queue);
+
+    if (self->index)
+    {
+        index_destroy(self->index);
+        g_free(self->index);
+        self->index = NULL;
+    }
+
+    g_list_free_full(self->bus_listeners, g_free);
+    self->bus_listeners = NULL;
+
+    // 还在等待的异步请求不再回调
+    g_idle_remove_by_data(self);
+    if (self->branch_timings)
+    {
+        g_hash_table_destroy(self->branch_timings);
+        self->branch_timings = NULL;
+    }
+    g_mutex_clear(&self->timing_lock);
+
+    gst_clear_object(&self->streams);
+    g_free(self->audio_language);
+    self->audio_language = NULL;
+    g_mutex_clear(&self->stream_lock);
+    g_free(self->selected_video);
+    self->selected_video = NULL;
+    g_free(self->selected_audio);
+    self->selected_audio = NULL;
+
+    // 释放对被限制的queue的引用
+    if (self->memory_branches)
+    {
+        g_hash_table_destroy(self->memory_branches);
+        self->memory_branches = NULL;
+    }
+    if (self->branch_budgets)
+    {
+        g_hash_table_destroy(self->branch_budgets);
+        self->branch_budgets = NULL;
+    }
+    g_list_free_full(self->memory_sources, g_free);
+    self->memory_sources = NULL;
+
+    g_mutex_clear(&self->snapshot_lock);
+    g_cond_clear(&self->snapshot_cond);
 }
 
 gboolean media_set_uri(GstMedia *self, const char *uri)
@@ -86,288 +277,1957 @@ gboolean media_set_uri(GstMedia *self, const char *uri)
         return FALSE;
     }
 
+    // 从时间线模式切回普通URI源
+    if (self->timeline)
+    {
+        GstElement *src = media_make_uri_source();
+        if (!src || !media_set_source(self, src))
+        {
+            g_printerr("Could not create uridecodebin\n");
+            return FALSE;
+        }
+        g_signal_connect(self->src, "deep-element-added", G_CALLBACK(media_on_src_element_added), self);
+        g_strfreev(self->timeline);
+        self->timeline = NULL;
+    }
+
     if (self->current_uri)
     {
         g_free(self->current_uri);
     }
     self->current_uri = g_strdup(uri);
 
-    g_object_set(self->src, "uri", uri, NULL);
-    return TRUE;
-}
+    g_free(self->cache_path);
+    self->cache_path = NULL;
+    gst_clear_object(&self->download_queue);
+    self->buffering = FALSE;
+    g_mutex_lock(&self->stream_lock);
+    gst_clear_object(&self->streams);
+    g_mutex_unlock(&self->stream_lock);
 
-gboolean media_play(GstMedia *self)
-{
-    if (!self || !self->pipeline)
+    // 网络源：启用缓冲消息；配置了缓存目录时下载到本地，已经下载过的直接播放缓存文件
+    gboolean network = gst_uri_is_valid(uri) && !g_str_has_prefix(uri, "file:");
+    gchar *cached_uri = NULL;
+    if (network && self->cache_dir)
     {
-        g_printerr("Player not initialized\n");
-        return FALSE;
-    }
+        gchar *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, uri, -1);
+        self->cache_path = g_build_filename(self->cache_dir, key, NULL);
+        g_free(key);
 
-    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, GST_STATE_PLAYING);
-    if (ret == GST_STATE_CHANGE_FAILURE)
-    {
-        g_printerr("Unable to set the pipeline to the playing state.\n");
-        return FALSE;
+        if (g_file_test(self->cache_path, G_FILE_TEST_IS_REGULAR))
+        {
+            cached_uri = g_filename_to_uri(self->cache_path, NULL, NULL);
+            LOG_INFO(self->name, NULL, "Playing %s from cache %s", uri, self->cache_path);
+            g_free(self->cache_path);
+            self->cache_path = NULL;
+        }
     }
 
-    self->state = MEDIA_STATE_PLAYING;
+    g_object_set(self->src,
+                 "uri", cached_uri ? cached_uri : uri,
+                 "use-buffering", network && !cached_uri,
+                 "download", self->cache_path != NULL,
+                 "buffer-size", self->buffer_size,
+                 "buffer-duration", self->buffer_duration,
+                 NULL);
+    media_load_index(self, cached_uri ? cached_uri : uri);
+    g_free(cached_uri);
     return TRUE;
 }
 
-gboolean media_pause(GstMedia *self)
+void media_set_name(GstMedia *self, const char *name)
 {
-    if (!self || !self->pipeline)
+    if (!self)
+        return;
+
+    g_free(self->name);
+    self->name = g_strdup(name);
+}
+
+// 设置网络源的缓冲大小和时长，-1表示使用uridecodebin的默认值，下一次media_set_uri时生效
+void media_set_buffering(GstMedia *self, gint buffer_size, gint64 buffer_duration)
+{
+    if (!self)
+        return;
+
+    self->buffer_size = buffer_size;
+    self->buffer_duration = buffer_duration;
+}
+
+// 设置下载缓存目录，缓存文件以URI的SHA1命名。dir为NULL时关闭缓存
+gboolean media_set_cache_dir(GstMedia *self, const char *dir)
+{
+    if (!self)
     {
-        g_printerr("Player not initialized\n");
+        g_printerr("Invalid arguments to media_set_cache_dir\n");
         return FALSE;
     }
 
-    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, GST_STATE_PAUSED);
-    if (ret == GST_STATE_CHANGE_FAILURE)
+    g_free(self->cache_dir);
+    self->cache_dir = NULL;
+
+    if (!dir)
+        return TRUE;
+
+    if (g_mkdir_with_parents(dir, 0755) != 0)
     {
-        g_printerr("Unable to set the pipeline to the paused state.\n");
+        g_printerr("Could not create cache directory %s\n", dir);
         return FALSE;
     }
 
-    self->state = MEDIA_STATE_PAUSED;
+    self->cache_dir = g_strdup(dir);
     return TRUE;
 }
 
-gboolean media_stop(GstMedia *self)
+// 开启download时uridecodebin创建下载用的queue2，uridecodebin3（urisourcebin）创建downloadbuffer。
+// 把它的临时文件放到缓存目录里，这样下载完成后可以直接硬链接成缓存文件，不需要再复制一遍
+void media_on_src_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, GstMedia *self)
 {
-    if (!self || !self->pipeline)
-    {
-        g_printerr("Player not initialized\n");
-        return FALSE;
-    }
+    GstElementFactory *factory = gst_element_get_factory(element);
+    if (!factory || !self->cache_path)
+        return;
 
-    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, GST_STATE_READY);
-    if (ret == GST_STATE_CHANGE_FAILURE)
+    gboolean download = g_strcmp0(GST_OBJECT_NAME(factory), "downloadbuffer") == 0;
+    if (g_strcmp0(GST_OBJECT_NAME(factory), "queue2") == 0)
     {
-        g_printerr("Unable to set the pipeline to the stopped state.\n");
-        return FALSE;
+        // 只用于缓冲的queue2没有临时文件模板，加入bin之前设置了模板的才是下载用的
+        gchar *template = NULL;
+        g_object_get(element, "temp-template", &template, NULL);
+        download = template != NULL;
+        g_free(template);
     }
+    if (!download)
+        return;
 
-    self->state = MEDIA_STATE_STOPPED;
-    return TRUE;
+    gchar *template = g_strdup_printf("%s-XXXXXX", self->cache_path);
+    g_object_set(element, "temp-template", template, "temp-remove", TRUE, NULL);
+    g_free(template);
+
+    // 持有引用，源重建内部元素后旧的下载元素可能已经释放
+    gst_clear_object(&self->download_queue);
+    self->download_queue = gst_object_ref(element);
 }
 
-void media_seek(GstMedia *self, gint64 position)
+// 下载完整后把下载元素的临时文件链接成缓存文件。临时文件本身仍由下载元素在结束时删除
+void media_cache_check_complete(GstMedia *self)
 {
-    if (!self || !self->pipeline)
-    {
-        g_printerr("Player not initialized\n");
+    if (!self->download_queue || !self->cache_path)
         return;
+
+    gint64 total = 0;
+    if (!gst_element_query_duration(self->download_queue, GST_FORMAT_BYTES, &total) || total <= 0)
+        return;
+
+    gboolean complete = FALSE;
+    GstQuery *query = gst_query_new_buffering(GST_FORMAT_BYTES);
+    if (gst_element_query(self->download_queue, query))
+    {
+        guint n = gst_query_get_n_buffering_ranges(query);
+        for (guint i = 0; i < n && !complete; i++)
+        {
+            gint64 start, stop;
+            if (gst_query_parse_nth_buffering_range(query, i, &start, &stop))
+                complete = start <= 0 && stop >= total;
+        }
     }
+    gst_query_unref(query);
+
+    if (!complete)
+        return;
+
+    gchar *temp_location = NULL;
+    g_object_get(self->download_queue, "temp-location", &temp_location, NULL);
+    if (!temp_location)
+        return;
+
+    // 先写到临时名再改名，避免其他进程读到不完整的缓存
+    gchar *partial = g_strdup_printf("%s.part", self->cache_path);
+    gboolean ok;
+#ifdef G_OS_UNIX
+    ok = link(temp_location, partial) == 0;
+#else
+    GFile *src = g_file_new_for_path(temp_location);
+    GFile *dst = g_file_new_for_path(partial);
+    ok = g_file_copy(src, dst, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, NULL);
+    g_object_unref(src);
+    g_object_unref(dst);
+#endif
+    if (ok && g_rename(partial, self->cache_path) == 0)
+        LOG_INFO(self->name, NULL, "Cached %" G_GINT64_FORMAT " bytes to %s", total, self->cache_path);
+    else
+        LOG_WARNING(self->name, NULL, "Could not store download cache %s", self->cache_path);
 
-    gst_element_seek(self->pipeline, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
-                     GST_SEEK_TYPE_SET, position,
-                     GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    g_free(partial);
+    g_free(temp_location);
+    g_free(self->cache_path);
+    self->cache_path = NULL;
 }
 
-void media_on_src_pad_added(GstElement *src, GstPad *new_pad, GstMedia *self)
+// 缓冲不足时暂停，缓冲满了再恢复到目标状态。直播源不能暂停，只记录缓冲状态
+void media_on_buffering(GstMedia *self, GstMessage *msg)
 {
-    g_print("Received new pad '%s' from '%s':\n", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
+    gint percent = 0;
+    gst_message_parse_buffering(msg, &percent);
 
-    GstPadLinkReturn ret;
-    GstCaps *new_pad_caps = NULL;
-    GstStructure *new_pad_struct = NULL;
-    const gchar *new_pad_type = NULL;
+    media_cache_check_complete(self);
 
-    GstPad *video_sink_pad = gst_element_get_static_pad(self->v_tee, "sink");
-    GstPad *audio_sink_pad = gst_element_get_static_pad(self->a_tee, "sink");
+    if (self->is_live)
+        return;
 
-    if (!video_sink_pad || !audio_sink_pad)
+    if (percent < 100)
     {
-        g_printerr("Could not get sink pads\n");
-        goto cleanup;
+        if (!self->buffering && self->state == MEDIA_STATE_PLAYING)
+        {
+            LOG_INFO(self->name, NULL, "Buffering %d%%, pausing", percent);
+            gst_element_set_state(self->pipeline, GST_STATE_PAUSED);
+        }
+        self->buffering = TRUE;
     }
-
-    if (gst_pad_is_linked(video_sink_pad) && gst_pad_is_linked(audio_sink_pad))
+    else if (self->buffering)
     {
-        g_print("We are already linked. Ignoring.\n");
-        goto cleanup;
+        self->buffering = FALSE;
+        LOG_INFO(self->name, NULL, "Buffering complete");
+        if (self->state == MEDIA_STATE_PLAYING)
+            gst_element_set_state(self->pipeline, GST_STATE_PLAYING);
     }
+}
 
-    new_pad_caps = gst_pad_get_current_caps(new_pad);
-    if (!new_pad_caps)
+// 本地文件旁边有GstRecorder生成的.idx时加载，用于快速定位和剪辑
+void media_load_index(GstMedia *self, const char *uri)
+{
+    if (self->index)
     {
-        g_printerr("Could not get caps from new pad\n");
-        goto cleanup;
+        index_destroy(self->index);
+        g_free(self->index);
+        self->index = NULL;
     }
 
-    new_pad_struct = gst_caps_get_structure(new_pad_caps, 0);
-    if (!new_pad_struct)
-    {
-        g_printerr("Could not get structure from caps\n");
-        goto cleanup;
-    }
+    gchar *filename = g_filename_from_uri(uri, NULL, NULL);
+    if (!filename)
+        return;
 
-    new_pad_type = gst_structure_get_name(new_pad_struct);
-    if (g_str_has_prefix(new_pad_type, "video/"))
-    {
-        ret = gst_pad_link(new_pad, video_sink_pad);
-        if (GST_PAD_LINK_FAILED(ret))
-            g_print("Type is '%s' but link failed.\n", new_pad_type);
-        else
-            g_print("Video link succeeded (type '%s').\n", new_pad_type);
-    }
-    else if (g_str_has_prefix(new_pad_type, "audio/"))
+    gchar *index_path = index_sidecar_path(filename);
+    if (g_file_test(index_path, G_FILE_TEST_IS_REGULAR))
     {
-        ret = gst_pad_link(new_pad, audio_sink_pad);
-        if (GST_PAD_LINK_FAILED(ret))
-            g_print("Type is '%s' but link failed.\n", new_pad_type);
+        self->index = g_new0(GstKeyIndex, 1);
+        index_init(self->index);
+        if (index_load(self->index, index_path))
+        {
+            LOG_INFO(self->name, NULL, "Loaded keyframe index %s (%u entries)", index_path, index_count(self->index));
+        }
         else
-            g_print("Audio link succeeded (type '%s').\n", new_pad_type);
-    }
-    else
-    {
-        g_print("It has type '%s' which is not supported. Ignoring.\n", new_pad_type);
+        {
+            index_destroy(self->index);
+            g_free(self->index);
+            self->index = NULL;
+        }
     }
 
-cleanup:
-    if (new_pad_caps != NULL)
-        gst_caps_unref(new_pad_caps);
-    if (video_sink_pad)
-        gst_object_unref(video_sink_pad);
-    if (audio_sink_pad)
-        gst_object_unref(audio_sink_pad);
+    g_free(index_path);
+    g_free(filename);
 }
 
-void media_on_src_pad_removed(GstElement *src, GstPad *new_pad, GstMedia *self)
+GstKeyIndex *media_get_index(GstMedia *self)
 {
-
+    return self ? self->index : NULL;
 }
 
-// 添加视频分支到tee
-gboolean media_add_video_branch(GstMedia *media, GstElement *branch)
+// 替换管道的源元素。新源的pad（包括已有的静态pad）都通过media_on_src_pad_added连接到tee，
+// 替换前管道会被切到READY状态
+gboolean media_set_source(GstMedia *self, GstElement *src)
 {
-    if (!media || !branch)
+    if (!self || !self->pipeline || !src)
     {
-        g_printerr("Invalid arguments to media_add_video_branch\n");
+        g_printerr("Invalid arguments to media_set_source\n");
         return FALSE;
     }
 
-    GstPad *tee_src_pad = gst_element_request_pad_simple(media->v_tee, "src_%u");
-    if (!tee_src_pad) {
-        g_printerr("Failed to request pad from video tee\n");
-        return FALSE;
-    }
+    if (self->state != MEDIA_STATE_STOPPED)
+        media_stop(self);
 
-    GstPad *branch_sink_pad = gst_element_get_static_pad(branch, "v_sink");
-    if (!branch_sink_pad) {
-        g_printerr("Failed to get sink pad from branch\n");
-        gst_object_unref(tee_src_pad);
-        return FALSE;
+    if (self->src)
+    {
+        gst_element_set_state(self->src, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(self->pipeline), self->src);
     }
 
-    GstPadLinkReturn ret = gst_pad_link(tee_src_pad, branch_sink_pad);
-    if (GST_PAD_LINK_FAILED(ret)) {
-        g_printerr("Failed to link video tee pad to branch\n");
-        gst_object_unref(tee_src_pad);
-        gst_object_unref(branch_sink_pad);
-        return FALSE;
+    self->src = src;
+    g_mutex_lock(&self->stream_lock);
+    gst_clear_object(&self->streams);
+    g_mutex_unlock(&self->stream_lock);
+    gst_bin_add(GST_BIN(self->pipeline), self->src);
+    g_signal_connect(self->src, "pad-added", G_CALLBACK(media_on_src_pad_added), self);
+    g_signal_connect(self->src, "pad-removed", G_CALLBACK(media_on_src_pad_removed), self);
+
+    GstIterator *it = gst_element_iterate_src_pads(self->src);
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        media_on_src_pad_added(self->src, GST_PAD(g_value_get_object(&item)), self);
+        g_value_reset(&item);
     }
+    g_value_unset(&item);
+    gst_iterator_free(it);
 
-    g_print("Successfully added video branch to tee\n");
-    gst_object_unref(tee_src_pad);
-    gst_object_unref(branch_sink_pad);
+    gst_element_sync_state_with_parent(self->src);
+
+    if (self->index)
+    {
+        index_destroy(self->index);
+        g_free(self->index);
+        self->index = NULL;
+    }
 
     return TRUE;
 }
 
-// 添加音频分支到tee
-gboolean media_add_audio_branch(GstMedia *media, GstElement *branch)
+// 时间线模式：用splitmuxsrc把多个录像分段拼成一条连续的时间线。
+// splitmuxsrc会提前打开并预卷下一个分段的demuxer，分段之间的时间戳连续，
+// 编码参数相同时也不需要重新协商，定位作用于整条时间线
+gboolean media_set_timeline(GstMedia *self, const char *const *files)
 {
-    if (!media || !branch)
+    if (!self || !files || !files[0])
     {
-        g_printerr("Invalid arguments to media_add_audio_branch\n");
+        g_printerr("Invalid arguments to media_set_timeline\n");
         return FALSE;
     }
 
-    GstPad *tee_src_pad = gst_element_request_pad_simple(media->a_tee, "src_%u");
-    if (!tee_src_pad) {
-        g_printerr("Failed to request pad from audio tee\n");
+    GstElement *bin = gst_bin_new("timeline");
+    GstElement *splitmux = gst_element_factory_make("splitmuxsrc", "timeline_splitmux");
+    if (!bin || !splitmux)
+    {
+        g_printerr("Could not create timeline source\n");
+        if (bin)
+            gst_object_unref(bin);
+        if (splitmux)
+            gst_object_unref(splitmux);
         return FALSE;
     }
 
-    GstPad *branch_sink_pad = gst_element_get_static_pad(branch, "a_sink");
-    if (!branch_sink_pad) {
-        g_printerr("Failed to get sink pad from branch\n");
-        gst_object_unref(tee_src_pad);
-        return FALSE;
-    }
+    // 只保持当前和下一个分段处于打开状态，分段再多也不会耗尽文件句柄
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(splitmux), "num-open-fragments"))
+        g_object_set(splitmux, "num-open-fragments", 2, NULL);
 
-    GstPadLinkReturn ret = gst_pad_link(tee_src_pad, branch_sink_pad);
-    if (GST_PAD_LINK_FAILED(ret)) {
-        g_printerr("Failed to link audio tee pad to branch\n");
-        gst_object_unref(tee_src_pad);
-        gst_object_unref(branch_sink_pad);
+    gst_bin_add(GST_BIN(bin), splitmux);
+    g_signal_connect(splitmux, "format-location", G_CALLBACK(media_on_timeline_format_location), self);
+    g_signal_connect(splitmux, "pad-added", G_CALLBACK(media_on_timeline_pad_added), bin);
+
+    if (!media_set_source(self, bin))
         return FALSE;
-    }
 
-    g_print("Successfully added audio branch to tee\n");
-    gst_object_unref(tee_src_pad);
-    gst_object_unref(branch_sink_pad);
+    g_strfreev(self->timeline);
+    self->timeline = g_strdupv((gchar **)files);
+
+    if (self->current_uri)
+    {
+        g_free(self->current_uri);
+        self->current_uri = NULL;
+    }
 
+    LOG_INFO(self->name, NULL, "Timeline set with %u segments", g_strv_length(self->timeline));
     return TRUE;
 }
 
-// 从tee移除视频分支
-gboolean media_remove_video_branch(GstMedia *media, GstElement *branch)
+gchar **media_on_timeline_format_location(GstElement *splitmux, GstMedia *self)
 {
-    if (!media || !branch) {
-        g_printerr("Invalid arguments to media_remove_video_branch\n");
-        return FALSE;
+    return g_strdupv(self->timeline);
+}
+
+// splitmuxsrc输出的是解复用后的压缩流，每个pad接一个decodebin
+void media_on_timeline_pad_added(GstElement *splitmux, GstPad *new_pad, GstElement *bin)
+{
+    GstElement *decodebin = gst_element_factory_make("decodebin", NULL);
+    if (!decodebin)
+    {
+        LOG_WARNING(NULL, NULL, "Could not create decodebin for timeline pad %s", GST_PAD_NAME(new_pad));
+        return;
     }
 
-    // 这里需要实际实现移除分支的逻辑
-    g_print("Video branch removed from tee\n");
-    return TRUE;
+    gst_bin_add(GST_BIN(bin), decodebin);
+    g_signal_connect(decodebin, "pad-added", G_CALLBACK(media_on_timeline_decoded_pad), bin);
+
+    GstPad *sink_pad = gst_element_get_static_pad(decodebin, "sink");
+    if (GST_PAD_LINK_FAILED(gst_pad_link(new_pad, sink_pad)))
+        LOG_WARNING(NULL, NULL, "Could not link timeline pad %s to decodebin", GST_PAD_NAME(new_pad));
+    gst_object_unref(sink_pad);
+
+    gst_element_sync_state_with_parent(decodebin);
 }
 
-// 从tee移除音频分支
-gboolean media_remove_audio_branch(GstMedia *media, GstElement *branch)
+// 解码后的pad以ghost pad的形式暴露到时间线bin上，由media_on_src_pad_added连接到tee
+void media_on_timeline_decoded_pad(GstElement *decodebin, GstPad *new_pad, GstElement *bin)
 {
-    if (!media || !branch) {
-        g_printerr("Invalid arguments to media_remove_audio_branch\n");
+    GstPad *ghost_pad = gst_ghost_pad_new(NULL, new_pad);
+    gst_pad_set_active(ghost_pad, TRUE);
+    gst_element_add_pad(bin, ghost_pad);
+}
+
+gboolean media_play(GstMedia *self)
+{
+    if (!self || !self->pipeline)
+    {
+        g_printerr("Player not initialized\n");
         return FALSE;
     }
 
-    // 这里需要实际实现移除分支的逻辑
-    g_print("Audio branch removed from tee\n");
+    // 还在缓冲时只记录目标状态，缓冲完成后由media_on_buffering切到PLAYING
+    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, self->buffering ? GST_STATE_PAUSED : GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("Unable to set the pipeline to the playing state.\n");
+        return FALSE;
+    }
+
+    self->is_live = ret == GST_STATE_CHANGE_NO_PREROLL;
+    self->state = MEDIA_STATE_PLAYING;
     return TRUE;
 }
 
-gboolean media_on_bus_message(GstBus *bus, GstMessage *msg, GstMedia *self)
+gboolean media_pause(GstMedia *self)
 {
-    GError *err;
-    gchar *debug_info;
-    switch (GST_MESSAGE_TYPE(msg))
+    if (!self || !self->pipeline)
     {
-    case GST_MESSAGE_ERROR:
-        gst_message_parse_error(msg, &err, &debug_info);
-        g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
-        g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
-        g_clear_error(&err);
-        g_free(debug_info);
+        g_printerr("Player not initialized\n");
+        return FALSE;
+    }
+
+    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, GST_STATE_PAUSED);
+    if (ret == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("Unable to set the pipeline to the paused state.\n");
+        return FALSE;
+    }
+
+    self->state = MEDIA_STATE_PAUSED;
+    return TRUE;
+}
+
+gboolean media_stop(GstMedia *self)
+{
+    if (!self || !self->pipeline)
+    {
+        g_printerr("Player not initialized\n");
+        return FALSE;
+    }
+
+    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, GST_STATE_READY);
+    if (ret == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("Unable to set the pipeline to the stopped state.\n");
+        return FALSE;
+    }
+
+    self->state = MEDIA_STATE_STOPPED;
+    self->seek_in_flight = FALSE;
+    self->seek_queued = FALSE;
+    gst_clear_object(&self->download_queue);
+    return TRUE;
+}
+
+void media_seek(GstMedia *self, gint64 position)
+{
+    media_seek_full(self, position, self ? self->rate : 1.0, MEDIA_SEEK_DEFAULT);
+}
+
+// 根据定位模式和速率计算seek标志
+GstSeekFlags media_seek_flags(MediaSeekMode mode, gdouble rate)
+{
+    GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+
+    switch (mode)
+    {
+    case MEDIA_SEEK_KEYFRAME:
+        flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST;
         break;
-    case GST_MESSAGE_EOS:
-        g_print("End-Of-Stream reached.\n");
-        self->state = MEDIA_STATE_STOPPED;
+    case MEDIA_SEEK_ACCURATE:
+        flags |= GST_SEEK_FLAG_ACCURATE;
         break;
-    case GST_MESSAGE_STATE_CHANGED:
-        if (GST_MESSAGE_SRC(msg) == GST_OBJECT(self->pipeline))
-        {
-            GstState old_state, new_state, pending_state;
-            gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
-            g_print("Pipeline state changed from %s to %s:\n",
-                    gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
-        }
+    case MEDIA_SEEK_SEGMENT:
+        flags |= GST_SEEK_FLAG_SEGMENT;
         break;
+    case MEDIA_SEEK_INSTANT_RATE:
+        return GST_SEEK_FLAG_INSTANT_RATE_CHANGE;
     default:
         break;
     }
-    return TRUE; // to keep receiving messages
-}
\ No newline at end of file
+
+    // 快进和倒放只解码关键帧，并丢弃音频
+    if (rate < 0.0 || rate > 2.0)
+        flags |= GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS | GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+
+    return flags;
+}
+
+gboolean media_seek_full(GstMedia *self, gint64 position, gdouble rate, MediaSeekMode mode)
+{
+    if (!self || !self->pipeline)
+    {
+        g_printerr("Player not initialized\n");
+        return FALSE;
+    }
+
+    if (rate == 0.0)
+    {
+        g_printerr("Invalid seek rate 0.0\n");
+        return FALSE;
+    }
+
+    // 即时变速不能改变播放方向，退化为关键帧定位
+    if (mode == MEDIA_SEEK_INSTANT_RATE && (rate < 0.0) != (self->rate < 0.0))
+    {
+        position = media_get_position(self);
+        mode = MEDIA_SEEK_KEYFRAME;
+    }
+
+    if (mode == MEDIA_SEEK_INSTANT_RATE)
+    {
+        if (!gst_element_seek(self->pipeline, rate, GST_FORMAT_TIME, media_seek_flags(mode, rate),
+                              GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE,
+                              GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE))
+        {
+            LOG_WARNING(self->name, NULL, "Instant rate change to %.2f failed", rate);
+            return FALSE;
+        }
+        self->rate = rate;
+        return TRUE;
+    }
+
+    // 上一次刷新定位还没完成时只记录最新的请求，避免拖动进度条时定位请求堆积
+    if (self->seek_in_flight)
+    {
+        self->seek_queued = TRUE;
+        self->queued_seek_position = position;
+        self->queued_seek_rate = rate;
+        self->queued_seek_mode = mode;
+        return TRUE;
+    }
+
+    if (position < 0)
+        position = 0;
+
+    // 有关键帧索引时直接查表得到关键帧的准确时间，精确定位到它不需要多解码任何帧，
+    // 也不依赖demuxer自己扫描分片建立索引
+    KeyIndexEntry before, after;
+    if (self->index && mode == MEDIA_SEEK_KEYFRAME && rate > 0.0 &&
+        index_lookup(self->index, position, &before))
+    {
+        guint64 target = before.pts;
+        if (index_lookup_after(self->index, position, &after) && after.pts - position < position - before.pts)
+            target = after.pts;
+
+        position = target;
+        mode = MEDIA_SEEK_ACCURATE;
+    }
+
+    gboolean ret;
+    if (rate > 0.0)
+    {
+        ret = gst_element_seek(self->pipeline, rate, GST_FORMAT_TIME, media_seek_flags(mode, rate),
+                               GST_SEEK_TYPE_SET, position,
+                               GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    }
+    else
+    {
+        // 倒放时从position向0播放
+        ret = gst_element_seek(self->pipeline, rate, GST_FORMAT_TIME, media_seek_flags(mode, rate),
+                               GST_SEEK_TYPE_SET, 0,
+                               GST_SEEK_TYPE_SET, position);
+    }
+
+    if (!ret)
+    {
+        LOG_WARNING(self->name, NULL, "Seek to %" GST_TIME_FORMAT " at rate %.2f failed", GST_TIME_ARGS(position), rate);
+        return FALSE;
+    }
+
+    self->rate = rate;
+    self->seek_in_flight = TRUE;
+    self->seek_request_time = g_get_monotonic_time();
+    return TRUE;
+}
+
+// 修改播放速率（快进/倒放），从当前位置开始
+gboolean media_set_rate(GstMedia *self, gdouble rate)
+{
+    if (!self || !self->pipeline)
+    {
+        g_printerr("Player not initialized\n");
+        return FALSE;
+    }
+
+    if (rate == self->rate)
+        return TRUE;
+
+    // 同方向的常速变速优先使用即时变速，不刷新管道
+    if ((rate < 0.0) == (self->rate < 0.0) && rate > -2.0 && rate <= 2.0 && self->rate > -2.0 && self->rate <= 2.0)
+        return media_seek_full(self, 0, rate, MEDIA_SEEK_INSTANT_RATE);
+
+    return media_seek_full(self, media_get_position(self), rate, MEDIA_SEEK_KEYFRAME);
+}
+
+gint64 media_get_position(GstMedia *self)
+{
+    gint64 position = 0;
+
+    if (!self || !self->pipeline)
+        return 0;
+
+    if (!gst_element_query_position(self->pipeline, GST_FORMAT_TIME, &position))
+        return 0;
+
+    return position;
+}
+
+void media_on_src_pad_added(GstElement *src, GstPad *new_pad, GstMedia *self)
+{
+    LOG_DEBUG(self->name, NULL, "Received new pad '%s' from '%s':", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
+
+    GstPadLinkReturn ret;
+    GstCaps *new_pad_caps = NULL;
+    GstStructure *new_pad_struct = NULL;
+    const gchar *new_pad_type = NULL;
+
+    GstPad *video_sink_pad = gst_element_get_static_pad(self->v_tee, "sink");
+    GstPad *audio_sink_pad = gst_element_get_static_pad(self->a_tee, "sink");
+
+    if (!video_sink_pad || !audio_sink_pad)
+    {
+        LOG_ERROR(self->name, NULL, "Could not get sink pads");
+        goto cleanup;
+    }
+
+    if (gst_pad_is_linked(video_sink_pad) && gst_pad_is_linked(audio_sink_pad))
+    {
+        LOG_DEBUG(self->name, NULL, "We are already linked. Ignoring.");
+        goto cleanup;
+    }
+
+    // ghost pad和静态pad在连接之前可能还没有当前caps，退回到查询caps
+    new_pad_caps = gst_pad_get_current_caps(new_pad);
+    if (!new_pad_caps)
+        new_pad_caps = gst_pad_query_caps(new_pad, NULL);
+    if (!new_pad_caps || gst_caps_is_empty(new_pad_caps) || gst_caps_is_any(new_pad_caps))
+    {
+        LOG_WARNING(self->name, NULL, "Could not get caps from new pad");
+        goto cleanup;
+    }
+
+    new_pad_struct = gst_caps_get_structure(new_pad_caps, 0);
+    if (!new_pad_struct)
+    {
+        LOG_WARNING(self->name, NULL, "Could not get structure from caps");
+        goto cleanup;
+    }
+
+    new_pad_type = gst_structure_get_name(new_pad_struct);
+    if (g_str_has_prefix(new_pad_type, "video/"))
+    {
+        ret = gst_pad_link(new_pad, video_sink_pad);
+        if (GST_PAD_LINK_FAILED(ret))
+            LOG_WARNING(self->name, NULL, "Type is '%s' but link failed.", new_pad_type);
+        else
+            LOG_INFO(self->name, NULL, "Video link succeeded (type '%s').", new_pad_type);
+    }
+    else if (g_str_has_prefix(new_pad_type, "audio/"))
+    {
+        ret = gst_pad_link(new_pad, audio_sink_pad);
+        if (GST_PAD_LINK_FAILED(ret))
+            LOG_WARNING(self->name, NULL, "Type is '%s' but link failed.", new_pad_type);
+        else
+            LOG_INFO(self->name, NULL, "Audio link succeeded (type '%s').", new_pad_type);
+    }
+    else
+    {
+        LOG_DEBUG(self->name, NULL, "It has type '%s' which is not supported. Ignoring.", new_pad_type);
+    }
+
+cleanup:
+    if (new_pad_caps != NULL)
+        gst_caps_unref(new_pad_caps);
+    if (video_sink_pad)
+        gst_object_unref(video_sink_pad);
+    if (audio_sink_pad)
+        gst_object_unref(audio_sink_pad);
+}
+
+void media_on_src_pad_removed(GstElement *src, GstPad *new_pad, GstMedia *self)
+{
+
+}
+
+// 添加视频分支到tee
+gboolean media_add_video_branch(GstMedia *media, GstElement *branch)
+{
+    if (!media || !branch)
+    {
+        g_printerr("Invalid arguments to media_add_video_branch\n");
+        return FALSE;
+    }
+
+    // 分支还没有加入管道时由这里添加，连接后同步到管道的状态
+    gboolean added = FALSE;
+    if (!GST_OBJECT_PARENT(branch))
+    {
+        gst_bin_add(GST_BIN(media->pipeline), branch);
+        added = TRUE;
+    }
+
+    GstPad *tee_src_pad = gst_element_request_pad_simple(media->v_tee, "src_%u");
+    if (!tee_src_pad) {
+        LOG_ERROR(media->name, GST_OBJECT_NAME(branch), "Failed to request pad from video tee");
+        return FALSE;
+    }
+
+    GstPad *branch_sink_pad = gst_element_get_static_pad(branch, "v_sink");
+    if (!branch_sink_pad) {
+        LOG_ERROR(media->name, GST_OBJECT_NAME(branch), "Failed to get sink pad from branch");
+        gst_object_unref(tee_src_pad);
+        return FALSE;
+    }
+
+    GstPadLinkReturn ret = gst_pad_link(tee_src_pad, branch_sink_pad);
+    if (GST_PAD_LINK_FAILED(ret)) {
+        LOG_ERROR(media->name, GST_OBJECT_NAME(branch), "Failed to link video tee pad to branch");
+        gst_object_unref(tee_src_pad);
+        gst_object_unref(branch_sink_pad);
+        return FALSE;
+    }
+
+    LOG_INFO(media->name, GST_OBJECT_NAME(branch), "Successfully added video branch to tee");
+    gst_object_unref(tee_src_pad);
+    gst_object_unref(branch_sink_pad);
+
+    if (added)
+        gst_element_sync_state_with_parent(branch);
+
+    return TRUE;
+}
+
+// 添加音频分支到tee
+gboolean media_add_audio_branch(GstMedia *media, GstElement *branch)
+{
+    if (!media || !branch)
+    {
+        g_printerr("Invalid arguments to media_add_audio_branch\n");
+        return FALSE;
+    }
+
+    gboolean added = FALSE;
+    if (!GST_OBJECT_PARENT(branch))
+    {
+        gst_bin_add(GST_BIN(media->pipeline), branch);
+        added = TRUE;
+    }
+
+    GstPad *tee_src_pad = gst_element_request_pad_simple(media->a_tee, "src_%u");
+    if (!tee_src_pad) {
+        LOG_ERROR(media->name, GST_OBJECT_NAME(branch), "Failed to request pad from audio tee");
+        return FALSE;
+    }
+
+    GstPad *branch_sink_pad = gst_element_get_static_pad(branch, "a_sink");
+    if (!branch_sink_pad) {
+        LOG_ERROR(media->name, GST_OBJECT_NAME(branch), "Failed to get sink pad from branch");
+        gst_object_unref(tee_src_pad);
+        return FALSE;
+    }
+
+    GstPadLinkReturn ret = gst_pad_link(tee_src_pad, branch_sink_pad);
+    if (GST_PAD_LINK_FAILED(ret)) {
+        LOG_ERROR(media->name, GST_OBJECT_NAME(branch), "Failed to link audio tee pad to branch");
+        gst_object_unref(tee_src_pad);
+        gst_object_unref(branch_sink_pad);
+        return FALSE;
+    }
+
+    LOG_INFO(media->name, GST_OBJECT_NAME(branch), "Successfully added audio branch to tee");
+    gst_object_unref(tee_src_pad);
+    gst_object_unref(branch_sink_pad);
+
+    if (added)
+        gst_element_sync_state_with_parent(branch);
+
+    return TRUE;
+}
+
+// tee的src pad空闲时断开分支：释放tee的请求pad，并向分支发送EOS让它把数据处理完
+GstPadProbeReturn media_on_branch_pad_idle(GstPad *tee_src_pad, GstPadProbeInfo *info, GstPad *branch_sink_pad)
+{
+    GstElement *tee = gst_pad_get_parent_element(tee_src_pad);
+
+    gst_pad_unlink(tee_src_pad, branch_sink_pad);
+    gst_pad_send_event(branch_sink_pad, gst_event_new_eos());
+    if (tee)
+    {
+        gst_element_release_request_pad(tee, tee_src_pad);
+        gst_object_unref(tee);
+    }
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+gboolean media_remove_branch(GstElement *branch, const char *pad_name)
+{
+    GstPad *branch_sink_pad = gst_element_get_static_pad(branch, pad_name);
+    if (!branch_sink_pad)
+    {
+        LOG_ERROR(NULL, GST_OBJECT_NAME(branch), "Failed to get sink pad from branch");
+        return FALSE;
+    }
+
+    GstPad *tee_src_pad = gst_pad_get_peer(branch_sink_pad);
+    if (!tee_src_pad)
+    {
+        // 没有连接，不需要处理
+        gst_object_unref(branch_sink_pad);
+        return TRUE;
+    }
+
+    // 空闲探针保证不会在buffer传递的中途断开；pad当前空闲时回调会立即执行
+    gst_pad_add_probe(tee_src_pad, GST_PAD_PROBE_TYPE_IDLE,
+                      (GstPadProbeCallback)media_on_branch_pad_idle,
+                      branch_sink_pad, (GDestroyNotify)gst_object_unref);
+    gst_object_unref(tee_src_pad);
+
+    return TRUE;
+}
+
+// 从tee移除视频分支。分支本身仍留在管道中，由调用者设置为NULL状态后移除
+gboolean media_remove_video_branch(GstMedia *media, GstElement *branch)
+{
+    if (!media || !branch) {
+        g_printerr("Invalid arguments to media_remove_video_branch\n");
+        return FALSE;
+    }
+
+    if (!media_remove_branch(branch, "v_sink"))
+        return FALSE;
+
+    LOG_INFO(media->name, GST_OBJECT_NAME(branch), "Video branch removed from tee");
+    return TRUE;
+}
+
+// 从tee移除音频分支
+gboolean media_remove_audio_branch(GstMedia *media, GstElement *branch)
+{
+    if (!media || !branch) {
+        g_printerr("Invalid arguments to media_remove_audio_branch\n");
+        return FALSE;
+    }
+
+    if (!media_remove_branch(branch, "a_sink"))
+        return FALSE;
+
+    LOG_INFO(media->name, GST_OBJECT_NAME(branch), "Audio branch removed from tee");
+    return TRUE;
+}
+
+// 空闲探针在pad空闲时立即在调用线程里执行，否则在tee的流线程里执行，不需要主循环
+gboolean media_wait_branch_unlinked(GstMedia *media, GstElement *branch)
+{
+    const char *pad_names[] = {"v_sink", "a_sink"};
+    gint64 deadline = g_get_monotonic_time() + MEDIA_UNLINK_TIMEOUT;
+
+    for (guint i = 0; i < G_N_ELEMENTS(pad_names); i++)
+    {
+        GstPad *pad = gst_element_get_static_pad(branch, pad_names[i]);
+        if (!pad)
+            continue;
+
+        while (gst_pad_is_linked(pad) && g_get_monotonic_time() < deadline)
+            g_usleep(G_TIME_SPAN_MILLISECOND);
+        gboolean linked = gst_pad_is_linked(pad);
+        gst_object_unref(pad);
+
+        if (linked)
+        {
+            LOG_WARNING(media ? media->name : NULL, GST_OBJECT_NAME(branch),
+                        "Timed out waiting for %s to leave the tee", pad_names[i]);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// 所有媒体共用的编码线程池，线程数有上限，截图请求再多也不会占满CPU
+static gpointer media_snapshot_pool_new(gpointer data)
+{
+    gint threads = CLAMP((gint)g_get_num_processors() / 2, 1, 4);
+    return g_thread_pool_new(media_snapshot_run, NULL, threads, FALSE, NULL);
+}
+
+static GThreadPool *media_snapshot_pool(void)
+{
+    static GOnce once = G_ONCE_INIT;
+    g_once(&once, media_snapshot_pool_new, NULL);
+    return once.retval;
+}
+
+// 截图分支只做引用计数：leaky queue + 只保留最新一帧的appsink，没有请求时不做任何转换和编码
+gboolean media_snapshot_add_branch(GstMedia *self)
+{
+    GstElement *bin = gst_bin_new("snapshot_bin");
+    GstElement *queue = gst_element_factory_make("queue", "snapshot_queue");
+    GstElement *sink = gst_element_factory_make("appsink", "snapshot_sink");
+
+    if (!bin || !queue || !sink)
+    {
+        g_printerr("Could not create snapshot elements.\n");
+        if (bin)
+            gst_object_unref(bin);
+        if (queue)
+            gst_object_unref(queue);
+        if (sink)
+            gst_object_unref(sink);
+        return FALSE;
+    }
+
+    g_object_set(queue, "leaky", 2, "max-size-buffers", 1, "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+    g_object_set(sink, "sync", FALSE, "async", FALSE, "max-buffers", 1, "drop", TRUE, NULL);
+
+    gst_bin_add_many(GST_BIN(bin), queue, sink, NULL);
+    gst_element_link(queue, sink);
+
+    GstPad *pad = gst_element_get_static_pad(queue, "sink");
+    GstPad *ghost_pad = gst_ghost_pad_new("v_sink", pad);
+    gst_element_add_pad(bin, ghost_pad);
+    gst_pad_set_active(ghost_pad, TRUE);
+    gst_object_unref(pad);
+
+    if (!media_add_video_branch(self, bin))
+    {
+        gst_bin_remove(GST_BIN(self->pipeline), bin);
+        return FALSE;
+    }
+
+    self->snapshot_sink = sink;
+    return TRUE;
+}
+
+// 截取当前画面并编码成JPEG/PNG，width/height为0时保持原尺寸（只指定一个时按比例缩放）。
+// 相同参数的并发请求只做一次编码，结果分发给所有请求者
+gboolean media_snapshot(GstMedia *self, MediaSnapshotFormat format, gint width, gint height,
+                        MediaSnapshotCallback callback, gpointer user_data)
+{
+    if (!self || !self->pipeline || !callback)
+    {
+        g_printerr("Invalid arguments to media_snapshot\n");
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->snapshot_lock);
+
+    if (!self->snapshot_sink && !media_snapshot_add_branch(self))
+    {
+        g_mutex_unlock(&self->snapshot_lock);
+        return FALSE;
+    }
+
+    MediaSnapshotWaiter waiter = {callback, user_data};
+    for (GList *l = self->snapshot_jobs; l; l = l->next)
+    {
+        MediaSnapshotJob *job = l->data;
+        if (job->format == format && job->width == width && job->height == height)
+        {
+            g_array_append_val(job->waiters, waiter);
+            g_mutex_unlock(&self->snapshot_lock);
+            return TRUE;
+        }
+    }
+
+    MediaSnapshotJob *job = g_new0(MediaSnapshotJob, 1);
+    job->media = self;
+    job->format = format;
+    job->width = width;
+    job->height = height;
+    job->waiters = g_array_new(FALSE, FALSE, sizeof(MediaSnapshotWaiter));
+    g_array_append_val(job->waiters, waiter);
+    self->snapshot_jobs = g_list_prepend(self->snapshot_jobs, job);
+    self->snapshot_running++;
+
+    g_mutex_unlock(&self->snapshot_lock);
+
+    g_thread_pool_push(media_snapshot_pool(), job, NULL);
+    return TRUE;
+}
+
+// 在编码线程池中运行：优先取appsink里的最新帧，没有新帧时用上次的缓存，都没有时等待下一帧
+void media_snapshot_run(gpointer data, gpointer unused)
+{
+    MediaSnapshotJob *job = data;
+    GstMedia *self = job->media;
+    GstAppSink *sink = GST_APP_SINK(self->snapshot_sink);
+    GBytes *image = NULL;
+
+    GstSample *sample = gst_app_sink_try_pull_sample(sink, 0);
+    if (!sample)
+    {
+        g_mutex_lock(&self->snapshot_lock);
+        if (self->snapshot_last)
+            sample = gst_sample_ref(self->snapshot_last);
+        g_mutex_unlock(&self->snapshot_lock);
+    }
+    if (!sample)
+        sample = gst_app_sink_try_pull_sample(sink, MEDIA_SNAPSHOT_TIMEOUT);
+
+    if (sample)
+    {
+        g_mutex_lock(&self->snapshot_lock);
+        gst_mini_object_replace((GstMiniObject **)&self->snapshot_last, GST_MINI_OBJECT_CAST(sample));
+        g_mutex_unlock(&self->snapshot_lock);
+
+        GstCaps *caps = gst_caps_new_empty_simple(job->format == MEDIA_SNAPSHOT_PNG ? "image/png" : "image/jpeg");
+        if (job->width > 0)
+            gst_caps_set_simple(caps, "width", G_TYPE_INT, job->width, NULL);
+        if (job->height > 0)
+            gst_caps_set_simple(caps, "height", G_TYPE_INT, job->height, NULL);
+
+        GError *error = NULL;
+        GstSample *converted = gst_video_convert_sample(sample, caps, MEDIA_SNAPSHOT_TIMEOUT, &error);
+        gst_caps_unref(caps);
+        gst_sample_unref(sample);
+
+        GstMapInfo map;
+        if (converted && gst_buffer_map(gst_sample_get_buffer(converted), &map, GST_MAP_READ))
+        {
+            image = g_bytes_new(map.data, map.size);
+            gst_buffer_unmap(gst_sample_get_buffer(converted), &map);
+        }
+        else
+        {
+            LOG_WARNING(self->name, "snapshot_bin", "Snapshot conversion failed: %s",
+                        error ? error->message : "unknown error");
+        }
+
+        if (converted)
+            gst_sample_unref(converted);
+        g_clear_error(&error);
+    }
+    else
+    {
+        LOG_WARNING(self->name, "snapshot_bin", "No frame available for snapshot");
+    }
+
+    // 从列表中移除之后到达的请求会创建新的任务
+    g_mutex_lock(&self->snapshot_lock);
+    self->snapshot_jobs = g_list_remove(self->snapshot_jobs, job);
+    g_mutex_unlock(&self->snapshot_lock);
+
+    for (guint i = 0; i < job->waiters->len; i++)
+    {
+        MediaSnapshotWaiter *waiter = &g_array_index(job->waiters, MediaSnapshotWaiter, i);
+        waiter->callback(image, waiter->user_data);
+    }
+
+    if (image)
+        g_bytes_unref(image);
+    g_array_free(job->waiters, TRUE);
+    g_free(job);
+
+    // media_destroy在等待所有任务结束
+    g_mutex_lock(&self->snapshot_lock);
+    self->snapshot_running--;
+    g_cond_broadcast(&self->snapshot_cond);
+
+    g_mutex_unlock(&self->snapshot_lock);
+}
+
+void media_add_bus_listener(GstMedia *self, GstBusFunc func, gpointer user_data)
+{
+    if (!self || !func)
+        return;
+
+    MediaBusListener *listener = g_new0(MediaBusListener, 1);
+    listener->func = func;
+    listener->user_data = user_data;
+    self->bus_listeners = g_list_append(self->bus_listeners, listener);
+}
+
+void media_remove_bus_listener(GstMedia *self, GstBusFunc func, gpointer user_data)
+{
+    if (!self)
+        return;
+
+    for (GList *l = self->bus_listeners; l; l = l->next)
+    {
+        MediaBusListener *listener = l->data;
+        if (listener->func == func && listener->user_data == user_data)
+        {
+            self->bus_listeners = g_list_delete_link(self->bus_listeners, l);
+            g_free(listener);
+            return;
+        }
+    }
+}
+
+gboolean media_on_bus_message(GstBus *bus, GstMessage *msg, GstMedia *self)
+{
+    GError *err;
+    gchar *debug_info;
+
+    // 先分发给注册的分支，回调里可以移除自己
+    for (GList *l = self->bus_listeners; l;)
+    {
+        MediaBusListener *listener = l->data;
+        l = l->next;
+        listener->func(bus, msg, listener->user_data);
+    }
+
+    switch (GST_MESSAGE_TYPE(msg))
+    {
+    case GST_MESSAGE_ERROR:
+        gst_message_parse_error(msg, &err, &debug_info);
+        LOG_ERROR(self->name, NULL, "Error received from element %s: %s", GST_OBJECT_NAME(msg->src), err->message);
+        LOG_DEBUG(self->name, NULL, "Debugging information: %s", debug_info ? debug_info : "none");
+        g_clear_error(&err);
+        g_free(debug_info);
+        self->seek_in_flight = FALSE;
+        self->seek_queued = FALSE;
+        media_finish_state_request(self, FALSE);
+        break;
+    case GST_MESSAGE_EOS:
+        LOG_INFO(self->name, NULL, "End-Of-Stream reached.");
+        media_cache_check_complete(self);
+        self->state = MEDIA_STATE_STOPPED;
+        break;
+    case GST_MESSAGE_BUFFERING:
+        media_on_buffering(self, msg);
+        break;
+    case GST_MESSAGE_STREAMS_SELECTED:
+        media_on_streams_selected(self, msg);
+        break;
+
+    case GST_MESSAGE_ASYNC_DONE:
+        if (self->seek_in_flight)
+        {
+            self->seek_in_flight = FALSE;
+            self->last_seek_latency = g_get_monotonic_time() - self->seek_request_time;
+            LOG_INFO(self->name, NULL, "Seek completed in %" G_GINT64_FORMAT " us", self->last_seek_latency);
+
+            if (self->seek_queued)
+            {
+                self->seek_queued = FALSE;
+                media_seek_full(self, self->queued_seek_position, self->queued_seek_rate, self->queued_seek_mode);
+            }
+        }
+        break;
+    case GST_MESSAGE_STATE_CHANGED:
+        if (GST_MESSAGE_SRC(msg) == GST_OBJECT(self->pipeline))
+        {
+            GstState old_state, new_state, pending_state;
+            gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
+            LOG_DEBUG(self->name, NULL, "Pipeline state changed from %s to %s:",
+                      gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
+            media_on_pipeline_state(self, new_state, pending_state);
+        }
+        break;
+    default:
+        break;
+    }
+    return TRUE; // to keep receiving messages
+}
+
+// 异步切换管道状态，立即返回，到达目标状态或失败时调用callback。
+// 同时记录各阶段的耗时和每个分支收到第一帧的时间，可以并行启动大量媒体后再逐个查看
+gboolean media_set_state_async(GstMedia *self, GstState state, MediaStateCallback callback, gpointer user_data)
+{
+    if (!self || !self->pipeline)
+    {
+        g_printerr("Player not initialized\n");
+        return FALSE;
+    }
+
+    // 上一个请求还没有完成，被新的请求取代
+    media_finish_state_request(self, FALSE);
+
+    self->state_target = state;
+    self->state_callback = callback;
+    self->state_user_data = user_data;
+
+    if (state >= GST_STATE_PAUSED)
+        media_reset_timings(self);
+
+    GstState current = GST_STATE_VOID_PENDING, pending = GST_STATE_VOID_PENDING;
+    gst_element_get_state(self->pipeline, &current, &pending, 0);
+
+    // 还在缓冲时先停在PAUSED，缓冲完成后由media_on_buffering切到PLAYING，那时再回调
+    GstState request = state == GST_STATE_PLAYING && self->buffering ? GST_STATE_PAUSED : state;
+    GstStateChangeReturn ret = gst_element_set_state(self->pipeline, request);
+
+    if (ret == GST_STATE_CHANGE_FAILURE || (current == state && pending == GST_STATE_VOID_PENDING))
+    {
+        // 没有状态变化消息可等，在空闲回调中报告，保证回调总是异步的
+        self->state_result = ret != GST_STATE_CHANGE_FAILURE;
+        self->state_idle = g_idle_add((GSourceFunc)media_on_state_idle, self);
+    }
+
+    if (ret == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("Unable to set the pipeline to the %s state.\n", gst_element_state_get_name(state));
+        return FALSE;
+    }
+
+    if (state == GST_STATE_PLAYING)
+        self->is_live = ret == GST_STATE_CHANGE_NO_PREROLL;
+    return TRUE;
+}
+
+gboolean media_play_async(GstMedia *self, MediaStateCallback callback, gpointer user_data)
+{
+    if (!media_set_state_async(self, GST_STATE_PLAYING, callback, user_data))
+        return FALSE;
+
+    self->state = MEDIA_STATE_PLAYING;
+    return TRUE;
+}
+
+gboolean media_stop_async(GstMedia *self, MediaStateCallback callback, gpointer user_data)
+{
+    if (!media_set_state_async(self, GST_STATE_READY, callback, user_data))
+        return FALSE;
+
+    self->state = MEDIA_STATE_STOPPED;
+    self->seek_in_flight = FALSE;
+    self->seek_queued = FALSE;
+    gst_clear_object(&self->download_queue);
+    return TRUE;
+}
+
+gboolean media_on_state_idle(GstMedia *self)
+{
+    self->state_idle = 0;
+    media_finish_state_request(self, self->state_result);
+    return G_SOURCE_REMOVE;
+}
+
+void media_finish_state_request(GstMedia *self, gboolean success)
+{
+    // 请求已经由总线消息结束或被新请求取代，空闲回调里的结果不再属于当前请求
+    if (self->state_idle)
+    {
+        g_source_remove(self->state_idle);
+        self->state_idle = 0;
+    }
+
+    if (self->state_target == GST_STATE_VOID_PENDING)
+        return;
+
+    MediaStateCallback callback = self->state_callback;
+    gpointer user_data = self->state_user_data;
+    self->state_target = GST_STATE_VOID_PENDING;
+    self->state_callback = NULL;
+    self->state_user_data = NULL;
+
+    if (callback)
+        callback(self, success, user_data);
+}
+
+void media_on_pipeline_state(GstMedia *self, GstState new_state, GstState pending_state)
+{
+    if (self->timings.request)
+    {
+        gint64 elapsed = g_get_monotonic_time() - self->timings.request;
+        gint64 *slot = new_state == GST_STATE_READY ? &self->timings.ready : new_state == GST_STATE_PAUSED ? &self->timings.paused
+                                                                         : new_state == GST_STATE_PLAYING  ? &self->timings.playing
+                                                                                                           : NULL;
+        if (slot && *slot < 0)
+            *slot = elapsed;
+    }
+
+    if (self->state_target != GST_STATE_VOID_PENDING && new_state == self->state_target &&
+        pending_state == GST_STATE_VOID_PENDING)
+    {
+        if (self->state_target == GST_STATE_PLAYING)
+            LOG_INFO(self->name, NULL,
+                     "Pipeline started: ready %.1f ms, prerolled %.1f ms, playing %.1f ms, first frame %.1f ms",
+                     self->timings.ready / 1000.0, self->timings.paused / 1000.0,
+                     self->timings.playing / 1000.0, self->timings.first_frame / 1000.0);
+        media_finish_state_request(self, TRUE);
+    }
+}
+
+// 开始新的计时，并在v_tee的输入和每个输出上挂一次性的探针，记录第一帧到达的时间。
+// 上一次计时还没有触发的探针先移除，每个pad上最多一个
+void media_reset_timings(GstMedia *self)
+{
+    g_mutex_lock(&self->timing_lock);
+    self->timings.request = g_get_monotonic_time();
+    self->timings.ready = self->timings.paused = self->timings.playing = self->timings.first_frame = -1;
+    g_hash_table_remove_all(self->branch_timings);
+
+    GstIterator *it = gst_element_iterate_pads(self->v_tee);
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        GstPad *pad = GST_PAD(g_value_get_object(&item));
+        gulong old = GPOINTER_TO_SIZE(g_object_get_data(G_OBJECT(pad), MEDIA_FIRST_FRAME_PROBE));
+        if (old)
+            gst_pad_remove_probe(pad, old);
+
+        gulong id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+                                      (GstPadProbeCallback)media_on_first_frame, self, NULL);
+        g_object_set_data(G_OBJECT(pad), MEDIA_FIRST_FRAME_PROBE, GSIZE_TO_POINTER(id));
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    g_mutex_unlock(&self->timing_lock);
+}
+
+GstPadProbeReturn media_on_first_frame(GstPad *pad, GstPadProbeInfo *info, GstMedia *self)
+{
+    g_mutex_lock(&self->timing_lock);
+    // 等锁期间media_reset_timings已经移除了这个探针，时间属于上一次请求
+    if (GPOINTER_TO_SIZE(g_object_get_data(G_OBJECT(pad), MEDIA_FIRST_FRAME_PROBE)) != info->id)
+    {
+        g_mutex_unlock(&self->timing_lock);
+        return GST_PAD_PROBE_REMOVE;
+    }
+    g_object_set_data(G_OBJECT(pad), MEDIA_FIRST_FRAME_PROBE, NULL);
+
+    gint64 elapsed = g_get_monotonic_time() - self->timings.request;
+    if (GST_PAD_IS_SINK(pad))
+    {
+        if (self->timings.first_frame < 0)
+            self->timings.first_frame = elapsed;
+    }
+    else
+    {
+        // 以对端分支bin的名字记录
+        GstPad *peer = gst_pad_get_peer(pad);
+        GstObject *branch = peer ? gst_object_get_parent(GST_OBJECT(peer)) : NULL;
+        if (branch)
+        {
+            gint64 *value = g_new(gint64, 1);
+            *value = elapsed;
+            g_hash_table_replace(self->branch_timings, gst_object_get_name(branch), value);
+            LOG_INFO(self->name, GST_OBJECT_NAME(branch), "First frame reached %s after %.1f ms",
+                     GST_OBJECT_NAME(branch), elapsed / 1000.0);
+            gst_object_unref(branch);
+        }
+        if (peer)
+            gst_object_unref(peer);
+    }
+    g_mutex_unlock(&self->timing_lock);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void media_get_timings(GstMedia *self, MediaTimings *timings)
+{
+    if (!self || !timings)
+        return;
+
+    g_mutex_lock(&self->timing_lock);
+    *timings = self->timings;
+    g_mutex_unlock(&self->timing_lock);
+}
+
+// 返回第一帧到达分支的耗时(us)，还没有到达时返回-1
+gint64 media_get_branch_first_frame(GstMedia *self, const char *branch)
+{
+    if (!self || !branch)
+        return -1;
+
+    g_mutex_lock(&self->timing_lock);
+    gint64 *value = g_hash_table_lookup(self->branch_timings, branch);
+    gint64 result = value ? *value : -1;
+    g_mutex_unlock(&self->timing_lock);
+    return result;
+}
+
+// 源是否支持select-streams事件
+gboolean media_src_selects_streams(GstMedia *self)
+{
+    GstElementFactory *factory = self->src ? gst_element_get_factory(self->src) : NULL;
+    return factory && g_strcmp0(GST_OBJECT_NAME(factory), "uridecodebin3") == 0;
+}
+
+// demuxer和decodebin3都会发布流集合，只处理decodebin3汇总之后的那一个
+// 同步处理函数在发消息的线程里调用，decodebin3在流集合消息返回之后才按默认规则选择轨道（包括字幕），
+// 在这里发出select-streams可以在默认选择生效之前换成我们要的轨道。其它消息仍然交给主循环处理
+GstBusSyncReply media_on_bus_sync(GstBus *bus, GstMessage *msg, GstMedia *self)
+{
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_COLLECTION)
+        media_on_stream_collection(self, msg);
+    return GST_BUS_PASS;
+}
+
+void media_on_stream_collection(GstMedia *self, GstMessage *msg)
+{
+    GstObject *src = GST_MESSAGE_SRC(msg);
+    if (!media_src_selects_streams(self) || !GST_IS_ELEMENT(src) ||
+        !gst_object_has_as_ancestor(src, GST_OBJECT(self->src)))
+        return;
+
+    GstElementFactory *factory = gst_element_get_factory(GST_ELEMENT(src));
+    if (!factory || g_strcmp0(GST_OBJECT_NAME(factory), "decodebin3") != 0)
+        return;
+
+    GstStreamCollection *collection = NULL;
+    gst_message_parse_stream_collection(msg, &collection);
+    if (!collection)
+        return;
+
+    g_mutex_lock(&self->stream_lock);
+    gst_object_replace((GstObject **)&self->streams, GST_OBJECT(collection));
+    g_mutex_unlock(&self->stream_lock);
+
+    guint size = gst_stream_collection_get_size(collection);
+    LOG_INFO(self->name, NULL, "Stream collection with %u streams:", size);
+    for (guint i = 0; i < size; i++)
+    {
+        GstStream *stream = gst_stream_collection_get_stream(collection, i);
+        GstTagList *tags = gst_stream_get_tags(stream);
+        gchar *language = NULL;
+        if (tags)
+        {
+            gst_tag_list_get_string(tags, GST_TAG_LANGUAGE_CODE, &language);
+            gst_tag_list_unref(tags);
+        }
+        LOG_INFO(self->name, NULL, "  %s %s%s%s", gst_stream_type_get_name(gst_stream_get_stream_type(stream)),
+                 gst_stream_get_stream_id(stream), language ? " " : "", language ? language : "");
+        g_free(language);
+    }
+    gst_object_unref(collection);
+
+    media_apply_stream_selection(self);
+}
+
+void media_on_streams_selected(GstMedia *self, GstMessage *msg)
+{
+    if (!media_src_selects_streams(self))
+        return;
+
+    g_free(self->selected_video);
+    g_free(self->selected_audio);
+    self->selected_video = NULL;
+    self->selected_audio = NULL;
+
+    guint size = gst_message_streams_selected_get_size(msg);
+    for (guint i = 0; i < size; i++)
+    {
+        GstStream *stream = gst_message_streams_selected_get_stream(msg, i);
+        GstStreamType type = gst_stream_get_stream_type(stream);
+        if ((type & GST_STREAM_TYPE_VIDEO) && !self->selected_video)
+            self->selected_video = g_strdup(gst_stream_get_stream_id(stream));
+        else if ((type & GST_STREAM_TYPE_AUDIO) && !self->selected_audio)
+            self->selected_audio = g_strdup(gst_stream_get_stream_id(stream));
+        gst_object_unref(stream);
+    }
+
+    LOG_INFO(self->name, NULL, "Selected streams: video=%s audio=%s",
+             self->selected_video ? self->selected_video : "none",
+             self->selected_audio ? self->selected_audio : "none");
+}
+
+// 根据轨道偏好选择要解码的流并发送select-streams。序号超出范围时使用该类型的第一个轨道，
+// 找不到指定语言时按audio_track选择。还没有收到流集合时只保存偏好，收到后再生效
+gboolean media_apply_stream_selection(GstMedia *self)
+{
+    if (!media_src_selects_streams(self))
+        return TRUE;
+
+    // 主循环和流线程都会调用，轨道id复制出来，发送事件时不持有锁
+    g_mutex_lock(&self->stream_lock);
+    if (!self->streams)
+    {
+        g_mutex_unlock(&self->stream_lock);
+        return TRUE;
+    }
+
+    GstStream *video = NULL, *first_video = NULL;
+    GstStream *audio = NULL, *first_audio = NULL, *language_audio = NULL;
+    gint n_video = 0, n_audio = 0;
+
+    guint size = gst_stream_collection_get_size(self->streams);
+    for (guint i = 0; i < size; i++)
+    {
+        GstStream *stream = gst_stream_collection_get_stream(self->streams, i);
+        GstStreamType type = gst_stream_get_stream_type(stream);
+        if (type & GST_STREAM_TYPE_VIDEO)
+        {
+            if (!first_video)
+                first_video = stream;
+            if (n_video++ == self->video_track)
+                video = stream;
+        }
+        else if (type & GST_STREAM_TYPE_AUDIO)
+        {
+            if (!first_audio)
+                first_audio = stream;
+            if (n_audio++ == self->audio_track)
+                audio = stream;
+
+            GstTagList *tags = gst_stream_get_tags(stream);
+            gchar *language = NULL;
+            if (!language_audio && self->audio_language && tags &&
+                gst_tag_list_get_string(tags, GST_TAG_LANGUAGE_CODE, &language) &&
+                g_ascii_strcasecmp(language, self->audio_language) == 0)
+                language_audio = stream;
+            g_free(language);
+            if (tags)
+                gst_tag_list_unref(tags);
+        }
+    }
+
+    if (self->video_track < 0)
+        video = NULL;
+    else if (!video)
+        video = first_video;
+
+    if (self->audio_track < 0)
+        audio = NULL;
+    else if (language_audio)
+        audio = language_audio;
+    else if (!audio)
+        audio = first_audio;
+
+    GList *ids = NULL;
+    if (video)
+        ids = g_list_append(ids, g_strdup(gst_stream_get_stream_id(video)));
+    if (audio)
+        ids = g_list_append(ids, g_strdup(gst_stream_get_stream_id(audio)));
+    g_mutex_unlock(&self->stream_lock);
+
+    if (!ids)
+    {
+        LOG_WARNING(self->name, NULL, "No streams left to decode");
+        return FALSE;
+    }
+
+    gboolean ret = gst_element_send_event(self->src, gst_event_new_select_streams(ids));
+    g_list_free_full(ids, g_free);
+    if (!ret)
+        LOG_WARNING(self->name, NULL, "Stream selection was not handled");
+    return ret;
+}
+
+// 选择第几个视频轨道（从0开始），-1表示不解码视频。播放中调用时立即切换
+gboolean media_select_video_track(GstMedia *self, gint index)
+{
+    if (!self || index < -1)
+    {
+        g_printerr("Invalid arguments to media_select_video_track\n");
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->stream_lock);
+    self->video_track = index;
+    g_mutex_unlock(&self->stream_lock);
+    return media_apply_stream_selection(self);
+}
+
+// 选择第几个音频轨道（从0开始），-1表示不解码音频。会清除语言偏好
+gboolean media_select_audio_track(GstMedia *self, gint index)
+{
+    if (!self || index < -1)
+    {
+        g_printerr("Invalid arguments to media_select_audio_track\n");
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->stream_lock);
+    self->audio_track = index;
+    g_free(self->audio_language);
+    self->audio_language = NULL;
+    g_mutex_unlock(&self->stream_lock);
+    return media_apply_stream_selection(self);
+}
+
+// 按语言选择音频轨道，language为NULL时清除语言偏好
+gboolean media_select_audio_language(GstMedia *self, const char *language)
+{
+    if (!self)
+    {
+        g_printerr("Invalid arguments to media_select_audio_language\n");
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->stream_lock);
+    g_free(self->audio_language);
+    self->audio_language = g_strdup(language);
+    g_mutex_unlock(&self->stream_lock);
+    return media_apply_stream_selection(self);
+}
+
+// 当前流集合中某种类型的轨道数，还没有收到流集合时返回0
+guint media_get_track_count(GstMedia *self, GstStreamType type)
+{
+    if (!self)
+        return 0;
+
+    guint count = 0;
+    g_mutex_lock(&self->stream_lock);
+    guint size = self->streams ? gst_stream_collection_get_size(self->streams) : 0;
+    for (guint i = 0; i < size; i++)
+    {
+        if (gst_stream_get_stream_type(gst_stream_collection_get_stream(self->streams, i)) & type)
+            count++;
+    }
+    g_mutex_unlock(&self->stream_lock);
+    return count;
+}
+
+// 性能测试：同一个多轨道文件分别用uridecodebin（解码全部轨道）和uridecodebin3（只解码选中的轨道）
+// 实时播放seconds秒，比较进程的CPU时间
+
+static gboolean media_bench_quit(gpointer data)
+{
+    g_main_loop_quit((GMainLoop *)data);
+    return G_SOURCE_REMOVE;
+}
+
+static gdouble media_bench_run(const char *uri, gboolean select, gint seconds)
+{
+    GstMedia media;
+    if (!media_init(&media))
+        return -1;
+
+    if (!select)
+        media_set_source(&media, gst_element_factory_make("uridecodebin", "source"));
+    else if (!media_src_selects_streams(&media))
+    {
+        g_printerr("uridecodebin3 is not available\n");
+        media_destroy(&media);
+        return -1;
+    }
+
+    GstElement *sinks = gst_parse_bin_from_description(
+        "queue name=v_queue ! fakesink sync=true queue name=a_queue ! fakesink sync=true", FALSE, NULL);
+    GstElement *v_queue = gst_bin_get_by_name(GST_BIN(sinks), "v_queue");
+    GstElement *a_queue = gst_bin_get_by_name(GST_BIN(sinks), "a_queue");
+    GstPad *v_pad = gst_element_get_static_pad(v_queue, "sink");
+    GstPad *a_pad = gst_element_get_static_pad(a_queue, "sink");
+    gst_element_add_pad(sinks, gst_ghost_pad_new("v_sink", v_pad));  // 统一使用v_sink和a_sink
+    gst_element_add_pad(sinks, gst_ghost_pad_new("a_sink", a_pad));
+    gst_object_unref(v_pad);
+    gst_object_unref(a_pad);
+    gst_object_unref(v_queue);
+    gst_object_unref(a_queue);
+    media_add_video_branch(&media, sinks);
+    media_add_audio_branch(&media, sinks);
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    media_set_uri(&media, uri);
+    media_play(&media);
+
+    clock_t cpu = clock();
+    g_timeout_add_seconds(seconds, media_bench_quit, loop);
+    g_main_loop_run(loop);
+    gdouble elapsed = (gdouble)(clock() - cpu) / CLOCKS_PER_SEC;
+
+    if (select)
+        g_print("  %u video and %u audio tracks, decoding %s and %s\n",
+                media_get_track_count(&media, GST_STREAM_TYPE_VIDEO),
+                media_get_track_count(&media, GST_STREAM_TYPE_AUDIO),
+                media.selected_video ? media.selected_video : "no video",
+                media.selected_audio ? media.selected_audio : "no audio");
+
+    media_stop(&media);
+    media_destroy(&media);
+    g_main_loop_unref(loop);
+    return elapsed;
+}
+
+void media_bench_streams(const char *uri, gint seconds)
+{
+    if (!uri || seconds <= 0)
+        return;
+
+    gdouble all = media_bench_run(uri, FALSE, seconds);
+    gdouble selected = media_bench_run(uri, TRUE, seconds);
+    if (all < 0 || selected < 0)
+        return;
+
+    g_print("streams: %d s of %s\n", seconds, uri);
+    g_print("  uridecodebin (all tracks):       cpu %.2f s (%.0f%% of one core)\n", all, all * 100 / seconds);
+    g_print("  uridecodebin3 (selected tracks): cpu %.2f s (%.0f%% of one core), %.0f%% saved\n",
+            selected, selected * 100 / seconds, all > 0 ? (all - selected) * 100 / all : 0.0);
+}
+
+// 设置内存预算（字节）：total是整个媒体的预算，per_branch是没有单独设置预算的分支使用的预算，0表示不限制。
+// 分支超出预算时，它里面的queue切换为leaky=downstream并按预算限制max-size-bytes，丢弃最旧的数据而不是继续增长；
+// 降到上限的一半以下后恢复原来的设置。整个媒体超出预算时，先限制当前占用最多的分支
+void media_set_memory_budget(GstMedia *self, guint64 total, guint64 per_branch)
+{
+    if (!self)
+        return;
+
+    self->memory.budget = total;
+    self->default_branch_budget = per_branch;
+}
+
+// 单独设置某个分支的预算，branch是分支bin的名字（例如recorder_bin）
+void media_set_branch_budget(GstMedia *self, const char *branch, guint64 budget)
+{
+    if (!self || !branch)
+        return;
+
+    guint64 *value = g_new(guint64, 1);
+    *value = budget;
+    g_hash_table_insert(self->branch_budgets, g_strdup(branch), value);
+}
+
+// branch为NULL时返回整个媒体的统计
+gboolean media_get_memory_usage(GstMedia *self, const char *branch, MediaMemoryUsage *usage)
+{
+    if (!self || !usage)
+        return FALSE;
+
+    if (!branch)
+    {
+        *usage = self->memory;
+        return TRUE;
+    }
+
+    MediaMemoryBranch *entry = g_hash_table_lookup(self->memory_branches, branch);
+    if (!entry)
+        return FALSE;
+
+    *usage = entry->usage;
+    return TRUE;
+}
+
+// 当前统计到的分支名，用g_strfreev释放
+gchar **media_get_memory_branches(GstMedia *self)
+{
+    GPtrArray *names = g_ptr_array_new();
+    if (self && self->memory_branches)
+    {
+        GHashTableIter iter;
+        gpointer key;
+        g_hash_table_iter_init(&iter, self->memory_branches);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+            g_ptr_array_add(names, g_strdup(key));
+    }
+    g_ptr_array_add(names, NULL);
+    return (gchar **)g_ptr_array_free(names, FALSE);
+}
+
+void media_add_memory_source(GstMedia *self, GstElement *branch, MediaMemoryFunc func, gpointer user_data)
+{
+    if (!self || !branch || !func)
+        return;
+
+    MediaMemorySource *source = g_new0(MediaMemorySource, 1);
+    source->branch = branch;
+    source->func = func;
+    source->user_data = user_data;
+    self->memory_sources = g_list_append(self->memory_sources, source);
+}
+
+void media_remove_memory_source(GstMedia *self, MediaMemoryFunc func, gpointer user_data)
+{
+    if (!self)
+        return;
+
+    for (GList *l = self->memory_sources; l; l = l->next)
+    {
+        MediaMemorySource *source = l->data;
+        if (source->func == func && source->user_data == user_data)
+        {
+            self->memory_sources = g_list_delete_link(self->memory_sources, l);
+            g_free(source);
+            return;
+        }
+    }
+}
+
+// 读取元素的current-level-bytes，queue和queue2是guint，appsrc是guint64
+static guint64 media_memory_level(GstElement *element)
+{
+    GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), "current-level-bytes");
+    if (!pspec)
+        return 0;
+
+    GValue value = G_VALUE_INIT, bytes = G_VALUE_INIT;
+    g_value_init(&value, pspec->value_type);
+    g_value_init(&bytes, G_TYPE_UINT64);
+    g_object_get_property(G_OBJECT(element), "current-level-bytes", &value);
+    guint64 level = g_value_transform(&value, &bytes) ? g_value_get_uint64(&bytes) : 0;
+    g_value_unset(&value);
+    g_value_unset(&bytes);
+    return level;
+}
+
+// 定时汇总每个分支的占用，检查预算
+gboolean media_on_memory_poll(GstMedia *self)
+{
+    GHashTableIter iter;
+    MediaMemoryBranch *branch;
+    g_hash_table_iter_init(&iter, self->memory_branches);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&branch))
+        branch->seen = FALSE;
+
+    guint64 total = 0;
+    GstIterator *it = gst_bin_iterate_elements(GST_BIN(self->pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        GstElement *element = g_value_get_object(&item);
+        if (element != self->v_tee && element != self->a_tee)
+            total += media_memory_update_branch(self, element);
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+
+    // 已经从管道移除的分支
+    const char *name;
+    MediaMemoryBranch *largest = NULL;
+    const char *largest_name = NULL;
+    g_hash_table_iter_init(&iter, self->memory_branches);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&name, (gpointer *)&branch))
+    {
+        if (!branch->seen)
+            g_hash_table_iter_remove(&iter);
+        else if (!branch->usage.limited && strcmp(name, "source") != 0 &&
+                 (!largest || branch->usage.current > largest->usage.current))
+        {
+            largest = branch;
+            largest_name = name;
+        }
+    }
+
+    self->memory.current = total;
+    self->memory.peak = MAX(self->memory.peak, total);
+
+    // 整个媒体超出预算：把占用最多的分支限制到当前的一半
+    if (self->memory.budget && total > self->memory.budget)
+    {
+        if (!self->memory.limited)
+            self->memory.limit_count++;
+        self->memory.limited = TRUE;
+        if (largest && largest->usage.current)
+            media_memory_limit(self, largest_name, largest, largest->usage.current / 2);
+    }
+    else if (total < self->memory.budget / 2)
+    {
+        self->memory.limited = FALSE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+// 汇总一个分支，返回它的占用
+guint64 media_memory_update_branch(GstMedia *self, GstElement *element)
+{
+    const char *name = element == self->src ? "source" : GST_OBJECT_NAME(element);
+    MediaMemoryBranch *branch = g_hash_table_lookup(self->memory_branches, name);
+    if (!branch)
+    {
+        branch = g_new0(MediaMemoryBranch, 1);
+        g_hash_table_insert(self->memory_branches, g_strdup(name), branch);
+    }
+    branch->seen = TRUE;
+    branch->element = element;
+
+    guint64 current = media_memory_level(element);
+    if (GST_IS_BIN(element))
+    {
+        GstIterator *it = gst_bin_iterate_recurse(GST_BIN(element));
+        GValue item = G_VALUE_INIT;
+        while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+        {
+            current += media_memory_level(g_value_get_object(&item));
+            g_value_reset(&item);
+        }
+        g_value_unset(&item);
+        gst_iterator_free(it);
+    }
+
+    for (GList *l = self->memory_sources; l; l = l->next)
+    {
+        MediaMemorySource *source = l->data;
+        if (source->branch == element)
+            current += source->func(source->user_data);
+    }
+
+    guint64 *budget = g_hash_table_lookup(self->branch_budgets, name);
+    branch->usage.budget = budget ? *budget : self->default_branch_budget;
+    branch->usage.current = current;
+    branch->usage.peak = MAX(branch->usage.peak, current);
+
+    // 源里的queue2和multiqueue没有丢弃策略，只统计不限制
+    if (element == self->src)
+        return current;
+
+    if (branch->usage.budget && current > branch->usage.budget && !branch->usage.limited)
+        media_memory_limit(self, name, branch, branch->usage.budget);
+    else if (branch->usage.limited && current < branch->limit / 2 &&
+             !(branch->usage.budget && current > branch->usage.budget) &&
+             !(self->memory.budget && self->memory.limited))
+        media_memory_release(self, name, branch);
+
+    return current;
+}
+
+// 让分支里的每个queue丢弃最旧的数据，limit平均分给这些queue
+void media_memory_limit(GstMedia *self, const char *name, MediaMemoryBranch *branch, guint64 limit)
+{
+    GList *queues = NULL;
+    if (GST_IS_BIN(branch->element))
+    {
+        GstIterator *it = gst_bin_iterate_recurse(GST_BIN(branch->element));
+        GValue item = G_VALUE_INIT;
+        while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+        {
+            GstElement *element = g_value_get_object(&item);
+            if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), "leaky"))
+                queues = g_list_prepend(queues, gst_object_ref(element));
+            g_value_reset(&item);
+        }
+        g_value_unset(&item);
+        gst_iterator_free(it);
+    }
+
+    branch->usage.limited = TRUE;
+    branch->usage.limit_count++;
+    branch->limit = limit;
+
+    if (!queues)
+    {
+        LOG_WARNING(self->name, name, "Branch %s is over its memory budget but has no queue to limit", name);
+        return;
+    }
+
+    guint max_bytes = (guint)CLAMP(limit / g_list_length(queues), 1, G_MAXUINT);
+    for (GList *l = queues; l; l = l->next)
+    {
+        MediaMemoryLimit *saved = g_new0(MediaMemoryLimit, 1);
+        saved->queue = l->data;
+        g_object_get(saved->queue, "leaky", &saved->leaky, "max-size-bytes", &saved->max_bytes,
+                     "max-size-buffers", &saved->max_buffers, "max-size-time", &saved->max_time, NULL);
+        g_object_set(saved->queue, "leaky", 2, "max-size-bytes", max_bytes,
+                     "max-size-buffers", 0, "max-size-time", (guint64)0, NULL);
+        branch->limits = g_list_prepend(branch->limits, saved);
+    }
+    g_list_free(queues);
+
+    LOG_WARNING(self->name, name, "Branch %s holds %" G_GUINT64_FORMAT " bytes, limiting it to %" G_GUINT64_FORMAT
+                " bytes", name, branch->usage.current, limit);
+}
+
+void media_memory_release(GstMedia *self, const char *name, MediaMemoryBranch *branch)
+{
+    for (GList *l = branch->limits; l; l = l->next)
+    {
+        MediaMemoryLimit *saved = l->data;
+        g_object_set(saved->queue, "leaky", saved->leaky, "max-size-bytes", saved->max_bytes,
+                     "max-size-buffers", saved->max_buffers, "max-size-time", saved->max_time, NULL);
+        gst_object_unref(saved->queue);
+    }
+    g_list_free_full(branch->limits, g_free);
+    branch->limits = NULL;
+    branch->usage.limited = FALSE;
+
+    if (self)
+        LOG_INFO(self->name, name, "Branch %s is back under its memory budget", name);
+}
+
+void media_memory_branch_free(MediaMemoryBranch *branch)
+{
+    media_memory_release(NULL, NULL, branch);
+    g_free(branch);
+}
@@ -2,6 +2,7 @@
 #define __GST_MEDIA_H__
 
 #include <gst/gst.h>
+#include "gst-index.h"
 
 typedef enum
 {
@@ -10,6 +11,61 @@ typedef enum
     MEDIA_STATE_PAUSED
 } MediaState;
 
+// 定位模式
+typedef enum
+{
+    MEDIA_SEEK_DEFAULT,      // 仅刷新，由demuxer决定落点（与旧版media_seek一致）
+    MEDIA_SEEK_KEYFRAME,     // 对齐到最近的关键帧，速度最快，适合拖动进度条
+    MEDIA_SEEK_ACCURATE,     // 精确定位到目标帧，需要从关键帧解码到目标位置
+    MEDIA_SEEK_SEGMENT,      // 段定位，播放到段尾发送SEGMENT_DONE而不是EOS
+    MEDIA_SEEK_INSTANT_RATE  // 不刷新管道，立即修改播放速率（不能改变方向）
+} MediaSeekMode;
+
+typedef enum
+{
+    MEDIA_SNAPSHOT_JPEG,
+    MEDIA_SNAPSHOT_PNG
+} MediaSnapshotFormat;
+
+// 截图完成后在编码线程中调用，失败时image为NULL；image在回调返回后释放，需要保留时自行g_bytes_ref
+typedef void (*MediaSnapshotCallback)(GBytes *image, gpointer user_data);
+
+struct GstMedia;
+
+// 异步状态切换完成（到达目标状态）或失败（状态切换失败、管道报错、被新的请求取代）时在主循环中调用
+typedef void (*MediaStateCallback)(struct GstMedia *media, gboolean success, gpointer user_data);
+
+// 启动耗时，都是相对于请求时刻的微秒数，-1表示还没有到达
+typedef struct MediaTimings
+{
+    gint64 request;      // 请求时刻（单调时钟）
+    gint64 ready;
+    gint64 paused;       // 预卷完成
+    gint64 playing;
+    gint64 first_frame;  // 第一帧视频到达v_tee
+} MediaTimings;
+
+// 内存统计：分支（管道里除源和tee之外的每个元素）缓存的字节数是其中所有带current-level-bytes属性的
+// 元素（queue、queue2、appsrc）之和，再加上分支登记的额外来源；源本身记在"source"名下
+typedef struct MediaMemoryUsage
+{
+    guint64 current;
+    guint64 peak;
+    guint64 budget;       // 0表示不限制
+    gboolean limited;     // 超出预算后分支里的queue已切换为丢弃旧数据
+    guint64 limit_count;  // 触发限制的次数
+} MediaMemoryUsage;
+
+// 分支在媒体管道之外缓存的字节数，例如RTSP媒体里appsrc的队列。在主循环中调用
+typedef guint64 (*MediaMemoryFunc)(gpointer user_data);
+
+// 分支所在的bin加入管道后没有自己的总线，需要管道消息的分支在媒体上注册监听
+typedef struct MediaBusListener
+{
+    GstBusFunc func;
+    gpointer user_data;
+} MediaBusListener;
+
 typedef struct GstMedia
 {
     GstBus *bus;
@@ -21,21 +77,118 @@ typedef struct GstMedia
 
     MediaState state;
     gchar *current_uri;
+    gchar *name;                  // 流的名字，日志记录用它区分流，NULL表示未命名
+
+    // 定位状态
+    gdouble rate;                 // 当前播放速率，负数为倒放
+    gboolean seek_in_flight;      // 刷新定位已发出，尚未收到ASYNC_DONE
+    gint64 seek_request_time;     // 定位请求发出的时间（单调时钟，微秒）
+    gint64 last_seek_latency;     // 上一次定位到首帧的耗时（微秒）
+    gboolean seek_queued;         // 定位进行中又收到的新请求，完成后只执行最后一个
+    gint64 queued_seek_position;
+    gdouble queued_seek_rate;
+    MediaSeekMode queued_seek_mode;
+
+    GstKeyIndex *index;           // 本地录像的关键帧索引（存在<文件>.idx时自动加载）
+
+    gchar **timeline;             // 时间线模式下按顺序拼接的分段文件，NULL表示普通URI模式
+
+    // 网络源的缓冲和下载缓存
+    gint buffer_size;             // queue2缓冲字节数，-1表示使用默认值
+    gint64 buffer_duration;       // queue2缓冲时长(ns)，-1表示使用默认值
+    gboolean buffering;           // 因缓冲不足临时暂停中
+    gboolean is_live;
+    gchar *cache_dir;             // 非NULL时渐进下载到该目录，下次打开同一URI直接读本地文件
+    gchar *cache_path;            // 当前URI下载完成后的缓存文件
+    GstElement *download_queue;   // 源内部负责下载的queue2或downloadbuffer，持有引用
+
+    // 截图：第一次调用media_snapshot时才在v_tee上挂一个只保留最新一帧的appsink
+    GstElement *snapshot_sink;
+    GstSample *snapshot_last;     // 最近取出的一帧，appsink里没有新帧时复用
+    GList *snapshot_jobs;         // 排队和进行中的截图任务，相同参数的请求合并到同一个任务
+    guint snapshot_running;       // 已提交到线程池还没有结束的任务数
+
+    GMutex snapshot_lock;
+    GCond snapshot_cond;
+
+    GList *bus_listeners;         // MediaBusListener，分支通过它接收管道总线上的消息
+
+    // 异步状态切换
+    GstState state_target;        // 等待到达的状态，VOID_PENDING表示没有进行中的请求
+    MediaStateCallback state_callback;
+    gpointer state_user_data;
+    gboolean state_result;        // 不需要等待总线消息的请求，在空闲回调中报告的结果
+    guint state_idle;             // 报告state_result的空闲回调，请求结束或被取代时取消
+    MediaTimings timings;
+    GHashTable *branch_timings;   // 分支名 -> 第一帧到达该分支的耗时(gint64 *)，流线程写入
+    GMutex timing_lock;
+
+    // 多轨道选择（源为uridecodebin3时）：只解码选中的轨道，切换轨道不需要重建管道
+    GstStreamCollection *streams; // decodebin3发布的流集合，还没有收到时为NULL
+    gint video_track;             // 选择第几个视频轨道（摄像机角度），-1表示不解码视频
+    gint audio_track;             // 选择第几个音频轨道，-1表示不解码音频
+    gchar *audio_language;        // 非NULL时优先选择该语言的音频轨道，和轨道标签的language-code比较
+    gchar *selected_video;        // 当前解码的stream-id
+    gchar *selected_audio;
+    GMutex stream_lock;           // 保护streams和轨道偏好，流集合在总线的同步处理函数（流线程）里更新
+
+    // 内存统计和预算，由主循环定时汇总
+    MediaMemoryUsage memory;      // 整个媒体
+    GHashTable *memory_branches;  // 分支名 -> MediaMemoryBranch
+    GHashTable *branch_budgets;   // 分支名 -> guint64 *，分支还没有加入时也可以设置
+    guint64 default_branch_budget;
+    GList *memory_sources;        // MediaMemorySource
+    guint memory_poll_id;
 
 } GstMedia;
 
 gboolean media_init(GstMedia *self);
 void media_destroy(GstMedia *self);
 gboolean media_set_uri(GstMedia *self, const char *url);
+void media_set_name(GstMedia *self, const char *name);
+
+gboolean media_set_timeline(GstMedia *self, const char *const *files);
+gboolean media_set_source(GstMedia *self, GstElement *src);
+void media_set_buffering(GstMedia *self, gint buffer_size, gint64 buffer_duration);
+gboolean media_set_cache_dir(GstMedia *self, const char *dir);
+
 gboolean media_play(GstMedia *self);
 gboolean media_pause(GstMedia *self);
 gboolean media_stop(GstMedia *self);
 void media_seek(GstMedia *self, gint64 position);
+gboolean media_seek_full(GstMedia *self, gint64 position, gdouble rate, MediaSeekMode mode);
+gboolean media_set_rate(GstMedia *self, gdouble rate);
+gint64 media_get_position(GstMedia *self);
+GstKeyIndex *media_get_index(GstMedia *self);
+gboolean media_snapshot(GstMedia *self, MediaSnapshotFormat format, gint width, gint height,
+                        MediaSnapshotCallback callback, gpointer user_data);
+gboolean media_set_state_async(GstMedia *self, GstState state, MediaStateCallback callback, gpointer user_data);
+gboolean media_play_async(GstMedia *self, MediaStateCallback callback, gpointer user_data);
+gboolean media_stop_async(GstMedia *self, MediaStateCallback callback, gpointer user_data);
+void media_get_timings(GstMedia *self, MediaTimings *timings);
+gint64 media_get_branch_first_frame(GstMedia *self, const char *branch);
+void media_add_bus_listener(GstMedia *self, GstBusFunc func, gpointer user_data);
+gboolean media_select_video_track(GstMedia *self, gint index);
+gboolean media_select_audio_track(GstMedia *self, gint index);
+gboolean media_select_audio_language(GstMedia *self, const char *language);
+guint media_get_track_count(GstMedia *self, GstStreamType type);
+void media_set_memory_budget(GstMedia *self, guint64 total, guint64 per_branch);
+void media_set_branch_budget(GstMedia *self, const char *branch, guint64 budget);
+gboolean media_get_memory_usage(GstMedia *self, const char *branch, MediaMemoryUsage *usage);
+gchar **media_get_memory_branches(GstMedia *self);
+void media_add_memory_source(GstMedia *self, GstElement *branch, MediaMemoryFunc func, gpointer user_data);
+void media_remove_memory_source(GstMedia *self, MediaMemoryFunc func, gpointer user_data);
+
+void media_bench_streams(const char *uri, gint seconds);
+
+void media_remove_bus_listener(GstMedia *self, GstBusFunc func, gpointer user_data);
 
 // 添加视频/音频分支的辅助函数
 gboolean media_add_video_branch(GstMedia *media, GstElement *branch);
 gboolean media_add_audio_branch(GstMedia *media, GstElement *branch);
 gboolean media_remove_video_branch(GstMedia *media, GstElement *branch);
 gboolean media_remove_audio_branch(GstMedia *media, GstElement *branch);
+// 移除是在tee的空闲探针里完成的，等分支的v_sink和a_sink都断开之后才能把分支设为NULL并移出管道
+gboolean media_wait_branch_unlinked(GstMedia *media, GstElement *branch);
 
 #endif
\ No newline at end of file
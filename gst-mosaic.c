@@ -0,0 +1,478 @@
+#include "gst-mosaic.h"
+#include "gst-log.h"
+#include <string.h>
+#include <time.h>
+
+void mosaic_layout(GstMosaic *self);
+guint mosaic_grid_cols(guint n);
+void mosaic_set_if_exists(GstElement *element, const char *property, gint value);
+GstPadProbeReturn mosaic_bench_on_buffer(GstPad *pad, GstPadProbeInfo *info, gint *count);
+void mosaic_bench_count(GstElement *element, const char *pad_name, gint *count);
+gboolean mosaic_bench_poll(gpointer user_data);
+
+gboolean mosaic_init(GstMosaic *self, gint width, gint height, gint fps)
+{
+    if (!self)
+    {
+        g_printerr("Mosaic instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstMosaic));
+    self->width = width > 0 ? width : 1920;
+    self->height = height > 0 ? height : 1080;
+    self->fps = fps > 0 ? fps : 25;
+    self->tiles = g_ptr_array_new_with_free_func(g_free);
+
+    if (!media_init(&self->media))
+        return FALSE;
+    sync_init(&self->own_sync);
+    self->sync = &self->own_sync;
+
+    // 创建元素
+    self->bin = gst_bin_new("mosaic");
+    self->compositor = gst_element_factory_make("compositor", "mosaic_compositor");
+    self->v_filter = gst_element_factory_make("capsfilter", "mosaic_v_filter");
+    self->a_src = gst_element_factory_make("audiotestsrc", "mosaic_a_src");
+    self->a_filter = gst_element_factory_make("capsfilter", "mosaic_a_filter");
+
+    if (!self->bin || !self->compositor || !self->v_filter || !self->a_src || !self->a_filter)
+    {
+        g_printerr("Could not create mosaic elements.\n");
+        mosaic_destroy(self);
+        return FALSE;
+    }
+
+    gst_bin_add_many(GST_BIN(self->bin), self->compositor, self->v_filter, self->a_src, self->a_filter, NULL);
+    if (!gst_element_link(self->compositor, self->v_filter) || !gst_element_link(self->a_src, self->a_filter))
+    {
+        g_printerr("Mosaic elements could not be linked.\n");
+        mosaic_destroy(self);
+        return FALSE;
+    }
+
+    // 新版本的compositor可以多线程混合，某一路断开时不等待它
+    mosaic_set_if_exists(self->compositor, "max-threads", g_get_num_processors());
+    mosaic_set_if_exists(self->compositor, "ignore-inactive-pads", TRUE);
+    g_object_set(self->compositor, "background", 1, NULL);
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "width", G_TYPE_INT, self->width,
+                                        "height", G_TYPE_INT, self->height,
+                                        "framerate", GST_TYPE_FRACTION, self->fps, 1,
+                                        NULL);
+    g_object_set(self->v_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(self->a_src, "wave", 4, "is-live", TRUE, NULL);  // 4: silence
+    caps = gst_caps_from_string("audio/x-raw, rate=(int)48000, channels=(int)2");
+    g_object_set(self->a_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    // 创建ghost pads，媒体按caps把它们连接到v_tee和a_tee
+    GstPad *v_pad = gst_element_get_static_pad(self->v_filter, "src");
+    GstPad *a_pad = gst_element_get_static_pad(self->a_filter, "src");
+    GstPad *v_ghost_pad = gst_ghost_pad_new("video", v_pad);
+    GstPad *a_ghost_pad = gst_ghost_pad_new("audio", a_pad);
+    gst_pad_set_active(v_ghost_pad, TRUE);
+    gst_pad_set_active(a_ghost_pad, TRUE);
+    gst_element_add_pad(self->bin, v_ghost_pad);
+    gst_element_add_pad(self->bin, a_ghost_pad);
+    gst_object_unref(v_pad);
+    gst_object_unref(a_pad);
+
+    if (!media_set_source(&self->media, self->bin))
+    {
+        mosaic_destroy(self);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void mosaic_destroy(GstMosaic *self)
+{
+    if (!self)
+        return;
+
+    // 输出随拼接一起释放，必须离开协调器；输入属于调用者，只在使用自己的协调器时移除
+    sync_remove_media(self->sync, &self->media);
+
+    if (self->tiles)
+    {
+        for (guint i = 0; i < self->tiles->len; i++)
+        {
+            MosaicTile *tile = g_ptr_array_index(self->tiles, i);
+            if (self->sync == &self->own_sync)
+                sync_remove_media(self->sync, tile->media);
+            media_remove_video_branch(tile->media, tile->branch);
+        }
+
+        for (guint i = 0; i < self->tiles->len; i++)
+        {
+            MosaicTile *tile = g_ptr_array_index(self->tiles, i);
+
+            // 输入媒体还会继续使用，分支要从它的管道里移除，管道持有分支唯一的引用。
+            // 还连在tee上时设为NULL会让tee收到FLUSHING而停止输入，超时的分支留在管道里
+            if (media_wait_branch_unlinked(tile->media, tile->branch))
+            {
+                gst_element_set_state(tile->branch, GST_STATE_NULL);
+                gst_bin_remove(GST_BIN(tile->media->pipeline), tile->branch);
+            }
+            gst_object_unref(tile->pad);
+        }
+        g_ptr_array_free(self->tiles, TRUE);
+        self->tiles = NULL;
+    }
+
+    // bin已经交给输出媒体，随媒体的管道一起释放
+    if (self->bin && !GST_OBJECT_PARENT(self->bin))
+        gst_object_unref(self->bin);
+    self->bin = NULL;
+
+    media_destroy(&self->media);
+    sync_destroy(&self->own_sync);
+    self->sync = NULL;
+}
+
+void mosaic_set_if_exists(GstElement *element, const char *property, gint value)
+{
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property);
+    if (!spec)
+        return;
+
+    if (spec->value_type == G_TYPE_BOOLEAN)
+        g_object_set(element, property, (gboolean)value, NULL);
+    else
+        g_object_set(element, property, (guint)value, NULL);
+}
+
+// 添加一路输入，必须在mosaic_start之前调用。输入媒体可以已经在播放，此时它必须已经加入拼接使用的协调器
+gboolean mosaic_add_source(GstMosaic *self, GstMedia *media)
+{
+    if (!self || !self->bin || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to mosaic_add_source\n");
+        return FALSE;
+    }
+
+    if (self->media.state != MEDIA_STATE_STOPPED)
+    {
+        g_printerr("Cannot add mosaic sources while running\n");
+        return FALSE;
+    }
+
+    guint n = self->tiles->len;
+    gchar *name = g_strdup_printf("mosaic_tile_%u", n);
+    GstElement *branch = gst_bin_new(name);
+    g_free(name);
+    GstElement *queue = gst_element_factory_make("queue", NULL);
+    GstElement *scale = gst_element_factory_make("videoscale", NULL);
+    GstElement *convert = gst_element_factory_make("videoconvert", NULL);
+    GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+    GstElement *proxysink = gst_element_factory_make("proxysink", NULL);
+    GstElement *proxysrc = gst_element_factory_make("proxysrc", NULL);
+
+    if (!branch || !queue || !scale || !convert || !filter || !proxysink || !proxysrc)
+    {
+        g_printerr("Could not create mosaic tile elements.\n");
+        GstElement *elements[] = {branch, queue, scale, convert, filter, proxysink, proxysrc};
+        for (guint i = 0; i < G_N_ELEMENTS(elements); i++)
+        {
+            if (elements[i])
+                gst_object_unref(gst_object_ref_sink(elements[i]));
+        }
+        return FALSE;
+    }
+
+    // 缩小在输入管道的线程里完成，compositor只处理格子大小的画面；拼接跟不上时丢帧，不能反压输入
+    gst_bin_add_many(GST_BIN(branch), queue, scale, convert, filter, proxysink, NULL);
+    gst_element_link_many(queue, scale, convert, filter, proxysink, NULL);
+    g_object_set(queue, "leaky", 2, "max-size-buffers", 2, "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+
+    GstPad *pad = gst_element_get_static_pad(queue, "sink");
+    GstPad *ghost_pad = gst_ghost_pad_new("v_sink", pad);
+    gst_pad_set_active(ghost_pad, TRUE);
+    gst_element_add_pad(branch, ghost_pad);
+    gst_object_unref(pad);
+
+    g_object_set(proxysrc, "proxysink", proxysink, NULL);
+    gst_bin_add(GST_BIN(self->bin), proxysrc);
+
+    MosaicTile *tile = g_new0(MosaicTile, 1);
+    tile->media = media;
+    tile->branch = branch;
+    tile->filter = filter;
+    tile->proxysink = proxysink;
+    tile->proxysrc = proxysrc;
+    tile->pad = gst_element_request_pad_simple(self->compositor, "sink_%u");
+
+    GstPad *src_pad = gst_element_get_static_pad(proxysrc, "src");
+    GstPadLinkReturn ret = tile->pad ? gst_pad_link(src_pad, tile->pad) : GST_PAD_LINK_REFUSED;
+    gst_object_unref(src_pad);
+    if (GST_PAD_LINK_FAILED(ret) || !media_add_video_branch(media, branch))
+    {
+        g_printerr("Could not link mosaic tile %u\n", n);
+        if (tile->pad)
+        {
+            gst_element_release_request_pad(self->compositor, tile->pad);
+            gst_object_unref(tile->pad);
+        }
+        gst_bin_remove(GST_BIN(self->bin), proxysrc);
+
+        // media_add_video_branch可能已经把分支加入了输入管道
+        if (GST_OBJECT_PARENT(branch))
+        {
+            gst_element_set_state(branch, GST_STATE_NULL);
+            gst_bin_remove(GST_BIN(media->pipeline), branch);
+        }
+        else
+        {
+            gst_object_unref(gst_object_ref_sink(branch));
+        }
+        g_free(tile);
+        return FALSE;
+    }
+
+    g_ptr_array_add(self->tiles, tile);
+    return TRUE;
+}
+
+// 能放下n个格子的最小正方形边长，即ceil(sqrt(n))，只用整数运算
+guint mosaic_grid_cols(guint n)
+{
+    guint cols = 1;
+    while (cols * cols < n)
+        cols++;
+    return cols;
+}
+
+// 按输入数量排成接近正方形的网格，每个格子的大小同时设置到输入分支的capsfilter，
+// 这样compositor不需要再缩放
+void mosaic_layout(GstMosaic *self)
+{
+    guint n = self->tiles->len;
+    guint cols = mosaic_grid_cols(n);
+    guint rows = (n + cols - 1) / cols;
+    gint tile_width = (self->width / cols) & ~1;
+    gint tile_height = (self->height / rows) & ~1;
+
+    for (guint i = 0; i < n; i++)
+    {
+        MosaicTile *tile = g_ptr_array_index(self->tiles, i);
+
+        GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                            "format", G_TYPE_STRING, "I420",
+                                            "width", G_TYPE_INT, tile_width,
+                                            "height", G_TYPE_INT, tile_height,
+                                            "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+                                            NULL);
+        g_object_set(tile->filter, "caps", caps, NULL);
+        gst_caps_unref(caps);
+
+        g_object_set(tile->pad,
+                     "xpos", (gint)(i % cols) * tile_width,
+                     "ypos", (gint)(i / cols) * tile_height,
+                     "width", tile_width,
+                     "height", tile_height,
+                     NULL);
+    }
+
+    LOG_DEBUG(self->media.name, GST_ELEMENT_NAME(self->bin), "Mosaic layout %ux%u, tile %dx%d",
+              cols, rows, tile_width, tile_height);
+}
+
+void mosaic_set_sync(GstMosaic *self, GstSync *sync)
+{
+    if (!self)
+        return;
+
+    sync_remove_media(self->sync, &self->media);
+    self->sync = sync ? sync : &self->own_sync;
+}
+
+gboolean mosaic_start(GstMosaic *self)
+{
+    if (!self || !self->tiles || self->tiles->len == 0)
+    {
+        g_printerr("Mosaic has no sources\n");
+        return FALSE;
+    }
+
+    mosaic_layout(self);
+
+    // 输入一起加入协调器，共用base time；已经在播放的输入不能再改时钟，必须已经在协调器里
+    for (guint i = 0; i < self->tiles->len; i++)
+    {
+        MosaicTile *tile = g_ptr_array_index(self->tiles, i);
+        if (!sync_add_media(self->sync, tile->media))
+        {
+            g_printerr("Mosaic source %u is not on the mosaic clock\n", i);
+            return FALSE;
+        }
+    }
+    if (!sync_add_media(self->sync, &self->media))
+        return FALSE;
+
+    for (guint i = 0; i < self->tiles->len; i++)
+    {
+        MosaicTile *tile = g_ptr_array_index(self->tiles, i);
+        if (tile->media->state != MEDIA_STATE_PLAYING && !media_play(tile->media))
+            g_printerr("Mosaic source %u failed to start\n", i);
+    }
+
+    return media_play(&self->media);
+}
+
+gboolean mosaic_stop(GstMosaic *self)
+{
+    if (!self)
+        return FALSE;
+
+    return media_stop(&self->media);
+}
+
+// 拼接性能测试：main.out --bench-mosaic。走实际的拼接路径：tiles路720p直播测试源各自是一个GstMedia，
+// 经过格子分支（leaky queue、缩放、proxysink）送到输出管道的compositor，输出接一个不同步的fakesink。
+// 输出是直播的，帧率上限就是拼接的fps；统计输出帧率、格子分支跟不上时丢掉的输入帧和进程的CPU占用
+#define MOSAIC_BENCH_FPS 25
+#define MOSAIC_BENCH_POLL 100  // 毫秒
+
+typedef struct MosaicBench
+{
+    GMainLoop *loop;
+    gint input, tiled, output;  // 进入格子分支、到达proxysink、输出的帧数，流线程累加
+    gint frames;
+    gint64 deadline;
+} MosaicBench;
+
+GstPadProbeReturn mosaic_bench_on_buffer(GstPad *pad, GstPadProbeInfo *info, gint *count)
+{
+    g_atomic_int_inc(count);
+    return GST_PAD_PROBE_OK;
+}
+
+void mosaic_bench_count(GstElement *element, const char *pad_name, gint *count)
+{
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)mosaic_bench_on_buffer, count, NULL);
+    gst_object_unref(pad);
+}
+
+gboolean mosaic_bench_poll(gpointer user_data)
+{
+    MosaicBench *bench = (MosaicBench *)user_data;
+    if (g_atomic_int_get(&bench->output) < bench->frames && g_get_monotonic_time() < bench->deadline)
+        return G_SOURCE_CONTINUE;
+
+    g_main_loop_quit(bench->loop);
+    return G_SOURCE_REMOVE;
+}
+
+void mosaic_bench(guint tiles, gint width, gint height, gint frames)
+{
+    GstMosaic mosaic;
+    if (!mosaic_init(&mosaic, width, height, MOSAIC_BENCH_FPS))
+        return;
+
+    MosaicBench bench = {0};
+    bench.frames = frames;
+    GstMedia *inputs = g_new0(GstMedia, tiles);
+    guint created = 0;
+    gboolean ok = TRUE;
+
+    gchar *desc = g_strdup_printf("videotestsrc is-live=true pattern=ball"
+                                  " ! video/x-raw,format=I420,width=1280,height=720,framerate=%d/1",
+                                  MOSAIC_BENCH_FPS);
+    for (guint i = 0; i < tiles && ok; i++)
+    {
+        if (!media_init(&inputs[i]))
+        {
+            ok = FALSE;
+            break;
+        }
+        created++;
+
+        GstElement *src = gst_parse_bin_from_description(desc, TRUE, NULL);
+        ok = src && media_set_source(&inputs[i], src) && mosaic_add_source(&mosaic, &inputs[i]);
+        if (ok)
+        {
+            MosaicTile *tile = g_ptr_array_index(mosaic.tiles, i);
+            mosaic_bench_count(tile->branch, "v_sink", &bench.input);
+            mosaic_bench_count(tile->proxysink, "sink", &bench.tiled);
+        }
+    }
+    g_free(desc);
+
+    GstElement *sink = NULL;
+    if (ok)
+    {
+        GstElement *branch = gst_bin_new("mosaic_bench");
+        GstElement *queue = gst_element_factory_make("queue", NULL);
+        sink = gst_element_factory_make("fakesink", NULL);
+        g_object_set(sink, "sync", FALSE, NULL);
+        gst_bin_add_many(GST_BIN(branch), queue, sink, NULL);
+        gst_element_link(queue, sink);
+        GstPad *pad = gst_element_get_static_pad(queue, "sink");
+        gst_element_add_pad(branch, gst_ghost_pad_new("v_sink", pad));
+        gst_object_unref(pad);
+
+        mosaic_bench_count(sink, "sink", &bench.output);
+        ok = media_add_video_branch(&mosaic.media, branch);
+    }
+
+    if (!ok)
+    {
+        g_printerr("Could not build mosaic benchmark\n");
+    }
+    else
+    {
+        bench.loop = g_main_loop_new(NULL, FALSE);
+        bench.deadline = g_get_monotonic_time() + (gint64)frames * 2 * G_TIME_SPAN_SECOND / MOSAIC_BENCH_FPS +
+                         5 * G_TIME_SPAN_SECOND;
+        g_timeout_add(MOSAIC_BENCH_POLL, mosaic_bench_poll, &bench);
+
+        // 第一帧输出之后才开始计时，不计入启动64路管道的时间
+        clock_t cpu_start = 0;
+        gint64 start = 0;
+        gint output_start = 0, input_start = 0, tiled_start = 0;
+        if (mosaic_start(&mosaic))
+        {
+            while (g_atomic_int_get(&bench.output) == 0 && g_get_monotonic_time() < bench.deadline)
+                g_main_context_iteration(NULL, TRUE);
+            cpu_start = clock();
+            start = g_get_monotonic_time();
+            output_start = g_atomic_int_get(&bench.output);
+            input_start = g_atomic_int_get(&bench.input);
+            tiled_start = g_atomic_int_get(&bench.tiled);
+            // 轮询回调在输出帧数够了或超时的时候退出主循环并移除自己
+            if (output_start > 0 && output_start < frames && g_get_monotonic_time() < bench.deadline)
+                g_main_loop_run(bench.loop);
+        }
+
+        gint64 elapsed = MAX(g_get_monotonic_time() - start, 1);
+        gdouble cpu = (gdouble)(clock() - cpu_start) / CLOCKS_PER_SEC;
+        gint output = g_atomic_int_get(&bench.output) - output_start;
+        gint input = g_atomic_int_get(&bench.input) - input_start;
+        gint dropped = input - (g_atomic_int_get(&bench.tiled) - tiled_start);
+
+        if (start == 0 || output <= 0)
+            g_printerr("Mosaic benchmark produced no frames\n");
+        else
+            g_print("%u tiles -> %dx%d@%d: %.1f fps, %.1f%% of tile frames dropped, CPU %.0f%%\n",
+                    tiles, width, height, MOSAIC_BENCH_FPS, output * 1e6 / elapsed,
+                    input > 0 ? 100.0 * MAX(dropped, 0) / input : 0.0, 100.0 * cpu * 1e6 / elapsed);
+
+        mosaic_stop(&mosaic);
+        g_main_loop_unref(bench.loop);
+        while (g_source_remove_by_user_data(&bench))
+            ;
+    }
+
+    for (guint i = 0; i < created; i++)
+        media_stop(&inputs[i]);
+    mosaic_destroy(&mosaic);
+    for (guint i = 0; i < created; i++)
+        media_destroy(&inputs[i]);
+    g_free(inputs);
+}
@@ -0,0 +1,46 @@
+#ifndef __GST_MOSAIC_H__
+#define __GST_MOSAIC_H__
+
+#include <gst/gst.h>
+#include "gst-media.h"
+#include "gst-sync.h"
+
+// 多路画面拼接：每个输入GstMedia的v_tee上挂一个分支，先在输入管道里缩小到格子大小，
+// 再通过proxysink/proxysrc送到输出管道的compositor。拼接结果作为一个普通的GstMedia，
+// 可以像单路摄像头一样交给GstPlayer、GstRecorder和RTSP服务器。
+// proxysink/proxysrc传递的是输入管道的running time，输出和所有输入在mosaic_start时加入同一个时钟协调器
+
+typedef struct MosaicTile
+{
+    GstMedia *media;
+    GstElement *branch;        // 输入管道里的分支：queue -> videoscale -> videoconvert -> capsfilter -> proxysink
+    GstElement *filter;
+    GstElement *proxysink, *proxysrc;
+    GstPad *pad;               // compositor的sink pad
+} MosaicTile;
+
+typedef struct GstMosaic
+{
+    GstMedia media;            // 输出，源是下面的bin
+    GstElement *bin;
+    GstElement *compositor, *v_filter;
+    GstElement *a_src, *a_filter;  // 静音音轨，下游分支都需要音频
+
+    gint width, height, fps;
+    GPtrArray *tiles;          // MosaicTile
+
+    GstSync own_sync;          // 没有指定协调器时使用
+    GstSync *sync;             // 输出和输入加入的协调器
+
+} GstMosaic;
+
+gboolean mosaic_init(GstMosaic *self, gint width, gint height, gint fps);
+void mosaic_destroy(GstMosaic *self);
+gboolean mosaic_add_source(GstMosaic *self, GstMedia *media);
+// 和其他管道共用协调器，在mosaic_start之前调用；已经在播放的输入必须事先加入这个协调器。NULL恢复使用自己的
+void mosaic_set_sync(GstMosaic *self, GstSync *sync);
+gboolean mosaic_start(GstMosaic *self);
+gboolean mosaic_stop(GstMosaic *self);
+void mosaic_bench(guint tiles, gint width, gint height, gint frames);
+
+#endif
@@ -0,0 +1,455 @@
+#include "gst-motion.h"
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MOTION_X86 1
+#include <immintrin.h>
+#endif
+
+#define MOTION_BLOCK 16
+
+// 计算一个16行高的条带里每个16x16块的SAD，结果写到sad[0..blocks-1]
+typedef void (*MotionSadFunc)(const guint8 *cur, const guint8 *prev, gint stride, gint blocks, guint32 *sad);
+
+typedef struct MotionKernel
+{
+    const char *name;
+    MotionSadFunc func;
+    gboolean available;
+} MotionKernel;
+
+GstFlowReturn motion_on_new_sample(GstAppSink *sink, GstMotion *self);
+void motion_analyze(GstMotion *self, GstVideoFrame *frame);
+void motion_notify(GstMotion *self);
+gboolean motion_apply_recorder(GstMotion *self);
+MotionSadFunc motion_get_kernel(void);
+
+void motion_sad_c(const guint8 *cur, const guint8 *prev, gint stride, gint blocks, guint32 *sad)
+{
+    for (gint bx = 0; bx < blocks; bx++)
+    {
+        guint32 sum = 0;
+        for (gint y = 0; y < MOTION_BLOCK; y++)
+        {
+            const guint8 *a = cur + y * stride + bx * MOTION_BLOCK;
+            const guint8 *b = prev + y * stride + bx * MOTION_BLOCK;
+            for (gint x = 0; x < MOTION_BLOCK; x++)
+                sum += a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+        }
+        sad[bx] = sum;
+    }
+}
+
+#ifdef MOTION_X86
+// _mm_sad_epu8一次算16个字节，结果在两个64位通道里，16行累加后最大32640，不会溢出32位
+__attribute__((target("sse2")))
+void motion_sad_sse2(const guint8 *cur, const guint8 *prev, gint stride, gint blocks, guint32 *sad)
+{
+    for (gint bx = 0; bx < blocks; bx++)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (gint y = 0; y < MOTION_BLOCK; y++)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(cur + y * stride + bx * MOTION_BLOCK));
+            __m128i b = _mm_loadu_si128((const __m128i *)(prev + y * stride + bx * MOTION_BLOCK));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+        }
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi64(acc, acc));
+        sad[bx] = (guint32)_mm_cvtsi128_si32(acc);
+    }
+}
+
+// 一次处理相邻的两个块：低128位对应bx，高128位对应bx+1，奇数个块时最后一个用SSE2
+__attribute__((target("avx2")))
+void motion_sad_avx2(const guint8 *cur, const guint8 *prev, gint stride, gint blocks, guint32 *sad)
+{
+    gint bx = 0;
+    for (; bx + 1 < blocks; bx += 2)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        for (gint y = 0; y < MOTION_BLOCK; y++)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(cur + y * stride + bx * MOTION_BLOCK));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(prev + y * stride + bx * MOTION_BLOCK));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(a, b));
+        }
+        __m128i lo = _mm256_castsi256_si128(acc);
+        __m128i hi = _mm256_extracti128_si256(acc, 1);
+        lo = _mm_add_epi32(lo, _mm_unpackhi_epi64(lo, lo));
+        hi = _mm_add_epi32(hi, _mm_unpackhi_epi64(hi, hi));
+        sad[bx] = (guint32)_mm_cvtsi128_si32(lo);
+        sad[bx + 1] = (guint32)_mm_cvtsi128_si32(hi);
+    }
+    if (bx < blocks)
+        motion_sad_sse2(cur + bx * MOTION_BLOCK, prev + bx * MOTION_BLOCK, stride, blocks - bx, sad + bx);
+}
+#endif
+
+// 按运行时CPU特性选择，顺序从快到慢
+static MotionKernel motion_kernels[] = {
+#ifdef MOTION_X86
+    {"avx2", motion_sad_avx2, FALSE},
+    {"sse2", motion_sad_sse2, FALSE},
+#endif
+    {"scalar", motion_sad_c, TRUE},
+};
+
+static gpointer motion_detect_kernels(gpointer data)
+{
+#ifdef MOTION_X86
+    __builtin_cpu_init();
+    motion_kernels[0].available = __builtin_cpu_supports("avx2");
+    motion_kernels[1].available = __builtin_cpu_supports("sse2");
+#endif
+    for (guint i = 0; i < G_N_ELEMENTS(motion_kernels); i++)
+    {
+        if (motion_kernels[i].available)
+            return motion_kernels[i].func;
+    }
+    return motion_sad_c;
+}
+
+MotionSadFunc motion_get_kernel(void)
+{
+    static GOnce once = G_ONCE_INIT;
+    g_once(&once, motion_detect_kernels, NULL);
+    return (MotionSadFunc)once.retval;
+}
+
+// 计算整帧的分块SAD，宽高不足一个块的部分忽略，返回所有块的SAD之和
+guint64 motion_block_sad(const guint8 *cur, const guint8 *prev, gint width, gint height, gint stride, guint32 *block_sad)
+{
+    MotionSadFunc sad = motion_get_kernel();
+    gint blocks_x = width / MOTION_BLOCK;
+    gint blocks_y = height / MOTION_BLOCK;
+    guint64 total = 0;
+
+    for (gint by = 0; by < blocks_y; by++)
+    {
+        gsize offset = (gsize)by * MOTION_BLOCK * stride;
+        guint32 *row = block_sad + by * blocks_x;
+        sad(cur + offset, prev + offset, stride, blocks_x, row);
+        for (gint bx = 0; bx < blocks_x; bx++)
+            total += row[bx];
+    }
+    return total;
+}
+
+gboolean motion_init(GstMotion *self, gint width, gint height, gint fps)
+{
+    if (!self)
+    {
+        g_printerr("Motion instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstMotion));
+
+    // 分析分辨率对齐到块大小，保证每一行都是完整的块
+    self->width = GST_ROUND_UP_16(MAX(width, MOTION_BLOCK));
+    self->height = GST_ROUND_UP_16(MAX(height, MOTION_BLOCK));
+    self->fps = fps > 0 ? fps : 5;
+    self->pixel_threshold = 12;
+    self->area_threshold = 0.01;
+    self->hold_time = 5 * GST_SECOND;
+
+    // 创建元素
+    self->bin = GST_BIN(gst_bin_new("motion_bin"));
+    self->v_queue = gst_element_factory_make("queue", "motion_v_queue");
+    self->v_rate = gst_element_factory_make("videorate", "motion_v_rate");
+    self->v_scale = gst_element_factory_make("videoscale", "motion_v_scale");
+    self->v_convert = gst_element_factory_make("videoconvert", "motion_v_convert");
+    self->v_filter = gst_element_factory_make("capsfilter", "motion_v_filter");
+    self->v_sink = gst_element_factory_make("appsink", "motion_v_sink");
+
+    if (!self->bin || !self->v_queue || !self->v_rate || !self->v_scale ||
+        !self->v_convert || !self->v_filter || !self->v_sink)
+    {
+        g_printerr("Could not create motion elements.\n");
+        motion_destroy(self);
+        return FALSE;
+    }
+
+    // bin会被加入媒体管道，这里持有自己的引用，销毁时再释放
+    gst_object_ref_sink(self->bin);
+
+    gst_bin_add_many(self->bin, self->v_queue, self->v_rate, self->v_scale,
+                     self->v_convert, self->v_filter, self->v_sink, NULL);
+
+    // 分析跟不上时直接丢旧帧，不能反压tee
+    g_object_set(self->v_queue, "leaky", 2, "max-size-buffers", 1, "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+    g_object_set(self->v_rate, "drop-only", TRUE, "max-rate", self->fps, NULL);
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, "GRAY8",
+                                        "width", G_TYPE_INT, self->width,
+                                        "height", G_TYPE_INT, self->height,
+                                        NULL);
+    g_object_set(self->v_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(self->v_sink, "sync", FALSE, "async", FALSE, "max-buffers", 1, "drop", TRUE, NULL);
+    GstAppSinkCallbacks callbacks = {0};
+    callbacks.new_sample = (GstFlowReturn(*)(GstAppSink *, gpointer))motion_on_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(self->v_sink), &callbacks, self, NULL);
+
+    if (!gst_element_link_many(self->v_queue, self->v_rate, self->v_scale,
+                               self->v_convert, self->v_filter, self->v_sink, NULL))
+    {
+        g_printerr("Motion elements could not be linked.\n");
+        motion_destroy(self);
+        return FALSE;
+    }
+
+    // 创建ghost pad
+    GstPad *v_pad = gst_element_get_static_pad(self->v_queue, "sink");
+    GstPad *v_ghost_pad = gst_ghost_pad_new("v_sink", v_pad);
+    gst_element_add_pad(GST_ELEMENT(self->bin), v_ghost_pad);
+    gst_pad_set_active(v_ghost_pad, TRUE);
+    gst_object_unref(v_pad);
+
+    return TRUE;
+}
+
+void motion_destroy(GstMotion *self)
+{
+    if (!self)
+        return;
+
+    if (self->bin)
+    {
+        gst_object_unref(self->bin);
+        self->bin = NULL;
+    }
+
+    g_free(self->prev);
+    self->prev = NULL;
+    g_free(self->block_sad);
+    self->block_sad = NULL;
+    g_free(self->filename_template);
+    self->filename_template = NULL;
+}
+
+gboolean motion_link(GstMotion *self, GstMedia *media)
+{
+    if (!self || !self->bin || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to motion_link\n");
+        return FALSE;
+    }
+
+    return media_add_video_branch(media, GST_ELEMENT(self->bin));
+}
+
+void motion_set_fps(GstMotion *self, gint fps)
+{
+    if (!self || !self->v_rate || fps <= 0)
+        return;
+
+    self->fps = fps;
+    g_object_set(self->v_rate, "max-rate", fps, NULL);
+}
+
+void motion_set_callback(GstMotion *self, MotionCallback callback, gpointer user_data)
+{
+    if (!self)
+        return;
+
+    self->callback = callback;
+    self->user_data = user_data;
+}
+
+void motion_set_recorder(GstMotion *self, GstRecorder *recorder, const char *filename_template)
+{
+    if (!self)
+        return;
+
+    self->recorder = recorder;
+    g_free(self->filename_template);
+    self->filename_template = g_strdup(filename_template ? filename_template : "motion-%Y%m%d-%H%M%S.mp4");
+}
+
+GstFlowReturn motion_on_new_sample(GstAppSink *sink, GstMotion *self)
+{
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample)
+        return GST_FLOW_EOS;
+
+    GstVideoInfo info;
+    GstVideoFrame frame;
+    if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+        gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ))
+    {
+        motion_analyze(self, &frame);
+        gst_video_frame_unmap(&frame);
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// 在appsink的流线程中运行
+void motion_analyze(GstMotion *self, GstVideoFrame *frame)
+{
+    gint width = GST_VIDEO_FRAME_WIDTH(frame);
+    gint height = GST_VIDEO_FRAME_HEIGHT(frame);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+    const guint8 *data = GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+    gsize size = (gsize)stride * height;
+    gint blocks = (width / MOTION_BLOCK) * (height / MOTION_BLOCK);
+
+    if (blocks == 0)
+        return;
+
+    // 第一帧或者分辨率变化时只保存参考帧
+    if (!self->prev || width != self->width || height != self->height)
+    {
+        g_free(self->prev);
+        g_free(self->block_sad);
+        self->prev = g_malloc(size);
+        self->block_sad = g_new(guint32, blocks);
+        self->width = width;
+        self->height = height;
+        memcpy(self->prev, data, size);
+        return;
+    }
+
+    motion_block_sad(data, self->prev, width, height, stride, self->block_sad);
+    memcpy(self->prev, data, size);
+
+    guint32 limit = self->pixel_threshold * MOTION_BLOCK * MOTION_BLOCK;
+    gint changed = 0;
+    for (gint i = 0; i < blocks; i++)
+        changed += self->block_sad[i] > limit;
+
+    self->ratio = (gdouble)changed / blocks;
+
+    GstClockTime now = g_get_monotonic_time() * GST_USECOND;
+    if (self->ratio >= self->area_threshold)
+    {
+        self->last_motion = now;
+        if (!self->active)
+        {
+            self->active = TRUE;
+            motion_notify(self);
+        }
+    }
+    else if (self->active && now - self->last_motion >= (GstClockTime)self->hold_time)
+    {
+        self->active = FALSE;
+        motion_notify(self);
+    }
+}
+
+// 运动开始/结束：回调（流线程）、总线上的element消息，录制的启停交给主循环
+void motion_notify(GstMotion *self)
+{
+    g_print("Motion %s (%.1f%% of blocks changed)\n", self->active ? "started" : "stopped", self->ratio * 100);
+
+    if (self->callback)
+        self->callback(self->active, self->ratio, self->user_data);
+
+    GstStructure *s = gst_structure_new("motion",
+                                        "active", G_TYPE_BOOLEAN, self->active,
+                                        "ratio", G_TYPE_DOUBLE, self->ratio,
+                                        NULL);
+    gst_element_post_message(GST_ELEMENT(self->bin), gst_message_new_element(GST_OBJECT(self->bin), s));
+
+    // recorder_stop要等待EOS，不能在流线程里调用
+    if (self->recorder)
+        g_main_context_invoke(NULL, (GSourceFunc)motion_apply_recorder, self);
+}
+
+gboolean motion_apply_recorder(GstMotion *self)
+{
+    GstRecorder *recorder = self->recorder;
+    if (!recorder)
+        return G_SOURCE_REMOVE;
+
+    if (self->active && recorder->state == RECORDER_STATE_STOPPED)
+    {
+        GDateTime *now = g_date_time_new_now_local();
+        gchar *filename = g_date_time_format(now, self->filename_template);
+        g_date_time_unref(now);
+
+        if (!filename || !recorder_start(recorder, filename))
+            g_printerr("Failed to start motion recording\n");
+        g_free(filename);
+    }
+    else if (!self->active && recorder->state == RECORDER_STATE_RECORDING)
+    {
+        recorder_stop(recorder);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+// 分块SAD的性能测试：main.out --bench-motion
+void motion_bench(gint width, gint height, gint iterations)
+{
+    gint stride = GST_ROUND_UP_32(width);
+    gsize size = (gsize)stride * height;
+    guint8 *a = g_malloc(size);
+    guint8 *b = g_malloc(size);
+    guint32 *sad = g_new(guint32, (width / MOTION_BLOCK) * (height / MOTION_BLOCK));
+    GRand *rand = g_rand_new_with_seed(1);
+
+    for (gsize i = 0; i < size; i++)
+    {
+        a[i] = g_rand_int(rand) & 0xff;
+        b[i] = g_rand_int(rand) & 0xff;
+    }
+
+    motion_get_kernel();
+
+    guint64 expected = 0;
+    gboolean have_expected = FALSE;
+    for (guint k = 0; k < G_N_ELEMENTS(motion_kernels); k++)
+    {
+        MotionKernel *kernel = &motion_kernels[k];
+        if (!kernel->available)
+        {
+            g_print("%dx%d %-6s not supported\n", width, height, kernel->name);
+            continue;
+        }
+
+        // 各实现的结果必须一致
+        guint64 total = 0;
+        for (gint by = 0; by < height / MOTION_BLOCK; by++)
+        {
+            gsize offset = (gsize)by * MOTION_BLOCK * stride;
+            guint32 *row = sad + by * (width / MOTION_BLOCK);
+            kernel->func(a + offset, b + offset, stride, width / MOTION_BLOCK, row);
+            for (gint bx = 0; bx < width / MOTION_BLOCK; bx++)
+                total += row[bx];
+        }
+        if (!have_expected)
+        {
+            expected = total;
+            have_expected = TRUE;
+        }
+
+        gint64 start = g_get_monotonic_time();
+        for (gint i = 0; i < iterations; i++)
+        {
+            for (gint by = 0; by < height / MOTION_BLOCK; by++)
+            {
+                gsize offset = (gsize)by * MOTION_BLOCK * stride;
+                kernel->func(a + offset, b + offset, stride, width / MOTION_BLOCK, sad + by * (width / MOTION_BLOCK));
+            }
+        }
+        gint64 elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+        g_print("%dx%d %-6s %8.3f ms/frame %7.2f GB/s%s\n", width, height, kernel->name,
+                elapsed / 1000.0 / iterations,
+                2.0 * width * height * iterations / elapsed / 1000.0,
+                total == expected ? "" : " MISMATCH");
+    }
+
+    g_rand_free(rand);
+    g_free(a);
+    g_free(b);
+    g_free(sad);
+}
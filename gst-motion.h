@@ -0,0 +1,51 @@
+#ifndef __GST_MOTION_H__
+#define __GST_MOTION_H__
+
+#include <gst/gst.h>
+#include "gst-media.h"
+#include "gst-recorder.h"
+
+// 运动检测分支：从v_tee按分析帧率取出缩小后的亮度图，按块计算与上一帧的差值(SAD)，
+// 有运动时发出事件，可以直接驱动GstRecorder开始/停止录制
+
+typedef void (*MotionCallback)(gboolean active, gdouble ratio, gpointer user_data);
+
+typedef struct GstMotion
+{
+    GstBin *bin;
+    GstElement *v_queue, *v_rate, *v_scale, *v_convert, *v_filter, *v_sink;
+
+    // 分析参数
+    gint width, height;       // 分析分辨率，宽度按16对齐
+    gint fps;                 // 分析帧率
+    guint pixel_threshold;    // 块内平均每像素差值超过该值认为块发生变化
+    gdouble area_threshold;   // 变化块的比例超过该值认为有运动
+    gint64 hold_time;         // 运动结束后保持的时间(ns)，避免频繁启停
+
+    // 分析状态（appsink流线程）
+    guint8 *prev;
+    guint32 *block_sad;
+    gboolean active;
+    GstClockTime last_motion;
+    gdouble ratio;
+
+    MotionCallback callback;
+    gpointer user_data;
+
+    // 运动触发录制
+    GstRecorder *recorder;
+    gchar *filename_template;  // g_date_time_format格式，例如 "motion-%Y%m%d-%H%M%S.mp4"
+
+} GstMotion;
+
+gboolean motion_init(GstMotion *self, gint width, gint height, gint fps);
+void motion_destroy(GstMotion *self);
+gboolean motion_link(GstMotion *self, GstMedia *media);
+void motion_set_fps(GstMotion *self, gint fps);
+void motion_set_callback(GstMotion *self, MotionCallback callback, gpointer user_data);
+void motion_set_recorder(GstMotion *self, GstRecorder *recorder, const char *filename_template);
+
+guint64 motion_block_sad(const guint8 *cur, const guint8 *prev, gint width, gint height, gint stride, guint32 *block_sad);
+void motion_bench(gint width, gint height, gint iterations);
+
+#endif
@@ -1,8 +1,20 @@
 #include "gst-player.h"
+#include "gst-log.h"
 #include <string.h>
 
 void player_on_src_pad_added(GstElement *src, GstPad *new_pad, GstPlayer *self);
 gboolean player_on_bus_message(GstBus *bus, GstMessage *msg, GstPlayer *self);
+void player_on_qos(GstPlayer *self, GstMessage *msg);
+gboolean player_on_qos_timeout(GstPlayer *self);
+void player_qos_set_level(GstPlayer *self, PlayerQosLevel level);
+gboolean player_qos_apply(GstPlayer *self, PlayerQosLevel level, gboolean enable);
+GstElement *player_find_video_decoder(GstPlayer *self);
+void player_on_tee_pads_changed(GstElement *tee, GstPad *pad, GstPlayer *self);
+gboolean player_on_branches_changed(GstPlayer *self);
+
+#define PLAYER_QOS_LATE_THRESHOLD 3  // 每秒丢帧数超过该值认为跟不上
+#define PLAYER_QOS_DEGRADE_WINDOWS 2 // 连续多少秒跟不上时降一级
+#define PLAYER_QOS_RESTORE_WINDOWS 5 // 连续多少秒没有丢帧时恢复一级
 
 gboolean player_init(GstPlayer *self)
 {
@@ -17,6 +29,9 @@ gboolean player_init(GstPlayer *self)
     /* 创建元素 */
     self->bin = GST_BIN(gst_bin_new("player_bin"));
     self->v_queue = gst_element_factory_make("queue", "videoqueue");
+    self->v_rate = gst_element_factory_make("videorate", "videorate");
+    self->v_scale = gst_element_factory_make("videoscale", "videoscale");
+    self->v_filter = gst_element_factory_make("capsfilter", "videofilter");
     self->v_convert = gst_element_factory_make("videoconvert", "videoconvert");
     self->v_sink = gst_element_factory_make("autovideosink", "videosink");
     self->a_queue = gst_element_factory_make("queue", "audioqueue");
@@ -26,7 +41,8 @@ gboolean player_init(GstPlayer *self)
 
     if (
         !self->bin ||                                                            // pipeline
-        !self->v_queue || !self->v_convert || !self->v_sink ||                   // video
+        !self->v_queue || !self->v_rate || !self->v_scale || !self->v_filter ||  // video
+        !self->v_convert || !self->v_sink ||
         !self->a_queue || !self->a_convert || !self->a_resample || !self->a_sink // audio
     )
     {
@@ -39,13 +55,14 @@ gboolean player_init(GstPlayer *self)
     //
     gst_bin_add_many(
         GST_BIN(self->bin),
-        self->v_queue, self->v_convert, self->v_sink,
+        self->v_queue, self->v_rate, self->v_scale, self->v_filter, self->v_convert, self->v_sink,
         self->a_queue, self->a_convert, self->a_resample, self->a_sink,
         NULL);
 
     // 连接元素
     if (
-        !gst_element_link_many(self->v_queue, self->v_convert, self->v_sink, NULL) ||                // video
+        !gst_element_link_many(self->v_queue, self->v_rate, self->v_scale, self->v_filter,
+                               self->v_convert, self->v_sink, NULL) ||                               // video
         !gst_element_link_many(self->a_queue, self->a_convert, self->a_resample, self->a_sink, NULL) // audio
     )
     {
@@ -66,12 +83,14 @@ gboolean player_init(GstPlayer *self)
     gst_object_unref(v_pad);
     gst_object_unref(a_pad);
 
-    // 监听pipeline的总线
-    self->bus = gst_element_get_bus(GST_ELEMENT(self->bin));
-    gst_bus_add_watch(self->bus, (GstBusFunc)player_on_bus_message, self);
+    // 降级用的videorate和videoscale平时直接透传
+    g_object_set(self->v_rate, "drop-only", TRUE, NULL);
+
+    // bin加入媒体管道之前没有总线，player_link时在媒体上注册总线监听
 
     self->state = PLAYER_STATE_STOPPED;
     self->current_uri = NULL;
+    self->qos_enabled = TRUE;
 
     return TRUE;
 }
@@ -86,6 +105,24 @@ void player_destroy(GstPlayer *self)
         gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
     }
 
+    if (self->qos_timeout)
+    {
+        g_source_remove(self->qos_timeout);
+        self->qos_timeout = 0;
+    }
+
+    // 解码器属于媒体，播放器释放后其他分支仍在使用它
+    player_qos_apply(self, PLAYER_QOS_SKIP_FRAMES, FALSE);
+
+    if (self->media)
+    {
+        g_signal_handlers_disconnect_by_data(self->media->v_tee, self);
+        media_remove_bus_listener(self->media, (GstBusFunc)player_on_bus_message, self);
+        self->media = NULL;
+    }
+    while (g_idle_remove_by_data(self))
+        ;
+
     if (self->bus)
     {
         gst_object_unref(self->bus);
@@ -114,6 +151,12 @@ gboolean player_link(GstPlayer *self, GstMedia *media)
     }
 
     gst_bin_add(GST_BIN(media->pipeline), GST_ELEMENT(self->bin));
+    self->media = media;
+    media_add_bus_listener(media, (GstBusFunc)player_on_bus_message, self);
+
+    self->qos_level_since = g_get_monotonic_time();
+    if (!self->qos_timeout)
+        self->qos_timeout = g_timeout_add_seconds(1, (GSourceFunc)player_on_qos_timeout, self);
 
     // 获取pad并连接
     GstPad *v_tee_src = gst_element_request_pad_simple(media->v_tee, "src_%u");
@@ -133,8 +176,10 @@ gboolean player_link(GstPlayer *self, GstMedia *media)
         return FALSE;
     }
 
-    g_print("link pad %s to %s for video.\n", gst_pad_get_name(v_tee_src), gst_pad_get_name(v_queue_sink));
-    g_print("link pad %s to %s for audio.\n", gst_pad_get_name(a_tee_src), gst_pad_get_name(a_queue_sink));
+    LOG_DEBUG(media->name, GST_ELEMENT_NAME(self->bin), "link pad %s to %s for video",
+              GST_PAD_NAME(v_tee_src), GST_PAD_NAME(v_queue_sink));
+    LOG_DEBUG(media->name, GST_ELEMENT_NAME(self->bin), "link pad %s to %s for audio",
+              GST_PAD_NAME(a_tee_src), GST_PAD_NAME(a_queue_sink));
 
     gboolean result = TRUE;
     if (gst_pad_link(v_tee_src, v_queue_sink) != GST_PAD_LINK_OK ||
@@ -147,9 +192,47 @@ gboolean player_link(GstPlayer *self, GstMedia *media)
     gst_object_unref(v_queue_sink);
     gst_object_unref(a_queue_sink);
 
+    // 跳帧依赖播放器是唯一的视频分支，之后v_tee上分支增减时重新检查
+    g_signal_connect(media->v_tee, "pad-added", G_CALLBACK(player_on_tee_pads_changed), self);
+    g_signal_connect(media->v_tee, "pad-removed", G_CALLBACK(player_on_tee_pads_changed), self);
+
     return result;
 }
 
+// 从运行中的媒体上拆下播放分支，媒体的其他分支不受影响。之后可以player_destroy或者再次player_link
+gboolean player_unlink(GstPlayer *self)
+{
+    if (!self || !self->media)
+    {
+        g_printerr("Player not linked to media\n");
+        return FALSE;
+    }
+
+    media_remove_video_branch(self->media, GST_ELEMENT(self->bin));
+    media_remove_audio_branch(self->media, GST_ELEMENT(self->bin));
+    media_remove_bus_listener(self->media, (GstBusFunc)player_on_bus_message, self);
+    g_signal_handlers_disconnect_by_data(self->media->v_tee, self);
+    while (g_idle_remove_by_data(self))
+        ;
+
+    if (self->qos_timeout)
+    {
+        g_source_remove(self->qos_timeout);
+        self->qos_timeout = 0;
+    }
+
+    player_qos_apply(self, PLAYER_QOS_SKIP_FRAMES, FALSE);
+
+    // 管道持有bin唯一的引用，移除前先加一个，bin仍由player_destroy释放
+    gst_object_ref(self->bin);
+    gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(self->media->pipeline), GST_ELEMENT(self->bin));
+
+    self->media = NULL;
+    self->state = PLAYER_STATE_STOPPED;
+    return TRUE;
+}
+
 gboolean player_play(GstPlayer *self)
 {
     if (!self || !GST_ELEMENT(self->bin))
@@ -204,34 +287,65 @@ gboolean player_stop(GstPlayer *self)
     return TRUE;
 }
 
+// 定位必须发给整个管道，只发给player_bin时其他分支和源不会跟着刷新
 void player_seek(GstPlayer *self, gint64 position)
 {
-    if (!self || !GST_ELEMENT(self->bin))
+    if (!self || !self->media)
     {
-        g_printerr("Player not initialized\n");
+        g_printerr("Player not linked to media\n");
         return;
     }
 
-    gst_element_seek(GST_ELEMENT(self->bin), 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
-                     GST_SEEK_TYPE_SET, position,
-                     GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    media_seek(self->media, position);
+}
+
+gboolean player_seek_full(GstPlayer *self, gint64 position, gdouble rate, MediaSeekMode mode)
+{
+    if (!self || !self->media)
+    {
+        g_printerr("Player not linked to media\n");
+        return FALSE;
+    }
+
+    return media_seek_full(self->media, position, rate, mode);
+}
+
+gboolean player_set_rate(GstPlayer *self, gdouble rate)
+{
+    if (!self || !self->media)
+    {
+        g_printerr("Player not linked to media\n");
+        return FALSE;
+    }
+
+    return media_set_rate(self->media, rate);
 }
 
 gboolean player_on_bus_message(GstBus *bus, GstMessage *msg, GstPlayer *self)
 {
     GError *err;
     gchar *debug_info;
+    gboolean own = gst_object_has_as_ancestor(GST_MESSAGE_SRC(msg), GST_OBJECT(self->bin));
     switch (GST_MESSAGE_TYPE(msg))
     {
+    case GST_MESSAGE_QOS:
+        if (own)
+            player_on_qos(self, msg);
+        break;
     case GST_MESSAGE_ERROR:
+        // 媒体已经打印了管道上的所有错误，这里只处理播放分支自己的
+        if (!own)
+            break;
         gst_message_parse_error(msg, &err, &debug_info);
-        g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
-        g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
+        LOG_ERROR(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                  "Error received from element %s: %s", GST_OBJECT_NAME(msg->src), err->message);
+        LOG_DEBUG(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                  "Debugging information: %s", debug_info ? debug_info : "none");
         g_clear_error(&err);
         g_free(debug_info);
         break;
     case GST_MESSAGE_EOS:
-        g_print("End-Of-Stream reached.\n");
+        LOG_INFO(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin), "End-Of-Stream reached");
         self->state = PLAYER_STATE_STOPPED;
         break;
     case GST_MESSAGE_STATE_CHANGED:
@@ -239,12 +353,277 @@ gboolean player_on_bus_message(GstBus *bus, GstMessage *msg, GstPlayer *self)
         {
             GstState old_state, new_state, pending_state;
             gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
-            g_print("Pipeline state changed from %s to %s:\n",
-                    gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
+            LOG_DEBUG(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                      "Pipeline state changed from %s to %s",
+                      gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
         }
         break;
     default:
         break;
     }
     return TRUE; // to keep receiving messages
-}
\ No newline at end of file
+}
+
+void player_set_qos_enabled(GstPlayer *self, gboolean enabled)
+{
+    if (!self)
+        return;
+
+    self->qos_enabled = enabled;
+    if (!enabled)
+        player_qos_set_level(self, PLAYER_QOS_NORMAL);
+}
+
+void player_get_qos_stats(GstPlayer *self, PlayerQosStats *stats)
+{
+    if (!self || !stats)
+        return;
+
+    *stats = self->qos_stats;
+    if (self->qos_level_since)
+        stats->time_in_level[stats->level] += g_get_monotonic_time() - self->qos_level_since;
+}
+
+void player_on_qos(GstPlayer *self, GstMessage *msg)
+{
+    GstFormat format;
+    guint64 processed, dropped;
+
+    // 只看视频sink，autovideosink是bin，消息来自它内部实际的sink
+    if (!gst_object_has_as_ancestor(GST_MESSAGE_SRC(msg), GST_OBJECT(self->v_sink)))
+        return;
+
+    self->qos_stats.qos_messages++;
+    self->qos_window_late++;
+
+    gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+    if (format == GST_FORMAT_BUFFERS)
+    {
+        self->qos_stats.processed = processed;
+        self->qos_stats.dropped = dropped;
+    }
+}
+
+// 每秒统计一次：持续跟不上时降一级，持续有余量时恢复一级，避免来回抖动
+gboolean player_on_qos_timeout(GstPlayer *self)
+{
+    guint late = self->qos_window_late;
+    self->qos_window_late = 0;
+
+    // 按bin的实际状态判断：player_link之后bin跟随媒体管道，main.c和配置文件都不经过player_play，
+    // self->state一直是STOPPED
+    if (!self->qos_enabled || GST_STATE(self->bin) != GST_STATE_PLAYING)
+        return G_SOURCE_CONTINUE;
+
+    if (late >= PLAYER_QOS_LATE_THRESHOLD)
+    {
+        self->qos_good_windows = 0;
+        if (++self->qos_bad_windows >= PLAYER_QOS_DEGRADE_WINDOWS && self->qos_stats.level < PLAYER_QOS_DOWNSCALE)
+        {
+            self->qos_bad_windows = 0;
+            player_qos_set_level(self, self->qos_stats.level + 1);
+        }
+    }
+    else if (late == 0)
+    {
+        self->qos_bad_windows = 0;
+        if (++self->qos_good_windows >= PLAYER_QOS_RESTORE_WINDOWS && self->qos_stats.level > PLAYER_QOS_NORMAL)
+        {
+            self->qos_good_windows = 0;
+            player_qos_set_level(self, self->qos_stats.level - 1);
+        }
+    }
+    else
+    {
+        self->qos_bad_windows = 0;
+        self->qos_good_windows = 0;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+// 逐级切换到目标级别，某一级不可用（例如跳帧）时跳过它
+void player_qos_set_level(GstPlayer *self, PlayerQosLevel level)
+{
+    PlayerQosLevel current = self->qos_stats.level;
+    if (level == current)
+        return;
+
+    gboolean degrade = level > current;
+    while (current < level)
+    {
+        current++;
+        if (!player_qos_apply(self, current, TRUE) && current == level && level < PLAYER_QOS_DOWNSCALE)
+            level++;
+    }
+    while (current > level)
+    {
+        player_qos_apply(self, current, FALSE);
+        current--;
+    }
+    if (current == PLAYER_QOS_SKIP_FRAMES && !self->qos_decoder)
+        current = PLAYER_QOS_NORMAL;
+
+    gint64 now = g_get_monotonic_time();
+    self->qos_stats.time_in_level[self->qos_stats.level] += now - self->qos_level_since;
+    self->qos_level_since = now;
+
+    if (degrade)
+        self->qos_stats.degrades[current]++;
+    else
+        self->qos_stats.restores++;
+    self->qos_stats.level = current;
+
+    LOG_INFO(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+             "Player QoS %s to level %d", degrade ? "degraded" : "restored", current);
+
+    GstStructure *s = gst_structure_new("player-qos",
+                                        "level", G_TYPE_INT, (gint)current,
+                                        "degraded", G_TYPE_BOOLEAN, degrade,
+                                        "qos-messages", G_TYPE_UINT64, self->qos_stats.qos_messages,
+                                        NULL);
+    gst_element_post_message(GST_ELEMENT(self->bin), gst_message_new_element(GST_OBJECT(self->bin), s));
+}
+
+gboolean player_qos_apply(GstPlayer *self, PlayerQosLevel level, gboolean enable)
+{
+    switch (level)
+    {
+    case PLAYER_QOS_SKIP_FRAMES:
+        if (!enable)
+        {
+            if (self->qos_decoder)
+            {
+                g_object_set(self->qos_decoder, "skip-frame", 0, NULL);
+                gst_object_unref(self->qos_decoder);
+                self->qos_decoder = NULL;
+            }
+            return TRUE;
+        }
+
+        // 解码器是所有分支共用的，有录像等其他分支时不能跳帧
+        if (!self->media || self->media->v_tee->numsrcpads != 1)
+            return FALSE;
+
+        self->qos_decoder = player_find_video_decoder(self);
+        if (!self->qos_decoder)
+            return FALSE;
+
+        g_object_set(self->qos_decoder, "skip-frame", 1, NULL);  // 1: 跳过非参考帧
+        return TRUE;
+
+    case PLAYER_QOS_REDUCE_RATE:
+    {
+        gint max_rate = G_MAXINT;
+        if (enable)
+        {
+            // 降到输入帧率的一半，不低于5帧
+            gint num = 0, den = 1;
+            GstPad *pad = gst_element_get_static_pad(self->v_queue, "src");
+            GstCaps *caps = gst_pad_get_current_caps(pad);
+            gst_object_unref(pad);
+            if (caps)
+            {
+                gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate", &num, &den);
+                gst_caps_unref(caps);
+            }
+            max_rate = MAX(num > 0 && den > 0 ? num / den / 2 : 15, 5);
+        }
+        g_object_set(self->v_rate, "max-rate", max_rate, NULL);
+        return TRUE;
+    }
+
+    case PLAYER_QOS_DOWNSCALE:
+    {
+        GstCaps *filter = NULL;
+        if (enable)
+        {
+            gint width = 0, height = 0;
+            GstPad *pad = gst_element_get_static_pad(self->v_queue, "src");
+            GstCaps *caps = gst_pad_get_current_caps(pad);
+            gst_object_unref(pad);
+            if (caps)
+            {
+                GstStructure *s = gst_caps_get_structure(caps, 0);
+                gst_structure_get_int(s, "width", &width);
+                gst_structure_get_int(s, "height", &height);
+                gst_caps_unref(caps);
+            }
+            if (width <= 0 || height <= 0)
+                return FALSE;
+
+            filter = gst_caps_new_simple("video/x-raw",
+                                         "width", G_TYPE_INT, (width / 2) & ~1,
+                                         "height", G_TYPE_INT, (height / 2) & ~1,
+                                         NULL);
+        }
+        else
+        {
+            filter = gst_caps_new_any();
+        }
+        g_object_set(self->v_filter, "caps", filter, NULL);
+        gst_caps_unref(filter);
+        return TRUE;
+    }
+
+    default:
+        return TRUE;
+    }
+}
+
+// 分支在空闲探针里释放tee的pad，信号可能来自流线程，到主循环里处理
+void player_on_tee_pads_changed(GstElement *tee, GstPad *pad, GstPlayer *self)
+{
+    if (GST_PAD_DIRECTION(pad) == GST_PAD_SRC)
+        g_idle_add((GSourceFunc)player_on_branches_changed, self);
+}
+
+// 有其他视频分支接入时解码器不能再跳帧；分支移除后只剩播放器、且仍处于更高的降级级别时重新开启
+gboolean player_on_branches_changed(GstPlayer *self)
+{
+    if (!self->media)
+        return G_SOURCE_REMOVE;
+
+    gboolean alone = self->media->v_tee->numsrcpads == 1;
+    if (!alone && self->qos_decoder)
+    {
+        LOG_INFO(self->media->name, GST_ELEMENT_NAME(self->bin), "Video branch attached, stop skipping frames");
+        if (self->qos_stats.level == PLAYER_QOS_SKIP_FRAMES)
+            player_qos_set_level(self, PLAYER_QOS_NORMAL);
+        else
+            player_qos_apply(self, PLAYER_QOS_SKIP_FRAMES, FALSE);
+    }
+    else if (alone && !self->qos_decoder && self->qos_stats.level > PLAYER_QOS_SKIP_FRAMES)
+    {
+        player_qos_apply(self, PLAYER_QOS_SKIP_FRAMES, TRUE);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+// 在媒体的源里找支持skip-frame的视频解码器（avdec_*）
+GstElement *player_find_video_decoder(GstPlayer *self)
+{
+    if (!self->media || !self->media->src || !GST_IS_BIN(self->media->src))
+        return NULL;
+
+    GstElement *decoder = NULL;
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(self->media->src));
+    GValue item = G_VALUE_INIT;
+    while (!decoder && gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        GstElement *element = g_value_get_object(&item);
+        GstElementFactory *factory = gst_element_get_factory(element);
+        const gchar *klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+        if (klass && strstr(klass, "Decoder") && strstr(klass, "Video") &&
+            g_object_class_find_property(G_OBJECT_GET_CLASS(element), "skip-frame"))
+        {
+            decoder = gst_object_ref(element);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+
+    return decoder;
+}
@@ -11,16 +11,47 @@ typedef enum
     PLAYER_STATE_PAUSED
 } PlayerState;
 
+// 解码或渲染跟不上时逐级降级，余量恢复后逐级恢复
+typedef enum
+{
+    PLAYER_QOS_NORMAL,
+    PLAYER_QOS_SKIP_FRAMES,   // 解码器跳过非参考帧（只在播放器是唯一的视频分支时使用，否则会影响录像）
+    PLAYER_QOS_REDUCE_RATE,   // videorate降低显示帧率
+    PLAYER_QOS_DOWNSCALE,     // videoconvert之前缩小到一半
+    PLAYER_QOS_LEVELS
+} PlayerQosLevel;
+
+typedef struct PlayerQosStats
+{
+    PlayerQosLevel level;
+    guint64 qos_messages;             // 播放分支收到的QoS消息（每条对应sink丢掉的一帧）
+    guint64 processed, dropped;       // 视频sink上报的累计处理/丢弃帧数
+    guint64 degrades[PLAYER_QOS_LEVELS];  // 降级进入各级的次数
+    guint64 restores;
+    gint64 time_in_level[PLAYER_QOS_LEVELS];  // 各级累计停留时间，微秒
+} PlayerQosStats;
+
 typedef struct GstPlayer
 {
     GstBus *bus;
     GstBin *bin;
 
-    GstElement *v_queue, *v_convert, *v_sink;
+    GstElement *v_queue, *v_rate, *v_scale, *v_filter, *v_convert, *v_sink;
     GstElement *a_queue, *a_convert, *a_resample, *a_sink;
 
     PlayerState state;
     gchar *current_uri;
+    GstMedia *media;  // player_link之后所属的媒体，定位等操作作用于它的管道
+
+    // QoS降级控制，每秒统计一次
+    gboolean qos_enabled;
+    guint qos_timeout;
+    guint qos_window_late;        // 当前统计周期内的QoS消息数
+    guint qos_bad_windows;        // 连续超过阈值的周期数
+    guint qos_good_windows;       // 连续没有丢帧的周期数
+    gint64 qos_level_since;
+    GstElement *qos_decoder;      // 设置了skip-frame的解码器，恢复时还原
+    PlayerQosStats qos_stats;
 
 } GstPlayer;
 
@@ -31,6 +62,12 @@ gboolean player_play(GstPlayer *self);
 gboolean player_pause(GstPlayer *self);
 gboolean player_stop(GstPlayer *self);
 void player_seek(GstPlayer *self, gint64 position);
+gboolean player_seek_full(GstPlayer *self, gint64 position, gdouble rate, MediaSeekMode mode);
+gboolean player_set_rate(GstPlayer *self, gdouble rate);
+
 gboolean player_link(GstPlayer *self, GstMedia *media);
+gboolean player_unlink(GstPlayer *self);
+void player_set_qos_enabled(GstPlayer *self, gboolean enabled);
+void player_get_qos_stats(GstPlayer *self, PlayerQosStats *stats);
 
 #endif
\ No newline at end of file
@@ -1,7 +1,35 @@
 #include "gst-recorder.h"
 #include "gst-media.h"
+#include "gst-log.h"
+#include <gst/video/video.h>
+#include <gst/audio/audio.h>
+#include <gio/gio.h>
 #include <string.h>
 
+#define RECORDER_EOS_TIMEOUT (5 * G_TIME_SPAN_SECOND)
+#define RECORDER_ALIGN_TOLERANCE (100 * GST_MSECOND)  // 第一个样本晚于对齐时刻超过它时告警
+#define FOURCC(a, b, c, d) ((guint32)(a) << 24 | (guint32)(b) << 16 | (guint32)(c) << 8 | (guint32)(d))
+
+GstPadProbeReturn recorder_on_sink_buffer(GstPad *pad, GstPadProbeInfo *info, RecorderOutput *output);
+GstPadProbeReturn recorder_on_main_keyframe(GstPad *pad, GstPadProbeInfo *info, GstRecorder *self);
+GstPadProbeReturn recorder_on_proxy_frame(GstPad *pad, GstPadProbeInfo *info, GstRecorder *self);
+GstPadProbeReturn recorder_on_input(GstPad *pad, GstPadProbeInfo *info, GstRecorder *self);
+void recorder_apply_mode(GstRecorder *self);
+gboolean recorder_truncate_file(const char *filename, guint64 size);
+gboolean recorder_output_init(RecorderOutput *output, GstRecorder *recorder, const char *prefix);
+void recorder_output_destroy(RecorderOutput *output);
+gboolean recorder_output_open(RecorderOutput *output, const char *filename);
+void recorder_output_close(RecorderOutput *output, const char *filename);
+gboolean recorder_create_proxy(GstRecorder *self);
+void recorder_unlink_proxy(GstRecorder *self);
+gchar *recorder_proxy_path(const char *filename);
+guint64 recorder_memory(GstRecorder *self);
+gboolean recorder_begin_stop(GstRecorder *self);
+gboolean recorder_finish_stop(GstRecorder *self);
+gboolean recorder_eos_done(GstRecorder *self);
+gboolean recorder_on_eos_idle(GstRecorder *self);
+gboolean recorder_on_eos_timeout(GstRecorder *self);
+
 gboolean recorder_init(GstRecorder *self)
 {
     if (!self)
@@ -11,6 +39,11 @@ gboolean recorder_init(GstRecorder *self)
     }
 
     memset(self, 0, sizeof(GstRecorder));
+    g_mutex_init(&self->eos_lock);
+    g_cond_init(&self->eos_cond);
+    g_mutex_init(&self->key_lock);
+    self->pending_key = GST_CLOCK_TIME_NONE;
+    self->start_time = GST_CLOCK_TIME_NONE;
 
     // 创建元素
     self->bin = GST_BIN(gst_bin_new("recorder_bin"));
@@ -23,14 +56,11 @@ gboolean recorder_init(GstRecorder *self)
     self->a_convert = gst_element_factory_make("audioconvert", "rec_a_convert");
     self->a_encoder = gst_element_factory_make("avenc_aac", "rec_a_encoder");
 
-    self->mp4mux = gst_element_factory_make("mp4mux", "rec_mp4mux");
-    self->filesink = gst_element_factory_make("filesink", "rec_filesink");
-
     if (
         !self->bin ||
         !self->v_queue || !self->v_convert || !self->v_encoder ||
         !self->a_queue || !self->a_convert || !self->a_encoder ||
-        !self->mp4mux || !self->filesink)
+        !recorder_output_init(&self->output, self, "rec"))
     {
         g_printerr("Could not create recording elements.\n");
         recorder_destroy(self);
@@ -41,17 +71,14 @@ gboolean recorder_init(GstRecorder *self)
     gst_bin_add_many(GST_BIN(self->bin),
                      self->v_queue, self->v_convert, self->v_encoder,
                      self->a_queue, self->a_convert, self->a_encoder,
-                     self->mp4mux, self->filesink,
+                     self->output.mp4mux, self->output.sink,
                      NULL);
 
-    // 配置mp4mux为流式传输模式
-    g_object_set(self->mp4mux, "streamable", TRUE, "fragment-duration", 1000, NULL);
-
     // 连接元素
     if (
-        !gst_element_link_many(self->v_queue, self->v_convert, self->v_encoder, self->mp4mux, NULL) ||
-        !gst_element_link_many(self->a_queue, self->a_convert, self->a_encoder, self->mp4mux, NULL) ||
-        !gst_element_link_many(self->mp4mux, self->filesink, NULL))
+        !gst_element_link_many(self->v_queue, self->v_convert, self->v_encoder, self->output.mp4mux, NULL) ||
+        !gst_element_link_many(self->a_queue, self->a_convert, self->a_encoder, self->output.mp4mux, NULL) ||
+        !gst_element_link_many(self->output.mp4mux, self->output.sink, NULL))
     {
         g_printerr("Elements could not be linked.\n");
         recorder_destroy(self);
@@ -60,7 +87,10 @@ gboolean recorder_init(GstRecorder *self)
 
     g_object_set(self->v_encoder, "speed-preset", 1, "tune", 0x00000004, "bitrate", 500, NULL);
     g_object_set(self->a_encoder, "bitrate", 128000, NULL);
-    g_object_set(self->mp4mux, "faststart", TRUE, NULL);
+
+    // 默认使用分片模式
+    self->mode = RECORDER_MODE_FRAGMENTED;
+    recorder_apply_mode(self);
 
     // 创建ghost pads
     GstPad *v_pad = gst_element_get_static_pad(self->v_queue, "sink");
@@ -71,6 +101,12 @@ gboolean recorder_init(GstRecorder *self)
     gst_element_add_pad(GST_ELEMENT(self->bin), a_ghost_pad);
     gst_pad_set_active(v_ghost_pad, TRUE);
     gst_pad_set_active(a_ghost_pad, TRUE);
+
+    // 入口处记录segment和音频格式，对齐开始时按运行时间丢弃和截断
+    gst_pad_add_probe(v_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      (GstPadProbeCallback)recorder_on_input, self, NULL);
+    gst_pad_add_probe(a_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      (GstPadProbeCallback)recorder_on_input, self, NULL);
     gst_object_unref(v_pad);
     gst_object_unref(a_pad);
 
@@ -85,10 +121,13 @@ void recorder_destroy(GstRecorder *self)
     if (!self)
         return;
 
-    if (self->state == RECORDER_STATE_RECORDING)
+    if (self->state != RECORDER_STATE_STOPPED)
     {
         recorder_stop(self);
     }
+    // EOS到达时调度的主循环回调
+    while (g_source_remove_by_user_data(self))
+        ;
 
     if (self->bin)
     {
@@ -101,54 +140,371 @@ void recorder_destroy(GstRecorder *self)
         g_free(self->filename);
         self->filename = NULL;
     }
+
+    recorder_output_destroy(&self->output);
+    recorder_output_destroy(&self->proxy);
+    g_free(self->proxy_filename);
+    self->proxy_filename = NULL;
+
+    g_free(self->stream_name);
+    self->stream_name = NULL;
+
+    g_mutex_clear(&self->eos_lock);
+    g_cond_clear(&self->eos_cond);
+    g_mutex_clear(&self->key_lock);
 }
 
-gboolean recorder_link(GstRecorder *self, GstMedia *media)
+// 创建一路输出的muxer和sink，muxer的输出在sink的pad上交给异步writer写盘，同时生成关键帧索引
+gboolean recorder_output_init(RecorderOutput *output, GstRecorder *recorder, const char *prefix)
 {
-    if (!self || !media || !media->pipeline)
+    gchar *mux_name = g_strdup_printf("%s_mp4mux", prefix);
+    gchar *sink_name = g_strdup_printf("%s_sink", prefix);
+
+    output->recorder = recorder;
+    index_init(&output->index);
+    writer_init(&output->writer);
+    output->mp4mux = gst_element_factory_make("mp4mux", mux_name);
+    output->sink = gst_element_factory_make("fakesink", sink_name);
+    g_free(mux_name);
+    g_free(sink_name);
+
+    if (!output->mp4mux || !output->sink)
+        return FALSE;
+
+    // 和原来的filesink一样不按时钟同步；也不参与preroll，录像bin加入运行中的管道时不会让管道进入ASYNC
+    g_object_set(output->sink, "sync", FALSE, "async", FALSE, NULL);
+
+    GstPad *sink_pad = gst_element_get_static_pad(output->sink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      (GstPadProbeCallback)recorder_on_sink_buffer, output, NULL);
+    gst_object_unref(sink_pad);
+    return TRUE;
+}
+
+void recorder_output_destroy(RecorderOutput *output)
+{
+    if (!output->recorder)
+        return;
+
+    index_destroy(&output->index);
+    writer_destroy(&output->writer);
+    output->recorder = NULL;
+}
+
+gboolean recorder_output_open(RecorderOutput *output, const char *filename)
+{
+    output->write_offset = 0;
+    output->eos_received = FALSE;
+    if (!writer_open(&output->writer, filename))
     {
-        g_printerr("Invalid arguments to recorder_link\n");
+        g_printerr("Could not open %s for recording\n", filename);
+        return FALSE;
+    }
+
+    gchar *index_path = index_sidecar_path(filename);
+    if (!index_writer_open(&output->index, index_path))
+        g_printerr("Recording without keyframe index\n");
+    g_free(index_path);
+    return TRUE;
+}
+
+void recorder_output_close(RecorderOutput *output, const char *filename)
+{
+    GstRecorder *self = output->recorder;
+
+    index_writer_close(&output->index);
+
+    // 等待队列中剩余的数据写完
+    if (!writer_close(&output->writer))
+        LOG_WARNING(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                    "Recording %s may be incomplete", filename);
+
+    if (self->storage)
+        storage_add_segment(self->storage, self->stream_name, filename, output->writer.file_size);
+}
+
+// a.mp4 -> a.proxy.mp4
+gchar *recorder_proxy_path(const char *filename)
+{
+    const char *dot = strrchr(filename, '.');
+    const char *slash = strrchr(filename, G_DIR_SEPARATOR);
+    if (!dot || (slash && dot < slash))
+        return g_strdup_printf("%s.proxy", filename);
+
+    return g_strdup_printf("%.*s.proxy%s", (int)(dot - filename), filename, dot);
+}
+
+// 代理分支：v_convert -> v_tee -> v_main_queue -> v_encoder（主编码）
+//                             -> p_queue -> p_scale -> p_rate -> p_filter -> p_encoder -> 代理muxer
+// 两路共用一个videoconvert和媒体上的同一个分支
+gboolean recorder_create_proxy(GstRecorder *self)
+{
+    self->v_tee = gst_element_factory_make("tee", "rec_v_tee");
+    self->v_main_queue = gst_element_factory_make("queue", "rec_v_main_queue");
+    self->p_queue = gst_element_factory_make("queue", "rec_p_queue");
+    self->p_scale = gst_element_factory_make("videoscale", "rec_p_scale");
+    self->p_rate = gst_element_factory_make("videorate", "rec_p_rate");
+    self->p_filter = gst_element_factory_make("capsfilter", "rec_p_filter");
+    self->p_encoder = gst_element_factory_make("x264enc", "rec_p_encoder");
+
+    if (!self->v_tee || !self->v_main_queue || !self->p_queue || !self->p_scale ||
+        !self->p_rate || !self->p_filter || !self->p_encoder ||
+        !recorder_output_init(&self->proxy, self, "rec_p"))
+    {
+        g_printerr("Could not create proxy recording elements.\n");
         return FALSE;
     }
 
-    gst_bin_add(GST_BIN(media->pipeline), GST_ELEMENT(self->bin));
+    gst_bin_add_many(self->bin, self->v_tee, self->v_main_queue, self->p_queue, self->p_scale,
+                     self->p_rate, self->p_filter, self->p_encoder,
+                     self->proxy.mp4mux, self->proxy.sink, NULL);
+
+    gst_element_unlink(self->v_convert, self->v_encoder);
+    if (!gst_element_link_many(self->v_convert, self->v_tee, self->v_main_queue, self->v_encoder, NULL) ||
+        !gst_element_link_many(self->v_tee, self->p_queue, self->p_scale, self->p_rate, self->p_filter,
+                               self->p_encoder, self->proxy.mp4mux, self->proxy.sink, NULL))
+    {
+        g_printerr("Proxy elements could not be linked.\n");
+        return FALSE;
+    }
+
+    // 代理文件和主文件使用同样的写盘参数
+    self->proxy.writer.block_size = self->output.writer.block_size;
+    self->proxy.writer.direct_io = self->output.writer.direct_io;
+    self->proxy.writer.sync_policy = self->output.writer.sync_policy;
+    self->proxy.writer.sync_interval = self->output.writer.sync_interval;
+
+    // 代理的关键帧由主编码器的关键帧触发，自身的GOP只作为兜底
+    g_object_set(self->p_rate, "drop-only", TRUE, NULL);
+    g_object_set(self->p_encoder, "speed-preset", 1, "tune", 0x00000004, "bitrate", 150, NULL);
+    recorder_apply_mode(self);
+
+    GstPad *pad = gst_element_get_static_pad(self->v_encoder, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)recorder_on_main_keyframe, self, NULL);
+    gst_object_unref(pad);
+
+    pad = gst_element_get_static_pad(self->p_encoder, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)recorder_on_proxy_frame, self, NULL);
+    gst_object_unref(pad);
 
-    // 获取pad并连接
-    GstPad *v_tee_src = gst_element_request_pad_simple(media->v_tee, "src_%u");
-    GstPad *a_tee_src = gst_element_request_pad_simple(media->a_tee, "src_%u");
-    GstPad *v_queue_sink = gst_element_get_static_pad(GST_ELEMENT(self->bin), "v_sink");
-    GstPad *a_queue_sink = gst_element_get_static_pad(GST_ELEMENT(self->bin), "a_sink");
+    return TRUE;
+}
 
-    if (!v_tee_src || !a_tee_src || !v_queue_sink || !a_queue_sink)
+// 代理关闭时把代理分支从v_tee上断开并释放请求pad，不再有数据流入缩放和编码。
+// 只在停止状态下调用，此时录像bin在NULL，可以直接断开
+void recorder_unlink_proxy(GstRecorder *self)
+{
+    GstPad *sink_pad = gst_element_get_static_pad(self->p_queue, "sink");
+    GstPad *tee_pad = gst_pad_get_peer(sink_pad);
+    if (tee_pad)
     {
-        g_printerr("Failed to get pads: v_tee_src=%p, a_tee_src=%p, v_queue_sink=%p, a_queue_sink=%p\n",
-                   v_tee_src, a_tee_src, v_queue_sink, a_queue_sink);
+        gst_pad_unlink(tee_pad, sink_pad);
+        gst_element_release_request_pad(self->v_tee, tee_pad);
+        gst_object_unref(tee_pad);
+    }
+    gst_object_unref(sink_pad);
+}
+
+// 开启低分辨率代理录像，width/height为0时保持原尺寸，fps为0时保持原帧率，三者都为0时关闭代理；
+// 只能在停止状态下调用，下一次recorder_start时生效
+gboolean recorder_set_proxy(GstRecorder *self, gint width, gint height, gint fps)
+{
+    if (!self || !self->bin)
+    {
+        g_printerr("Recorder not initialized\n");
+        return FALSE;
+    }
 
-        if (v_queue_sink)
-            gst_object_unref(v_queue_sink);
-        if (a_queue_sink)
-            gst_object_unref(a_queue_sink);
+    if (self->state != RECORDER_STATE_STOPPED)
+    {
+        g_printerr("Cannot change proxy settings while recording\n");
         return FALSE;
     }
 
-    g_print("link pad %s to %s for video.\n", gst_pad_get_name(v_tee_src), gst_pad_get_name(v_queue_sink));
-    g_print("link pad %s to %s for audio.\n", gst_pad_get_name(a_tee_src), gst_pad_get_name(a_queue_sink));
+    self->proxy_width = width;
+    self->proxy_height = height;
+    self->proxy_fps = fps;
+    self->proxy_enabled = width > 0 || height > 0 || fps > 0;
+    if (!self->proxy_enabled)
+    {
+        if (self->v_tee)
+            recorder_unlink_proxy(self);
+        return TRUE;
+    }
 
-    gboolean result = TRUE;
-    if (gst_pad_link(v_tee_src, v_queue_sink) != GST_PAD_LINK_OK ||
-        gst_pad_link(a_tee_src, a_queue_sink) != GST_PAD_LINK_OK)
+    if (!self->v_tee && !recorder_create_proxy(self))
     {
-        g_printerr("Tee could not be linked.\n");
-        result = FALSE;
+        self->proxy_enabled = FALSE;
+        return FALSE;
     }
 
-    gst_object_unref(v_queue_sink);
-    gst_object_unref(a_queue_sink);
+    // 之前关闭过代理，重新连接到v_tee
+    GstPad *sink_pad = gst_element_get_static_pad(self->p_queue, "sink");
+    gboolean linked = gst_pad_is_linked(sink_pad);
+    gst_object_unref(sink_pad);
+    if (!linked && !gst_element_link(self->v_tee, self->p_queue))
+    {
+        g_printerr("Proxy elements could not be linked.\n");
+        self->proxy_enabled = FALSE;
+        return FALSE;
+    }
 
-    return result;
+    GstCaps *caps = gst_caps_new_empty_simple("video/x-raw");
+    if (width > 0)
+        gst_caps_set_simple(caps, "width", G_TYPE_INT, width, NULL);
+    if (height > 0)
+        gst_caps_set_simple(caps, "height", G_TYPE_INT, height, NULL);
+    if (fps > 0)
+        gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    g_object_set(self->p_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    if (fps > 0)
+        g_object_set(self->p_encoder, "key-int-max", fps * 10, NULL);
+
+    return TRUE;
+}
+
+// 主编码器每输出一个关键帧，记录它的时间，代理在同一时刻之后的第一帧强制编码为关键帧
+GstPadProbeReturn recorder_on_main_keyframe(GstPad *pad, GstPadProbeInfo *info, GstRecorder *self)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) && GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        g_mutex_lock(&self->key_lock);
+        self->pending_key = GST_BUFFER_PTS(buffer);
+        g_mutex_unlock(&self->key_lock);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn recorder_on_proxy_frame(GstPad *pad, GstPadProbeInfo *info, GstRecorder *self)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    gboolean force = FALSE;
+
+    g_mutex_lock(&self->key_lock);
+    if (GST_CLOCK_TIME_IS_VALID(self->pending_key) && GST_BUFFER_PTS_IS_VALID(buffer) &&
+        GST_BUFFER_PTS(buffer) >= self->pending_key)
+    {
+        self->pending_key = GST_CLOCK_TIME_NONE;
+        force = TRUE;
+    }
+    g_mutex_unlock(&self->key_lock);
+
+    // 在编码器的流线程中发送，事件会在这一帧之前到达编码器
+    if (force)
+        gst_pad_send_event(pad, gst_video_event_new_downstream_force_key_unit(
+                                    GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, 0));
+
+    return GST_PAD_PROBE_OK;
+}
+
+// 分片模式下每秒输出一个moof+mdat，moov在开头一次写出，不需要结束时再处理；
+// faststart需要在结束时重写整个文件，两者不能同时开启
+void recorder_apply_mode(GstRecorder *self)
+{
+    RecorderOutput *outputs[] = {&self->output, &self->proxy};
+    for (guint i = 0; i < G_N_ELEMENTS(outputs); i++)
+    {
+        GstElement *mp4mux = outputs[i]->mp4mux;
+        if (!mp4mux)
+            continue;
+
+        if (self->mode == RECORDER_MODE_FRAGMENTED)
+            g_object_set(mp4mux, "faststart", FALSE, "streamable", TRUE, "fragment-duration", 1000, NULL);
+        else
+            g_object_set(mp4mux, "fragment-duration", 0, "streamable", FALSE, "faststart", TRUE, NULL);
+    }
+}
+
+gboolean recorder_set_mode(GstRecorder *self, RecorderMode mode)
+{
+    if (!self || !self->output.mp4mux)
+    {
+        g_printerr("Recorder not initialized\n");
+        return FALSE;
+    }
+
+    if (self->state != RECORDER_STATE_STOPPED)
+    {
+        g_printerr("Cannot change recorder mode while recording\n");
+        return FALSE;
+    }
+
+    self->mode = mode;
+    recorder_apply_mode(self);
+    return TRUE;
+}
+
+gboolean recorder_link(GstRecorder *self, GstMedia *media)
+{
+    if (!self || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to recorder_link\n");
+        return FALSE;
+    }
+
+    // bin只在录制期间连接到tee并运行：跟着管道进入PAUSED的话，muxer会在文件打开之前输出ftyp/moov，
+    // 写盘线程没有文件可写，文件头就丢了。锁定在NULL，由recorder_start_at打开文件之后连接并解锁。
+    // 不能连着tee停在NULL：tee遇到FLUSHING会停止整个媒体的数据流
+    gst_element_set_locked_state(GST_ELEMENT(self->bin), TRUE);
+    if (!gst_bin_add(GST_BIN(media->pipeline), GST_ELEMENT(self->bin)))
+    {
+        g_printerr("Could not add recorder to media pipeline\n");
+        return FALSE;
+    }
+    self->media = media;
+
+    media_add_memory_source(media, GST_ELEMENT(self->bin), (MediaMemoryFunc)recorder_memory, self);
+    return TRUE;
+}
+
+// 写盘线程队列里还没有写出去的字节数，计入录像分支的内存占用
+guint64 recorder_memory(GstRecorder *self)
+{
+    WriterStats stats;
+    writer_get_stats(&self->output.writer, &stats);
+    guint64 bytes = stats.queued_bytes;
+
+    if (self->proxy_enabled)
+    {
+        writer_get_stats(&self->proxy.writer, &stats);
+        bytes += stats.queued_bytes;
+    }
+    return bytes;
+}
+
+// 停止录制并把录像分支从媒体管道中移除，媒体的其他分支不受影响
+gboolean recorder_unlink(GstRecorder *self)
+{
+    if (!self || !self->media)
+    {
+        g_printerr("Recorder not linked to media\n");
+        return FALSE;
+    }
+
+    // 停止时已经从tee断开，bin锁定在NULL
+    recorder_stop(self);
+    media_remove_memory_source(self->media, (MediaMemoryFunc)recorder_memory, self);
+
+    // 管道持有bin唯一的引用，移除前先加一个，bin仍由recorder_destroy释放
+    gst_object_ref(self->bin);
+    gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(self->media->pipeline), GST_ELEMENT(self->bin));
+
+    self->media = NULL;
+    return TRUE;
 }
 
 gboolean recorder_start(GstRecorder *self, const char *filename)
+{
+    return recorder_start_at(self, filename, GST_CLOCK_TIME_NONE);
+}
+
+// 文件从运行时间running_time开始：之前的视频帧丢弃，音频截到该时刻对应的样本。
+// 多路媒体共用时钟和base time（见gst-sync.h）时，用同一个running_time开始的录像彼此对齐
+gboolean recorder_start_at(GstRecorder *self, const char *filename, GstClockTime running_time)
 {
     if (!self || !filename)
     {
@@ -156,26 +512,80 @@ gboolean recorder_start(GstRecorder *self, const char *filename)
         return FALSE;
     }
 
-    if (self->state == RECORDER_STATE_RECORDING)
+    if (self->state != RECORDER_STATE_STOPPED)
     {
         g_printerr("Recorder is already recording\n");
         return FALSE;
     }
 
-    g_print("Starting recording to %s...\n", filename);
+    LOG_INFO(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin), "Starting recording to %s", filename);
 
-    if (self->filename)
+    // filename可能就是self->filename（沿用上一次的文件名），先复制再释放旧的
+    gchar *copy = g_strdup(filename);
+    g_free(self->filename);
+    self->filename = copy;
+    filename = copy;
+
+    // 在重新连接之前设置，第一个样本就按新的开始时刻判断
+    self->start_time = running_time;
+    self->v_started = FALSE;
+    self->a_started = FALSE;
+
+    if (!recorder_output_open(&self->output, filename))
+        return FALSE;
+
+    // 代理录像开启时同时打开第二个文件
+    g_free(self->proxy_filename);
+    self->proxy_filename = NULL;
+    if (self->proxy_enabled)
     {
-        g_free(self->filename);
+        self->proxy_filename = recorder_proxy_path(filename);
+        g_mutex_lock(&self->key_lock);
+        self->pending_key = GST_CLOCK_TIME_NONE;
+        g_mutex_unlock(&self->key_lock);
+        if (!recorder_output_open(&self->proxy, self->proxy_filename))
+        {
+            writer_close(&self->output.writer);
+            index_writer_close(&self->output.index);
+            return FALSE;
+        }
     }
-    self->filename = g_strdup(filename);
 
-    g_object_set(self->filesink, "location", filename, NULL);
+    // 文件打开之后再连接到tee并跟随管道的状态，muxer的文件头写进文件
+    gboolean ok = TRUE;
+    if (self->media)
+    {
+        ok = media_add_video_branch(self->media, GST_ELEMENT(self->bin)) &&
+             media_add_audio_branch(self->media, GST_ELEMENT(self->bin));
+        if (!ok)
+            g_printerr("Could not link recorder to media\n");
+    }
+
+    if (ok)
+    {
+        gst_element_set_locked_state(GST_ELEMENT(self->bin), FALSE);
+        ok = self->media ? gst_element_sync_state_with_parent(GST_ELEMENT(self->bin))
+                         : gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+        if (!ok)
+            g_printerr("Could not set recorder to playing state\n");
+    }
 
-    GstStateChangeReturn ret = gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_PLAYING);
-    if (ret == GST_STATE_CHANGE_FAILURE)
+    if (!ok)
     {
-        g_printerr("Could not set recorder to playing state\n");
+        if (self->media)
+        {
+            media_remove_video_branch(self->media, GST_ELEMENT(self->bin));
+            media_remove_audio_branch(self->media, GST_ELEMENT(self->bin));
+        }
+        gst_element_set_locked_state(GST_ELEMENT(self->bin), TRUE);
+        gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
+        writer_close(&self->output.writer);
+        index_writer_close(&self->output.index);
+        if (self->proxy_filename)
+        {
+            writer_close(&self->proxy.writer);
+            index_writer_close(&self->proxy.index);
+        }
         return FALSE;
     }
 
@@ -191,21 +601,438 @@ gboolean recorder_stop(GstRecorder *self)
         return FALSE;
     }
 
-    if (self->state != RECORDER_STATE_RECORDING)
+    // 异步停止还在等待EOS时直接在这里等完
+    if (self->state == RECORDER_STATE_STOPPED)
     {
         g_print("Recorder is not currently recording\n");
         return TRUE;
     }
+    if (self->state == RECORDER_STATE_RECORDING)
+        recorder_begin_stop(self);
+
+    gint64 deadline = g_get_monotonic_time() + RECORDER_EOS_TIMEOUT;
+    g_mutex_lock(&self->eos_lock);
+    while (!recorder_eos_done(self))
+    {
+        if (!g_cond_wait_until(&self->eos_cond, &self->eos_lock, deadline))
+        {
+            LOG_WARNING(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                        "Timed out waiting for recorder EOS, last fragment may be lost");
+            break;
+        }
+    }
+    g_mutex_unlock(&self->eos_lock);
+
+    return recorder_finish_stop(self);
+}
+
+gboolean recorder_stop_async(GstRecorder *self, RecorderStopCallback callback, gpointer user_data)
+{
+    if (!self || self->state != RECORDER_STATE_RECORDING)
+    {
+        g_printerr("Recorder is not currently recording\n");
+        return FALSE;
+    }
+
+    self->stop_callback = callback;
+    self->stop_user_data = user_data;
+    recorder_begin_stop(self);
+
+    // EOS可能在断开分支时就已经到达，否则由sink上的探针调度完成
+    g_mutex_lock(&self->eos_lock);
+    gboolean done = recorder_eos_done(self);
+    g_mutex_unlock(&self->eos_lock);
+
+    if (done)
+        g_idle_add((GSourceFunc)recorder_on_eos_idle, self);
+    else
+        self->stop_timeout = g_timeout_add(RECORDER_EOS_TIMEOUT / G_TIME_SPAN_MILLISECOND,
+                                           (GSourceFunc)recorder_on_eos_timeout, self);
+    return TRUE;
+}
+
+// 先从tee断开并发送EOS，等muxer写完最后一个分片（faststart模式下是写完moov）再停止，
+// 直接切到NULL会丢掉muxer里还没输出的数据。分支不在运行时没有EOS可等
+gboolean recorder_begin_stop(GstRecorder *self)
+{
+    LOG_INFO(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin), "Stopping recording");
+
+    g_mutex_lock(&self->eos_lock);
+    self->state = RECORDER_STATE_STOPPING;
+    g_mutex_unlock(&self->eos_lock);
+
+    // 管道没有运行时也要断开，否则下次播放时tee会推给停在NULL的bin
+    GstState current = GST_STATE_NULL;
+    gst_element_get_state(GST_ELEMENT(self->bin), &current, NULL, 0);
+    if (self->media)
+    {
+        media_remove_video_branch(self->media, GST_ELEMENT(self->bin));
+        media_remove_audio_branch(self->media, GST_ELEMENT(self->bin));
+        if (current >= GST_STATE_PAUSED)
+            return TRUE;
+    }
 
-    g_print("Stopping recording...\n");
+    g_mutex_lock(&self->eos_lock);
+    self->output.eos_received = TRUE;
+    self->proxy.eos_received = TRUE;
+    g_mutex_unlock(&self->eos_lock);
+    return FALSE;
+}
 
-    GstStateChangeReturn ret = gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL);
-    if (ret == GST_STATE_CHANGE_FAILURE)
+// 调用者持有eos_lock
+gboolean recorder_eos_done(GstRecorder *self)
+{
+    return self->output.eos_received && (!self->proxy_filename || self->proxy.eos_received);
+}
+
+// 关闭文件并回调异步停止的调用者
+gboolean recorder_finish_stop(GstRecorder *self)
+{
+    if (self->stop_timeout)
+    {
+        g_source_remove(self->stop_timeout);
+        self->stop_timeout = 0;
+    }
+
+    RecorderStopCallback callback = self->stop_callback;
+    gpointer user_data = self->stop_user_data;
+    self->stop_callback = NULL;
+    self->stop_user_data = NULL;
+
+    // 停止后留在管道里，锁定在NULL，管道再次暂停或播放时不会带动已经断开的bin
+    gboolean ok = gst_element_set_state(GST_ELEMENT(self->bin), GST_STATE_NULL) != GST_STATE_CHANGE_FAILURE;
+    if (self->media)
+        gst_element_set_locked_state(GST_ELEMENT(self->bin), TRUE);
+    if (ok)
+    {
+        recorder_output_close(&self->output, self->filename);
+        if (self->proxy_filename)
+            recorder_output_close(&self->proxy, self->proxy_filename);
+        self->state = RECORDER_STATE_STOPPED;
+    }
+    else
     {
         g_printerr("Could not stop recorder\n");
+        self->state = RECORDER_STATE_RECORDING;
+    }
+
+    if (callback)
+        callback(self, ok, user_data);
+    return ok;
+}
+
+gboolean recorder_on_eos_idle(GstRecorder *self)
+{
+    if (self->state == RECORDER_STATE_STOPPING)
+        recorder_finish_stop(self);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean recorder_on_eos_timeout(GstRecorder *self)
+{
+    self->stop_timeout = 0;
+    LOG_WARNING(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                "Timed out waiting for recorder EOS, last fragment may be lost");
+    recorder_finish_stop(self);
+    return G_SOURCE_REMOVE;
+}
+
+// 修改写盘参数，下一次recorder_start时生效，主文件和代理文件都使用这组参数
+void recorder_set_writer_options(GstRecorder *self, gsize block_size, gboolean direct_io,
+                                 WriterSyncPolicy sync_policy, guint sync_interval)
+{
+    if (!self)
+        return;
+
+    RecorderOutput *outputs[] = {&self->output, &self->proxy};
+    for (guint i = 0; i < G_N_ELEMENTS(outputs); i++)
+    {
+        outputs[i]->writer.block_size = block_size;
+        outputs[i]->writer.direct_io = direct_io;
+        outputs[i]->writer.sync_policy = sync_policy;
+        outputs[i]->writer.sync_interval = sync_interval;
+    }
+}
+
+// 录完的文件登记到存储管理器，stream_name用于按路统计配额
+void recorder_set_storage(GstRecorder *self, GstStorage *storage, const char *stream_name)
+{
+    if (!self)
+        return;
+
+    self->storage = storage;
+    g_free(self->stream_name);
+    self->stream_name = g_strdup(stream_name ? stream_name : "default");
+}
+
+void recorder_get_writer_stats(GstRecorder *self, WriterStats *stats)
+{
+    if (!self)
+        return;
+
+    writer_get_stats(&self->output.writer, stats);
+}
+
+gboolean recorder_on_sink_buffer_list_item(GstBuffer **buffer, guint idx, gpointer user_data)
+{
+    RecorderOutput *output = (RecorderOutput *)user_data;
+    GstMapInfo map;
+
+    writer_push(&output->writer, *buffer, output->write_offset);
+    output->write_offset += gst_buffer_get_size(*buffer);
+
+    if (gst_buffer_map(*buffer, &map, GST_MAP_READ))
+    {
+        index_writer_feed(&output->index, map.data, map.size);
+        gst_buffer_unmap(*buffer, &map);
+    }
+    return TRUE;
+}
+
+GstPadProbeReturn recorder_on_sink_buffer(GstPad *pad, GstPadProbeInfo *info, RecorderOutput *output)
+{
+    GstRecorder *self = output->recorder;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+    {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        recorder_on_sink_buffer_list_item(&buffer, 0, output);
+    }
+    else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), recorder_on_sink_buffer_list_item, output);
+    }
+    else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS)
+    {
+        g_mutex_lock(&self->eos_lock);
+        output->eos_received = TRUE;
+        g_cond_signal(&self->eos_cond);
+        // 异步停止不阻塞主循环，EOS都到达后回到主循环关闭文件
+        if (self->state == RECORDER_STATE_STOPPING && recorder_eos_done(self))
+            g_idle_add((GSourceFunc)recorder_on_eos_idle, self);
+        g_mutex_unlock(&self->eos_lock);
+    }
+    else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_SEGMENT)
+    {
+        // muxer回到文件开头更新文件头时会发送BYTES格式的segment
+        const GstSegment *segment;
+        gst_event_parse_segment(GST_PAD_PROBE_INFO_EVENT(info), &segment);
+        if (segment->format == GST_FORMAT_BYTES && (guint64)segment->start != output->write_offset)
+        {
+            // 回写的内容不是新的分片，索引到此为止
+            index_writer_close(&output->index);
+            output->write_offset = segment->start;
+        }
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+// 录像分支入口（v_queue和a_queue的sink pad）
+GstPadProbeReturn recorder_on_input(GstPad *pad, GstPadProbeInfo *info, GstRecorder *self)
+{
+    gboolean audio = GST_PAD_PARENT(pad) == self->a_queue;
+    GstSegment *segment = audio ? &self->a_segment : &self->v_segment;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+        {
+            gst_event_copy_segment(event, segment);
+        }
+        else if (audio && GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            GstCaps *caps;
+            GstAudioInfo audio_info;
+            gst_event_parse_caps(event, &caps);
+            if (gst_audio_info_from_caps(&audio_info, caps))
+            {
+                self->a_rate = GST_AUDIO_INFO_RATE(&audio_info);
+                self->a_bpf = GST_AUDIO_INFO_BPF(&audio_info);
+            }
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    gboolean *started = audio ? &self->a_started : &self->v_started;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (*started || !GST_CLOCK_TIME_IS_VALID(self->start_time) || segment->format != GST_FORMAT_TIME ||
+        !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    GstClockTime start = self->start_time;
+    GstClockTime running = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    if (!GST_CLOCK_TIME_IS_VALID(running))
+        return GST_PAD_PROBE_DROP;
+
+    if (running >= start)
+    {
+        *started = TRUE;
+        if (running - start > RECORDER_ALIGN_TOLERANCE)
+            LOG_WARNING(self->media ? self->media->name : NULL, GST_ELEMENT_NAME(self->bin),
+                        "First %s sample %.1f ms after aligned start", audio ? "audio" : "video",
+                        (gdouble)(running - start) / GST_MSECOND);
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (!audio || self->a_rate <= 0 || self->a_bpf <= 0)
+        return GST_PAD_PROBE_DROP;
+
+    // 跨过开始时刻的音频buffer：去掉前面的样本，时间戳移到第一个保留的样本上
+    gsize samples = gst_buffer_get_size(buffer) / self->a_bpf;
+    guint64 trim = gst_util_uint64_scale_round(start - running, self->a_rate, GST_SECOND);
+    if (trim >= samples)
+        return GST_PAD_PROBE_DROP;
+
+    GstClockTime pts = GST_BUFFER_PTS(buffer) + gst_util_uint64_scale_int(trim, GST_SECOND, self->a_rate);
+    buffer = gst_audio_buffer_truncate(gst_buffer_ref(buffer), self->a_bpf, trim, -1);
+    buffer = gst_buffer_make_writable(buffer);
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale_int(samples - trim, GST_SECOND, self->a_rate);
+    GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+
+    gst_buffer_unref(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    *started = TRUE;
+    return GST_PAD_PROBE_OK;
+}
+
+gboolean recorder_truncate_file(const char *filename, guint64 size)
+{
+    GFile *file = g_file_new_for_path(filename);
+    GFileIOStream *stream = g_file_open_readwrite(file, NULL, NULL);
+    g_object_unref(file);
+    if (!stream)
+        return FALSE;
+
+    gboolean ok = g_seekable_truncate(G_SEEKABLE(stream), size, NULL, NULL);
+    g_io_stream_close(G_IO_STREAM(stream), NULL, NULL);
+    g_object_unref(stream);
+    return ok;
+}
+
+// 修复崩溃或断电后留下的分片MP4：顺序读取顶层box头，找到最后一个完整的moof+mdat，
+// 原地截掉后面不完整的分片。只读box头，不重写文件，耗时与文件大小基本无关。
+// 关键帧索引中指向被截掉部分的记录也一并截掉
+gboolean recorder_recover_file(const char *filename)
+{
+    if (!filename)
+    {
+        g_printerr("Invalid arguments to recorder_recover_file\n");
         return FALSE;
     }
 
-    self->state = RECORDER_STATE_STOPPED;
+    GFile *file = g_file_new_for_path(filename);
+    GFileInfo *info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    GFileInputStream *stream = g_file_read(file, NULL, NULL);
+    g_object_unref(file);
+    if (!info || !stream)
+    {
+        g_printerr("Could not open %s\n", filename);
+        if (info)
+            g_object_unref(info);
+        if (stream)
+            g_object_unref(stream);
+        return FALSE;
+    }
+
+    guint64 file_size = g_file_info_get_size(info);
+    g_object_unref(info);
+
+    guint64 offset = 0, good_end = 0;
+    gboolean have_moov = FALSE, in_fragment = FALSE;
+    guint fragments = 0;
+    guint8 header[16];
+    gsize n;
+
+    while (offset + 8 <= file_size)
+    {
+        if (!g_seekable_seek(G_SEEKABLE(stream), offset, G_SEEK_SET, NULL, NULL) ||
+            !g_input_stream_read_all(G_INPUT_STREAM(stream), header, 16, &n, NULL, NULL) || n < 8)
+            break;
+
+        guint64 box_size = GST_READ_UINT32_BE(header);
+        guint32 type = GST_READ_UINT32_BE(header + 4);
+        guint64 header_len = 8;
+        if (box_size == 1)
+        {
+            if (n < 16)
+                break;
+            box_size = GST_READ_UINT64_BE(header + 8);
+            header_len = 16;
+        }
+        else if (box_size == 0)
+        {
+            box_size = file_size - offset;
+        }
+
+        // box头损坏或box只写了一半
+        if (box_size < header_len || offset + box_size > file_size)
+            break;
+
+        guint64 end = offset + box_size;
+        if (type == FOURCC('m', 'o', 'o', 'v'))
+        {
+            have_moov = TRUE;
+            good_end = end;
+        }
+        else if (type == FOURCC('m', 'o', 'o', 'f'))
+        {
+            in_fragment = TRUE;
+        }
+        else if (type == FOURCC('m', 'd', 'a', 't'))
+        {
+            if (in_fragment)
+                fragments++;
+            in_fragment = FALSE;
+            good_end = end;
+        }
+        else if (!in_fragment)
+        {
+            good_end = end;
+        }
+
+        offset = end;
+    }
+    g_object_unref(stream);
+
+    if (!have_moov)
+    {
+        g_printerr("%s has no moov, it was not recorded in fragmented mode and cannot be recovered\n", filename);
+        return FALSE;
+    }
+
+    gchar *index_path = index_sidecar_path(filename);
+    if (good_end < file_size)
+    {
+        if (!recorder_truncate_file(filename, good_end))
+        {
+            g_printerr("Could not truncate %s\n", filename);
+            g_free(index_path);
+            return FALSE;
+        }
+        g_print("Recovered %s: kept %u fragments, trimmed %" G_GUINT64_FORMAT " torn bytes\n",
+                filename, fragments, file_size - good_end);
+    }
+    else
+    {
+        g_print("%s is intact (%u fragments)\n", filename, fragments);
+    }
+
+    // 索引记录按偏移递增，截到第一条越界的记录
+    gchar *contents = NULL;
+    gsize length = 0;
+    if (g_file_get_contents(index_path, &contents, &length, NULL) && length >= 8)
+    {
+        gsize keep = 8;
+        while (keep + 16 <= length && GST_READ_UINT64_LE(contents + keep + 8) < good_end)
+            keep += 16;
+        if (keep < length)
+            recorder_truncate_file(index_path, keep);
+    }
+    g_free(contents);
+    g_free(index_path);
+
     return TRUE;
-}
\ No newline at end of file
+}
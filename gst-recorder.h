@@ -3,12 +3,38 @@
 
 #include <gst/gst.h>
 #include "gst-media.h"
+#include "gst-index.h"
+#include "gst-writer.h"
+#include "gst-storage.h"
 
 typedef enum {
     RECORDER_STATE_STOPPED,
-    RECORDER_STATE_RECORDING
+    RECORDER_STATE_RECORDING,
+    RECORDER_STATE_STOPPING    // recorder_stop_async已经断开分支，正在等待EOS
 } RecorderState;
 
+typedef enum {
+    RECORDER_MODE_FRAGMENTED,  // 分片MP4，moov在文件头，崩溃后最后一个完整分片之前的内容都可以播放
+    RECORDER_MODE_FASTSTART    // 普通MP4，结束时把moov移到文件头，必须正常结束才能播放
+} RecorderMode;
+
+struct GstRecorder;
+
+// 异步停止完成（文件已经关闭）时在主循环中调用，success为FALSE表示停止失败
+typedef void (*RecorderStopCallback)(struct GstRecorder *recorder, gboolean success, gpointer user_data);
+
+// 一路输出文件：muxer、接收muxer输出的sink、异步写盘和关键帧索引
+typedef struct RecorderOutput
+{
+    struct GstRecorder *recorder;
+    GstElement *mp4mux, *sink;  // sink只负责接收muxer输出，实际写盘由writer完成
+    gboolean eos_received;
+
+    GstKeyIndex index;  // 录制时同步生成的关键帧索引 <filename>.idx
+    GstDiskWriter writer;
+    guint64 write_offset;  // muxer输出的下一个字节在文件中的位置
+} RecorderOutput;
+
 typedef struct GstRecorder
 {
     GstBus *bus;
@@ -18,17 +44,61 @@ typedef struct GstRecorder
     GstElement *v_queue, *v_convert, *v_encoder;
     GstElement *a_queue, *a_convert, *a_encoder;
 
-    GstElement *mp4mux, *filesink;
+    RecorderOutput output;
     
     RecorderState state;
+    RecorderMode mode;
     gchar *filename;
+    GstMedia *media;  // recorder_link之后所属的媒体，每次开始录制时连接到它的tee
+
+    // 停止时等待EOS经过muxer到达sink
+    GMutex eos_lock;
+    GCond eos_cond;
+    RecorderStopCallback stop_callback;
+    gpointer stop_user_data;
+    guint stop_timeout;        // 异步停止时等待EOS的超时
+
+    GstStorage *storage;   // 非NULL时，每个录完的文件交给存储管理器按配额回收
+    gchar *stream_name;
+
+    // 低分辨率代理录像：v_convert之后分出一路缩小、降帧率后单独编码，写到<文件名>.proxy.mp4。
+    // 代理只有视频，关键帧跟随主编码器，两个文件的分片在时间上对齐
+    gboolean proxy_enabled;
+    gint proxy_width, proxy_height, proxy_fps;
+    GstElement *v_tee, *v_main_queue;
+    GstElement *p_queue, *p_scale, *p_rate, *p_filter, *p_encoder;
+    RecorderOutput proxy;
+    gchar *proxy_filename;
+    GMutex key_lock;
+    GstClockTime pending_key;  // 主编码器最近一个关键帧的时间，代理收到该时间之后的帧时强制编码为关键帧
+
+    // 对齐开始：start_time有效时丢弃运行时间早于它的样本，跨过它的音频buffer在样本边界上截断。
+    // 共用时钟的几路录像用同一个start_time开始，文件的0点就是共享时间线上的同一时刻
+    GstClockTime start_time;
+    gboolean v_started, a_started;  // 已经有样本通过，之后不用再比较
+    GstSegment v_segment, a_segment;
+    gint a_rate, a_bpf;
 
 } GstRecorder;
 
 gboolean recorder_init(GstRecorder *self);
 void recorder_destroy(GstRecorder *self);
+// 把录像bin加入媒体管道，开始录制时才连接到tee，停止后断开并锁定在NULL
 gboolean recorder_link(GstRecorder *self, GstMedia *media);
+gboolean recorder_unlink(GstRecorder *self);
+
 gboolean recorder_start(GstRecorder *self, const char *filename);
+// running_time是媒体管道的运行时间，GST_CLOCK_TIME_NONE表示从下一个样本开始
+gboolean recorder_start_at(GstRecorder *self, const char *filename, GstClockTime running_time);
 gboolean recorder_stop(GstRecorder *self);
+// 不阻塞主循环：EOS写完或超时后在主循环中关闭文件并回调。只能在录制中调用
+gboolean recorder_stop_async(GstRecorder *self, RecorderStopCallback callback, gpointer user_data);
+void recorder_set_writer_options(GstRecorder *self, gsize block_size, gboolean direct_io,
+                                 WriterSyncPolicy sync_policy, guint sync_interval);
+void recorder_get_writer_stats(GstRecorder *self, WriterStats *stats);
+void recorder_set_storage(GstRecorder *self, GstStorage *storage, const char *stream_name);
+gboolean recorder_set_mode(GstRecorder *self, RecorderMode mode);
+gboolean recorder_set_proxy(GstRecorder *self, gint width, gint height, gint fps);
+gboolean recorder_recover_file(const char *filename);
 
 #endif
\ No newline at end of file
@@ -1,42 +1,125 @@
 #include "gst-rtsp-server.h"
+#include "gst-log.h"
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/rtsp-server/rtsp-server.h>
 #include <string.h>
 
-// 创建RTSP流的bin，用于连接到media的tee
-GstElement* create_rtsp_stream_bin()
+// 一个已经准备好的RTSP媒体，客户端共用
+typedef struct RtspSession
 {
-    GstElement *bin = gst_bin_new("rtsp_stream_bin");
-    
-    // 创建视频队列
-    GstElement *v_queue = gst_element_factory_make("queue", "rtsp_v_queue");
-    
-    // 创建音频队列
-    GstElement *a_queue = gst_element_factory_make("queue", "rtsp_a_queue");
-    
-    if (!bin || !v_queue || !a_queue)
+    RtspStream *stream;
+    GstRTSPMedia *media;
+    GstElement *v_src, *a_src;
+    GstClockTime base;   // 第一个关键帧的时间，之后的时间戳都减去它，RTSP媒体从0开始
+    gboolean started;
+    gboolean dropping;   // 客户端读得太慢，丢弃数据直到下一个关键帧
+} RtspSession;
+
+// 每个RTSP媒体的appsrc最多缓存的字节数
+#define RTSP_SESSION_MAX_BYTES (4 * 1024 * 1024)
+
+GstFlowReturn rtsp_on_new_sample(GstAppSink *sink, RtspStream *stream);
+void rtsp_on_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, RtspStream *stream);
+void rtsp_on_media_unprepared(GstRTSPMedia *media, RtspSession *session);
+void rtsp_session_push(RtspSession *session, GstSample *sample, gboolean video);
+void rtsp_session_free(RtspSession *session);
+GstRTSPFilterResult rtsp_on_client_filter(GstRTSPServer *server, GstRTSPClient *client, gpointer user_data);
+void rtsp_stream_free(RtspStream *stream);
+guint64 rtsp_stream_memory(RtspStream *stream);
+
+// 创建RTSP流的bin，用于连接到media的tee：在媒体管道里完成编码，编码后的数据由appsink取出
+gboolean create_rtsp_stream_bin(RtspStream *stream)
+{
+    gchar *name = g_strdup_printf("rtsp%s", stream->path);
+    g_strdelimit(name, "/", '_');
+    stream->bin = gst_bin_new(name);
+    g_free(name);
+
+    stream->v_queue = gst_element_factory_make("queue", "rtsp_v_queue");
+    stream->v_convert = gst_element_factory_make("videoconvert", "rtsp_v_convert");
+    stream->v_encoder = gst_element_factory_make("x264enc", "rtsp_v_encoder");
+    stream->v_parse = gst_element_factory_make("h264parse", "rtsp_v_parse");
+    stream->v_sink = gst_element_factory_make("appsink", "rtsp_v_sink");
+
+    if (!stream->bin || !stream->v_queue || !stream->v_convert || !stream->v_encoder ||
+        !stream->v_parse || !stream->v_sink)
     {
         g_printerr("Could not create RTSP stream basic elements\n");
-        if (bin) gst_object_unref(bin);
-        return NULL;
+        return FALSE;
     }
 
-    // 添加元素到bin
-    gst_bin_add_many(GST_BIN(bin),
-        v_queue, a_queue,
-        NULL);
+    gst_bin_add_many(GST_BIN(stream->bin),
+                     stream->v_queue, stream->v_convert, stream->v_encoder, stream->v_parse, stream->v_sink,
+                     NULL);
 
-    // 创建ghost pads - 一个用于视频，一个用于音频
-    GstPad *v_pad = gst_element_get_static_pad(v_queue, "sink");
-    GstPad *a_pad = gst_element_get_static_pad(a_queue, "sink");
+    if (!gst_element_link_many(stream->v_queue, stream->v_convert, stream->v_encoder,
+                               stream->v_parse, stream->v_sink, NULL))
+    {
+        g_printerr("RTSP video elements could not be linked.\n");
+        return FALSE;
+    }
+
+    // 编码跟不上时丢旧帧，不能反压tee影响播放和录像
+    g_object_set(stream->v_queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                 "max-size-time", (guint64)GST_SECOND, NULL);
+    g_object_set(stream->v_encoder, "speed-preset", 1, "tune", 0x00000004, "bitrate", 2048,
+                 "key-int-max", 60, NULL);
+    g_object_set(stream->v_parse, "config-interval", -1, NULL);
+
+    GstPad *v_pad = gst_element_get_static_pad(stream->v_queue, "sink");
     GstPad *v_ghost_pad = gst_ghost_pad_new("v_sink", v_pad);  // 统一使用v_sink和a_sink
-    GstPad *a_ghost_pad = gst_ghost_pad_new("a_sink", a_pad);  // 统一使用v_sink和a_sink
-    gst_element_add_pad(bin, v_ghost_pad);
-    gst_element_add_pad(bin, a_ghost_pad);
+    gst_element_add_pad(stream->bin, v_ghost_pad);
     gst_pad_set_active(v_ghost_pad, TRUE);
-    gst_pad_set_active(a_ghost_pad, TRUE);
     gst_object_unref(v_pad);
-    gst_object_unref(a_pad);
 
-    return bin;
+    if (stream->audio)
+    {
+        stream->a_queue = gst_element_factory_make("queue", "rtsp_a_queue");
+        stream->a_convert = gst_element_factory_make("audioconvert", "rtsp_a_convert");
+        stream->a_resample = gst_element_factory_make("audioresample", "rtsp_a_resample");
+        stream->a_encoder = gst_element_factory_make("opusenc", "rtsp_a_encoder");
+        stream->a_sink = gst_element_factory_make("appsink", "rtsp_a_sink");
+
+        if (!stream->a_queue || !stream->a_convert || !stream->a_resample || !stream->a_encoder || !stream->a_sink)
+        {
+            g_printerr("Could not create RTSP audio elements\n");
+            return FALSE;
+        }
+
+        gst_bin_add_many(GST_BIN(stream->bin),
+                         stream->a_queue, stream->a_convert, stream->a_resample, stream->a_encoder, stream->a_sink,
+                         NULL);
+
+        if (!gst_element_link_many(stream->a_queue, stream->a_convert, stream->a_resample,
+                                   stream->a_encoder, stream->a_sink, NULL))
+        {
+            g_printerr("RTSP audio elements could not be linked.\n");
+            return FALSE;
+        }
+
+        g_object_set(stream->a_queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                     "max-size-time", (guint64)GST_SECOND, NULL);
+
+        GstPad *a_pad = gst_element_get_static_pad(stream->a_queue, "sink");
+        GstPad *a_ghost_pad = gst_ghost_pad_new("a_sink", a_pad);
+        gst_element_add_pad(stream->bin, a_ghost_pad);
+        gst_pad_set_active(a_ghost_pad, TRUE);
+        gst_object_unref(a_pad);
+    }
+
+    // appsink不参与同步和预卷，没有客户端时取出的数据直接丢弃
+    GstAppSinkCallbacks callbacks = {0};
+    callbacks.new_sample = (GstFlowReturn(*)(GstAppSink *, gpointer))rtsp_on_new_sample;
+    g_object_set(stream->v_sink, "sync", FALSE, "async", FALSE, "max-buffers", 30, "drop", TRUE, NULL);
+    gst_app_sink_set_callbacks(GST_APP_SINK(stream->v_sink), &callbacks, stream, NULL);
+    if (stream->a_sink)
+    {
+        g_object_set(stream->a_sink, "sync", FALSE, "async", FALSE, "max-buffers", 50, "drop", TRUE, NULL);
+        gst_app_sink_set_callbacks(GST_APP_SINK(stream->a_sink), &callbacks, stream, NULL);
+    }
+
+    return TRUE;
 }
 
 gboolean rtsp_server_init(GstRtspServer *self, guint port)
@@ -52,8 +135,19 @@ gboolean rtsp_server_init(GstRtspServer *self, guint port)
     self->port = port;
     self->uri_path = g_strdup("/stream");  // 默认流路径
     self->is_streaming = FALSE;
-    
-    self->server = NULL;
+
+    self->server = gst_rtsp_server_new();
+    if (!self->server)
+    {
+        g_printerr("Could not create RTSP server\n");
+        rtsp_server_destroy(self);
+        return FALSE;
+    }
+
+    gchar *service = g_strdup_printf("%u", port);
+    gst_rtsp_server_set_service(self->server, service);
+    g_free(service);
+    self->mounts = gst_rtsp_server_get_mount_points(self->server);
 
     g_print("RTSP Server initialized on port %u\n", port);
     return TRUE;
@@ -68,11 +162,19 @@ void rtsp_server_destroy(GstRtspServer *self)
         rtsp_stop(self);
     }
 
-    if (self->bin)
+    while (self->streams)
+        rtsp_remove_mount(self, ((RtspStream *)self->streams->data)->path);
+
+    if (self->mounts)
+    {
+        g_object_unref(self->mounts);
+        self->mounts = NULL;
+    }
+
+    if (self->server)
     {
-        gst_element_set_state(self->bin, GST_STATE_NULL);
-        gst_object_unref(self->bin);
-        self->bin = NULL;
+        g_object_unref(self->server);
+        self->server = NULL;
     }
 
     if (self->uri_path)
@@ -80,7 +182,7 @@ void rtsp_server_destroy(GstRtspServer *self)
         g_free(self->uri_path);
         self->uri_path = NULL;
     }
-    
+
     g_print("RTSP Server destroyed\n");
 }
 
@@ -92,62 +194,217 @@ gboolean rtsp_link(GstRtspServer *self, GstMedia *media)
         return FALSE;
     }
 
-    // 创建RTSP流的bin
-    self->bin = create_rtsp_stream_bin();
-    if (!self->bin)
+    return rtsp_add_mount(self, media, self->uri_path, TRUE);
+}
+
+gboolean rtsp_unlink(GstRtspServer *self, GstMedia *media)
+{
+    if (!self || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to rtsp_unlink\n");
+        return FALSE;
+    }
+
+    RtspStream *stream = rtsp_find_mount(self, self->uri_path);
+    if (!stream || stream->media != media)
+    {
+        g_printerr("Media is not mounted at %s\n", self->uri_path);
+        return FALSE;
+    }
+
+    return rtsp_remove_mount(self, self->uri_path);
+}
+
+void rtsp_set_configure_func(GstRtspServer *self, RtspConfigureFunc func, gpointer user_data)
+{
+    if (!self)
+        return;
+
+    self->configure_func = func;
+    self->configure_data = user_data;
+}
+
+RtspStream *rtsp_find_mount(GstRtspServer *self, const char *path)
+{
+    for (GList *l = self ? self->streams : NULL; l; l = l->next)
+    {
+        RtspStream *stream = l->data;
+        if (g_strcmp0(stream->path, path) == 0)
+            return stream;
+    }
+    return NULL;
+}
+
+// 在path上发布媒体。媒体可以已经在播放，分支会同步到管道的状态
+gboolean rtsp_add_mount(GstRtspServer *self, GstMedia *media, const char *path, gboolean audio)
+{
+    if (!self || !self->server || !media || !media->pipeline || !path || path[0] != '/')
+    {
+        g_printerr("Invalid arguments to rtsp_add_mount\n");
+        return FALSE;
+    }
+
+    if (rtsp_find_mount(self, path))
+    {
+        g_printerr("RTSP mount %s already exists\n", path);
+        return FALSE;
+    }
+
+    RtspStream *stream = g_new0(RtspStream, 1);
+    stream->server = self;
+    stream->path = g_strdup(path);
+    stream->media = media;
+    stream->audio = audio;
+    g_mutex_init(&stream->lock);
+
+    if (!create_rtsp_stream_bin(stream))
     {
         g_printerr("Could not create RTSP stream bin\n");
+        rtsp_stream_free(stream);
         return FALSE;
     }
 
-    // 添加视频分支和音频分支
-    gboolean video_success = media_add_video_branch(media, self->bin);
-    gboolean audio_success = media_add_audio_branch(media, self->bin);
+    // RTSP媒体只负责打包，appsrc的caps和数据都来自分支里的appsink
+    GString *launch = g_string_new("( appsrc name=v_src is-live=true format=time ! "
+                                   "h264parse ! rtph264pay name=pay0 pt=96 config-interval=-1");
+    if (audio)
+        g_string_append(launch, " appsrc name=a_src is-live=true format=time ! rtpopuspay name=pay1 pt=97");
+    g_string_append(launch, " )");
+
+    stream->factory = gst_rtsp_media_factory_new();
+    gst_rtsp_media_factory_set_launch(stream->factory, launch->str);
+    gst_rtsp_media_factory_set_shared(stream->factory, TRUE);
+    g_string_free(launch, TRUE);
+    g_signal_connect(stream->factory, "media-configure", G_CALLBACK(rtsp_on_media_configure), stream);
+
+    // 分支还是NULL状态，编码器的所有属性都可以修改
+    if (self->configure_func)
+        self->configure_func(stream, self->configure_data);
 
-    if (!(video_success && audio_success)) {
+    if (!media_add_video_branch(media, stream->bin) ||
+        (audio && !media_add_audio_branch(media, stream->bin)))
+    {
         g_printerr("Failed to link RTSP stream bin to media\n");
-        gst_element_set_state(self->bin, GST_STATE_NULL);
-        gst_object_unref(self->bin);
-        self->bin = NULL;
+        rtsp_stream_free(stream);
         return FALSE;
     }
 
-    g_print("RTSP server successfully linked to media\n");
+    media_add_memory_source(media, stream->bin, (MediaMemoryFunc)rtsp_stream_memory, stream);
+    gst_rtsp_mount_points_add_factory(self->mounts, path, g_object_ref(stream->factory));
+    self->streams = g_list_append(self->streams, stream);
+
+    LOG_INFO(media->name, GST_ELEMENT_NAME(stream->bin), "RTSP mount %s added", path);
     return TRUE;
 }
 
-gboolean rtsp_unlink(GstRtspServer *self, GstMedia *media)
+gboolean rtsp_remove_mount(GstRtspServer *self, const char *path)
 {
-    if (!self || !media || !media->pipeline || !self->bin)
+    RtspStream *stream = rtsp_find_mount(self, path);
+    if (!stream)
     {
-        g_printerr("Invalid arguments to rtsp_unlink\n");
+        g_printerr("RTSP mount %s not found\n", path ? path : "(null)");
         return FALSE;
     }
 
-    // 移除视频分支和音频分支
-    gboolean video_success = media_remove_video_branch(media, self->bin);
-    gboolean audio_success = media_remove_audio_branch(media, self->bin);
+    self->streams = g_list_remove(self->streams, stream);
+    gst_rtsp_mount_points_remove_factory(self->mounts, stream->path);
+
+    LOG_INFO(stream->media->name, GST_ELEMENT_NAME(stream->bin), "RTSP mount %s removed", stream->path);
+    rtsp_stream_free(stream);
+    return TRUE;
+}
 
-    gst_element_set_state(self->bin, GST_STATE_NULL);
-    gst_object_unref(self->bin);
-    self->bin = NULL;
+// 所有RTSP媒体的appsrc中还没有发出去的字节数，计入该挂载点分支的内存占用
+guint64 rtsp_stream_memory(RtspStream *stream)
+{
+    guint64 bytes = 0;
 
-    return video_success && audio_success;
+    g_mutex_lock(&stream->lock);
+    for (GList *l = stream->sessions; l; l = l->next)
+    {
+        RtspSession *session = l->data;
+        if (session->v_src)
+            bytes += gst_app_src_get_current_level_bytes(GST_APP_SRC(session->v_src));
+        if (session->a_src)
+            bytes += gst_app_src_get_current_level_bytes(GST_APP_SRC(session->a_src));
+    }
+    g_mutex_unlock(&stream->lock);
+
+    return bytes;
+}
+
+// 从媒体断开分支，已经连接的客户端收到EOS
+void rtsp_stream_free(RtspStream *stream)
+{
+    if (stream->factory)
+    {
+        g_signal_handlers_disconnect_by_data(stream->factory, stream);
+        g_object_unref(stream->factory);
+    }
+
+    g_mutex_lock(&stream->lock);
+    GList *sessions = stream->sessions;
+    stream->sessions = NULL;
+    g_mutex_unlock(&stream->lock);
+    for (GList *l = sessions; l; l = l->next)
+    {
+        RtspSession *session = l->data;
+        if (session->v_src)
+            gst_app_src_end_of_stream(GST_APP_SRC(session->v_src));
+        if (session->a_src)
+            gst_app_src_end_of_stream(GST_APP_SRC(session->a_src));
+        rtsp_session_free(session);
+    }
+    g_list_free(sessions);
+
+    if (stream->bin)
+    {
+        if (GST_OBJECT_PARENT(stream->bin))
+        {
+            media_remove_memory_source(stream->media, (MediaMemoryFunc)rtsp_stream_memory, stream);
+            media_remove_video_branch(stream->media, stream->bin);
+            if (stream->audio)
+                media_remove_audio_branch(stream->media, stream->bin);
+
+            gst_object_ref(stream->bin);
+            gst_element_set_state(stream->bin, GST_STATE_NULL);
+            gst_bin_remove(GST_BIN(stream->media->pipeline), stream->bin);
+        }
+        else
+        {
+            gst_object_ref_sink(stream->bin);
+        }
+        gst_object_unref(stream->bin);
+    }
+
+    g_mutex_clear(&stream->lock);
+    g_free(stream->path);
+    g_free(stream);
 }
 
 gboolean rtsp_start(GstRtspServer *self)
 {
-    if (!self)
+    if (!self || !self->server)
     {
         g_printerr("RTSP server instance is NULL\n");
         return FALSE;
     }
 
+    if (self->is_streaming)
+        return TRUE;
+
+    self->source_id = gst_rtsp_server_attach(self->server, NULL);
+    if (!self->source_id)
+    {
+        g_printerr("Could not attach RTSP server to port %u\n", self->port);
+        return FALSE;
+    }
+
     self->is_streaming = TRUE;
-    g_print("RTSP server started on port %u, path %s\n", 
-            self->port, self->uri_path);
-    g_print("Connect using: rtsp://127.0.0.1:%u%s\n", 
-            self->port, self->uri_path);
+    g_print("RTSP server started on port %u\n", self->port);
+    for (GList *l = self->streams; l; l = l->next)
+        g_print("Connect using: rtsp://127.0.0.1:%u%s\n",
+                self->port, ((RtspStream *)l->data)->path);
 
     return TRUE;
 }
@@ -164,8 +421,131 @@ gboolean rtsp_stop(GstRtspServer *self)
         return TRUE;
     }
 
+    // 停止监听并断开所有客户端
+    g_source_remove(self->source_id);
+    self->source_id = 0;
+    gst_rtsp_server_client_filter(self->server, rtsp_on_client_filter, NULL);
+
     self->is_streaming = FALSE;
     g_print("RTSP server stopped\n");
 
     return TRUE;
-}
\ No newline at end of file
+}
+
+GstRTSPFilterResult rtsp_on_client_filter(GstRTSPServer *server, GstRTSPClient *client, gpointer user_data)
+{
+    return GST_RTSP_FILTER_REMOVE;
+}
+
+// 共享工厂第一次有客户端时创建RTSP媒体，记下其中的appsrc
+void rtsp_on_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, RtspStream *stream)
+{
+    GstElement *element = gst_rtsp_media_get_element(media);
+
+    RtspSession *session = g_new0(RtspSession, 1);
+    session->stream = stream;
+    session->media = g_object_ref(media);
+    session->v_src = gst_bin_get_by_name_recurse_up(GST_BIN(element), "v_src");
+    session->a_src = stream->audio ? gst_bin_get_by_name_recurse_up(GST_BIN(element), "a_src") : NULL;
+    session->base = GST_CLOCK_TIME_NONE;
+    gst_object_unref(element);
+
+    g_signal_connect(media, "unprepared", G_CALLBACK(rtsp_on_media_unprepared), session);
+
+    g_mutex_lock(&stream->lock);
+    stream->sessions = g_list_append(stream->sessions, session);
+    g_mutex_unlock(&stream->lock);
+
+    LOG_INFO(stream->media->name, GST_ELEMENT_NAME(stream->bin), "RTSP media for %s prepared", stream->path);
+}
+
+// 最后一个客户端断开后RTSP媒体被释放
+void rtsp_on_media_unprepared(GstRTSPMedia *media, RtspSession *session)
+{
+    RtspStream *stream = session->stream;
+
+    g_mutex_lock(&stream->lock);
+    stream->sessions = g_list_remove(stream->sessions, session);
+    g_mutex_unlock(&stream->lock);
+
+    LOG_INFO(stream->media->name, GST_ELEMENT_NAME(stream->bin), "RTSP media for %s unprepared", stream->path);
+    rtsp_session_free(session);
+}
+
+void rtsp_session_free(RtspSession *session)
+{
+    g_signal_handlers_disconnect_by_data(session->media, session);
+    g_object_unref(session->media);
+    if (session->v_src)
+        gst_object_unref(session->v_src);
+    if (session->a_src)
+        gst_object_unref(session->a_src);
+    g_free(session);
+}
+
+// appsink流线程：把编码后的数据转发给所有RTSP媒体
+GstFlowReturn rtsp_on_new_sample(GstAppSink *sink, RtspStream *stream)
+{
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample)
+        return GST_FLOW_OK;
+
+    gboolean video = GST_ELEMENT(sink) == stream->v_sink;
+
+    g_mutex_lock(&stream->lock);
+    for (GList *l = stream->sessions; l; l = l->next)
+        rtsp_session_push(l->data, sample, video);
+    g_mutex_unlock(&stream->lock);
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// 从第一个视频关键帧开始转发，时间戳平移到从0开始；buffer只复制元数据，不复制数据
+void rtsp_session_push(RtspSession *session, GstSample *sample, gboolean video)
+{
+    GstElement *src = video ? session->v_src : session->a_src;
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (!src || !buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return;
+
+    if (!session->started)
+    {
+        if (!video || GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+            return;
+        session->base = GST_BUFFER_PTS(buffer);
+        session->started = TRUE;
+    }
+
+    if (GST_BUFFER_PTS(buffer) < session->base)
+        return;
+
+    // 客户端停止读取时appsrc的队列会一直增长：超过上限后丢弃数据，
+    // 等队列降到一半以下再从下一个关键帧继续，避免解码端花屏
+    guint64 level = gst_app_src_get_current_level_bytes(GST_APP_SRC(src));
+    if (level > RTSP_SESSION_MAX_BYTES && !session->dropping)
+    {
+        LOG_WARNING(session->stream->media->name, GST_ELEMENT_NAME(session->stream->bin),
+                    "RTSP client for %s is too slow, dropping until the next keyframe", session->stream->path);
+        session->dropping = TRUE;
+    }
+    if (session->dropping)
+    {
+        if (!video || GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) ||
+            level > RTSP_SESSION_MAX_BYTES / 2)
+            return;
+        session->dropping = FALSE;
+    }
+
+    GstBuffer *copy = gst_buffer_copy(buffer);
+    GST_BUFFER_PTS(copy) -= session->base;
+    if (GST_BUFFER_DTS_IS_VALID(copy) && GST_BUFFER_DTS(copy) >= session->base)
+        GST_BUFFER_DTS(copy) -= session->base;
+    else
+        GST_BUFFER_DTS(copy) = GST_CLOCK_TIME_NONE;
+
+    GstSample *out = gst_sample_new(copy, gst_sample_get_caps(sample), NULL, NULL);
+    gst_buffer_unref(copy);
+    gst_app_src_push_sample(GST_APP_SRC(src), out);
+    gst_sample_unref(out);
+}
@@ -8,24 +8,61 @@
 typedef struct _GstRTSPServer GstRTSPServer;
 typedef struct _GstRTSPMountPoints GstRTSPMountPoints;
 typedef struct _GstRTSPMediaFactory GstRTSPMediaFactory;
+typedef struct _GstRTSPMedia GstRTSPMedia;
+
+struct GstRtspServer;
+struct RtspStream;
+
+// 挂载点的分支创建后、连接到媒体之前调用，可以修改编码器和队列的参数
+typedef void (*RtspConfigureFunc)(struct RtspStream *stream, gpointer user_data);
+
+// 一个挂载点：媒体管道里的分支负责编码，编码后的数据经appsink交给RTSP媒体里的appsrc。
+// 工厂是共享的，所有客户端共用同一个RTSP媒体，编码只做一次
+typedef struct RtspStream
+{
+    struct GstRtspServer *server;
+    gchar *path;
+    GstMedia *media;
+    gboolean audio;
+
+    GstElement *bin;
+    GstElement *v_queue, *v_convert, *v_encoder, *v_parse, *v_sink;
+    GstElement *a_queue, *a_convert, *a_resample, *a_encoder, *a_sink;
+
+    GstRTSPMediaFactory *factory;
+
+    // 已经准备好的RTSP媒体(RtspSession)，appsink流线程和主循环都会访问
+    GMutex lock;
+    GList *sessions;
+
+} RtspStream;
 
 typedef struct GstRtspServer
 {
     GstRTSPServer *server;     // 实际的RTSP服务器实例
     GstRTSPMountPoints *mounts;// 挂载点
-    GstRTSPMediaFactory *factory; // 媒体工厂
     guint port;
-    gchar *uri_path;
-    GstElement *bin;           // RTSP流的bin
+    gchar *uri_path;           // rtsp_link使用的默认路径
+    guint source_id;           // gst_rtsp_server_attach返回的主循环源
     gboolean is_streaming;
 
+    GList *streams;            // RtspStream
+
+    RtspConfigureFunc configure_func;
+    gpointer configure_data;
+
 } GstRtspServer;
 
 gboolean rtsp_server_init(GstRtspServer *self, guint port);
 void rtsp_server_destroy(GstRtspServer *self);
 gboolean rtsp_link(GstRtspServer *self, GstMedia *media);
 gboolean rtsp_unlink(GstRtspServer *self, GstMedia *media);
+gboolean rtsp_add_mount(GstRtspServer *self, GstMedia *media, const char *path, gboolean audio);
+gboolean rtsp_remove_mount(GstRtspServer *self, const char *path);
+RtspStream *rtsp_find_mount(GstRtspServer *self, const char *path);
+void rtsp_set_configure_func(GstRtspServer *self, RtspConfigureFunc func, gpointer user_data);
+
 gboolean rtsp_start(GstRtspServer *self);
 gboolean rtsp_stop(GstRtspServer *self);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,325 @@
+#include "gst-storage.h"
+#include "gst-index.h"
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+gpointer storage_delete_thread(GstStorage *self);
+gboolean storage_on_expire_timeout(GstStorage *self);
+StorageStream *storage_get_stream(GstStorage *self, const char *name);
+void storage_stream_free(StorageStream *stream);
+void storage_insert(GstStorage *self, StorageStream *stream, gchar *path, guint64 size, gint64 time);
+void storage_evict(GstStorage *self, StorageSegment *segment);
+void storage_enforce(GstStorage *self, StorageStream *stream);
+gint storage_compare_mtime(gconstpointer a, gconstpointer b);
+
+gboolean storage_init(GstStorage *self, guint64 max_bytes, gint64 max_age)
+{
+    if (!self)
+    {
+        g_printerr("Storage instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstStorage));
+    g_mutex_init(&self->lock);
+    g_queue_init(&self->segments);
+    self->streams = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)storage_stream_free);
+    self->max_bytes = max_bytes;
+    self->max_age = max_age;
+
+    self->deletions = g_async_queue_new();
+    self->thread = g_thread_new("storage-delete", (GThreadFunc)storage_delete_thread, self);
+
+    // 时长配额需要定期检查，字节配额在每次新增分段时检查
+    self->expire_source = g_timeout_add_seconds(10, (GSourceFunc)storage_on_expire_timeout, self);
+
+    return TRUE;
+}
+
+void storage_destroy(GstStorage *self)
+{
+    if (!self)
+        return;
+
+    if (self->expire_source)
+    {
+        g_source_remove(self->expire_source);
+        self->expire_source = 0;
+    }
+
+    // 空字符串通知删除线程退出，已排队的删除会先完成
+    if (self->thread)
+    {
+        g_async_queue_push(self->deletions, g_strdup(""));
+        g_thread_join(self->thread);
+        self->thread = NULL;
+        g_async_queue_unref(self->deletions);
+        self->deletions = NULL;
+    }
+
+    g_mutex_lock(&self->lock);
+    StorageSegment *segment;
+    while ((segment = g_queue_peek_head(&self->segments)) != NULL)
+    {
+        g_queue_unlink(&self->segments, &segment->global_link);
+        g_free(segment->path);
+        g_free(segment);
+    }
+    g_mutex_unlock(&self->lock);
+
+    if (self->streams)
+    {
+        g_hash_table_destroy(self->streams);
+        self->streams = NULL;
+    }
+
+    g_mutex_clear(&self->lock);
+}
+
+void storage_stream_free(StorageStream *stream)
+{
+    g_free(stream->name);
+    g_free(stream);
+}
+
+// 调用者持有锁
+StorageStream *storage_get_stream(GstStorage *self, const char *name)
+{
+    StorageStream *stream = g_hash_table_lookup(self->streams, name);
+    if (!stream)
+    {
+        stream = g_new0(StorageStream, 1);
+        stream->name = g_strdup(name);
+        g_queue_init(&stream->segments);
+        g_hash_table_insert(self->streams, stream->name, stream);
+    }
+    return stream;
+}
+
+void storage_set_stream_quota(GstStorage *self, const char *stream, guint64 max_bytes, gint64 max_age)
+{
+    if (!self || !stream)
+        return;
+
+    g_mutex_lock(&self->lock);
+    StorageStream *s = storage_get_stream(self, stream);
+    s->max_bytes = max_bytes;
+    s->max_age = max_age;
+    storage_enforce(self, s);
+    g_mutex_unlock(&self->lock);
+}
+
+// 调用者持有锁。分段按时间插入，正常情况下新分段总是最新的，直接追加到队尾
+void storage_insert(GstStorage *self, StorageStream *stream, gchar *path, guint64 size, gint64 time)
+{
+    StorageSegment *segment = g_new0(StorageSegment, 1);
+    segment->path = path;
+    segment->stream = stream;
+    segment->size = size;
+    segment->time = time;
+    segment->global_link.data = segment;
+    segment->stream_link.data = segment;
+
+    GList *after = self->segments.tail;
+    while (after && ((StorageSegment *)after->data)->time > time)
+        after = after->prev;
+    if (after)
+        g_queue_insert_after_link(&self->segments, after, &segment->global_link);
+    else
+        g_queue_push_head_link(&self->segments, &segment->global_link);
+
+    after = stream->segments.tail;
+    while (after && ((StorageSegment *)after->data)->time > time)
+        after = after->prev;
+    if (after)
+        g_queue_insert_after_link(&stream->segments, after, &segment->stream_link);
+    else
+        g_queue_push_head_link(&stream->segments, &segment->stream_link);
+
+    stream->bytes += size;
+    self->bytes += size;
+}
+
+// 调用者持有锁。从两个队列中摘除并交给删除线程
+void storage_evict(GstStorage *self, StorageSegment *segment)
+{
+    StorageStream *stream = segment->stream;
+
+    g_queue_unlink(&self->segments, &segment->global_link);
+    g_queue_unlink(&stream->segments, &segment->stream_link);
+    stream->bytes -= segment->size;
+    self->bytes -= segment->size;
+    self->deleted_segments++;
+    self->deleted_bytes += segment->size;
+
+    g_async_queue_push(self->deletions, segment->path);
+    g_free(segment);
+}
+
+// 调用者持有锁。先满足这一路自己的配额，再满足全局配额
+void storage_enforce(GstStorage *self, StorageStream *stream)
+{
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    StorageSegment *oldest;
+
+    // 每一路至少保留最新的一个分段
+    while (stream && stream->segments.length > 1)
+    {
+        oldest = g_queue_peek_head(&stream->segments);
+        if ((stream->max_bytes && stream->bytes > stream->max_bytes) ||
+            (stream->max_age && now - oldest->time > stream->max_age))
+            storage_evict(self, oldest);
+        else
+            break;
+    }
+
+    // 全局配额从最旧的分段开始删除，跳过各路仅剩的最后一个分段
+    GList *link = self->segments.head;
+    while (link)
+    {
+        oldest = link->data;
+        link = link->next;
+        if (!(self->max_bytes && self->bytes > self->max_bytes) &&
+            !(self->max_age && now - oldest->time > self->max_age))
+            break;
+        if (oldest->stream->segments.length > 1)
+            storage_evict(self, oldest);
+    }
+}
+
+// 录制的分段关闭后调用
+void storage_add_segment(GstStorage *self, const char *stream, const char *path, guint64 size)
+{
+    if (!self || !stream || !path)
+    {
+        g_printerr("Invalid arguments to storage_add_segment\n");
+        return;
+    }
+
+    g_mutex_lock(&self->lock);
+    StorageStream *s = storage_get_stream(self, stream);
+    storage_insert(self, s, g_strdup(path), size, g_get_real_time() / G_USEC_PER_SEC);
+    storage_enforce(self, s);
+    g_mutex_unlock(&self->lock);
+}
+
+gint storage_compare_mtime(gconstpointer a, gconstpointer b)
+{
+    guint64 ta = g_file_info_get_attribute_uint64(*(GFileInfo **)a, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    guint64 tb = g_file_info_get_attribute_uint64(*(GFileInfo **)b, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    return ta < tb ? -1 : ta > tb;
+}
+
+// 启动时扫描一次已有的录像目录，建立内存索引。之后不再扫描
+gboolean storage_scan_directory(GstStorage *self, const char *stream, const char *dir)
+{
+    if (!self || !stream || !dir)
+    {
+        g_printerr("Invalid arguments to storage_scan_directory\n");
+        return FALSE;
+    }
+
+    GFile *file = g_file_new_for_path(dir);
+    GFileEnumerator *enumerator = g_file_enumerate_children(
+        file, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
+        G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (!enumerator)
+    {
+        g_printerr("Could not scan recording directory %s\n", dir);
+        g_object_unref(file);
+        return FALSE;
+    }
+
+    // 先按修改时间排序，再整体追加，避免逐个有序插入
+    GPtrArray *infos = g_ptr_array_new_with_free_func(g_object_unref);
+    GFileInfo *info;
+    while ((info = g_file_enumerator_next_file(enumerator, NULL, NULL)) != NULL)
+    {
+        if (g_file_info_get_file_type(info) == G_FILE_TYPE_REGULAR &&
+            !g_str_has_suffix(g_file_info_get_name(info), ".idx"))
+            g_ptr_array_add(infos, info);
+        else
+            g_object_unref(info);
+    }
+    g_ptr_array_sort(infos, (GCompareFunc)storage_compare_mtime);
+
+    g_mutex_lock(&self->lock);
+    StorageStream *s = storage_get_stream(self, stream);
+    for (guint i = 0; i < infos->len; i++)
+    {
+        info = g_ptr_array_index(infos, i);
+        storage_insert(self, s, g_build_filename(dir, g_file_info_get_name(info), NULL),
+                       g_file_info_get_size(info),
+                       (gint64)g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED));
+    }
+    g_print("Storage: %u existing segments for stream %s\n", infos->len, stream);
+    storage_enforce(self, s);
+    g_mutex_unlock(&self->lock);
+
+    g_ptr_array_unref(infos);
+    g_object_unref(enumerator);
+    g_object_unref(file);
+    return TRUE;
+}
+
+void storage_expire(GstStorage *self)
+{
+    if (!self)
+        return;
+
+    g_mutex_lock(&self->lock);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, self->streams);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        storage_enforce(self, (StorageStream *)value);
+    storage_enforce(self, NULL);
+    g_mutex_unlock(&self->lock);
+}
+
+gboolean storage_on_expire_timeout(GstStorage *self)
+{
+    storage_expire(self);
+    return TRUE;
+}
+
+// stream为NULL时返回全部分段的总字节数
+guint64 storage_get_bytes(GstStorage *self, const char *stream)
+{
+    if (!self)
+        return 0;
+
+    g_mutex_lock(&self->lock);
+    guint64 bytes = self->bytes;
+    if (stream)
+    {
+        StorageStream *s = g_hash_table_lookup(self->streams, stream);
+        bytes = s ? s->bytes : 0;
+    }
+    g_mutex_unlock(&self->lock);
+    return bytes;
+}
+
+// 删除分段文件和它的关键帧索引
+gpointer storage_delete_thread(GstStorage *self)
+{
+    for (;;)
+    {
+        gchar *path = g_async_queue_pop(self->deletions);
+        if (path[0] == '\0')
+        {
+            g_free(path);
+            break;
+        }
+
+        if (g_unlink(path) != 0)
+            g_printerr("Could not delete segment %s\n", path);
+
+        gchar *index_path = index_sidecar_path(path);
+        g_unlink(index_path);
+        g_free(index_path);
+        g_free(path);
+    }
+    return NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef __GST_STORAGE_H__
+#define __GST_STORAGE_H__
+
+#include <gst/gst.h>
+
+// 录像存储管理：在内存里按完成顺序维护所有分段，超出每路或全局的字节/时长配额时
+// 从最旧的分段开始删除。新增一个分段和淘汰一个分段都是O(1)，不需要重新扫描目录，
+// 删除文件在后台线程进行
+
+typedef struct StorageSegment
+{
+    gchar *path;
+    struct StorageStream *stream;
+    guint64 size;
+    gint64 time;        // 分段完成的时间（秒）
+    GList global_link;  // 在GstStorage.segments中的节点
+    GList stream_link;  // 在StorageStream.segments中的节点
+} StorageSegment;
+
+typedef struct StorageStream
+{
+    gchar *name;
+    GQueue segments;
+    guint64 bytes;
+    guint64 max_bytes;  // 0表示不限制
+    gint64 max_age;     // 秒，0表示不限制
+} StorageStream;
+
+typedef struct GstStorage
+{
+    GMutex lock;
+    GHashTable *streams;  // name -> StorageStream
+    GQueue segments;      // 所有分段，最旧的在队头
+    guint64 bytes;
+    guint64 max_bytes;
+    gint64 max_age;
+    guint expire_source;
+
+    GThread *thread;
+    GAsyncQueue *deletions;  // 待删除的文件路径
+    guint64 deleted_segments;
+    guint64 deleted_bytes;
+
+} GstStorage;
+
+gboolean storage_init(GstStorage *self, guint64 max_bytes, gint64 max_age);
+void storage_destroy(GstStorage *self);
+void storage_set_stream_quota(GstStorage *self, const char *stream, guint64 max_bytes, gint64 max_age);
+void storage_add_segment(GstStorage *self, const char *stream, const char *path, guint64 size);
+gboolean storage_scan_directory(GstStorage *self, const char *stream, const char *dir);
+void storage_expire(GstStorage *self);
+guint64 storage_get_bytes(GstStorage *self, const char *stream);
+
+#endif
@@ -0,0 +1,293 @@
+#include "gst-sync.h"
+#include "gst-log.h"
+#include <string.h>
+
+void sync_use_clock(GstSync *self, GstMedia *media);
+void sync_bench_on_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data);
+gboolean sync_bench_quit(gpointer user_data);
+gboolean sync_bench_run(const char *uri, gint streams, gint seconds, gboolean shared,
+                        gdouble *avg_spread, gdouble *max_spread);
+
+gboolean sync_init(GstSync *self)
+{
+    if (!self)
+    {
+        g_printerr("Sync instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstSync));
+    self->clock = gst_system_clock_obtain();
+    self->base_time = GST_CLOCK_TIME_NONE;
+    return TRUE;
+}
+
+void sync_destroy(GstSync *self)
+{
+    if (!self)
+        return;
+
+    sync_stop_net_clock(self);
+    g_list_free(self->media);
+    self->media = NULL;
+
+    if (self->clock)
+    {
+        gst_object_unref(self->clock);
+        self->clock = NULL;
+    }
+}
+
+// start time设为NONE，管道切到PLAYING时使用我们设置的base time而不是重新计算
+void sync_use_clock(GstSync *self, GstMedia *media)
+{
+    gst_pipeline_use_clock(GST_PIPELINE(media->pipeline), self->clock);
+    gst_element_set_start_time(media->pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(media->pipeline, self->base_time);
+}
+
+gboolean sync_add_media(GstSync *self, GstMedia *media)
+{
+    if (!self || !media || !media->pipeline)
+    {
+        g_printerr("Invalid arguments to sync_add_media\n");
+        return FALSE;
+    }
+
+    if (g_list_find(self->media, media))
+        return TRUE;
+
+    GstState state = GST_STATE_NULL;
+    gst_element_get_state(media->pipeline, &state, NULL, 0);
+    if (state == GST_STATE_PLAYING)
+    {
+        g_printerr("Media is already playing, cannot change its clock\n");
+        return FALSE;
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID(self->base_time))
+        self->base_time = gst_clock_get_time(self->clock) + SYNC_BASE_MARGIN;
+
+    sync_use_clock(self, media);
+    self->media = g_list_append(self->media, media);
+
+    LOG_DEBUG(media->name, NULL, "Using shared clock, base time %" GST_TIME_FORMAT, GST_TIME_ARGS(self->base_time));
+    return TRUE;
+}
+
+// 没有在播放的管道恢复自己选时钟；最后一个管道移除后，下一个加入的管道重新确定base time
+void sync_remove_media(GstSync *self, GstMedia *media)
+{
+    if (!self || !media || !g_list_find(self->media, media))
+        return;
+
+    self->media = g_list_remove(self->media, media);
+
+    GstState state = GST_STATE_NULL;
+    gst_element_get_state(media->pipeline, &state, NULL, 0);
+    if (state != GST_STATE_PLAYING)
+    {
+        gst_pipeline_auto_clock(GST_PIPELINE(media->pipeline));
+        gst_element_set_start_time(media->pipeline, 0);
+    }
+
+    if (!self->media)
+        self->base_time = GST_CLOCK_TIME_NONE;
+}
+
+GstClockTime sync_get_running_time(GstSync *self)
+{
+    if (!self || !GST_CLOCK_TIME_IS_VALID(self->base_time))
+        return GST_CLOCK_TIME_NONE;
+
+    GstClockTime now = gst_clock_get_time(self->clock);
+    return now > self->base_time ? now - self->base_time : 0;
+}
+
+// 只监听回环地址，时钟只给本机的进程使用
+gboolean sync_start_net_clock(GstSync *self, guint port)
+{
+    if (!self || !self->clock)
+    {
+        g_printerr("Sync not initialized\n");
+        return FALSE;
+    }
+
+    sync_stop_net_clock(self);
+
+    self->provider = gst_net_time_provider_new(self->clock, "127.0.0.1", port);
+    if (!self->provider)
+    {
+        g_printerr("Could not start net clock on port %u\n", port);
+        return FALSE;
+    }
+
+    gint bound = 0;
+    g_object_get(self->provider, "port", &bound, NULL);
+    self->net_port = bound;
+
+    LOG_INFO(NULL, NULL, "Net clock on 127.0.0.1:%u", self->net_port);
+    return TRUE;
+}
+
+void sync_stop_net_clock(GstSync *self)
+{
+    if (!self || !self->provider)
+        return;
+
+    gst_object_unref(self->provider);
+    self->provider = NULL;
+    self->net_port = 0;
+}
+
+// 性能测试：每条管道的视频接一个sync=true的fakesink，记录每一帧实际渲染的单调时钟时刻。
+// 管道之间间隔SYNC_BENCH_STAGGER依次启动，各自选时钟时启动的先后直接变成输出的偏差；
+// 共用时钟和base time时，同一个时间戳的帧在所有管道里同时渲染
+
+#define SYNC_BENCH_STAGGER (50 * G_TIME_SPAN_MILLISECOND)
+#define SYNC_BENCH_MAX_FRAMES 4096
+
+typedef struct SyncBenchStream
+{
+    GstMedia media;
+    GstElement *bin;
+    gint64 *times;     // 第i帧渲染的时刻，g_get_monotonic_time
+    gint count;        // 只由该管道的流线程写入
+} SyncBenchStream;
+
+void sync_bench_on_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data)
+{
+    SyncBenchStream *stream = (SyncBenchStream *)user_data;
+    gint count = g_atomic_int_get(&stream->count);
+    if (count >= SYNC_BENCH_MAX_FRAMES)
+        return;
+
+    stream->times[count] = g_get_monotonic_time();
+    g_atomic_int_set(&stream->count, count + 1);
+}
+
+gboolean sync_bench_quit(gpointer user_data)
+{
+    g_main_loop_quit((GMainLoop *)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+// 返回同一帧在各管道之间渲染时刻的平均差和最大差（毫秒），失败时返回FALSE
+gboolean sync_bench_run(const char *uri, gint streams, gint seconds, gboolean shared,
+                        gdouble *avg_spread, gdouble *max_spread)
+{
+    GstSync sync;
+    sync_init(&sync);
+
+    SyncBenchStream *items = g_new0(SyncBenchStream, streams);
+    gboolean ok = TRUE;
+    gint created = 0;
+    for (gint i = 0; i < streams && ok; i++)
+    {
+        SyncBenchStream *item = &items[i];
+        if (!media_init(&item->media))
+        {
+            ok = FALSE;
+            break;
+        }
+        item->times = g_new0(gint64, SYNC_BENCH_MAX_FRAMES);
+        created++;
+        if (!media_set_uri(&item->media, uri))
+        {
+            ok = FALSE;
+            break;
+        }
+
+        gchar *name = g_strdup_printf("sync_bench_%d", i);
+        item->bin = gst_bin_new(name);
+        g_free(name);
+        GstElement *queue = gst_element_factory_make("queue", NULL);
+        GstElement *sink = gst_element_factory_make("fakesink", NULL);
+        if (!queue || !sink)
+        {
+            g_printerr("Could not create sync benchmark elements\n");
+            ok = FALSE;
+            break;
+        }
+        g_object_set(sink, "sync", TRUE, "signal-handoffs", TRUE, NULL);
+        g_signal_connect(sink, "handoff", G_CALLBACK(sync_bench_on_handoff), item);
+        gst_bin_add_many(GST_BIN(item->bin), queue, sink, NULL);
+        gst_element_link(queue, sink);
+
+        GstPad *pad = gst_element_get_static_pad(queue, "sink");
+        gst_element_add_pad(item->bin, gst_ghost_pad_new("v_sink", pad));
+        gst_object_unref(pad);
+
+        ok = media_add_video_branch(&item->media, item->bin) && (!shared || sync_add_media(&sync, &item->media));
+    }
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    if (ok)
+    {
+        for (gint i = 0; i < streams; i++)
+        {
+            if (i > 0)
+                g_usleep(SYNC_BENCH_STAGGER);
+            media_play(&items[i].media);
+        }
+
+        g_timeout_add_seconds(seconds, sync_bench_quit, loop);
+        g_main_loop_run(loop);
+    }
+
+    for (gint i = 0; i < created; i++)
+        media_stop(&items[i].media);
+
+    gint frames = ok ? SYNC_BENCH_MAX_FRAMES : 0;
+    for (gint i = 0; i < created; i++)
+        frames = MIN(frames, g_atomic_int_get(&items[i].count));
+
+    gint64 sum = 0, max = 0;
+    for (gint f = 0; f < frames; f++)
+    {
+        gint64 lo = G_MAXINT64, hi = 0;
+        for (gint i = 0; i < streams; i++)
+        {
+            lo = MIN(lo, items[i].times[f]);
+            hi = MAX(hi, items[i].times[f]);
+        }
+        sum += hi - lo;
+        max = MAX(max, hi - lo);
+    }
+
+    for (gint i = 0; i < created; i++)
+    {
+        sync_remove_media(&sync, &items[i].media);
+        media_destroy(&items[i].media);
+        g_free(items[i].times);
+    }
+    g_free(items);
+    g_main_loop_unref(loop);
+    sync_destroy(&sync);
+
+    if (frames == 0)
+    {
+        g_printerr("Sync benchmark produced no frames\n");
+        return FALSE;
+    }
+
+    *avg_spread = (gdouble)sum / frames / 1000.0;
+    *max_spread = max / 1000.0;
+    return TRUE;
+}
+
+void sync_bench(const char *uri, gint streams, gint seconds)
+{
+    if (!uri || streams < 2 || seconds <= 0)
+        return;
+
+    gdouble own_avg, own_max, shared_avg, shared_max;
+    if (!sync_bench_run(uri, streams, seconds, FALSE, &own_avg, &own_max) ||
+        !sync_bench_run(uri, streams, seconds, TRUE, &shared_avg, &shared_max))
+        return;
+
+    g_print("sync: %d pipelines, %d s of %s, started %d ms apart\n", streams, seconds, uri,
+            (gint)(SYNC_BENCH_STAGGER / G_TIME_SPAN_MILLISECOND));
+    g_print("  own clocks:   frame spread avg %.2f ms, max %.2f ms\n", own_avg, own_max);
+    g_print("  shared clock: frame spread avg %.2f ms, max %.2f ms\n", shared_avg, shared_max);
+}
@@ -0,0 +1,50 @@
+#ifndef __GST_SYNC_H__
+#define __GST_SYNC_H__
+
+#include <gst/gst.h>
+#include <gst/net/net.h>
+#include "gst-media.h"
+
+// 时钟协调：加入的所有媒体管道使用同一个系统时钟和同一个base time，各管道的running time在同一条时间线上，
+// 不同摄像机在同一时刻采集的样本时间戳相同，拼接、多路输出和录像不需要再重新对齐时间戳。
+//
+// base time在第一个管道加入时确定，之后加入的管道沿用它。直播源按时钟给样本打时间戳，任何时候加入都对齐；
+// 非直播源（本地文件）从0开始，应该在同一批加入后一起启动，晚加入的会被sink判定为迟到而快进到当前位置。
+// 管道的start time设为NONE，暂停恢复和刷新定位都不会重新计算base time。
+//
+// 可选在127.0.0.1上发布网络时钟，本机其他进程用
+//   gst_net_client_clock_new(NULL, "127.0.0.1", port, 0)
+// 作为管道时钟，并设置同样的base time（控制接口的clock命令返回），样本时间戳和本进程一致。
+
+#define SYNC_BASE_MARGIN (200 * GST_MSECOND)  // base time比第一个管道加入的时刻晚一点，给预卷留出时间
+
+typedef struct GstSync
+{
+    GstClock *clock;
+    GstClockTime base_time;       // NONE表示还没有管道加入
+    GList *media;                 // GstMedia，没有引用
+
+    GstNetTimeProvider *provider;
+    guint net_port;               // 网络时钟的端口，0表示没有发布
+
+} GstSync;
+
+gboolean sync_init(GstSync *self);
+// 只释放协调器本身，仍在播放的管道继续使用同一个时钟
+void sync_destroy(GstSync *self);
+
+// 必须在媒体切到PLAYING之前调用，已经在播放的管道不能再改时钟
+gboolean sync_add_media(GstSync *self, GstMedia *media);
+void sync_remove_media(GstSync *self, GstMedia *media);
+
+// 共享时间线上的当前时刻，所有加入的管道相同；还没有管道加入时返回GST_CLOCK_TIME_NONE
+GstClockTime sync_get_running_time(GstSync *self);
+
+// port为0时由系统分配，实际端口记在net_port
+gboolean sync_start_net_clock(GstSync *self, guint port);
+void sync_stop_net_clock(GstSync *self);
+
+// 性能测试：同一个uri启动若干条管道，比较各自选时钟和共用时钟时同一帧在各管道里渲染时刻的差
+void sync_bench(const char *uri, gint streams, gint seconds);
+
+#endif
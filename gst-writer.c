@@ -0,0 +1,404 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#elif !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "gst-writer.h"
+#include <string.h>
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#define WRITER_ALIGN 4096
+#define WRITER_DEFAULT_BLOCK_SIZE (4 * 1024 * 1024)
+
+// 队列中的一次写入，buffer为NULL表示关闭
+typedef struct WriterOp
+{
+    GstBuffer *buffer;
+    guint64 offset;
+} WriterOp;
+
+gpointer writer_thread(GstDiskWriter *self);
+gboolean writer_write_at(GstDiskWriter *self, gboolean direct, const guint8 *data, gsize size, guint64 offset);
+void writer_append(GstDiskWriter *self, const guint8 *data, gsize size, guint64 offset);
+void writer_flush_block(GstDiskWriter *self);
+void writer_sync(GstDiskWriter *self);
+
+gboolean writer_init(GstDiskWriter *self)
+{
+    if (!self)
+    {
+        g_printerr("Writer instance is NULL\n");
+        return FALSE;
+    }
+
+    memset(self, 0, sizeof(GstDiskWriter));
+#ifdef G_OS_UNIX
+    self->fd = -1;
+    self->buffered_fd = -1;
+#endif
+    self->block_size = WRITER_DEFAULT_BLOCK_SIZE;
+    self->sync_policy = WRITER_SYNC_INTERVAL;
+    self->sync_interval = 1000;
+    self->flush_timeout = 200;
+    self->high_watermark = 64 * 1024 * 1024;
+    g_mutex_init(&self->stats_lock);
+    g_cond_init(&self->space_cond);
+
+    return TRUE;
+}
+
+void writer_destroy(GstDiskWriter *self)
+{
+    if (!self)
+        return;
+
+    writer_close(self);
+    g_mutex_clear(&self->stats_lock);
+    g_cond_clear(&self->space_cond);
+}
+
+gboolean writer_open(GstDiskWriter *self, const char *filename)
+{
+    if (!self || !filename)
+    {
+        g_printerr("Invalid arguments to writer_open\n");
+        return FALSE;
+    }
+
+    if (self->thread)
+    {
+        g_printerr("Writer is already open\n");
+        return FALSE;
+    }
+
+    // O_DIRECT要求块大小按页对齐
+    self->block_size = MAX((self->block_size + WRITER_ALIGN - 1) / WRITER_ALIGN * WRITER_ALIGN, WRITER_ALIGN);
+
+#ifdef G_OS_UNIX
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (self->direct_io)
+    {
+        self->fd = open(filename, flags | O_DIRECT, 0644);
+        if (self->fd < 0)
+            g_printerr("O_DIRECT not supported for %s, using buffered I/O\n", filename);
+    }
+#endif
+    if (self->fd < 0)
+    {
+        self->direct_io = FALSE;
+        self->fd = open(filename, flags, 0644);
+    }
+    if (self->fd < 0)
+    {
+        g_printerr("Could not open %s for writing\n", filename);
+        return FALSE;
+    }
+    // O_DIRECT模式下不对齐的回写（muxer更新文件头）走普通文件描述符
+    self->buffered_fd = self->direct_io ? open(filename, O_WRONLY) : self->fd;
+
+    if (posix_memalign((void **)&self->block, WRITER_ALIGN, self->block_size) != 0)
+        self->block = NULL;
+#else
+    self->direct_io = FALSE;
+    GFile *file = g_file_new_for_path(filename);
+    self->stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL);
+    g_object_unref(file);
+    if (!self->stream)
+    {
+        g_printerr("Could not open %s for writing\n", filename);
+        return FALSE;
+    }
+    self->block = g_malloc(self->block_size);
+#endif
+
+    if (!self->block)
+    {
+        g_printerr("Could not allocate writer block\n");
+#ifdef G_OS_UNIX
+        if (self->buffered_fd >= 0 && self->buffered_fd != self->fd)
+            close(self->buffered_fd);
+        close(self->fd);
+        self->fd = -1;
+        self->buffered_fd = -1;
+#else
+        g_object_unref(self->stream);
+        self->stream = NULL;
+#endif
+        return FALSE;
+    }
+
+    self->block_base = 0;
+    self->block_len = 0;
+    self->block_dirty = FALSE;
+    self->file_size = 0;
+    self->failed = FALSE;
+    self->last_sync = g_get_monotonic_time();
+
+    g_mutex_lock(&self->stats_lock);
+    memset(&self->stats, 0, sizeof(WriterStats));
+    g_mutex_unlock(&self->stats_lock);
+
+    self->queue = g_async_queue_new();
+    self->thread = g_thread_new("rec-writer", (GThreadFunc)writer_thread, self);
+
+    return TRUE;
+}
+
+// 流线程调用：只增加引用并入队。排队的数据超过高水位时等I/O线程写到水位以下，
+// 反压经由muxer和编码器传到录像分支的queue，而不是丢掉muxer的输出让文件损坏
+void writer_push(GstDiskWriter *self, GstBuffer *buffer, guint64 offset)
+{
+    if (!self || !self->queue || !buffer)
+        return;
+
+    gsize size = gst_buffer_get_size(buffer);
+
+    g_mutex_lock(&self->stats_lock);
+    if (self->stats.queued_bytes > self->high_watermark)
+    {
+        // 磁盘持续跟不上时每个buffer都会等待，只提示一次
+        gboolean first = ++self->stats.overflows == 1;
+        g_mutex_unlock(&self->stats_lock);
+        if (first)
+            g_printerr("Recorder writer queue above %" G_GUINT64_FORMAT " bytes, disk is too slow\n", self->high_watermark);
+
+        gint64 start = g_get_monotonic_time();
+        g_mutex_lock(&self->stats_lock);
+        while (self->stats.queued_bytes > self->high_watermark)
+            g_cond_wait(&self->space_cond, &self->stats_lock);
+        self->stats.total_stall_time += g_get_monotonic_time() - start;
+    }
+    self->stats.queue_depth++;
+    self->stats.queued_bytes += size;
+    self->stats.max_queue_depth = MAX(self->stats.max_queue_depth, self->stats.queue_depth);
+    self->stats.max_queued_bytes = MAX(self->stats.max_queued_bytes, self->stats.queued_bytes);
+    g_mutex_unlock(&self->stats_lock);
+
+    WriterOp *op = g_new(WriterOp, 1);
+    op->buffer = gst_buffer_ref(buffer);
+    op->offset = offset;
+    g_async_queue_push(self->queue, op);
+}
+
+// 等待队列写完并关闭文件
+gboolean writer_close(GstDiskWriter *self)
+{
+    if (!self || !self->thread)
+        return TRUE;
+
+    WriterOp *op = g_new0(WriterOp, 1);
+    g_async_queue_push(self->queue, op);
+    g_thread_join(self->thread);
+    self->thread = NULL;
+
+    g_async_queue_unref(self->queue);
+    self->queue = NULL;
+
+#ifdef G_OS_UNIX
+    // O_DIRECT写出的最后一块按页补齐过，截回真实长度
+    if (self->direct_io && ftruncate(self->buffered_fd, self->file_size) != 0)
+        self->failed = TRUE;
+    fsync(self->fd);
+    if (self->buffered_fd >= 0 && self->buffered_fd != self->fd)
+        close(self->buffered_fd);
+    close(self->fd);
+    self->fd = -1;
+    self->buffered_fd = -1;
+    free(self->block);
+#else
+    g_output_stream_close(G_OUTPUT_STREAM(self->stream), NULL, NULL);
+    g_object_unref(self->stream);
+    self->stream = NULL;
+    g_free(self->block);
+#endif
+    self->block = NULL;
+
+    if (self->failed)
+        g_printerr("Recorder writer had write errors\n");
+    return !self->failed;
+}
+
+void writer_get_stats(GstDiskWriter *self, WriterStats *stats)
+{
+    if (!self || !stats)
+        return;
+
+    g_mutex_lock(&self->stats_lock);
+    *stats = self->stats;
+    g_mutex_unlock(&self->stats_lock);
+}
+
+gpointer writer_thread(GstDiskWriter *self)
+{
+    for (;;)
+    {
+        // 有未写出的块时最多等flush_timeout，避免数据长时间停留在内存里
+        WriterOp *op = self->block_dirty
+                           ? g_async_queue_timeout_pop(self->queue, (guint64)self->flush_timeout * 1000)
+                           : g_async_queue_pop(self->queue);
+        if (!op)
+        {
+            writer_flush_block(self);
+            writer_sync(self);
+            continue;
+        }
+
+        if (!op->buffer)
+        {
+            g_free(op);
+            break;
+        }
+
+        GstMapInfo map;
+        gsize size = gst_buffer_get_size(op->buffer);
+        if (gst_buffer_map(op->buffer, &map, GST_MAP_READ))
+        {
+            writer_append(self, map.data, map.size, op->offset);
+            gst_buffer_unmap(op->buffer, &map);
+        }
+        gst_buffer_unref(op->buffer);
+        g_free(op);
+
+        g_mutex_lock(&self->stats_lock);
+        self->stats.queue_depth--;
+        self->stats.queued_bytes -= size;
+        g_cond_signal(&self->space_cond);
+        g_mutex_unlock(&self->stats_lock);
+
+        if (self->sync_policy == WRITER_SYNC_INTERVAL)
+            writer_sync(self);
+    }
+
+    writer_flush_block(self);
+    return NULL;
+}
+
+// 把数据合并到当前块，块满了写出。不连续的写入（muxer回写文件头）先写出当前块
+void writer_append(GstDiskWriter *self, const guint8 *data, gsize size, guint64 offset)
+{
+    while (size > 0)
+    {
+        if (self->block_len == 0 && !self->direct_io)
+            self->block_base = offset;
+
+        if (offset == self->block_base + self->block_len)
+        {
+            gsize n = MIN(size, self->block_size - self->block_len);
+            memcpy(self->block + self->block_len, data, n);
+            self->block_len += n;
+            self->block_dirty = TRUE;
+            data += n;
+            size -= n;
+            offset += n;
+            self->file_size = MAX(self->file_size, offset);
+
+            if (self->block_len == self->block_size)
+                writer_flush_block(self);
+        }
+        else if (offset >= self->block_base && offset + size <= self->block_base + self->block_len)
+        {
+            // 落在还没写出的块内，直接修改内存
+            memcpy(self->block + (offset - self->block_base), data, size);
+            self->block_dirty = TRUE;
+            break;
+        }
+        else if (!self->direct_io)
+        {
+            writer_flush_block(self);
+        }
+        else
+        {
+            writer_write_at(self, FALSE, data, size, offset);
+            self->file_size = MAX(self->file_size, offset + size);
+            break;
+        }
+    }
+}
+
+// 写出当前块。O_DIRECT模式下不满的块补齐到页边界写出，但保留在内存里，后续数据继续追加后整块重写
+void writer_flush_block(GstDiskWriter *self)
+{
+    if (self->block_len == 0 || !self->block_dirty)
+        return;
+
+    self->block_dirty = FALSE;
+
+    if (!self->direct_io || self->block_len == self->block_size)
+    {
+        writer_write_at(self, self->direct_io, self->block, self->block_len, self->block_base);
+        self->block_base += self->block_len;
+        self->block_len = 0;
+
+        if (self->sync_policy == WRITER_SYNC_BLOCK)
+            writer_sync(self);
+        return;
+    }
+
+    gsize padded = (self->block_len + WRITER_ALIGN - 1) / WRITER_ALIGN * WRITER_ALIGN;
+    memset(self->block + self->block_len, 0, padded - self->block_len);
+    writer_write_at(self, TRUE, self->block, padded, self->block_base);
+}
+
+gboolean writer_write_at(GstDiskWriter *self, gboolean direct, const guint8 *data, gsize size, guint64 offset)
+{
+    gint64 start = g_get_monotonic_time();
+    gboolean ok = TRUE;
+
+#ifdef G_OS_UNIX
+    int fd = direct ? self->fd : self->buffered_fd;
+    gsize done = 0;
+    while (done < size)
+    {
+        ssize_t n = pwrite(fd, data + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            ok = FALSE;
+            break;
+        }
+        done += n;
+    }
+#else
+    ok = g_seekable_seek(G_SEEKABLE(self->stream), offset, G_SEEK_SET, NULL, NULL) &&
+         g_output_stream_write_all(G_OUTPUT_STREAM(self->stream), data, size, NULL, NULL, NULL);
+#endif
+
+    gint64 latency = g_get_monotonic_time() - start;
+
+    if (!ok)
+        g_printerr("Recorder writer failed to write %" G_GSIZE_FORMAT " bytes at %" G_GUINT64_FORMAT "\n", size, offset);
+    self->failed |= !ok;
+
+    g_mutex_lock(&self->stats_lock);
+    self->stats.writes++;
+    self->stats.bytes_written += ok ? size : 0;
+    self->stats.last_write_latency = latency;
+    self->stats.max_write_latency = MAX(self->stats.max_write_latency, latency);
+    self->stats.total_write_latency += latency;
+    g_mutex_unlock(&self->stats_lock);
+
+    return ok;
+}
+
+void writer_sync(GstDiskWriter *self)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (self->sync_policy == WRITER_SYNC_NONE)
+        return;
+    if (self->sync_policy == WRITER_SYNC_INTERVAL && now - self->last_sync < (gint64)self->sync_interval * 1000)
+        return;
+
+#ifdef G_OS_UNIX
+    fdatasync(self->fd);
+#else
+    g_output_stream_flush(G_OUTPUT_STREAM(self->stream), NULL, NULL);
+#endif
+    self->last_sync = now;
+}
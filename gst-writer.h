@@ -0,0 +1,73 @@
+#ifndef __GST_WRITER_H__
+#define __GST_WRITER_H__
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+// 异步磁盘写入：流线程只把buffer放进队列，独立的I/O线程把连续的数据合并成大块再写盘，
+// 磁盘的抖动不会阻塞muxer和tee；磁盘持续跟不上、排队超过高水位时流线程才等待，内存不会无限增长
+
+typedef enum
+{
+    WRITER_SYNC_NONE,     // 只在关闭时fsync
+    WRITER_SYNC_BLOCK,    // 每写完一个块fdatasync
+    WRITER_SYNC_INTERVAL  // 每隔sync_interval毫秒fdatasync
+} WriterSyncPolicy;
+
+typedef struct WriterStats
+{
+    guint64 bytes_written;
+    guint64 writes;              // 实际的写系统调用次数
+    gint64 last_write_latency;   // 微秒
+    gint64 max_write_latency;
+    gint64 total_write_latency;
+    guint queue_depth;           // 队列中等待写入的buffer数
+    guint max_queue_depth;
+    guint64 queued_bytes;
+    guint64 max_queued_bytes;
+    guint64 overflows;           // 队列超过高水位、流线程等待写盘的次数
+    gint64 total_stall_time;     // 流线程等待写盘的总时间，微秒
+} WriterStats;
+
+typedef struct GstDiskWriter
+{
+    GThread *thread;
+    GAsyncQueue *queue;
+
+    // 配置，writer_open之前设置
+    gsize block_size;
+    gboolean direct_io;          // O_DIRECT，仅Linux
+    WriterSyncPolicy sync_policy;
+    guint sync_interval;         // 毫秒
+    guint flush_timeout;         // 队列空闲多久后把不满的块写出去，毫秒
+    guint64 high_watermark;      // 排队字节数超过该值时writer_push等待I/O线程写出
+
+    // I/O线程状态
+#ifdef G_OS_UNIX
+    int fd, buffered_fd;
+#else
+    GFileOutputStream *stream;
+#endif
+    guint8 *block;
+    guint64 block_base;          // 块在文件中的起始偏移
+    gsize block_len;
+    gboolean block_dirty;        // 块里有还没写到磁盘的数据
+
+    guint64 file_size;
+    gint64 last_sync;
+    gboolean failed;
+
+    GMutex stats_lock;
+    GCond space_cond;            // I/O线程每写完一个buffer通知，配合stats_lock使用
+    WriterStats stats;
+
+} GstDiskWriter;
+
+gboolean writer_init(GstDiskWriter *self);
+void writer_destroy(GstDiskWriter *self);
+gboolean writer_open(GstDiskWriter *self, const char *filename);
+void writer_push(GstDiskWriter *self, GstBuffer *buffer, guint64 offset);
+gboolean writer_close(GstDiskWriter *self);
+void writer_get_stats(GstDiskWriter *self, WriterStats *stats);
+
+#endif
@@ -1,10 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gst/gst.h>
 #include "gst-media.h"
 #include "gst-player.h"
 #include "gst-recorder.h"
+#include "gst-clip.h"
+#include "gst-motion.h"
+#include "gst-level.h"
+#include "gst-mosaic.h"
 #include "gst-rtsp-server.h"
+#include "gst-config.h"
+#include "gst-control.h"
+#include "gst-export.h"
+#include "gst-log.h"
+#include "gst-hls.h"
+#include "gst-sync.h"
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#endif
 
 static gboolean quit_func(gpointer data)
 {
@@ -13,22 +28,198 @@ static gboolean quit_func(gpointer data)
     return FALSE;
 }
 
+#ifdef G_OS_UNIX
+// kill -HUP 重新加载配置，只修改有变化的流和分支
+static gboolean reload_func(gpointer data)
+{
+    config_reload((GstConfig *)data);
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+// 按配置文件启动所有流：main.out --config streams.conf
+static int run_config(const char *path)
+{
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+    GstConfig config;
+    if (!config_init(&config) || !config_load(&config, path))
+    {
+        g_printerr("Failed to load config %s\n", path);
+        config_destroy(&config);
+        g_main_loop_unref(loop);
+        return -1;
+    }
+
+#ifdef G_OS_UNIX
+    g_unix_signal_add(SIGHUP, reload_func, &config);
+    g_unix_signal_add(SIGINT, quit_func, loop);
+    g_unix_signal_add(SIGTERM, quit_func, loop);
+#endif
+
+    // [control] socket=/run/gst-player.sock 开启本地控制接口
+    GstControl control;
+    control_init(&control, &config);
+    gchar *socket_path = g_key_file_get_string(config.keyfile, "control", "socket", NULL);
+    if (socket_path && !control_start(&control, socket_path))
+        g_printerr("Failed to start control server\n");
+    g_free(socket_path);
+
+    g_print("Running %u streams from %s. Press Ctrl+C to exit.\n", g_hash_table_size(config.streams), path);
+    g_main_loop_run(loop);
+
+    control_destroy(&control);
+    config_destroy(&config);
+    g_main_loop_unref(loop);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     // 初始化GStreamer
     gst_init(&argc, &argv);
 
+    // 修复模式：main.out --recover a.mp4 b.mp4 ...
+    if (argc >= 2 && strcmp(argv[1], "--recover") == 0)
+    {
+        int failed = 0;
+        for (int i = 2; i < argc; i++)
+            failed += !recorder_recover_file(argv[i]);
+        return failed ? 1 : 0;
+    }
+
+    // 运动检测内核性能测试：main.out --bench-motion [次数]
+    if (argc >= 2 && strcmp(argv[1], "--bench-motion") == 0)
+    {
+        gint iterations = argc >= 3 ? atoi(argv[2]) : 100;
+        motion_bench(1920, 1080, iterations);
+        motion_bench(3840, 2160, iterations);
+        return 0;
+    }
+
+    // 音频电平内核性能测试：main.out --bench-level [秒数]
+    if (argc >= 2 && strcmp(argv[1], "--bench-level") == 0)
+    {
+        gint seconds = argc >= 3 ? atoi(argv[2]) : 60;
+        level_bench(1, 48000, seconds);
+        level_bench(2, 48000, seconds);
+        return 0;
+    }
+
+    // 拼接性能测试：main.out --bench-mosaic [帧数]
+    if (argc >= 2 && strcmp(argv[1], "--bench-mosaic") == 0)
+    {
+        gint frames = argc >= 3 ? atoi(argv[2]) : 300;
+        mosaic_bench(16, 1920, 1080, frames);
+        mosaic_bench(64, 3840, 2160, frames);
+        return 0;
+    }
+
+    // 控制接口往返延迟测试：main.out --bench-control [命令数]
+    if (argc >= 2 && strcmp(argv[1], "--bench-control") == 0)
+    {
+        gint commands = argc >= 3 ? atoi(argv[2]) : 20000;
+        control_bench(1, commands);
+        control_bench(64, commands);
+        return 0;
+    }
+
+    // 日志写入开销测试：main.out --bench-log [每个线程的记录数]
+    if (argc >= 2 && strcmp(argv[1], "--bench-log") == 0)
+    {
+        gint events = argc >= 3 ? atoi(argv[2]) : 1000000;
+        log_bench(1, events);
+        log_bench(4, events);
+        return 0;
+    }
+
+    // 多轨道解码对比测试：main.out --bench-streams URI [秒数]
+    if (argc >= 3 && strcmp(argv[1], "--bench-streams") == 0)
+    {
+        gint seconds = argc >= 4 ? atoi(argv[3]) : 20;
+        media_bench_streams(argv[2], seconds);
+        return 0;
+    }
+
+    // 大文件片段导出测试：main.out --bench-clip 录像文件 [输出目录]
+    if (argc >= 3 && strcmp(argv[1], "--bench-clip") == 0)
+    {
+        clip_bench(argv[2], argc >= 4 ? argv[3] : NULL);
+        return 0;
+    }
+
+    // 共享内存导出测试：main.out --bench-export URI [读者数] [秒数]
+    if (argc >= 3 && strcmp(argv[1], "--bench-export") == 0)
+    {
+        gint consumers = argc >= 4 ? atoi(argv[3]) : 4;
+        gint seconds = argc >= 5 ? atoi(argv[4]) : 10;
+        export_bench(argv[2], consumers, seconds);
+        return 0;
+    }
+
+    // HLS延迟和内存测试：main.out --bench-hls URI [秒数]
+    if (argc >= 3 && strcmp(argv[1], "--bench-hls") == 0)
+    {
+        gint seconds = argc >= 4 ? atoi(argv[3]) : 20;
+        hls_bench(argv[2], seconds);
+        return 0;
+    }
+
+    // 多管道时钟同步测试：main.out --bench-sync URI [管道数] [秒数]
+    if (argc >= 3 && strcmp(argv[1], "--bench-sync") == 0)
+    {
+        gint streams = argc >= 4 ? atoi(argv[3]) : 4;
+        gint seconds = argc >= 5 ? atoi(argv[4]) : 10;
+        sync_bench(argv[2], streams, seconds);
+        return 0;
+    }
+
+    // 共享内存参考读者：main.out --shm-consume SOCKET [秒数]
+    if (argc >= 3 && strcmp(argv[1], "--shm-consume") == 0)
+    {
+        ExportConsumerStats stats;
+        gdouble seconds = argc >= 4 ? atof(argv[3]) : 10;
+        if (!export_consume(argv[2], seconds, &stats))
+            return 1;
+        g_print("%" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " missed, %"
+                G_GUINT64_FORMAT " overwritten\n", stats.frames, stats.bytes, stats.missed, stats.overwritten);
+        return 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--config") == 0)
+        return run_config(argv[2]);
+
+    if (argc >= 2 && g_str_has_prefix(argv[1], "--"))
+    {
+        g_printerr("Unknown option %s\n", argv[1]);
+        return -1;
+    }
+
+    // 默认使用网络上的测试源，也可以指定本地文件或URI，不依赖网络：main.out [URI|文件] [录像文件]
+    const char *source = argc >= 2 ? argv[1]
+                                   : "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm";
+    const char *output = argc >= 3 ? argv[2] : "output.mp4";
+    gchar *uri = gst_uri_is_valid(source) ? g_strdup(source) : gst_filename_to_uri(source, NULL);
+    if (!uri)
+    {
+        g_printerr("Invalid source %s\n", source);
+        return -1;
+    }
+
     GMainLoop *loop = g_main_loop_new(NULL, FALSE);
 
     // 创建并初始化媒体实例
     GstMedia media;
     if (!media_init(&media)) {
         g_printerr("Failed to initialize media\n");
+        g_free(uri);
         return -1;
     }
 
-    // 设置媒体URI（使用测试源）
-    if (!media_set_uri(&media, "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm")) {
+    // 设置媒体URI
+    gboolean uri_set = media_set_uri(&media, uri);
+    g_free(uri);
+    if (!uri_set) {
         g_printerr("Failed to set media URI\n");
         media_destroy(&media);
         return -1;
@@ -61,6 +252,9 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // 流线程上的日志写到各自的环里，由日志线程输出到stderr，不在流线程里做I/O
+    log_start("-");
+
     // 链接各组件到媒体源
     if (!player_link(&player, &media)) {
         g_printerr("Failed to link player to media\n");
@@ -75,7 +269,7 @@ int main(int argc, char *argv[])
     }
 
     // 启动录制（在启动播放之前，这样可以确保tee已经准备好）
-    if (!recorder_start(&recorder, "output.mp4")) {
+    if (!recorder_start(&recorder, output)) {
         g_printerr("Failed to start recording\n");
     }
 
@@ -104,6 +298,7 @@ int main(int argc, char *argv[])
     player_destroy(&player);
     media_destroy(&media);
 
+    log_stop();
     g_main_loop_unref(loop);
 
     return 0;
@@ -0,0 +1,132 @@
+#include "test-util.h"
+#include "gst-media.h"
+#include "gst-player.h"
+
+#define TEST_BRANCH_CYCLES 20
+
+GST_START_TEST(test_media_init_destroy)
+{
+    GstMedia media;
+    fail_unless(media_init(&media));
+    fail_unless(media.pipeline != NULL && media.src != NULL);
+    fail_unless(media.v_tee != NULL && media.a_tee != NULL);
+    fail_unless_equals_int(media.state, MEDIA_STATE_STOPPED);
+    fail_unless(media.current_uri == NULL);
+    media_destroy(&media);
+    fail_unless(media.pipeline == NULL && media.bus == NULL);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_media_set_uri)
+{
+    GstMedia media;
+    fail_unless(media_init(&media));
+    fail_if(media_set_uri(&media, NULL));
+    fail_if(media_set_uri(NULL, test_clip_uri));
+
+    fail_unless(media_set_uri(&media, "file:///nonexistent/clip.mp4"));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+    fail_unless_equals_string(media.current_uri, test_clip_uri);
+
+    gint frames = 0;
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, &frames);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    fail_unless(media_play(&media));
+    fail_unless(test_wait_count(&frames, 15, TEST_TIMEOUT_MS), "No frames from %s", test_clip_uri);
+    fail_unless_equals_int(media.state, MEDIA_STATE_PLAYING);
+
+    fail_unless(media_stop(&media));
+    fail_unless_equals_int(media.state, MEDIA_STATE_STOPPED);
+    media_destroy(&media);
+}
+GST_END_TEST;
+
+// 播放中反复添加和移除分支：新分支收到帧，移除后tee的请求pad释放，原有分支不受影响
+GST_START_TEST(test_media_branch_add_remove)
+{
+    GstMedia media;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+
+    gint frames = 0;
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, &frames);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+    fail_unless(media_play(&media));
+    fail_unless(test_wait_count(&frames, 5, TEST_TIMEOUT_MS));
+
+    for (gint i = 0; i < TEST_BRANCH_CYCLES; i++)
+    {
+        gint extra_frames = 0;
+        GstElement *extra = test_make_sink_branch("extra", TRUE, &extra_frames);
+        fail_unless(media_add_video_branch(&media, extra));
+        fail_unless(media_add_audio_branch(&media, extra));
+        fail_unless_equals_int(GST_ELEMENT(media.v_tee)->numsrcpads, 2);
+        fail_unless(test_wait_count(&extra_frames, 2, TEST_TIMEOUT_MS), "Branch %d got no frames", i);
+
+        fail_unless(media_remove_video_branch(&media, extra));
+        fail_unless(media_remove_audio_branch(&media, extra));
+        fail_unless(test_wait_unlinked(extra, "v_sink", TEST_TIMEOUT_MS));
+        fail_unless(test_wait_unlinked(extra, "a_sink", TEST_TIMEOUT_MS));
+        gst_element_set_state(extra, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(media.pipeline), extra);
+
+        fail_unless(test_wait_src_pads(media.v_tee, 1, TEST_TIMEOUT_MS), "Video tee pad not released");
+        fail_unless(test_wait_src_pads(media.a_tee, 1, TEST_TIMEOUT_MS), "Audio tee pad not released");
+    }
+
+    gint before = g_atomic_int_get(&frames);
+    fail_unless(test_wait_count(&frames, before + 5, TEST_TIMEOUT_MS), "Remaining branch stalled");
+
+    media_stop(&media);
+    media_destroy(&media);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_player_link)
+{
+    GstMedia media;
+    GstPlayer player;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+    fail_unless(player_init(&player));
+
+    fail_if(player_link(NULL, &media));
+    fail_unless(player_link(&player, &media));
+    fail_unless(player.media == &media);
+    fail_unless(GST_OBJECT_PARENT(player.bin) == GST_OBJECT(media.pipeline));
+
+    gint frames = 0;
+    test_count_buffers(player.v_queue, "sink", &frames);
+    fail_unless(media_play(&media));
+    fail_unless(test_wait_count(&frames, 10, TEST_TIMEOUT_MS), "Player got no frames");
+
+    fail_unless(player_unlink(&player));
+    fail_unless(player.media == NULL);
+    fail_unless(GST_OBJECT_PARENT(player.bin) == NULL);
+    fail_unless(test_wait_src_pads(media.v_tee, 0, TEST_TIMEOUT_MS), "Player tee pad not released");
+
+    media_stop(&media);
+    player_destroy(&player);
+    media_destroy(&media);
+}
+GST_END_TEST;
+
+static Suite *media_suite(void)
+{
+    Suite *s = suite_create("media");
+    TCase *tc = tcase_create("general");
+
+    tcase_add_unchecked_fixture(tc, test_clip_setup, test_clip_teardown);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_media_init_destroy);
+    tcase_add_test(tc, test_media_set_uri);
+    tcase_add_test(tc, test_media_branch_add_remove);
+    tcase_add_test(tc, test_player_link);
+    return s;
+}
+
+GST_CHECK_MAIN(media);
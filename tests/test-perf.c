@@ -0,0 +1,183 @@
+#include "test-util.h"
+#include "gst-media.h"
+#include "gst-recorder.h"
+#include "gst-log.h"
+
+// 性能回归：热路径变慢或者泄漏时这些断言失败，make check跟着失败。
+// 上限按普通开发机留了余量，实测值每次都打印出来，收紧上限之前先看几次实测
+
+#define PERF_SOURCE_FPS 30
+#define PERF_MIN_FPS 27.0                                      // 直播源的90%，编码录像和播放分支都要跟上
+#define PERF_FPS_SECONDS 3
+#define PERF_MAX_START_LATENCY (500 * G_TIME_SPAN_MILLISECOND) // 请求播放到第一帧到达v_tee，微秒
+#define PERF_START_RUNS 5                                      // 第一次加载插件、读文件，不计入
+#define PERF_CYCLES 500
+#define PERF_FULL_CYCLES 10000                                 // 设置TEST_PERF_FULL时运行，make check默认不跑
+#define PERF_WARMUP_CYCLES 200                                 // 让分配器和类型系统的缓存先稳定下来
+#define PERF_MAX_RSS_GROWTH (4 * 1024 * 1024)                  // 允许分配器的碎片，真正的泄漏每次循环都会增长
+
+static void test_on_started(GstMedia *media, gboolean success, gboolean *done)
+{
+    fail_unless(success, "Media failed to start");
+    *done = TRUE;
+}
+
+// 720p直播源同时录像和播放：统计一段时间内编码器输出的帧数和播放分支渲染的帧数
+GST_START_TEST(test_perf_fps_floor)
+{
+    GstMedia media;
+    GstRecorder recorder;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_source(&media, test_make_source(TRUE, 1280, 720, PERF_SOURCE_FPS)));
+
+    gint rendered = 0, encoded = 0;
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, &rendered);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    fail_unless(recorder_init(&recorder));
+    fail_unless(recorder_link(&recorder, &media));
+    test_count_buffers(recorder.v_encoder, "src", &encoded);
+
+    gchar *path = g_build_filename(test_dir, "fps.mp4", NULL);
+    fail_unless(recorder_start(&recorder, path));
+    fail_unless(media_play(&media));
+    fail_unless(test_wait_count(&encoded, 1, TEST_TIMEOUT_MS), "Encoder produced no frames");
+
+    gint rendered_start = g_atomic_int_get(&rendered), encoded_start = g_atomic_int_get(&encoded);
+    gint64 start = g_get_monotonic_time();
+    while (g_get_monotonic_time() - start < PERF_FPS_SECONDS * G_TIME_SPAN_SECOND)
+        test_iterate();
+    gdouble elapsed = (gdouble)(g_get_monotonic_time() - start) / G_TIME_SPAN_SECOND;
+    gdouble render_fps = (g_atomic_int_get(&rendered) - rendered_start) / elapsed;
+    gdouble encode_fps = (g_atomic_int_get(&encoded) - encoded_start) / elapsed;
+
+    recorder_stop(&recorder);
+    media_stop(&media);
+    recorder_unlink(&recorder);
+    recorder_destroy(&recorder);
+    media_destroy(&media);
+    g_free(path);
+
+    g_print("perf: 1280x720@%d rendered %.1f fps, recorded %.1f fps\n", PERF_SOURCE_FPS, render_fps, encode_fps);
+    fail_unless(render_fps >= PERF_MIN_FPS, "Rendered %.1f fps, floor is %.1f", render_fps, PERF_MIN_FPS);
+    fail_unless(encode_fps >= PERF_MIN_FPS, "Recorded %.1f fps, floor is %.1f", encode_fps, PERF_MIN_FPS);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_perf_start_latency)
+{
+    GstMedia media;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, NULL);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    gint64 worst = 0;
+    for (gint i = 0; i < PERF_START_RUNS; i++)
+    {
+        gboolean done = FALSE;
+        fail_unless(media_play_async(&media, (MediaStateCallback)test_on_started, &done));
+        fail_unless(test_wait_flag(&done, TEST_TIMEOUT_MS), "Media never reached PLAYING");
+
+        MediaTimings timings;
+        gint64 deadline = g_get_monotonic_time() + TEST_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+        do
+        {
+            test_iterate();
+            media_get_timings(&media, &timings);
+        } while (timings.first_frame < 0 && g_get_monotonic_time() < deadline);
+        fail_unless(timings.first_frame >= 0, "No first frame in run %d", i);
+
+        g_print("perf: start %d, paused %.1f ms, playing %.1f ms, first frame %.1f ms\n", i,
+                timings.paused / 1000.0, timings.playing / 1000.0, timings.first_frame / 1000.0);
+        if (i > 0)
+            worst = MAX(worst, timings.first_frame);
+
+        fail_unless(media_stop(&media));
+        while (g_main_context_iteration(NULL, FALSE))
+            ;
+    }
+
+    media_destroy(&media);
+    fail_unless(worst <= PERF_MAX_START_LATENCY, "Start latency %.1f ms, ceiling is %.1f ms",
+                worst / 1000.0, PERF_MAX_START_LATENCY / 1000.0);
+}
+GST_END_TEST;
+
+// 每次循环：加一个分支，播放，播放中移除分支，停止。媒体、tee的请求pad和分支都应该完整释放
+static void test_perf_cycle(GstMedia *media, gint i)
+{
+    GstElement *extra = test_make_sink_branch("extra", FALSE, NULL);
+    fail_unless(media_add_video_branch(media, extra));
+    fail_unless(media_add_audio_branch(media, extra));
+
+    fail_unless(media_play(media));
+    fail_unless(gst_element_get_state(media->pipeline, NULL, NULL, 5 * GST_SECOND) == GST_STATE_CHANGE_SUCCESS,
+                "Cycle %d did not reach PLAYING", i);
+
+    fail_unless(media_remove_video_branch(media, extra));
+    fail_unless(media_remove_audio_branch(media, extra));
+    fail_unless(test_wait_unlinked(extra, "v_sink", TEST_TIMEOUT_MS));
+    fail_unless(test_wait_unlinked(extra, "a_sink", TEST_TIMEOUT_MS));
+    gst_element_set_state(extra, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(media->pipeline), extra);
+    fail_unless(test_wait_src_pads(media->v_tee, 1, TEST_TIMEOUT_MS), "Cycle %d leaked a video tee pad", i);
+    fail_unless(test_wait_src_pads(media->a_tee, 1, TEST_TIMEOUT_MS), "Cycle %d leaked an audio tee pad", i);
+
+    fail_unless(media_stop(media));
+    while (g_main_context_iteration(NULL, FALSE))
+        ;
+}
+
+GST_START_TEST(test_perf_rss_start_stop)
+{
+    // 每次循环都有分支加入和移除的INFO日志
+    log_set_level(LOG_LEVEL_WARNING);
+
+    GstMedia media;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_source(&media, test_make_source(FALSE, 320, 240, PERF_SOURCE_FPS)));
+
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, NULL);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    for (gint i = 0; i < PERF_WARMUP_CYCLES; i++)
+        test_perf_cycle(&media, i);
+    guint64 before = test_rss_bytes();
+    fail_unless(before > 0, "Could not read RSS");
+
+    gint cycles = g_getenv("TEST_PERF_FULL") ? PERF_FULL_CYCLES : PERF_CYCLES;
+    gint64 start = g_get_monotonic_time();
+    for (gint i = 0; i < cycles; i++)
+        test_perf_cycle(&media, i);
+    gdouble elapsed = (gdouble)(g_get_monotonic_time() - start) / G_TIME_SPAN_SECOND;
+    guint64 after = test_rss_bytes();
+    media_destroy(&media);
+
+    gint64 growth = (gint64)after - (gint64)before;
+    g_print("perf: %d start/stop cycles in %.1f s, RSS %" G_GUINT64_FORMAT " -> %" G_GUINT64_FORMAT " KB\n",
+            cycles, elapsed, before / 1024, after / 1024);
+    fail_unless(growth <= PERF_MAX_RSS_GROWTH, "RSS grew %" G_GINT64_FORMAT " KB over %d cycles, limit is %d KB",
+                growth / 1024, cycles, PERF_MAX_RSS_GROWTH / 1024);
+}
+GST_END_TEST;
+
+static Suite *perf_suite(void)
+{
+    Suite *s = suite_create("perf");
+    TCase *tc = tcase_create("general");
+
+    tcase_add_unchecked_fixture(tc, test_clip_setup, test_clip_teardown);
+    tcase_set_timeout(tc, g_getenv("TEST_PERF_FULL") ? 1200 : 120);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_perf_fps_floor);
+    tcase_add_test(tc, test_perf_start_latency);
+    tcase_add_test(tc, test_perf_rss_start_stop);
+    return s;
+}
+
+GST_CHECK_MAIN(perf);
@@ -0,0 +1,198 @@
+#include "test-util.h"
+#include "gst-media.h"
+#include "gst-recorder.h"
+
+#define TEST_RECORD_FRAMES 45  // 1.5秒，分片模式下至少写出一个完整分片
+
+typedef struct TestStop
+{
+    gboolean done;
+    gboolean success;
+} TestStop;
+
+static void test_on_record_stopped(GstRecorder *recorder, gboolean success, TestStop *stop)
+{
+    stop->success = success;
+    stop->done = TRUE;
+}
+
+// 录像文件可以完整解码，帧数和时长都在录制过的范围内
+static void test_check_recording(const char *path, gint min_frames)
+{
+    fail_unless(g_file_test(path, G_FILE_TEST_IS_REGULAR), "%s was not written", path);
+
+    GstClockTime duration = GST_CLOCK_TIME_NONE;
+    gint frames = test_decode_file(path, &duration);
+    fail_unless(frames >= min_frames, "%s decoded %d frames, expected at least %d", path, frames, min_frames);
+    fail_unless(GST_CLOCK_TIME_IS_VALID(duration) && duration > 0, "%s has no duration", path);
+}
+
+static void test_record(RecorderMode mode, const char *name, gboolean async)
+{
+    GstMedia media;
+    GstRecorder recorder;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+
+    // 播放速度由sync=true的分支控制，录像不会一下子读完整个素材
+    gint frames = 0;
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, NULL);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    fail_unless(recorder_init(&recorder));
+    fail_unless(recorder_set_mode(&recorder, mode));
+    fail_unless(recorder_link(&recorder, &media));
+    test_count_buffers(recorder.v_encoder, "sink", &frames);
+
+    gchar *path = g_build_filename(test_dir, name, NULL);
+    fail_unless(recorder_start(&recorder, path));
+    fail_unless_equals_int(recorder.state, RECORDER_STATE_RECORDING);
+    fail_if(recorder_start(&recorder, path), "Second start must be rejected");
+
+    fail_unless(media_play(&media));
+    fail_unless(test_wait_count(&frames, TEST_RECORD_FRAMES, TEST_TIMEOUT_MS), "Recorder got no frames");
+
+    if (async)
+    {
+        TestStop stop = {FALSE, FALSE};
+        fail_unless(recorder_stop_async(&recorder, (RecorderStopCallback)test_on_record_stopped, &stop));
+        fail_unless_equals_int(recorder.state, RECORDER_STATE_STOPPING);
+        fail_unless(test_wait_flag(&stop.done, TEST_TIMEOUT_MS), "Async stop never completed");
+        fail_unless(stop.success);
+    }
+    else
+    {
+        fail_unless(recorder_stop(&recorder));
+    }
+    fail_unless_equals_int(recorder.state, RECORDER_STATE_STOPPED);
+
+    test_check_recording(path, TEST_RECORD_FRAMES / 2);
+
+    media_stop(&media);
+    recorder_unlink(&recorder);
+    recorder_destroy(&recorder);
+    media_destroy(&media);
+    g_free(path);
+}
+
+GST_START_TEST(test_recorder_fragmented)
+{
+    test_record(RECORDER_MODE_FRAGMENTED, "fragmented.mp4", FALSE);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_recorder_faststart)
+{
+    test_record(RECORDER_MODE_FASTSTART, "faststart.mp4", FALSE);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_recorder_stop_async)
+{
+    test_record(RECORDER_MODE_FRAGMENTED, "async.mp4", TRUE);
+}
+GST_END_TEST;
+
+// 同一个录像器停止后再开始，每个文件都完整
+GST_START_TEST(test_recorder_restart)
+{
+    GstMedia media;
+    GstRecorder recorder;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, NULL);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+    fail_unless(recorder_init(&recorder));
+    fail_unless(recorder_link(&recorder, &media));
+
+    gint frames = 0;
+    test_count_buffers(recorder.v_encoder, "sink", &frames);
+    fail_unless(media_play(&media));
+
+    gchar *paths[2];
+    for (gint i = 0; i < 2; i++)
+    {
+        gchar *name = g_strdup_printf("restart-%d.mp4", i);
+        paths[i] = g_build_filename(test_dir, name, NULL);
+        g_free(name);
+
+        gint target = g_atomic_int_get(&frames) + TEST_RECORD_FRAMES / 2;
+        fail_unless(recorder_start(&recorder, paths[i]));
+        fail_unless(test_wait_count(&frames, target, TEST_TIMEOUT_MS), "Recording %d got no frames", i);
+        fail_unless(recorder_stop(&recorder));
+    }
+
+    media_stop(&media);
+    for (gint i = 0; i < 2; i++)
+    {
+        test_check_recording(paths[i], 1);
+        g_free(paths[i]);
+    }
+
+    recorder_unlink(&recorder);
+    recorder_destroy(&recorder);
+    media_destroy(&media);
+}
+GST_END_TEST;
+
+// 开启后又关闭代理：代理分支不再接收数据，管道仍然能完成preroll进入PLAYING，只写主文件
+GST_START_TEST(test_recorder_proxy_disabled)
+{
+    GstMedia media;
+    GstRecorder recorder;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, NULL);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    fail_unless(recorder_init(&recorder));
+    fail_unless(recorder_set_proxy(&recorder, 160, 120, 15));
+    fail_unless(recorder_set_proxy(&recorder, 0, 0, 0));
+    fail_unless_equals_int(recorder.v_tee->numsrcpads, 1);
+    fail_unless(recorder_link(&recorder, &media));
+
+    gint frames = 0;
+    test_count_buffers(recorder.v_encoder, "sink", &frames);
+    gchar *path = g_build_filename(test_dir, "noproxy.mp4", NULL);
+    fail_unless(recorder_start(&recorder, path));
+    fail_unless(media_play(&media));
+    fail_unless(gst_element_get_state(media.pipeline, NULL, NULL, 5 * GST_SECOND) == GST_STATE_CHANGE_SUCCESS,
+                "Pipeline did not preroll with the proxy disabled");
+    fail_unless(test_wait_count(&frames, TEST_RECORD_FRAMES, TEST_TIMEOUT_MS), "Recorder got no frames");
+    fail_unless(recorder_stop(&recorder));
+
+    test_check_recording(path, TEST_RECORD_FRAMES / 2);
+    gchar *proxy_path = g_build_filename(test_dir, "noproxy.proxy.mp4", NULL);
+    fail_if(g_file_test(proxy_path, G_FILE_TEST_EXISTS), "Disabled proxy wrote %s", proxy_path);
+    g_free(proxy_path);
+
+    media_stop(&media);
+    recorder_unlink(&recorder);
+    recorder_destroy(&recorder);
+    media_destroy(&media);
+    g_free(path);
+}
+GST_END_TEST;
+
+static Suite *recorder_suite(void)
+{
+    Suite *s = suite_create("recorder");
+    TCase *tc = tcase_create("general");
+
+    tcase_add_unchecked_fixture(tc, test_clip_setup, test_clip_teardown);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_recorder_fragmented);
+    tcase_add_test(tc, test_recorder_faststart);
+    tcase_add_test(tc, test_recorder_stop_async);
+    tcase_add_test(tc, test_recorder_restart);
+    tcase_add_test(tc, test_recorder_proxy_disabled);
+    return s;
+}
+
+GST_CHECK_MAIN(recorder);
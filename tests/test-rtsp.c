@@ -0,0 +1,96 @@
+#include "test-util.h"
+#include "gst-media.h"
+#include "gst-rtsp-server.h"
+#include <gst/rtsp-server/rtsp-server.h>
+
+#define TEST_RTSP_FRAMES 15
+
+// 服务器和客户端在同一个进程里：服务器挂在默认主循环上，客户端管道有自己的线程，
+// 客户端解码出帧说明编码分支、appsink到appsrc的转发和RTP打包都是通的
+static void test_rtsp_play(gboolean audio)
+{
+    GstMedia media;
+    GstRtspServer server;
+    fail_unless(media_init(&media));
+    fail_unless(media_set_uri(&media, test_clip_uri));
+
+    GstElement *sinks = test_make_sink_branch("sinks", TRUE, NULL);
+    fail_unless(media_add_video_branch(&media, sinks));
+    fail_unless(media_add_audio_branch(&media, sinks));
+
+    // 端口0由系统分配，并行运行的测试不会冲突
+    fail_unless(rtsp_server_init(&server, 0));
+    fail_unless(rtsp_add_mount(&server, &media, "/test", audio));
+    fail_if(rtsp_add_mount(&server, &media, "/test", audio), "Duplicate mount must be rejected");
+    fail_unless(rtsp_start(&server));
+    gint port = gst_rtsp_server_get_bound_port(server.server);
+    fail_unless(port > 0);
+
+    fail_unless(media_play(&media));
+
+    gchar *desc = g_strdup_printf("rtspsrc location=rtsp://127.0.0.1:%d/test latency=0 protocols=tcp"
+                                  " ! rtph264depay ! h264parse ! decodebin ! fakesink name=sink sync=false",
+                                  port);
+    GstElement *client = gst_parse_launch(desc, NULL);
+    g_free(desc);
+    fail_unless(client != NULL);
+
+    gint frames = 0;
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(client), "sink");
+    test_count_buffers(sink, "sink", &frames);
+    gst_object_unref(sink);
+
+    fail_unless(gst_element_set_state(client, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+    gboolean received = test_wait_count(&frames, TEST_RTSP_FRAMES, TEST_TIMEOUT_MS);
+
+    GstBus *bus = gst_element_get_bus(client);
+    GstMessage *error = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    if (error)
+    {
+        GError *err = NULL;
+        gst_message_parse_error(error, &err, NULL);
+        g_printerr("RTSP client error: %s\n", err->message);
+        g_clear_error(&err);
+        gst_message_unref(error);
+    }
+    gst_object_unref(bus);
+
+    gst_element_set_state(client, GST_STATE_NULL);
+    gst_object_unref(client);
+    fail_unless(received, "RTSP client decoded %d frames", g_atomic_int_get(&frames));
+
+    fail_unless(rtsp_stop(&server));
+    fail_unless(rtsp_remove_mount(&server, "/test"));
+    fail_unless(rtsp_find_mount(&server, "/test") == NULL);
+
+    media_stop(&media);
+    rtsp_server_destroy(&server);
+    media_destroy(&media);
+}
+
+GST_START_TEST(test_rtsp_video)
+{
+    test_rtsp_play(FALSE);
+}
+GST_END_TEST;
+
+GST_START_TEST(test_rtsp_audio_video)
+{
+    test_rtsp_play(TRUE);
+}
+GST_END_TEST;
+
+static Suite *rtsp_suite(void)
+{
+    Suite *s = suite_create("rtsp");
+    TCase *tc = tcase_create("loopback");
+
+    tcase_add_unchecked_fixture(tc, test_clip_setup, test_clip_teardown);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_rtsp_video);
+    tcase_add_test(tc, test_rtsp_audio_video);
+    return s;
+}
+
+GST_CHECK_MAIN(rtsp);
@@ -0,0 +1,263 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "test-util.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <unistd.h>
+
+gchar *test_dir = NULL;
+gchar *test_clip_path = NULL;
+gchar *test_clip_uri = NULL;
+
+GstPadProbeReturn test_on_buffer(GstPad *pad, GstPadProbeInfo *info, gint *count);
+
+void test_clip_setup(void)
+{
+    test_dir = g_dir_make_tmp("gst-player-test-XXXXXX", NULL);
+    fail_unless(test_dir != NULL, "Could not create test directory");
+
+    test_clip_path = g_build_filename(test_dir, "clip.mp4", NULL);
+    test_clip_uri = gst_filename_to_uri(test_clip_path, NULL);
+    fail_unless(test_make_clip(test_clip_path, TEST_CLIP_SECONDS), "Could not encode test clip");
+}
+
+void test_clip_teardown(void)
+{
+    if (test_dir)
+    {
+        GDir *dir = g_dir_open(test_dir, 0, NULL);
+        const gchar *name;
+        while (dir && (name = g_dir_read_name(dir)))
+        {
+            gchar *path = g_build_filename(test_dir, name, NULL);
+            g_unlink(path);
+            g_free(path);
+        }
+        if (dir)
+            g_dir_close(dir);
+        g_rmdir(test_dir);
+    }
+
+    g_free(test_clip_uri);
+    test_clip_uri = NULL;
+    g_free(test_clip_path);
+    test_clip_path = NULL;
+    g_free(test_dir);
+    test_dir = NULL;
+}
+
+// 和录像同样的编码器，素材可以解码说明录像写出的文件也能解码
+gboolean test_make_clip(const char *path, gint seconds)
+{
+    gchar *desc = g_strdup_printf(
+        "videotestsrc num-buffers=%d pattern=ball ! video/x-raw,width=320,height=240,framerate=30/1"
+        " ! x264enc speed-preset=1 tune=zerolatency key-int-max=30 ! h264parse ! mp4mux name=mux"
+        " ! filesink location=\"%s\""
+        " audiotestsrc num-buffers=%d samplesperbuffer=1024 ! audio/x-raw,rate=44100,channels=2"
+        " ! audioconvert ! avenc_aac ! aacparse ! mux.",
+        seconds * 30, path, seconds * 44100 / 1024);
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(desc, &error);
+    g_free(desc);
+    if (!pipeline)
+    {
+        g_printerr("Could not create clip pipeline: %s\n", error ? error->message : "unknown error");
+        g_clear_error(&error);
+        return FALSE;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, 30 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return ok;
+}
+
+GstElement *test_make_source(gboolean live, gint width, gint height, gint fps)
+{
+    gchar *desc = g_strdup_printf(
+        "videotestsrc is-live=%d pattern=ball ! video/x-raw,width=%d,height=%d,framerate=%d/1"
+        " ! capsfilter name=v_out"
+        " audiotestsrc is-live=%d samplesperbuffer=1024 ! audio/x-raw,rate=44100,channels=2"
+        " ! capsfilter name=a_out",
+        live, width, height, fps, live);
+    GstElement *bin = gst_parse_bin_from_description(desc, FALSE, NULL);
+    g_free(desc);
+    if (!bin)
+        return NULL;
+
+    GstElement *v_out = gst_bin_get_by_name(GST_BIN(bin), "v_out");
+    GstElement *a_out = gst_bin_get_by_name(GST_BIN(bin), "a_out");
+    GstPad *v_pad = gst_element_get_static_pad(v_out, "src");
+    GstPad *a_pad = gst_element_get_static_pad(a_out, "src");
+    gst_element_add_pad(bin, gst_ghost_pad_new("video", v_pad));
+    gst_element_add_pad(bin, gst_ghost_pad_new("audio", a_pad));
+    gst_object_unref(v_pad);
+    gst_object_unref(a_pad);
+    gst_object_unref(v_out);
+    gst_object_unref(a_out);
+    return bin;
+}
+
+GstElement *test_make_sink_branch(const char *name, gboolean sync, gint *frames)
+{
+    gchar *desc = g_strdup_printf("queue name=v_queue ! fakesink name=v_fakesink sync=%d"
+                                  " queue name=a_queue ! fakesink sync=%d",
+                                  sync, sync);
+    GstElement *bin = gst_parse_bin_from_description(desc, FALSE, NULL);
+    g_free(desc);
+    if (!bin)
+        return NULL;
+    gst_object_set_name(GST_OBJECT(bin), name);
+
+    GstElement *v_queue = gst_bin_get_by_name(GST_BIN(bin), "v_queue");
+    GstElement *a_queue = gst_bin_get_by_name(GST_BIN(bin), "a_queue");
+    GstPad *v_pad = gst_element_get_static_pad(v_queue, "sink");
+    GstPad *a_pad = gst_element_get_static_pad(a_queue, "sink");
+    gst_element_add_pad(bin, gst_ghost_pad_new("v_sink", v_pad));  // 统一使用v_sink和a_sink
+    gst_element_add_pad(bin, gst_ghost_pad_new("a_sink", a_pad));
+    gst_object_unref(v_pad);
+    gst_object_unref(a_pad);
+    gst_object_unref(v_queue);
+    gst_object_unref(a_queue);
+
+    if (frames)
+    {
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), "v_fakesink");
+        test_count_buffers(sink, "sink", frames);
+        gst_object_unref(sink);
+    }
+    return bin;
+}
+
+GstPadProbeReturn test_on_buffer(GstPad *pad, GstPadProbeInfo *info, gint *count)
+{
+    g_atomic_int_inc(count);
+    return GST_PAD_PROBE_OK;
+}
+
+void test_count_buffers(GstElement *element, const char *pad_name, gint *count)
+{
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    fail_unless(pad != NULL, "No pad %s on %s", pad_name, GST_ELEMENT_NAME(element));
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)test_on_buffer, count, NULL);
+    gst_object_unref(pad);
+}
+
+void test_iterate(void)
+{
+    if (!g_main_context_iteration(NULL, FALSE))
+        g_usleep(G_TIME_SPAN_MILLISECOND);
+}
+
+gboolean test_wait_count(gint *count, gint target, gint timeout_ms)
+{
+    gint64 deadline = g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND;
+    while (g_atomic_int_get(count) < target)
+    {
+        if (g_get_monotonic_time() > deadline)
+            return FALSE;
+        test_iterate();
+    }
+    return TRUE;
+}
+
+// flag由主循环里的回调设置
+gboolean test_wait_flag(gboolean *flag, gint timeout_ms)
+{
+    gint64 deadline = g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND;
+    while (!*flag)
+    {
+        if (g_get_monotonic_time() > deadline)
+            return FALSE;
+        test_iterate();
+    }
+    return TRUE;
+}
+
+// media_remove_*_branch在tee的空闲探针里断开，可能发生在流线程里
+gboolean test_wait_unlinked(GstElement *branch, const char *pad_name, gint timeout_ms)
+{
+    GstPad *pad = gst_element_get_static_pad(branch, pad_name);
+    gint64 deadline = g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND;
+    gboolean unlinked = FALSE;
+    while (pad && !(unlinked = !gst_pad_is_linked(pad)) && g_get_monotonic_time() <= deadline)
+        test_iterate();
+    if (pad)
+        gst_object_unref(pad);
+    return unlinked;
+}
+
+// tee的请求pad也在空闲探针里释放，断开之后才会释放
+gboolean test_wait_src_pads(GstElement *element, guint count, gint timeout_ms)
+{
+    gint64 deadline = g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND;
+    while (element->numsrcpads != count)
+    {
+        if (g_get_monotonic_time() > deadline)
+            return FALSE;
+        test_iterate();
+    }
+    return TRUE;
+}
+
+gint test_decode_file(const char *path, GstClockTime *duration)
+{
+    gchar *desc = g_strdup_printf("filesrc location=\"%s\" ! qtdemux name=demux"
+                                  " demux.video_0 ! queue ! decodebin ! fakesink name=sink sync=false",
+                                  path);
+    GstElement *pipeline = gst_parse_launch(desc, NULL);
+    g_free(desc);
+    if (!pipeline)
+        return -1;
+
+    gint frames = 0;
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    test_count_buffers(sink, "sink", &frames);
+    gst_object_unref(sink);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, 30 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg && !ok)
+    {
+        GError *error = NULL;
+        gst_message_parse_error(msg, &error, NULL);
+        g_printerr("Could not decode %s: %s\n", path, error->message);
+        g_clear_error(&error);
+    }
+    if (msg)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    gint64 length = -1;
+    if (duration)
+        *duration = ok && gst_element_query_duration(pipeline, GST_FORMAT_TIME, &length) && length > 0
+                        ? (GstClockTime)length
+                        : GST_CLOCK_TIME_NONE;
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return ok ? g_atomic_int_get(&frames) : -1;
+}
+
+// /proc/self/statm的第二项是常驻页数
+guint64 test_rss_bytes(void)
+{
+    gchar *contents = NULL;
+    if (!g_file_get_contents("/proc/self/statm", &contents, NULL, NULL))
+        return 0;
+
+    unsigned long size = 0, resident = 0;
+    gint fields = sscanf(contents, "%lu %lu", &size, &resident);
+    g_free(contents);
+    return fields == 2 ? (guint64)resident * (guint64)sysconf(_SC_PAGESIZE) : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+#include <gst/gst.h>
+#include <gst/check/gstcheck.h>
+
+// 测试共用的素材和辅助函数。素材由videotestsrc和audiotestsrc现场编码成短MP4，不依赖网络和外部文件，
+// 测试里产生的文件都放在test_dir下，test_clip_teardown时一起删除
+
+#define TEST_CLIP_SECONDS 4
+#define TEST_TIMEOUT_MS 10000  // 等待帧、状态和文件的默认上限
+
+extern gchar *test_dir;
+extern gchar *test_clip_path;
+extern gchar *test_clip_uri;
+
+// 作为unchecked fixture使用：整个TCase只编码一次素材，各测试在fork出的子进程里共用
+void test_clip_setup(void);
+void test_clip_teardown(void);
+
+gboolean test_make_clip(const char *path, gint seconds);
+// 合成源：ghost pad "video"和"audio"，交给media_set_source
+GstElement *test_make_source(gboolean live, gint width, gint height, gint fps);
+// 带v_sink和a_sink的分支，视频经过fakesink时计数
+GstElement *test_make_sink_branch(const char *name, gboolean sync, gint *frames);
+// 元素的pad上每经过一个buffer，count原子加一
+void test_count_buffers(GstElement *element, const char *pad_name, gint *count);
+
+// 等待期间运行默认主循环，总线消息、空闲回调和RTSP服务器都在上面
+void test_iterate(void);
+gboolean test_wait_count(gint *count, gint target, gint timeout_ms);
+gboolean test_wait_flag(gboolean *flag, gint timeout_ms);
+gboolean test_wait_unlinked(GstElement *branch, const char *pad_name, gint timeout_ms);
+gboolean test_wait_src_pads(GstElement *element, guint count, gint timeout_ms);
+
+// 完整解码一个MP4文件，返回视频帧数，出错时返回-1；duration可以为NULL
+gint test_decode_file(const char *path, GstClockTime *duration);
+guint64 test_rss_bytes(void);
+
+#endif